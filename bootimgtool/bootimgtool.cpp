@@ -17,13 +17,21 @@
  * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <cassert>
+#include <cinttypes>
 #include <climits>
 #include <cstdarg>
 #include <cstdio>
@@ -31,10 +39,23 @@
 #include <cstring>
 
 #include <getopt.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 // libmbcommon
 #include <mbcommon/common.h>
+#include <mbcommon/file.h>
+#include <mbcommon/file/fd.h>
 #include <mbcommon/libc/stdio.h>
+#include <mbcommon/string.h>
 
 // libmbbootimg
 #include <mbbootimg/entry.h>
@@ -119,6 +140,8 @@ typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
     "Available commands:\n" \
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
+    "  batch-unpack   Unpack many boot images in parallel\n" \
+    "  batch-pack     Assemble many boot images in parallel\n" \
     "\n" \
     "Pass -h/--help as a argument to a command to see it's available options.\n"
 
@@ -215,6 +238,10 @@ typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
     "If the --input-<item>=<item path> option is specified, then that particular\n" \
     "item is loaded from the specified <item path>.\n" \
     "\n" \
+    "If <output file> is \"-\", the boot image is written to stdout, which may be\n" \
+    "a pipe. The image is assembled in memory before it is written. No prefix is\n" \
+    "used unless one is specified with -p.\n" \
+    "\n" \
     "Examples:\n" \
     "\n" \
     "1. Build a boot image from unpacked components in the current directory\n" \
@@ -225,6 +252,60 @@ typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
     "   kernel located at /tmp/newkernel.\n" \
     "\n" \
     "        bootimgtool pack boot.img -i /tmp/android --input-kernel /tmp/newkernel\n" \
+    "\n" \
+    "3. Build a boot image and copy it to another machine without a temporary file\n" \
+    "\n" \
+    "        bootimgtool pack - -i /tmp/android | ssh host 'cat > boot.img'\n" \
+    "\n"
+
+#define HELP_BATCH_OPTIONS \
+    "Options:\n" \
+    "  -o, --output <output directory>\n" \
+    "                  Output directory (current directory if unspecified)\n" \
+    "  -t, --type <type>\n" \
+    "                  Type of the boot images (see the single image command)\n" \
+    "  -j, --jobs <count>\n" \
+    "                  Number of images to process at the same time\n" \
+    "                  (number of CPUs if unspecified)\n" \
+    "\n" \
+    "The manifest is a list of newline-separated \"<source>\" or\n" \
+    "\"<source>\\t<destination>\" entries, where lines containing only whitespace\n" \
+    "and lines that begin with '#' following any leading whitespace are ignored.\n" \
+    "If no destination is given, it is \"<output directory>/<source name>\".\n" \
+    "\n" \
+    "Every image is processed independently. Errors are reported per image and\n" \
+    "the command fails if any image fails.\n"
+
+#define HELP_BATCH_UNPACK_USAGE \
+    "Usage: bootimgtool batch-unpack <manifest | input directory> [<option>...]\n" \
+    "\n" \
+    "Unpack every boot image listed in the manifest or every file in the input\n" \
+    "directory. Each image is unpacked without a prefix to its own destination\n" \
+    "directory.\n" \
+    "\n" \
+    HELP_BATCH_OPTIONS \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Unpack all boot images in images/ to unpacked/<image name>/\n" \
+    "\n" \
+    "        bootimgtool batch-unpack images -o unpacked\n" \
+    "\n"
+
+#define HELP_BATCH_PACK_USAGE \
+    "Usage: bootimgtool batch-pack <manifest | input directory> [<option>...]\n" \
+    "\n" \
+    "Assemble a boot image from every unpacked directory listed in the manifest\n" \
+    "or every subdirectory of the input directory. The items in each directory\n" \
+    "must not have a prefix, as created by batch-unpack.\n" \
+    "\n" \
+    HELP_BATCH_OPTIONS \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Repack all boot images unpacked by batch-unpack to images/<image name>\n" \
+    "\n" \
+    "        bootimgtool batch-pack unpacked -o images\n" \
     "\n"
 
 template <typename F>
@@ -249,6 +330,64 @@ Finally<F> finally(F f)
     return Finally<F>(f);
 }
 
+#ifdef __ANDROID__
+// The NDK doesn't support TLS
+static pthread_once_t g_tls_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_tls_key_errors;
+
+static void init_tls_keys()
+{
+    pthread_key_create(&g_tls_key_errors, nullptr);
+}
+#else
+static thread_local std::string *g_errors = nullptr;
+#endif
+
+static std::string * error_buffer()
+{
+#ifdef __ANDROID__
+    pthread_once(&g_tls_once, init_tls_keys);
+    return static_cast<std::string *>(pthread_getspecific(g_tls_key_errors));
+#else
+    return g_errors;
+#endif
+}
+
+/*!
+ * \brief Collect messages from print_error() in the current thread
+ *
+ * \param buf Buffer to append messages to or nullptr to print to stderr
+ */
+static void set_error_buffer(std::string *buf)
+{
+#ifdef __ANDROID__
+    pthread_once(&g_tls_once, init_tls_keys);
+    pthread_setspecific(g_tls_key_errors, buf);
+#else
+    g_errors = buf;
+#endif
+}
+
+static void print_error(const char *fmt, ...)
+{
+    std::string *buf = error_buffer();
+    va_list ap;
+
+    va_start(ap, fmt);
+
+    if (buf) {
+        char *msg = mb_format_v(fmt, ap);
+        if (msg) {
+            *buf += msg;
+            free(msg);
+        }
+    } else {
+        vfprintf(stderr, fmt, ap);
+    }
+
+    va_end(ap);
+}
+
 template<typename UIntType>
 static inline bool str_to_unum(const char *str, int base, UIntType *out)
 {
@@ -386,7 +525,7 @@ static bool offset_to_absolute(uint32_t *base_ptr,
     if (base_ptr) {
         if (kernel_offset_ptr) {
             if (*kernel_offset_ptr > UINT32_MAX - *base_ptr) {
-                fprintf(stderr, overflow_fmt, FIELD_BASE, *base_ptr,
+                print_error(overflow_fmt, FIELD_BASE, *base_ptr,
                         FIELD_KERNEL_OFFSET, *kernel_offset_ptr);
                 return false;
             }
@@ -394,7 +533,7 @@ static bool offset_to_absolute(uint32_t *base_ptr,
         }
         if (ramdisk_offset_ptr) {
             if (*ramdisk_offset_ptr > UINT32_MAX - *base_ptr) {
-                fprintf(stderr, overflow_fmt, FIELD_BASE, *base_ptr,
+                print_error(overflow_fmt, FIELD_BASE, *base_ptr,
                         FIELD_RAMDISK_OFFSET, *ramdisk_offset_ptr);
                 return false;
             }
@@ -402,7 +541,7 @@ static bool offset_to_absolute(uint32_t *base_ptr,
         }
         if (second_offset_ptr) {
             if (*second_offset_ptr > UINT32_MAX - *base_ptr) {
-                fprintf(stderr, overflow_fmt, FIELD_BASE, *base_ptr,
+                print_error(overflow_fmt, FIELD_BASE, *base_ptr,
                         FIELD_SECOND_OFFSET, *second_offset_ptr);
                 return false;
             }
@@ -410,7 +549,7 @@ static bool offset_to_absolute(uint32_t *base_ptr,
         }
         if (tags_offset_ptr) {
             if (*tags_offset_ptr > UINT32_MAX - *base_ptr) {
-                fprintf(stderr, overflow_fmt, FIELD_BASE, *base_ptr,
+                print_error(overflow_fmt, FIELD_BASE, *base_ptr,
                         FIELD_TAGS_OFFSET, *tags_offset_ptr);
                 return false;
             }
@@ -434,7 +573,7 @@ static bool read_header(const std::string &path, MbBiHeader *header)
 
     ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
     if (!fp) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+        print_error("%s: Failed to open for reading: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
@@ -480,7 +619,7 @@ static bool read_header(const std::string &path, MbBiHeader *header)
 
         char *equals = strchr(ptr, '=');
         if (!equals) {
-            fprintf(stderr, "Invalid line: %s\n", line);
+            print_error("Invalid line: %s\n", line);
             return false;
         }
 
@@ -541,18 +680,18 @@ static bool read_header(const std::string &path, MbBiHeader *header)
                 ret = mb_bi_header_set_page_size(header, page_size);
             }
         } else {
-            fprintf(stderr, fmt_unknown_key, key);
+            print_error(fmt_unknown_key, key);
             return false;
         }
 
         if (!valid) {
-            fprintf(stderr, fmt_invalid_value, key, value);
+            print_error(fmt_invalid_value, key, value);
             return false;
         } else if (ret == MB_BI_UNSUPPORTED) {
-            fprintf(stderr, fmt_unsupported, key);
+            print_error(fmt_unsupported, key);
             continue;
         } else if (ret < 0) {
-            fprintf(stderr, fmt_failed_to_set, key);
+            print_error(fmt_failed_to_set, key);
             return false;
         }
     }
@@ -570,36 +709,36 @@ static bool read_header(const std::string &path, MbBiHeader *header)
     if (have_kernel_offset) {
         ret = mb_bi_header_set_kernel_address(header, kernel_offset);
         if (ret == MB_BI_UNSUPPORTED) {
-            fprintf(stderr, fmt_unsupported, FIELD_KERNEL_OFFSET);
+            print_error(fmt_unsupported, FIELD_KERNEL_OFFSET);
         } else if (ret < 0) {
-            fprintf(stderr, fmt_failed_to_set, FIELD_KERNEL_OFFSET);
+            print_error(fmt_failed_to_set, FIELD_KERNEL_OFFSET);
             return false;
         }
     }
     if (have_ramdisk_offset) {
         ret = mb_bi_header_set_ramdisk_address(header, ramdisk_offset);
         if (ret == MB_BI_UNSUPPORTED) {
-            fprintf(stderr, fmt_unsupported, FIELD_RAMDISK_OFFSET);
+            print_error(fmt_unsupported, FIELD_RAMDISK_OFFSET);
         } else if (ret < 0) {
-            fprintf(stderr, fmt_failed_to_set, FIELD_RAMDISK_OFFSET);
+            print_error(fmt_failed_to_set, FIELD_RAMDISK_OFFSET);
             return false;
         }
     }
     if (have_second_offset) {
         ret = mb_bi_header_set_secondboot_address(header, second_offset);
         if (ret == MB_BI_UNSUPPORTED) {
-            fprintf(stderr, fmt_unsupported, FIELD_SECOND_OFFSET);
+            print_error(fmt_unsupported, FIELD_SECOND_OFFSET);
         } else if (ret < 0) {
-            fprintf(stderr, fmt_failed_to_set, FIELD_SECOND_OFFSET);
+            print_error(fmt_failed_to_set, FIELD_SECOND_OFFSET);
             return false;
         }
     }
     if (have_tags_offset) {
         ret = mb_bi_header_set_kernel_tags_address(header, tags_offset);
         if (ret == MB_BI_UNSUPPORTED) {
-            fprintf(stderr, fmt_unsupported, FIELD_TAGS_OFFSET);
+            print_error(fmt_unsupported, FIELD_TAGS_OFFSET);
         } else if (ret < 0) {
-            fprintf(stderr, fmt_failed_to_set, FIELD_TAGS_OFFSET);
+            print_error(fmt_failed_to_set, FIELD_TAGS_OFFSET);
             return false;
         }
     }
@@ -641,7 +780,7 @@ static bool write_header(const std::string &path, MbBiHeader *header)
 
     ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
     if (!fp) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+        print_error("%s: Failed to open for writing: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
@@ -681,13 +820,13 @@ static bool write_header(const std::string &path, MbBiHeader *header)
                             mb_bi_header_page_size(header)) < 0);
 
     if (failed) {
-        fprintf(stderr, "%s: Failed to write file: %s\n",
+        print_error("%s: Failed to write file: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
 
     if (fclose(fp.release()) < 0) {
-        fprintf(stderr, "%s: Failed to close file: %s\n",
+        print_error("%s: Failed to close file: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
@@ -703,7 +842,7 @@ static bool write_data_file_to_entry(const std::string &path, MbBiWriter *biw)
         if (errno == ENOENT) {
             return true;
         } else {
-            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+            print_error("%s: Failed to open for reading: %s\n",
                     path.c_str(), strerror(errno));
             return false;
         }
@@ -719,14 +858,14 @@ static bool write_data_file_to_entry(const std::string &path, MbBiWriter *biw)
 
         if (mb_bi_writer_write_data(biw, buf, n, &bytes_written) != MB_BI_OK
                 || bytes_written != n) {
-            fprintf(stderr, "Failed to write entry data: %s\n",
+            print_error("Failed to write entry data: %s\n",
                     mb_bi_writer_error_string(biw));
             return false;
         }
 
         if (n < sizeof(buf)) {
             if (ferror(fp.get())) {
-                fprintf(stderr, "%s: Failed to read file: %s\n",
+                print_error("%s: Failed to read file: %s\n",
                         path.c_str(), strerror(errno));
             } else {
                 break;
@@ -741,7 +880,7 @@ static bool write_data_entry_to_file(const std::string &path, MbBiReader *bir)
 {
     ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
     if (!fp) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+        print_error("%s: Failed to open for writing: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
@@ -753,20 +892,20 @@ static bool write_data_entry_to_file(const std::string &path, MbBiReader *bir)
     while ((ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n))
             == MB_BI_OK) {
         if (fwrite(buf, 1, n, fp.get()) != n) {
-            fprintf(stderr, "%s: Failed to write data: %s\n",
+            print_error("%s: Failed to write data: %s\n",
                     path.c_str(), strerror(errno));
             return false;
         }
     }
 
     if (ret != MB_BI_EOF) {
-        fprintf(stderr, "Failed to read entry data: %s\n",
+        print_error("Failed to read entry data: %s\n",
                 mb_bi_reader_error_string(bir));
         return false;
     }
 
     if (fclose(fp.release()) < 0) {
-        fprintf(stderr, "%s: Failed to close file: %s\n",
+        print_error("%s: Failed to close file: %s\n",
                 path.c_str(), strerror(errno));
         return false;
     }
@@ -780,7 +919,7 @@ static bool write_file_to_entry(const Paths &paths, MbBiWriter *biw,
     std::string path;
 
     if (!mb_bi_entry_type_is_set(entry)) {
-        fprintf(stderr, "No entry type set!\n");
+        print_error("No entry type set!\n");
         return false;
     }
 
@@ -816,12 +955,12 @@ static bool write_file_to_entry(const Paths &paths, MbBiWriter *biw,
         path = paths.appsbl;
         break;
     default:
-        fprintf(stderr, "Unknown entry type: %d\n", mb_bi_entry_type(entry));
+        print_error("Unknown entry type: %d\n", mb_bi_entry_type(entry));
         return false;
     }
 
     if (mb_bi_writer_write_entry(biw, entry) != MB_BI_OK) {
-        fprintf(stderr, "Failed to write entry: %s\n",
+        print_error("Failed to write entry: %s\n",
                 mb_bi_writer_error_string(biw));
         return false;
     }
@@ -835,7 +974,7 @@ static bool write_entry_to_file(const Paths &paths, MbBiReader *bir,
     std::string path;
 
     if (!mb_bi_entry_type_is_set(entry)) {
-        fprintf(stderr, "No entry type set!\n");
+        print_error("No entry type set!\n");
         return false;
     }
 
@@ -871,13 +1010,174 @@ static bool write_entry_to_file(const Paths &paths, MbBiReader *bir,
         path = paths.appsbl;
         break;
     default:
-        fprintf(stderr, "Unknown entry type: %d\n", mb_bi_entry_type(entry));
+        print_error("Unknown entry type: %d\n", mb_bi_entry_type(entry));
         return false;
     }
 
     return write_data_entry_to_file(path, bir);
 }
 
+static bool unpack_image(const std::string &input_file, const char *type,
+                         const Paths &paths)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    int ret;
+
+    if (!bir) {
+        print_error("Failed to allocate reader: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (type) {
+        ret = mb_bi_reader_enable_format_by_name(bir.get(), type);
+        if (ret != MB_BI_OK) {
+            print_error("Failed to enable format '%s': %s\n",
+                    type, mb_bi_reader_error_string(bir.get()));
+            return false;
+        }
+    } else {
+        ret = mb_bi_reader_enable_format_all(bir.get());
+        if (ret != MB_BI_OK) {
+            print_error("Failed to enable all formats: %s\n",
+                    mb_bi_reader_error_string(bir.get()));
+            return false;
+        }
+    }
+
+    // The input file is not expected to change while it is being unpacked
+    mb_bi_reader_set_use_mmap(bir.get(), true);
+
+    ret = mb_bi_reader_open_filename(bir.get(), input_file.c_str());
+    if (ret != MB_BI_OK) {
+        print_error("%s: Failed to open for reading: %s\n",
+                input_file.c_str(), mb_bi_reader_error_string(bir.get()));
+        return false;
+    }
+
+    ret = mb_bi_reader_read_header(bir.get(), &header);
+    if (ret != MB_BI_OK) {
+        print_error("%s: Failed to read header: %s\n",
+                input_file.c_str(), mb_bi_reader_error_string(bir.get()));
+        return false;
+    }
+
+    if (!write_header(paths.header, header)) {
+        return false;
+    }
+
+    while ((ret = mb_bi_reader_read_entry(bir.get(), &entry)) == MB_BI_OK) {
+        if (!write_entry_to_file(paths, bir.get(), entry)) {
+            return false;
+        }
+    }
+
+    if (ret != MB_BI_EOF) {
+        print_error("Failed to read entry: %s\n",
+                mb_bi_reader_error_string(bir.get()));
+        return false;
+    }
+
+    return true;
+}
+
+static bool pack_image(const std::string &output_file, const char *type,
+                       const Paths &paths)
+{
+    // Create the boot image
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    int ret;
+
+    if (!biw) {
+        print_error("Failed to allocate writer: %s\n", strerror(errno));
+        return false;
+    }
+
+    ret = mb_bi_writer_set_format_by_name(biw.get(), type);
+    if (ret != MB_BI_OK) {
+        print_error("Invalid boot image type: %s\n", type);
+        return false;
+    }
+
+    if (output_file == "-") {
+        // stdout may not be seekable, so have the writer assemble the image in
+        // memory and write it out in one pass when it is closed
+        MbFile *file = mb_file_new();
+        if (!file) {
+            print_error("Failed to allocate file: %s\n", strerror(errno));
+            return false;
+        }
+
+#ifdef _WIN32
+        _setmode(STDOUT_FILENO, _O_BINARY);
+#endif
+
+        ret = mb_file_open_fd(file, STDOUT_FILENO, false);
+        if (ret != MB_FILE_OK) {
+            print_error("stdout: Failed to open for writing: %s\n",
+                    mb_file_error_string(file));
+            mb_file_free(file);
+            return false;
+        }
+
+        ret = mb_bi_writer_set_streaming(biw.get(), true);
+        if (ret == MB_BI_OK) {
+            ret = mb_bi_writer_open(biw.get(), file, true);
+        } else {
+            mb_file_free(file);
+        }
+    } else {
+        ret = mb_bi_writer_open_filename(biw.get(), output_file.c_str());
+    }
+    if (ret != MB_BI_OK) {
+        print_error("%s: Failed to open for writing: %s\n",
+                output_file.c_str(), mb_bi_writer_error_string(biw.get()));
+        return false;
+    }
+
+    ret = mb_bi_writer_get_header(biw.get(), &header);
+    if (ret != MB_BI_OK) {
+        print_error("Failed to get header instance: %s\n",
+                mb_bi_writer_error_string(biw.get()));
+        return false;
+    }
+
+    if (!read_header(paths.header, header)) {
+        return false;
+    }
+
+    ret = mb_bi_writer_write_header(biw.get(), header);
+    if (ret != MB_BI_OK) {
+        print_error("%s: Failed to read header: %s\n",
+                output_file.c_str(), mb_bi_writer_error_string(biw.get()));
+        return false;
+    }
+
+    while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
+        if (!write_file_to_entry(paths, biw.get(), entry)) {
+            return false;
+        }
+    }
+
+    if (ret != MB_BI_EOF) {
+        print_error("Failed to get next entry: %s\n",
+                mb_bi_writer_error_string(biw.get()));
+        return false;
+    }
+
+    ret = mb_bi_writer_close(biw.get());
+    if (ret != MB_BI_OK) {
+        print_error("Failed to close boot image: %s\n",
+                mb_bi_writer_error_string(biw.get()));
+        return false;
+    }
+
+    return true;
+}
+
 bool unpack_main(int argc, char *argv[])
 {
     int opt;
@@ -979,69 +1279,12 @@ bool unpack_main(int argc, char *argv[])
     prepend_if_empty(paths, output_dir, prefix);
 
     if (!io::createDirectories(output_dir)) {
-        fprintf(stderr, "%s: Failed to create directory: %s\n",
+        print_error("%s: Failed to create directory: %s\n",
                 output_dir.c_str(), io::lastErrorString().c_str());
         return false;
     }
 
-    // Load the boot image
-    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
-    MbBiHeader *header;
-    MbBiEntry *entry;
-    int ret;
-
-    if (!bir) {
-        fprintf(stderr, "Failed to allocate reader: %s\n", strerror(errno));
-        return false;
-    }
-
-    if (type) {
-        ret = mb_bi_reader_enable_format_by_name(bir.get(), type);
-        if (ret != MB_BI_OK) {
-            fprintf(stderr, "Failed to enable format '%s': %s\n",
-                    type, mb_bi_reader_error_string(bir.get()));
-            return false;
-        }
-    } else {
-        ret = mb_bi_reader_enable_format_all(bir.get());
-        if (ret != MB_BI_OK) {
-            fprintf(stderr, "Failed to enable all formats: %s\n",
-                    mb_bi_reader_error_string(bir.get()));
-            return false;
-        }
-    }
-
-    ret = mb_bi_reader_open_filename(bir.get(), input_file.c_str());
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                input_file.c_str(), mb_bi_reader_error_string(bir.get()));
-        return false;
-    }
-
-    ret = mb_bi_reader_read_header(bir.get(), &header);
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                input_file.c_str(), mb_bi_reader_error_string(bir.get()));
-        return false;
-    }
-
-    if (!write_header(paths.header, header)) {
-        return false;
-    }
-
-    while ((ret = mb_bi_reader_read_entry(bir.get(), &entry)) == MB_BI_OK) {
-        if (!write_entry_to_file(paths, bir.get(), entry)) {
-            return false;
-        }
-    }
-
-    if (ret != MB_BI_EOF) {
-        fprintf(stderr, "Failed to read entry: %s\n",
-                mb_bi_reader_error_string(bir.get()));
-        return false;
-    }
-
-    return true;
+    return unpack_image(input_file, type, paths);
 }
 
 bool pack_main(int argc, char *argv[])
@@ -1135,7 +1378,7 @@ bool pack_main(int argc, char *argv[])
 
     output_file = argv[optind];
 
-    if (no_prefix) {
+    if (no_prefix || (prefix.empty() && output_file == "-")) {
         prefix.clear();
     } else if (prefix.empty()) {
         prefix = io::baseName(output_file);
@@ -1148,68 +1391,395 @@ bool pack_main(int argc, char *argv[])
 
     prepend_if_empty(paths, input_dir, prefix);
 
-    // Load the boot image
-    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
-    MbBiHeader *header;
-    MbBiEntry *entry;
-    int ret;
+    return pack_image(output_file, type, paths);
+}
 
-    if (!biw) {
-        fprintf(stderr, "Failed to allocate writer: %s\n", strerror(errno));
+struct BatchJob
+{
+    std::string source;
+    std::string target;
+    bool success = false;
+    // Errors and warnings printed while processing the image
+    std::string messages;
+    // Size of the boot image
+    uint64_t size = 0;
+    uint64_t time_ms = 0;
+};
+
+static bool file_size(const std::string &path, uint64_t *size_out)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
+    if (!fp) {
+        print_error("%s: Failed to open for reading: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    ret = mb_bi_writer_set_format_by_name(biw.get(), type);
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "Invalid boot image type: %s\n", type);
+    long size;
+
+    if (fseek(fp.get(), 0, SEEK_END) < 0 || (size = ftell(fp.get())) < 0) {
+        print_error("%s: Failed to get file size: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    ret = mb_bi_writer_open_filename(biw.get(), output_file.c_str());
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                output_file.c_str(), mb_bi_writer_error_string(biw.get()));
+    *size_out = static_cast<uint64_t>(size);
+    return true;
+}
+
+static bool read_manifest(const std::string &path,
+                          const std::string &output_dir,
+                          std::vector<BatchJob> *jobs)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
+    if (!fp) {
+        print_error("%s: Failed to open for reading: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    ret = mb_bi_writer_get_header(biw.get(), &header);
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "Failed to get header instance: %s\n",
-                mb_bi_writer_error_string(biw.get()));
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read;
+
+    auto free_line = finally([&]{
+        free(line);
+    });
+
+    errno = 0;
+
+    while ((read = mb_getline(&line, &len, fp.get())) >= 0) {
+        // Strip line ending
+        while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+            line[--read] = '\0';
+        }
+
+        const char *start = line;
+        while (*start == ' ' || *start == '\t') {
+            ++start;
+        }
+
+        if (!*start || *start == '#') {
+            continue;
+        }
+
+        BatchJob job;
+        const char *tab = strchr(start, '\t');
+
+        if (tab) {
+            job.source.assign(start, tab);
+            job.target = tab + 1;
+        } else {
+            job.source = start;
+            job.target = io::pathJoin({output_dir, io::baseName(job.source)});
+        }
+
+        jobs->push_back(std::move(job));
+    }
+
+    if (errno) {
+        print_error("%s: Failed to read file: %s\n",
+                path.c_str(), strerror(errno));
         return false;
     }
 
-    if (!read_header(paths.header, header)) {
+    return true;
+}
+
+/*!
+ * \brief Load the list of images to process
+ *
+ * If \p input is a directory, a job is created for every file (or every
+ * directory if \p directories is true) in it. Otherwise, \p input is read as a
+ * manifest.
+ */
+static bool load_batch_jobs(const std::string &input,
+                            const std::string &output_dir, bool directories,
+                            std::vector<BatchJob> *jobs)
+{
+    std::vector<io::DirEntry> entries;
+
+    if (!io::listDirectory(input, &entries)) {
+        return read_manifest(input, output_dir, jobs);
+    }
+
+    for (auto const &entry : entries) {
+        if (entry.isDirectory != directories) {
+            continue;
+        }
+
+        BatchJob job;
+        job.source = io::pathJoin({input, entry.name});
+        job.target = io::pathJoin({output_dir, entry.name});
+        jobs->push_back(std::move(job));
+    }
+
+    return true;
+}
+
+static bool batch_unpack_job(BatchJob &job, const char *type)
+{
+    Paths paths;
+    prepend_if_empty(paths, job.target, "");
+
+    if (!io::createDirectories(job.target)) {
+        print_error("%s: Failed to create directory: %s\n",
+                job.target.c_str(), io::lastErrorString().c_str());
         return false;
     }
 
-    ret = mb_bi_writer_write_header(biw.get(), header);
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                output_file.c_str(), mb_bi_writer_error_string(biw.get()));
+    return unpack_image(job.source, type, paths)
+            && file_size(job.source, &job.size);
+}
+
+static bool batch_pack_job(BatchJob &job, const char *type)
+{
+    Paths paths;
+    prepend_if_empty(paths, job.source, "");
+
+    std::string parent = io::dirName(job.target);
+    if (!parent.empty() && !io::createDirectories(parent)) {
+        print_error("%s: Failed to create directory: %s\n",
+                parent.c_str(), io::lastErrorString().c_str());
         return false;
     }
 
-    while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
-        if (!write_file_to_entry(paths, biw.get(), entry)) {
+    return pack_image(job.target, type, paths)
+            && file_size(job.target, &job.size);
+}
+
+#ifdef _WIN32
+typedef std::thread WorkerThread;
+
+static bool start_worker(WorkerThread *thread, std::function<void()> *fn)
+{
+    // Windows builds have exceptions enabled, so a failure throws instead
+    *thread = std::thread(*fn);
+    return true;
+}
+
+static void join_worker(WorkerThread *thread)
+{
+    thread->join();
+}
+#else
+// std::thread cannot report failures without exceptions, which are disabled on
+// Android, so pthreads are used directly
+typedef pthread_t WorkerThread;
+
+static void * worker_thread(void *fn)
+{
+    (*static_cast<std::function<void()> *>(fn))();
+    return nullptr;
+}
+
+static bool start_worker(WorkerThread *thread, std::function<void()> *fn)
+{
+    int ret = pthread_create(thread, nullptr, &worker_thread, fn);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to create worker thread: %s\n", strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+static void join_worker(WorkerThread *thread)
+{
+    pthread_join(*thread, nullptr);
+}
+#endif
+
+/*!
+ * \brief Process jobs on a bounded pool of worker threads
+ *
+ * Each worker handles one image at a time with its own reader or writer. The
+ * result of each image is printed as soon as it completes and the aggregate
+ * statistics are printed at the end.
+ */
+static bool run_batch(std::vector<BatchJob> &jobs, unsigned int threads,
+                      const std::function<bool(BatchJob &)> &fn)
+{
+    std::atomic<size_t> next(0);
+    std::mutex print_lock;
+    size_t completed = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::function<void()> worker = [&]{
+        size_t i;
+
+        while ((i = next++) < jobs.size()) {
+            BatchJob &job = jobs[i];
+            auto job_start = std::chrono::steady_clock::now();
+
+            set_error_buffer(&job.messages);
+            job.success = fn(job);
+            set_error_buffer(nullptr);
+
+            job.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - job_start).count();
+
+            std::lock_guard<std::mutex> lock(print_lock);
+            FILE *out = job.success ? stdout : stderr;
+            ++completed;
+
+            if (job.success) {
+                fprintf(out, "[%zu/%zu] OK: %s (%.1f MiB, %" PRIu64 " ms)\n",
+                        completed, jobs.size(), job.source.c_str(),
+                        job.size / 1024.0 / 1024.0, job.time_ms);
+            } else {
+                fflush(stdout);
+                fprintf(out, "[%zu/%zu] FAILED: %s (%" PRIu64 " ms)\n",
+                        completed, jobs.size(), job.source.c_str(),
+                        job.time_ms);
+            }
+
+            // Indent the messages for this image
+            size_t pos = 0;
+            while (pos < job.messages.size()) {
+                size_t end = job.messages.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = job.messages.size();
+                }
+                fprintf(out, "    %.*s\n", static_cast<int>(end - pos),
+                        job.messages.data() + pos);
+                pos = end + 1;
+            }
+
+            fflush(out);
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+            std::max<size_t>(std::min<size_t>(threads, jobs.size()), 1));
+
+    // The calling thread is one of the workers. Jobs are handed out
+    // dynamically, so if a thread cannot be created, the remaining threads
+    // (possibly only the calling thread) simply process more images.
+    std::vector<WorkerThread> workers(threads - 1);
+    size_t started = 0;
+    while (started < workers.size()
+            && start_worker(&workers[started], &worker)) {
+        ++started;
+    }
+    threads = static_cast<unsigned int>(started + 1);
+
+    worker();
+
+    for (size_t i = 0; i < started; ++i) {
+        join_worker(&workers[i]);
+    }
+
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    size_t failed = 0;
+    uint64_t total_size = 0;
+
+    for (auto const &job : jobs) {
+        if (job.success) {
+            total_size += job.size;
+        } else {
+            ++failed;
+        }
+    }
+
+    printf("\n");
+    printf("Processed %zu images with %u threads in %.2f s\n",
+           jobs.size(), threads, seconds);
+    printf("Succeeded: %zu, failed: %zu\n", jobs.size() - failed, failed);
+    if (seconds > 0) {
+        printf("Throughput: %.1f MiB/s, %.1f images/s\n",
+               total_size / 1024.0 / 1024.0 / seconds,
+               (jobs.size() - failed) / seconds);
+    }
+
+    if (failed > 0) {
+        fflush(stdout);
+        fprintf(stderr, "\nFailed images:\n");
+        for (auto const &job : jobs) {
+            if (!job.success) {
+                fprintf(stderr, "  %s\n", job.source.c_str());
+            }
+        }
+    }
+
+    return failed == 0;
+}
+
+static bool batch_main(int argc, char *argv[], bool pack)
+{
+    const char *usage = pack ? HELP_BATCH_PACK_USAGE : HELP_BATCH_UNPACK_USAGE;
+    int opt;
+    std::string output_dir;
+    const char *type = pack ? MB_BI_FORMAT_NAME_ANDROID : nullptr;
+    unsigned int threads = 0;
+
+    static const char short_options[] = "o:t:j:" "h";
+
+    static struct option long_options[] = {
+        {"output", required_argument, 0, 'o'},
+        {"type",   required_argument, 0, 't'},
+        {"jobs",   required_argument, 0, 'j'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'o':
+            output_dir = optarg;
+            break;
+
+        case 't':
+            type = optarg;
+            break;
+
+        case 'j':
+            if (!str_to_unum(optarg, 10, &threads) || threads == 0) {
+                print_error("Invalid number of jobs: %s\n", optarg);
+                return false;
+            }
+            break;
+
+        case 'h':
+            fputs(usage, stdout);
+            return true;
+
+        default:
+            fputs(usage, stderr);
             return false;
         }
     }
 
-    if (ret != MB_BI_EOF) {
-        fprintf(stderr, "Failed to get next entry: %s\n",
-                mb_bi_writer_error_string(biw.get()));
+    // There should be one other argument
+    if (argc - optind != 1) {
+        fputs(usage, stderr);
         return false;
     }
 
-    ret = mb_bi_writer_close(biw.get());
-    if (ret != MB_BI_OK) {
-        fprintf(stderr, "Failed to close boot image: %s\n",
-                mb_bi_writer_error_string(biw.get()));
+    if (output_dir.empty()) {
+        output_dir = ".";
+    }
+
+    std::vector<BatchJob> jobs;
+
+    if (!load_batch_jobs(argv[optind], output_dir, pack, &jobs)) {
         return false;
     }
 
-    return true;
+    if (jobs.empty()) {
+        print_error("%s: No images to process\n", argv[optind]);
+        return false;
+    }
+
+    return run_batch(jobs, threads, [&](BatchJob &job) {
+        return pack ? batch_pack_job(job, type) : batch_unpack_job(job, type);
+    });
 }
 
 int main(int argc, char *argv[])
@@ -1226,6 +1796,10 @@ int main(int argc, char *argv[])
         ret = unpack_main(--argc, ++argv);
     } else if (command == "pack") {
         ret = pack_main(--argc, ++argv);
+    } else if (command == "batch-unpack") {
+        ret = batch_main(--argc, ++argv, false);
+    } else if (command == "batch-pack") {
+        ret = batch_main(--argc, ++argv, true);
     } else {
         fputs(HELP_MAIN_USAGE, stderr);
         return EXIT_FAILURE;
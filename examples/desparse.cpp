@@ -24,6 +24,7 @@
 #include <cstdio>
 
 #include "mbcommon/file/filename.h"
+#include "mbcommon/file_util.h"
 #include "mbsparse/sparse.h"
 
 typedef std::unique_ptr<MbFile, int (*)(MbFile *)> ScopedMbFile;
@@ -88,6 +89,44 @@ bool cbSeek(int64_t offset, int whence, void *userData)
     return true;
 }
 
+bool cbPread(void *buf, uint64_t size, uint64_t offset, uint64_t *bytesRead,
+             void *userData)
+{
+    Context *ctx = static_cast<Context *>(userData);
+    size_t n;
+    if (mb_file_pread_fully(ctx->file.get(), buf, size, offset, &n)
+            != MB_FILE_OK) {
+        fprintf(stderr, "%s: Failed to read: %s\n",
+                ctx->path.c_str(), mb_file_error_string(ctx->file.get()));
+        return false;
+    }
+    *bytesRead = n;
+    return true;
+}
+
+bool cbPwrite(const void *buf, uint64_t size, uint64_t offset, void *userData)
+{
+    MbFile *file = static_cast<MbFile *>(userData);
+    size_t n;
+    if (mb_file_pwrite_fully(file, buf, size, offset, &n) != MB_FILE_OK
+            || n != size) {
+        fprintf(stderr, "Failed to write: %s\n", mb_file_error_string(file));
+        return false;
+    }
+    return true;
+}
+
+bool cbDiscard(uint64_t offset, uint64_t size, void *userData)
+{
+    (void) offset;
+    (void) size;
+    (void) userData;
+
+    // The output file was truncated to the full size, so holes are already
+    // zeros
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 3) {
@@ -113,13 +152,19 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (!sparseOpen(sparseCtx.get(), &cbOpen, &cbClose, &cbRead, &cbSeek,
-                    nullptr, &ctx)) {
+    if (!sparseSetPreadCallback(sparseCtx.get(), &cbPread)
+            || !sparseOpen(sparseCtx.get(), &cbOpen, &cbClose, &cbRead, &cbSeek,
+                           nullptr, &ctx)) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t size;
+    if (!sparseSize(sparseCtx.get(), &size)) {
         return EXIT_FAILURE;
     }
 
     ScopedMbFile file(mb_file_new(), &mb_file_free);
-    if (!ctx.file) {
+    if (!file) {
         fprintf(stderr, "Out of memory\n");
         return EXIT_FAILURE;
     }
@@ -131,25 +176,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    uint64_t bytesRead;
-    char buf[10240];
-    bool ret;
-    while ((ret = sparseRead(sparseCtx.get(), buf, sizeof(buf), &bytesRead))
-            && bytesRead > 0) {
-        char *ptr = buf;
-        size_t bytesWritten;
-        while (bytesRead > 0) {
-            if (mb_file_write(file.get(), buf, bytesRead, &bytesWritten)
-                    != MB_FILE_OK) {
-                fprintf(stderr, "%s: Failed to write: %s\n",
-                        outputFile, mb_file_error_string(file.get()));
-                return EXIT_FAILURE;
-            }
-            bytesRead -= bytesWritten;
-            ptr += bytesWritten;
-        }
+    if (mb_file_truncate(file.get(), size) != MB_FILE_OK) {
+        fprintf(stderr, "%s: Failed to set file size: %s\n",
+                outputFile, mb_file_error_string(file.get()));
+        return EXIT_FAILURE;
     }
-    if (!ret) {
+
+    // Expand with one thread per CPU
+    if (!sparseExpand(sparseCtx.get(), 0, &cbPwrite, &cbDiscard, file.get())) {
         return EXIT_FAILURE;
     }
 
@@ -34,6 +34,16 @@
 #define MB_BI_FORMAT_NAME_MTK           "mtk"
 #define MB_BI_FORMAT_NAME_SONY_ELF      "sony_elf"
 
+// Compression hints
+
+#define MB_BI_COMPRESSION_UNKNOWN       0
+#define MB_BI_COMPRESSION_GZIP          1
+#define MB_BI_COMPRESSION_LZ4           2
+#define MB_BI_COMPRESSION_XZ            3
+#define MB_BI_COMPRESSION_LZMA          4
+#define MB_BI_COMPRESSION_BZIP2         5
+#define MB_BI_COMPRESSION_LZOP          6
+
 // Return values
 
 #define MB_BI_EOF                       1
@@ -52,6 +52,13 @@ int loki_find_ramdisk_address(struct MbBiReader *bir, struct MbFile *file,
                               uint32_t *ramdisk_addr_out);
 int loki_old_find_gzip_offset(struct MbBiReader *bir, struct MbFile *file,
                               uint32_t start_offset, uint64_t *gzip_offset_out);
+int loki_old_find_gzip_offset_and_ramdisk_address(struct MbBiReader *bir,
+                                                  struct MbFile *file,
+                                                  const struct AndroidHeader *hdr,
+                                                  const struct LokiHeader *loki_hdr,
+                                                  uint64_t start_offset,
+                                                  uint64_t *gzip_offset_out,
+                                                  uint32_t *ramdisk_addr_out);
 int loki_old_find_ramdisk_size(struct MbBiReader *bir, struct MbFile *file,
                                const struct AndroidHeader *hdr,
                                uint32_t ramdisk_offset,
@@ -84,6 +91,12 @@ int loki_reader_go_to_entry(struct MbBiReader *bir, void *userdata,
 int loki_reader_read_data(struct MbBiReader *bir, void *userdata,
                           void *buf, size_t buf_size,
                           size_t *bytes_read);
+int loki_reader_read_data_range(struct MbBiReader *bir, void *userdata,
+                                uint64_t size, uint64_t *offset_out,
+                                uint64_t *size_out);
+int loki_reader_get_entry_table(struct MbBiReader *bir, void *userdata,
+                                struct MbBiEntryInfo *table,
+                                size_t table_size, size_t *count);
 int loki_reader_free(struct MbBiReader *bir, void *userdata);
 
 MB_END_C_DECLS
@@ -59,6 +59,9 @@ int loki_writer_write_entry(struct MbBiWriter *biw, void *userdata,
 int loki_writer_write_data(struct MbBiWriter *biw, void *userdata,
                            const void *buf, size_t buf_size,
                            size_t *bytes_written);
+int loki_writer_copy_data(struct MbBiWriter *biw, void *userdata,
+                          struct MbFile *src, uint64_t src_offset,
+                          uint64_t size, uint64_t *bytes_copied);
 int loki_writer_finish_entry(struct MbBiWriter *biw, void *userdata);
 int loki_writer_close(struct MbBiWriter *biw, void *userdata);
 int loki_writer_free(struct MbBiWriter *bir, void *userdata);
@@ -58,6 +58,12 @@ int mtk_reader_go_to_entry(struct MbBiReader *bir, void *userdata,
 int mtk_reader_read_data(struct MbBiReader *bir, void *userdata,
                          void *buf, size_t buf_size,
                          size_t *bytes_read);
+int mtk_reader_read_data_range(struct MbBiReader *bir, void *userdata,
+                               uint64_t size, uint64_t *offset_out,
+                               uint64_t *size_out);
+int mtk_reader_get_entry_table(struct MbBiReader *bir, void *userdata,
+                               struct MbBiEntryInfo *table,
+                               size_t table_size, size_t *count);
 int mtk_reader_free(struct MbBiReader *bir, void *userdata);
 
 MB_END_C_DECLS
@@ -55,6 +55,9 @@ int mtk_writer_write_entry(struct MbBiWriter *biw, void *userdata,
 int mtk_writer_write_data(struct MbBiWriter *biw, void *userdata,
                           const void *buf, size_t buf_size,
                           size_t *bytes_written);
+int mtk_writer_copy_data(struct MbBiWriter *biw, void *userdata,
+                         struct MbFile *src, uint64_t src_offset,
+                         uint64_t size, uint64_t *bytes_copied);
 int mtk_writer_finish_entry(struct MbBiWriter *biw, void *userdata);
 int mtk_writer_close(struct MbBiWriter *biw, void *userdata);
 int mtk_writer_free(struct MbBiWriter *bir, void *userdata);
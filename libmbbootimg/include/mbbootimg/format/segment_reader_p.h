@@ -90,3 +90,11 @@ int _segment_reader_go_to_entry(struct SegmentReaderCtx *ctx, struct MbFile *fil
 int _segment_reader_read_data(struct SegmentReaderCtx *ctx, struct MbFile *file,
                               void *buf, size_t buf_size, size_t *bytes_read,
                               struct MbBiReader *bir);
+int _segment_reader_read_data_range(struct SegmentReaderCtx *ctx,
+                                    struct MbFile *file, uint64_t size,
+                                    uint64_t *offset_out, uint64_t *size_out,
+                                    struct MbBiReader *bir);
+int _segment_reader_get_entry_table(struct SegmentReaderCtx *ctx,
+                                    struct MbBiEntryInfo *table,
+                                    size_t table_size, size_t *count,
+                                    struct MbBiReader *bir);
@@ -30,6 +30,9 @@
 #include "mbbootimg/writer.h"
 
 #define SEGMENT_WRITER_MAX_ENTRIES      10
+// Padding is written from a 4 KiB block of zeros, so this allows 64 KiB of
+// padding per write
+#define SEGMENT_WRITER_MAX_PAD_IOVS     16
 
 enum
 #ifdef __cplusplus
@@ -63,6 +66,9 @@ struct SegmentWriterCtx
 
     bool have_pos;
     uint64_t pos;
+
+    // Alignment padding that has not been written yet. It is included in pos.
+    uint64_t pad_size;
 };
 
 int _segment_writer_init(struct SegmentWriterCtx *ctx);
@@ -89,5 +95,14 @@ int _segment_writer_write_entry(struct SegmentWriterCtx *ctx, struct MbFile *fil
 int _segment_writer_write_data(struct SegmentWriterCtx *ctx, struct MbFile *file,
                                const void *buf, size_t buf_size,
                                size_t *bytes_written, struct MbBiWriter *biw);
+int _segment_writer_copy_data(struct SegmentWriterCtx *ctx, struct MbFile *file,
+                              struct MbFile *src, uint64_t src_offset,
+                              uint64_t size, uint64_t *bytes_copied,
+                              struct MbBiWriter *biw);
 int _segment_writer_finish_entry(struct SegmentWriterCtx *ctx, struct MbFile *file,
                                  struct MbBiWriter *biw);
+
+uint64_t _segment_writer_padding_size(struct SegmentWriterCtx *ctx);
+int _segment_writer_write_padded(struct SegmentWriterCtx *ctx, struct MbFile *file,
+                                 const void *buf, size_t buf_size,
+                                 struct MbBiWriter *biw);
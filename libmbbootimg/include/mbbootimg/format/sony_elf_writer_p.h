@@ -63,6 +63,9 @@ int sony_elf_writer_write_entry(struct MbBiWriter *biw, void *userdata,
 int sony_elf_writer_write_data(struct MbBiWriter *biw, void *userdata,
                                const void *buf, size_t buf_size,
                                size_t *bytes_written);
+int sony_elf_writer_copy_data(struct MbBiWriter *biw, void *userdata,
+                              struct MbFile *src, uint64_t src_offset,
+                              uint64_t size, uint64_t *bytes_copied);
 int sony_elf_writer_finish_entry(struct MbBiWriter *biw, void *userdata);
 int sony_elf_writer_close(struct MbBiWriter *biw, void *userdata);
 int sony_elf_writer_free(struct MbBiWriter *bir, void *userdata);
@@ -22,10 +22,12 @@
 #ifdef __cplusplus
 #  include <cstdarg>
 #  include <cstddef>
+#  include <cstdint>
 #  include <cwchar>
 #else
 #  include <stdarg.h>
 #  include <stddef.h>
+#  include <stdint.h>
 #  include <wchar.h>
 #endif
 
@@ -40,6 +42,20 @@ struct MbBiEntry;
 struct MbBiHeader;
 struct MbFile;
 
+struct MbBiEntryInfo
+{
+    // Entry type
+    int type;
+    // Offset of entry data in the boot image
+    uint64_t offset;
+    // Size of entry data
+    uint64_t size;
+    // Whether the data is allowed to be shorter than the size
+    bool can_truncate;
+    // Compression method detected from the data (one of MB_BI_COMPRESSION_*)
+    int compression;
+};
+
 // Construction/destruction
 MB_EXPORT struct MbBiReader * mb_bi_reader_new(void);
 MB_EXPORT int mb_bi_reader_free(struct MbBiReader *bir);
@@ -70,6 +86,13 @@ MB_EXPORT int mb_bi_reader_go_to_entry2(struct MbBiReader *bir,
                                         int entry_type);
 MB_EXPORT int mb_bi_reader_read_data(struct MbBiReader *bir, void *buf,
                                      size_t size, size_t *bytes_read);
+MB_EXPORT int mb_bi_reader_get_entry_table(struct MbBiReader *bir,
+                                           const struct MbBiEntryInfo **table,
+                                           size_t *count);
+MB_EXPORT int mb_bi_reader_read_entry_data_at(struct MbBiReader *bir,
+                                              int entry_type, uint64_t offset,
+                                              void *buf, size_t size,
+                                              size_t *bytes_read);
 
 // Format operations
 MB_EXPORT int mb_bi_reader_format_code(struct MbBiReader *bir);
@@ -78,6 +101,10 @@ MB_EXPORT int mb_bi_reader_set_format_by_code(struct MbBiReader *bir,
                                               int code);
 MB_EXPORT int mb_bi_reader_set_format_by_name(struct MbBiReader *bir,
                                               const char *name);
+MB_EXPORT int mb_bi_reader_set_probe_size(struct MbBiReader *bir,
+                                          size_t size);
+MB_EXPORT int mb_bi_reader_set_use_mmap(struct MbBiReader *bir,
+                                        bool enable);
 MB_EXPORT int mb_bi_reader_enable_format_all(struct MbBiReader *bir);
 MB_EXPORT int mb_bi_reader_enable_format_by_code(struct MbBiReader *bir,
                                                  int code);
@@ -23,12 +23,16 @@
 
 #ifdef __cplusplus
 #  include <cstddef>
+#  include <cstdint>
 #else
 #  include <stddef.h>
+#  include <stdint.h>
 #endif
 
 #include "mbcommon/common.h"
 
+#include "mbbootimg/reader.h"
+
 #define READER_ENSURE_STATE(INSTANCE, STATES) \
     do { \
         if (!((INSTANCE)->state & (STATES))) { \
@@ -57,6 +61,12 @@
     } while (0)
 
 #define MAX_FORMATS     10
+#define MAX_ENTRIES     16
+
+// Number of bytes read up front and shared by all bidders
+#define DEFAULT_PROBE_SIZE  (64 * 1024)
+// Size of cached reads beyond the probe window
+#define PROBE_BLOCK_SIZE    4096
 
 MB_BEGIN_C_DECLS
 
@@ -78,6 +88,14 @@ typedef int (*FormatReaderGoToEntry)(struct MbBiReader *bir, void *userdata,
 typedef int (*FormatReaderReadData)(struct MbBiReader *bir, void *userdata,
                                     void *buf, size_t buf_size,
                                     size_t *bytes_read);
+typedef int (*FormatReaderReadDataRange)(struct MbBiReader *bir,
+                                         void *userdata, uint64_t size,
+                                         uint64_t *offset_out,
+                                         uint64_t *size_out);
+typedef int (*FormatReaderGetEntryTable)(struct MbBiReader *bir,
+                                         void *userdata,
+                                         struct MbBiEntryInfo *table,
+                                         size_t table_size, size_t *count);
 typedef int (*FormatReaderFree)(struct MbBiReader *bir, void *userdata);
 
 struct FormatReader
@@ -92,6 +110,8 @@ struct FormatReader
     FormatReaderReadEntry read_entry_cb;
     FormatReaderGoToEntry go_to_entry_cb;
     FormatReaderReadData read_data_cb;
+    FormatReaderReadDataRange read_data_range_cb;
+    FormatReaderGetEntryTable get_entry_table_cb;
     FormatReaderFree free_cb;
     void *userdata;
 };
@@ -117,6 +137,8 @@ struct MbBiReader
     // File
     struct MbFile *file;
     bool file_owned;
+    // Whether mb_bi_reader_open_filename() may memory map the file
+    bool use_mmap;
 
     // Error
     int error_code;
@@ -126,6 +148,14 @@ struct MbBiReader
     size_t formats_len;
     struct FormatReader *format;
 
+    // Format detection
+    size_t probe_size;
+
+    // Entry table (populated when the header is read)
+    struct MbBiEntryInfo entry_table[MAX_ENTRIES];
+    size_t entry_table_len;
+    bool entry_table_valid;
+
     struct MbBiHeader *header;
     struct MbBiEntry *entry;
 };
@@ -140,6 +170,8 @@ int _mb_bi_reader_register_format(struct MbBiReader *bir,
                                   FormatReaderReadEntry read_entry_cb,
                                   FormatReaderGoToEntry go_to_entry_cb,
                                   FormatReaderReadData read_data_cb,
+                                  FormatReaderReadDataRange read_data_range_cb,
+                                  FormatReaderGetEntryTable get_entry_table_cb,
                                   FormatReaderFree free_cb);
 
 int _mb_bi_reader_free_format(struct MbBiReader *bir,
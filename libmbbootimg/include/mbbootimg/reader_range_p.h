@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#ifdef __cplusplus
+#  include <cstdint>
+#else
+#  include <stdint.h>
+#endif
+
+#include "mbcommon/common.h"
+
+// This is separate from reader_p.h so that it can be used by the writer, whose
+// private header declares conflicting state enums
+
+MB_BEGIN_C_DECLS
+
+struct MbBiReader;
+struct MbFile;
+
+int _mb_bi_reader_read_data_range(struct MbBiReader *bir, uint64_t size,
+                                  struct MbFile **file_out,
+                                  uint64_t *offset_out, uint64_t *size_out);
+
+MB_END_C_DECLS
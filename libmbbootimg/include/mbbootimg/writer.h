@@ -22,10 +22,12 @@
 #ifdef __cplusplus
 #  include <cstdarg>
 #  include <cstddef>
+#  include <cstdint>
 #  include <cwchar>
 #else
 #  include <stdarg.h>
 #  include <stddef.h>
+#  include <stdint.h>
 #  include <wchar.h>
 #endif
 
@@ -38,6 +40,7 @@ MB_BEGIN_C_DECLS
 struct MbBiWriter;
 struct MbBiEntry;
 struct MbBiHeader;
+struct MbBiReader;
 struct MbFile;
 
 // Construction/destruction
@@ -68,6 +71,9 @@ MB_EXPORT int mb_bi_writer_write_entry(struct MbBiWriter *biw,
                                        struct MbBiEntry *entry);
 MB_EXPORT int mb_bi_writer_write_data(struct MbBiWriter *biw, const void *buf,
                                       size_t size, size_t *bytes_written);
+MB_EXPORT int mb_bi_writer_copy_data(struct MbBiWriter *biw,
+                                     struct MbBiReader *bir,
+                                     uint64_t *bytes_copied);
 
 // Format operations
 MB_EXPORT int mb_bi_writer_format_code(struct MbBiWriter *biw);
@@ -76,6 +82,8 @@ MB_EXPORT int mb_bi_writer_set_format_by_code(struct MbBiWriter *biw,
                                               int code);
 MB_EXPORT int mb_bi_writer_set_format_by_name(struct MbBiWriter *biw,
                                               const char *name);
+MB_EXPORT int mb_bi_writer_set_streaming(struct MbBiWriter *biw,
+                                         bool enabled);
 
 // Specific formats
 MB_EXPORT int mb_bi_writer_set_format_android(struct MbBiWriter *biw);
@@ -23,8 +23,10 @@
 
 #ifdef __cplusplus
 #  include <cstddef>
+#  include <cstdint>
 #else
 #  include <stddef.h>
+#  include <stdint.h>
 #endif
 
 #include "mbcommon/common.h"
@@ -78,6 +80,9 @@ typedef int (*FormatWriterWriteEntry)(struct MbBiWriter *biw, void *userdata,
 typedef int (*FormatWriterWriteData)(struct MbBiWriter *biw, void *userdata,
                                      const void *buf, size_t buf_size,
                                      size_t *bytes_written);
+typedef int (*FormatWriterCopyData)(struct MbBiWriter *biw, void *userdata,
+                                    struct MbFile *src, uint64_t src_offset,
+                                    uint64_t size, uint64_t *bytes_copied);
 typedef int (*FormatWriterFinishEntry)(struct MbBiWriter *biw, void *userdata);
 typedef int (*FormatWriterClose)(struct MbBiWriter *biw, void *userdata);
 typedef int (*FormatWriterFree)(struct MbBiWriter *biw, void *userdata);
@@ -94,6 +99,7 @@ struct FormatWriter
     FormatWriterGetEntry get_entry_cb;
     FormatWriterWriteEntry write_entry_cb;
     FormatWriterWriteData write_data_cb;
+    FormatWriterCopyData copy_data_cb;
     FormatWriterFinishEntry finish_entry_cb;
     FormatWriterClose close_cb;
     FormatWriterFree free_cb;
@@ -131,6 +137,16 @@ struct MbBiWriter
 
     struct MbBiEntry *entry;
     struct MbBiHeader *header;
+
+    // Streaming output. When enabled, the format writer writes to an in-memory
+    // staging file, which is written to stream_file in one pass when closing.
+    // The image is only written once every entry has been written.
+    bool streaming;
+    bool stream_complete;
+    struct MbFile *stream_file;
+    bool stream_file_owned;
+    void *stream_buf;
+    size_t stream_buf_size;
 };
 
 int _mb_bi_writer_register_format(struct MbBiWriter *biw,
@@ -143,6 +159,7 @@ int _mb_bi_writer_register_format(struct MbBiWriter *biw,
                                   FormatWriterGetEntry get_entry_cb,
                                   FormatWriterWriteEntry write_entry_cb,
                                   FormatWriterWriteData write_data_cb,
+                                  FormatWriterCopyData copy_data_cb,
                                   FormatWriterFinishEntry finish_entry_cb,
                                   FormatWriterClose close_cb,
                                   FormatWriterFree free_cb);
@@ -150,4 +167,12 @@ int _mb_bi_writer_register_format(struct MbBiWriter *biw,
 int _mb_bi_writer_free_format(struct MbBiWriter *biw,
                               struct FormatWriter *format);
 
+typedef int (*MbBiWriterVisitFileDataCb)(const void *buf, size_t size,
+                                         void *userdata);
+
+int _mb_bi_writer_visit_file_data(struct MbBiWriter *biw, struct MbFile *src,
+                                  uint64_t offset, uint64_t size,
+                                  MbBiWriterVisitFileDataCb cb,
+                                  void *userdata);
+
 MB_END_C_DECLS
@@ -72,9 +72,11 @@ int find_android_header(MbBiReader *bir, MbFile *file,
                         AndroidHeader *header_out, uint64_t *offset_out)
 {
     unsigned char buf[ANDROID_MAX_HEADER_OFFSET + sizeof(AndroidHeader)];
+    const unsigned char *data;
+    const void *peek_data;
     size_t n;
     int ret;
-    void *ptr;
+    const void *ptr;
     size_t offset;
 
     if (max_header_offset > ANDROID_MAX_HEADER_OFFSET) {
@@ -85,24 +87,38 @@ int find_android_header(MbBiReader *bir, MbFile *file,
         return MB_BI_WARN;
     }
 
-    ret = mb_file_seek(file, 0, SEEK_SET, nullptr);
-    if (ret != MB_FILE_OK) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Failed to seek to beginning: %s",
-                               mb_file_error_string(file));
-        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-    }
+    // Scan the data in place if possible
+    ret = mb_file_peek(file, 0, max_header_offset + sizeof(AndroidHeader),
+                       &peek_data, &n);
+    if (ret == MB_FILE_OK) {
+        data = static_cast<const unsigned char *>(peek_data);
+    } else if (ret == MB_FILE_UNSUPPORTED) {
+        ret = mb_file_seek(file, 0, SEEK_SET, nullptr);
+        if (ret != MB_FILE_OK) {
+            mb_bi_reader_set_error(bir, mb_file_error(file),
+                                   "Failed to seek to beginning: %s",
+                                   mb_file_error_string(file));
+            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+        }
 
-    ret = mb_file_read_fully(
-            file, buf, max_header_offset + sizeof(AndroidHeader), &n);
-    if (ret != MB_FILE_OK) {
+        ret = mb_file_read_fully(
+                file, buf, max_header_offset + sizeof(AndroidHeader), &n);
+        if (ret != MB_FILE_OK) {
+            mb_bi_reader_set_error(bir, mb_file_error(file),
+                                   "Failed to read header: %s",
+                                   mb_file_error_string(file));
+            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+        }
+
+        data = buf;
+    } else {
         mb_bi_reader_set_error(bir, mb_file_error(file),
                                "Failed to read header: %s",
                                mb_file_error_string(file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
     }
 
-    ptr = mb_memmem(buf, n, ANDROID_BOOT_MAGIC, ANDROID_BOOT_MAGIC_SIZE);
+    ptr = mb_memmem(data, n, ANDROID_BOOT_MAGIC, ANDROID_BOOT_MAGIC_SIZE);
     if (!ptr) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
                                "Android magic not found in first %d bytes",
@@ -110,7 +126,7 @@ int find_android_header(MbBiReader *bir, MbFile *file,
         return MB_BI_WARN;
     }
 
-    offset = static_cast<unsigned char *>(ptr) - buf;
+    offset = static_cast<const unsigned char *>(ptr) - data;
 
     if (n - offset < sizeof(AndroidHeader)) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
@@ -554,6 +570,26 @@ int android_reader_read_data(MbBiReader *bir, void *userdata,
                                      bytes_read, bir);
 }
 
+int android_reader_read_data_range(MbBiReader *bir, void *userdata,
+                                   uint64_t size, uint64_t *offset_out,
+                                   uint64_t *size_out)
+{
+    AndroidReaderCtx *const ctx = static_cast<AndroidReaderCtx *>(userdata);
+
+    return _segment_reader_read_data_range(&ctx->segctx, bir->file, size,
+                                           offset_out, size_out, bir);
+}
+
+int android_reader_get_entry_table(MbBiReader *bir, void *userdata,
+                                   MbBiEntryInfo *table,
+                                   size_t table_size, size_t *count)
+{
+    AndroidReaderCtx *const ctx = static_cast<AndroidReaderCtx *>(userdata);
+
+    return _segment_reader_get_entry_table(&ctx->segctx, table, table_size,
+                                           count, bir);
+}
+
 int android_reader_free(MbBiReader *bir, void *userdata)
 {
     (void) bir;
@@ -599,6 +635,8 @@ int mb_bi_reader_enable_format_android(MbBiReader *bir)
                                          &android_reader_read_entry,
                                          &android_reader_go_to_entry,
                                          &android_reader_read_data,
+                                         &android_reader_read_data_range,
+                                         &android_reader_get_entry_table,
                                          &android_reader_free);
 }
 
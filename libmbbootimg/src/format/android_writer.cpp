@@ -177,6 +177,13 @@ int android_writer_write_entry(MbBiWriter *biw, void *userdata,
     return _segment_writer_write_entry(&ctx->segctx, biw->file, entry, biw);
 }
 
+static int sha1_update_cb(const void *buf, size_t size, void *userdata)
+{
+    SHA_CTX *sha_ctx = static_cast<SHA_CTX *>(userdata);
+
+    return SHA1_Update(sha_ctx, buf, size) ? MB_BI_OK : MB_BI_FAILED;
+}
+
 int android_writer_write_data(MbBiWriter *biw, void *userdata,
                               const void *buf, size_t buf_size,
                               size_t *bytes_written)
@@ -203,6 +210,34 @@ int android_writer_write_data(MbBiWriter *biw, void *userdata,
     return MB_BI_OK;
 }
 
+int android_writer_copy_data(MbBiWriter *biw, void *userdata,
+                             MbFile *src, uint64_t src_offset,
+                             uint64_t size, uint64_t *bytes_copied)
+{
+    AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(userdata);
+    int ret;
+
+    ret = _segment_writer_copy_data(&ctx->segctx, biw->file, src, src_offset,
+                                    size, bytes_copied, biw);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    // Same as android_writer_write_data(), but the data has to be read back
+    // from the source file for the hash
+    ret = _mb_bi_writer_visit_file_data(biw, src, src_offset, size,
+                                        &sha1_update_cb, &ctx->sha_ctx);
+    if (ret != MB_BI_OK) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Failed to update SHA1 hash");
+        // This must be fatal as the copy already happened and cannot be
+        // reattempted
+        return MB_BI_FATAL;
+    }
+
+    return MB_BI_OK;
+}
+
 int android_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     AndroidWriterCtx *const ctx = static_cast<AndroidWriterCtx *>(userdata);
@@ -277,25 +312,20 @@ int android_writer_close(MbBiWriter *biw, void *userdata)
     // If successful, finish up the boot image
     if (!swentry) {
         // Write bump magic if we're outputting a bump'd image. Otherwise, write
-        // the Samsung SEAndroid magic.
+        // the Samsung SEAndroid magic. The last entry's padding is written
+        // along with it.
         if (ctx->is_bump) {
-            ret = mb_file_write_fully(biw->file, BUMP_MAGIC,
-                                      BUMP_MAGIC_SIZE, &n);
-            if (ret != MB_FILE_OK || n != BUMP_MAGIC_SIZE) {
-                mb_bi_writer_set_error(biw, mb_file_error(biw->file),
-                                       "Failed to write Bump magic: %s",
-                                       mb_file_error_string(biw->file));
-                return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-            }
+            ret = _segment_writer_write_padded(&ctx->segctx, biw->file,
+                                               BUMP_MAGIC, BUMP_MAGIC_SIZE,
+                                               biw);
         } else {
-            ret = mb_file_write_fully(biw->file, SAMSUNG_SEANDROID_MAGIC,
-                                      SAMSUNG_SEANDROID_MAGIC_SIZE, &n);
-            if (ret != MB_FILE_OK || n != SAMSUNG_SEANDROID_MAGIC_SIZE) {
-                mb_bi_writer_set_error(biw, mb_file_error(biw->file),
-                                       "Failed to write SEAndroid magic: %s",
-                                       mb_file_error_string(biw->file));
-                return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-            }
+            ret = _segment_writer_write_padded(&ctx->segctx, biw->file,
+                                               SAMSUNG_SEANDROID_MAGIC,
+                                               SAMSUNG_SEANDROID_MAGIC_SIZE,
+                                               biw);
+        }
+        if (ret != MB_BI_OK) {
+            return ret;
         }
 
         // Set ID
@@ -382,6 +412,7 @@ int mb_bi_writer_set_format_android(MbBiWriter *biw)
                                          &android_writer_get_entry,
                                          &android_writer_write_entry,
                                          &android_writer_write_data,
+                                         &android_writer_copy_data,
                                          &android_writer_finish_entry,
                                          &android_writer_close,
                                          &android_writer_free);
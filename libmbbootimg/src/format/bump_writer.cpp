@@ -69,6 +69,7 @@ int mb_bi_writer_set_format_bump(MbBiWriter *biw)
                                          &android_writer_get_entry,
                                          &android_writer_write_entry,
                                          &android_writer_write_data,
+                                         &android_writer_copy_data,
                                          &android_writer_finish_entry,
                                          &android_writer_close,
                                          &android_writer_free);
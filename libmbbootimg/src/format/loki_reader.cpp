@@ -70,15 +70,8 @@ int find_loki_header(MbBiReader *bir, MbFile *file,
     size_t n;
     int ret;
 
-    ret = mb_file_seek(file, LOKI_MAGIC_OFFSET, SEEK_SET, nullptr);
-    if (ret < 0) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Loki magic not found: %s",
-                               mb_file_error_string(file));
-        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_WARN;
-    }
-
-    ret = mb_file_read_fully(file, &header, sizeof(header), &n);
+    ret = mb_file_pread_fully(file, &header, sizeof(header),
+                              LOKI_MAGIC_OFFSET, &n);
     if (ret < 0) {
         mb_bi_reader_set_error(bir, mb_file_error(file),
                                "Failed to read header: %s",
@@ -103,6 +96,120 @@ int find_loki_header(MbBiReader *bir, MbFile *file,
     return MB_BI_OK;
 }
 
+// gzip header:
+// byte 0-1 : magic bytes 0x1f, 0x8b
+// byte 2   : compression (0x08 = deflate)
+// byte 3   : flags
+// byte 4-7 : modification timestamp
+// byte 8   : compression flags
+// byte 9   : operating system
+
+static const unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
+
+struct GzipSearchResult
+{
+    bool have_flag0;
+    bool have_flag8;
+    uint64_t flag0_offset;
+    uint64_t flag8_offset;
+};
+
+/*!
+ * \brief Record gzip header match if its flags byte is `0x00` or `0x08`
+ *
+ * \return
+ *   * #MB_FILE_OK if the search should continue
+ *   * #MB_FILE_WARN if EOF was reached while reading the flags byte
+ *   * \<= #MB_FILE_FAILED if the flags byte could not be read
+ */
+static int loki_record_gzip_match(MbFile *file, GzipSearchResult *result,
+                                  uint64_t offset)
+{
+    unsigned char flags;
+    size_t n;
+    int ret;
+
+    // Read flags byte without disturbing the search's file position
+    ret = mb_file_pread_fully(file, &flags, sizeof(flags), offset + 3, &n);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    } else if (n != sizeof(flags)) {
+        // EOF
+        return MB_FILE_WARN;
+    }
+
+    if (!result->have_flag0 && flags == 0x00) {
+        result->have_flag0 = true;
+        result->flag0_offset = offset;
+    } else if (!result->have_flag8 && flags == 0x08) {
+        result->have_flag8 = true;
+        result->flag8_offset = offset;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int loki_pick_gzip_offset(MbBiReader *bir,
+                                 const GzipSearchResult *result,
+                                 uint64_t *gzip_offset_out)
+{
+    // Prefer gzip header with original filename flag since most loki'd boot
+    // images will have been compressed manually with the gzip tool
+    if (result->have_flag8) {
+        *gzip_offset_out = result->flag8_offset;
+    } else if (result->have_flag0) {
+        *gzip_offset_out = result->flag0_offset;
+    } else {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                               "No gzip headers found");
+        return MB_BI_WARN;
+    }
+
+    return MB_BI_OK;
+}
+
+static int loki_read_shellcode_ramdisk_address(MbBiReader *bir, MbFile *file,
+                                               uint64_t shellcode_offset,
+                                               uint32_t *ramdisk_addr_out)
+{
+    uint32_t ramdisk_addr;
+    size_t n;
+    int ret;
+
+    ret = mb_file_pread_fully(file, &ramdisk_addr, sizeof(ramdisk_addr),
+                              shellcode_offset + LOKI_SHELLCODE_SIZE - 5, &n);
+    if (ret < 0) {
+        mb_bi_reader_set_error(bir, mb_file_error(file),
+                               "Failed to read ramdisk address offset: %s",
+                               mb_file_error_string(file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    } else if (n != sizeof(ramdisk_addr)) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                               "Unexpected EOF when reading ramdisk address");
+        return MB_BI_WARN;
+    }
+
+    *ramdisk_addr_out = mb_le32toh(ramdisk_addr);
+    return MB_BI_OK;
+}
+
+static int loki_default_ramdisk_address(MbBiReader *bir,
+                                        const AndroidHeader *hdr,
+                                        uint32_t *ramdisk_addr_out)
+{
+    // Use the default for jflte (- 0x00008000 + 0x02000000)
+
+    if (hdr->kernel_addr > UINT32_MAX - 0x01ff8000) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                               "Invalid kernel address: %" PRIu32,
+                               hdr->kernel_addr);
+        return MB_BI_WARN;
+    }
+
+    *ramdisk_addr_out = hdr->kernel_addr + 0x01ff8000;
+    return MB_BI_OK;
+}
+
 /*!
  * \brief Find and read Loki ramdisk address
  *
@@ -130,12 +237,9 @@ int loki_find_ramdisk_address(MbBiReader *bir, MbFile *file,
 {
     // If the boot image was patched with a newer version of loki, find the
     // ramdisk offset in the shell code
-    uint32_t ramdisk_addr = 0;
-    int ret;
-    size_t n;
-
     if (loki_hdr->ramdisk_addr != 0) {
         uint64_t offset = 0;
+        int ret;
 
         auto result_cb = [](MbFile *file, void *userdata,
                             uint64_t offset) -> int {
@@ -160,45 +264,12 @@ int loki_find_ramdisk_address(MbBiReader *bir, MbFile *file,
             return MB_FILE_WARN;
         }
 
-        offset += LOKI_SHELLCODE_SIZE - 5;
-
-        ret = mb_file_seek(file, offset, SEEK_SET, nullptr);
-        if (ret < 0) {
-            mb_bi_reader_set_error(bir, mb_file_error(file),
-                                   "Failed to seek to ramdisk address offset: %s",
-                                   mb_file_error_string(file));
-            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-        }
-
-        ret = mb_file_read_fully(file, &ramdisk_addr,
-                                 sizeof(ramdisk_addr), &n);
-        if (ret < 0) {
-            mb_bi_reader_set_error(bir, mb_file_error(file),
-                                   "Failed to read ramdisk address offset: %s",
-                                   mb_file_error_string(file));
-            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-        } else if (n != sizeof(ramdisk_addr)) {
-            mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
-                                   "Unexpected EOF when reading ramdisk address");
-            return MB_BI_WARN;
-        }
-
-        ramdisk_addr = mb_le32toh(ramdisk_addr);
+        return loki_read_shellcode_ramdisk_address(bir, file, offset,
+                                                   ramdisk_addr_out);
     } else {
-        // Otherwise, use the default for jflte (- 0x00008000 + 0x02000000)
-
-        if (hdr->kernel_addr > UINT32_MAX - 0x01ff8000) {
-            mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
-                                   "Invalid kernel address: %" PRIu32,
-                                   hdr->kernel_addr);
-            return MB_BI_WARN;
-        }
-
-        ramdisk_addr = hdr->kernel_addr + 0x01ff8000;
+        // Otherwise, use the default for jflte
+        return loki_default_ramdisk_address(bir, hdr, ramdisk_addr_out);
     }
-
-    *ramdisk_addr_out = ramdisk_addr;
-    return MB_BI_OK;
 }
 
 /*!
@@ -229,100 +300,151 @@ int loki_find_ramdisk_address(MbBiReader *bir, MbFile *file,
 int loki_old_find_gzip_offset(MbBiReader *bir, MbFile *file,
                               uint32_t start_offset, uint64_t *gzip_offset_out)
 {
-    struct SearchResult
-    {
-        bool have_flag0 = false;
-        bool have_flag8 = false;
-        uint64_t flag0_offset;
-        uint64_t flag8_offset;
-    };
-
-    // gzip header:
-    // byte 0-1 : magic bytes 0x1f, 0x8b
-    // byte 2   : compression (0x08 = deflate)
-    // byte 3   : flags
-    // byte 4-7 : modification timestamp
-    // byte 8   : compression flags
-    // byte 9   : operating system
-
-    static const unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
-
-    SearchResult result = {};
+    GzipSearchResult result = {};
     int ret;
 
     // Find first result with flags == 0x00 and flags == 0x08
     auto result_cb = [](MbFile *file, void *userdata, uint64_t offset) -> int {
-        SearchResult *result = static_cast<SearchResult *>(userdata);
-        uint64_t orig_offset;
-        unsigned char flags;
-        size_t n;
-        int ret;
+        GzipSearchResult *result = static_cast<GzipSearchResult *>(userdata);
 
         // Stop early if possible
         if (result->have_flag0 && result->have_flag8) {
             return MB_FILE_WARN;
         }
 
-        // Save original position
-        ret = mb_file_seek(file, 0, SEEK_CUR, &orig_offset);
-        if (ret != MB_FILE_OK) {
-            return ret;
-        }
+        return loki_record_gzip_match(file, result, offset);
+    };
 
-        // Seek to flags byte
-        ret = mb_file_seek(file, offset + 3, SEEK_SET, nullptr);
-        if (ret != MB_FILE_OK) {
-            return ret;
-        }
+    ret = mb_file_search(file, start_offset, -1, 0, gzip_deflate_magic,
+                         sizeof(gzip_deflate_magic), -1, result_cb, &result);
+    if (ret < 0) {
+        mb_bi_reader_set_error(bir, mb_file_error(file),
+                               "Failed to search for gzip magic: %s",
+                               mb_file_error_string(file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    }
 
-        // Read next bytes for flags
-        ret = mb_file_read_fully(file, &flags, sizeof(flags), &n);
-        if (ret != MB_FILE_OK) {
-            return ret;
-        } else if (n != sizeof(flags)) {
-            // EOF
-            return MB_FILE_WARN;
-        }
+    return loki_pick_gzip_offset(bir, &result, gzip_offset_out);
+}
 
-        if (!result->have_flag0 && flags == 0x00) {
-            result->have_flag0 = true;
-            result->flag0_offset = offset;
-        } else if (!result->have_flag8 && flags == 0x08) {
-            result->have_flag8 = true;
-            result->flag8_offset = offset;
+/*!
+ * \brief Find gzip ramdisk offset and ramdisk address in old-style Loki image
+ *
+ * This is equivalent to calling loki_old_find_gzip_offset() followed by
+ * loki_find_ramdisk_address(), except that the gzip headers and the Loki
+ * shellcode are located with a single pass over the file.
+ *
+ * \pre The file position can be at any offset prior to calling this function.
+ *
+ * \post The file pointer position is undefined after this function returns.
+ *       Use mb_file_seek() to return to a known position.
+ *
+ * \param[in] bir MbBiReader to set error message
+ * \param[in] file MbFile handle
+ * \param[in] hdr Android header
+ * \param[in] loki_hdr Loki header
+ * \param[in] start_offset Starting offset for gzip header search
+ * \param[out] gzip_offset_out Pointer to store gzip ramdisk offset
+ * \param[out] ramdisk_addr_out Pointer to store ramdisk address
+ *
+ * \return
+ *   * #MB_BI_OK if both the gzip offset and ramdisk address are found
+ *   * #MB_BI_WARN if either the gzip offset or ramdisk address is not found
+ *   * #MB_BI_FAILED if any file operation fails non-fatally
+ *   * #MB_BI_FATAL if any file operation fails fatally
+ */
+int loki_old_find_gzip_offset_and_ramdisk_address(MbBiReader *bir,
+                                                  MbFile *file,
+                                                  const AndroidHeader *hdr,
+                                                  const LokiHeader *loki_hdr,
+                                                  uint64_t start_offset,
+                                                  uint64_t *gzip_offset_out,
+                                                  uint32_t *ramdisk_addr_out)
+{
+    struct SearchResult
+    {
+        GzipSearchResult gzip;
+        uint64_t gzip_start;
+        bool gzip_done;
+        bool want_shellcode;
+        bool have_shellcode;
+        uint64_t shellcode_offset;
+    };
+
+    static const void * const patterns[] = {
+        gzip_deflate_magic,
+        LOKI_SHELLCODE,
+    };
+    static const size_t pattern_sizes[] = {
+        sizeof(gzip_deflate_magic),
+        LOKI_SHELLCODE_SIZE - 9,
+    };
+
+    SearchResult result = {};
+    int ret;
+
+    result.gzip_start = start_offset;
+    result.want_shellcode = loki_hdr->ramdisk_addr != 0;
+
+    auto result_cb = [](MbFile *file, void *userdata, size_t pattern_id,
+                        uint64_t offset) -> int {
+        SearchResult *result = static_cast<SearchResult *>(userdata);
+
+        if (pattern_id == 0) {
+            if (!result->gzip_done && offset >= result->gzip_start) {
+                int ret = loki_record_gzip_match(file, &result->gzip, offset);
+                if (ret < 0) {
+                    return ret;
+                } else if (ret == MB_FILE_WARN || (result->gzip.have_flag0
+                        && result->gzip.have_flag8)) {
+                    result->gzip_done = true;
+                }
+            }
+        } else if (!result->have_shellcode) {
+            result->have_shellcode = true;
+            result->shellcode_offset = offset;
         }
 
-        // Restore original position as per contract
-        ret = mb_file_seek(file, orig_offset, SEEK_SET, nullptr);
-        if (ret != MB_FILE_OK) {
-            return ret;
+        // Stop once nothing else is needed
+        if (result->gzip_done
+                && (!result->want_shellcode || result->have_shellcode)) {
+            return MB_FILE_WARN;
         }
 
         return MB_FILE_OK;
     };
 
-    ret = mb_file_search(file, start_offset, -1, 0, gzip_deflate_magic,
-                         sizeof(gzip_deflate_magic), -1, result_cb, &result);
+    // The shellcode can appear anywhere in the file, so only narrow the search
+    // range if it's not needed
+    ret = mb_file_search_multi(file,
+                               result.want_shellcode
+                                       ? 0 : static_cast<int64_t>(start_offset),
+                               -1, 0, patterns, pattern_sizes,
+                               result.want_shellcode ? 2 : 1, -1,
+                               result_cb, &result);
     if (ret < 0) {
         mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Failed to search for gzip magic: %s",
-                               mb_file_error_string(file));
+                               "Failed to search for gzip magic and Loki "
+                               "shellcode: %s", mb_file_error_string(file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
     }
 
-    // Prefer gzip header with original filename flag since most loki'd boot
-    // images will have been compressed manually with the gzip tool
-    if (result.have_flag8) {
-        *gzip_offset_out = result.flag8_offset;
-    } else if (result.have_flag0) {
-        *gzip_offset_out = result.flag0_offset;
-    } else {
+    ret = loki_pick_gzip_offset(bir, &result.gzip, gzip_offset_out);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    if (!result.want_shellcode) {
+        return loki_default_ramdisk_address(bir, hdr, ramdisk_addr_out);
+    } else if (!result.have_shellcode) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
-                               "No gzip headers found");
+                               "Loki shellcode not found");
         return MB_BI_WARN;
     }
 
-    return MB_BI_OK;
+    return loki_read_shellcode_ramdisk_address(bir, file,
+                                               result.shellcode_offset,
+                                               ramdisk_addr_out);
 }
 
 /*!
@@ -463,15 +585,8 @@ int find_linux_kernel_size(MbBiReader *bir, MbFile *file,
     // shellcode). The size is stored in the kernel image's header though, so
     // we'll use that.
     // http://www.simtec.co.uk/products/SWLINUX/files/booting_article.html#d0e309
-    ret = mb_file_seek(file, kernel_offset + 0x2c, SEEK_SET, nullptr);
-    if (ret != MB_FILE_OK) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Failed to seek to kernel header: %s",
-                               mb_file_error_string(file));
-        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-    }
-
-    ret = mb_file_read_fully(file, &kernel_size, sizeof(kernel_size), &n);
+    ret = mb_file_pread_fully(file, &kernel_size, sizeof(kernel_size),
+                              kernel_offset + 0x2c, &n);
     if (ret != MB_FILE_OK) {
         mb_bi_reader_set_error(bir, mb_file_error(file),
                                "Failed to read size from kernel header: %s",
@@ -538,11 +653,12 @@ int loki_read_old_header(MbBiReader *bir, MbFile *file,
         return ret;
     }
 
-    // Look for gzip offset for the ramdisk
-    ret = loki_old_find_gzip_offset(
-            bir, file, hdr->page_size + kernel_size
+    // Look for gzip offset for the ramdisk and guess the original ramdisk
+    // address in the same pass over the file
+    ret = loki_old_find_gzip_offset_and_ramdisk_address(
+            bir, file, hdr, loki_hdr, hdr->page_size + kernel_size
             + align_page_size<uint64_t>(kernel_size, hdr->page_size),
-            &gzip_offset);
+            &gzip_offset, &ramdisk_addr);
     if (ret != MB_BI_OK) {
         return ret;
     }
@@ -554,12 +670,6 @@ int loki_read_old_header(MbBiReader *bir, MbFile *file,
         return ret;
     }
 
-    // Guess original ramdisk address
-    ret = loki_find_ramdisk_address(bir, file, hdr, loki_hdr, &ramdisk_addr);
-    if (ret != MB_BI_OK) {
-        return ret;
-    }
-
     *kernel_size_out = kernel_size;
     *ramdisk_size_out = ramdisk_size;
 
@@ -883,6 +993,26 @@ int loki_reader_read_data(MbBiReader *bir, void *userdata,
                                      bytes_read, bir);
 }
 
+int loki_reader_read_data_range(MbBiReader *bir, void *userdata,
+                                uint64_t size, uint64_t *offset_out,
+                                uint64_t *size_out)
+{
+    LokiReaderCtx *const ctx = static_cast<LokiReaderCtx *>(userdata);
+
+    return _segment_reader_read_data_range(&ctx->segctx, bir->file, size,
+                                           offset_out, size_out, bir);
+}
+
+int loki_reader_get_entry_table(MbBiReader *bir, void *userdata,
+                                MbBiEntryInfo *table,
+                                size_t table_size, size_t *count)
+{
+    LokiReaderCtx *const ctx = static_cast<LokiReaderCtx *>(userdata);
+
+    return _segment_reader_get_entry_table(&ctx->segctx, table, table_size,
+                                           count, bir);
+}
+
 int loki_reader_free(MbBiReader *bir, void *userdata)
 {
     (void) bir;
@@ -925,6 +1055,8 @@ int mb_bi_reader_enable_format_loki(MbBiReader *bir)
                                          &loki_reader_read_entry,
                                          &loki_reader_go_to_entry,
                                          &loki_reader_read_data,
+                                         &loki_reader_read_data_range,
+                                         &loki_reader_get_entry_table,
                                          &loki_reader_free);
 }
 
@@ -180,6 +180,13 @@ int loki_writer_write_entry(MbBiWriter *biw, void *userdata,
     return _segment_writer_write_entry(&ctx->segctx, biw->file, entry, biw);
 }
 
+static int sha1_update_cb(const void *buf, size_t size, void *userdata)
+{
+    SHA_CTX *sha_ctx = static_cast<SHA_CTX *>(userdata);
+
+    return SHA1_Update(sha_ctx, buf, size) ? MB_BI_OK : MB_BI_FAILED;
+}
+
 int loki_writer_write_data(MbBiWriter *biw, void *userdata,
                            const void *buf, size_t buf_size,
                            size_t *bytes_written)
@@ -235,6 +242,74 @@ int loki_writer_write_data(MbBiWriter *biw, void *userdata,
     return MB_BI_OK;
 }
 
+int loki_writer_copy_data(MbBiWriter *biw, void *userdata,
+                          MbFile *src, uint64_t src_offset,
+                          uint64_t size, uint64_t *bytes_copied)
+{
+    LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(userdata);
+    SegmentWriterEntry *swentry;
+    int ret;
+
+    swentry = _segment_writer_entry(&ctx->segctx);
+
+    if (swentry->type == MB_BI_ENTRY_ABOOT) {
+        // aboot is buffered in memory, so there is nothing to gain from
+        // copying it directly
+        if (size > MAX_ABOOT_SIZE - ctx->aboot_size) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "aboot image too large");
+            return MB_BI_FATAL;
+        }
+
+        size_t new_aboot_size = ctx->aboot_size + size;
+        unsigned char *new_aboot;
+        size_t n;
+
+        new_aboot = static_cast<unsigned char *>(
+                realloc(ctx->aboot, new_aboot_size));
+        if (!new_aboot) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Failed to expand aboot buffer");
+            return MB_BI_FAILED;
+        }
+
+        ctx->aboot = new_aboot;
+
+        ret = mb_file_pread_fully(src, new_aboot + ctx->aboot_size, size,
+                                  src_offset, &n);
+        if (ret != MB_FILE_OK || n != size) {
+            mb_bi_writer_set_error(biw, mb_file_error(src),
+                                   "Failed to read aboot data: %s",
+                                   mb_file_error_string(src));
+            return MB_BI_FAILED;
+        }
+
+        ctx->aboot_size = new_aboot_size;
+
+        *bytes_copied = size;
+    } else {
+        ret = _segment_writer_copy_data(&ctx->segctx, biw->file, src,
+                                        src_offset, size, bytes_copied, biw);
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+
+        // Same as loki_writer_write_data(), but the data has to be read back
+        // from the source file for the hash
+        ret = _mb_bi_writer_visit_file_data(biw, src, src_offset, size,
+                                            &sha1_update_cb, &ctx->sha_ctx);
+        if (ret != MB_BI_OK) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                                   "Failed to update SHA1 hash");
+            // This must be fatal as the copy already happened and cannot be
+            // reattempted
+            return MB_BI_FATAL;
+        }
+    }
+
+    return MB_BI_OK;
+}
+
 int loki_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     LokiWriterCtx *const ctx = static_cast<LokiWriterCtx *>(userdata);
@@ -307,6 +382,9 @@ int loki_writer_close(MbBiWriter *biw, void *userdata)
             return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
         }
 
+        // The last entry's padding is not written yet. Truncating to the
+        // full size below fills it in.
+        ctx->file_size += _segment_writer_padding_size(&ctx->segctx);
         ctx->have_file_size = true;
     }
 
@@ -414,6 +492,7 @@ int mb_bi_writer_set_format_loki(MbBiWriter *biw)
                                          &loki_writer_get_entry,
                                          &loki_writer_write_entry,
                                          &loki_writer_write_data,
+                                         &loki_writer_copy_data,
                                          &loki_writer_finish_entry,
                                          &loki_writer_close,
                                          &loki_writer_free);
@@ -68,15 +68,7 @@ int read_mtk_header(MbBiReader *bir, MbFile *file,
     size_t n;
     int ret;
 
-    ret = mb_file_seek(file, offset, SEEK_SET, nullptr);
-    if (ret < 0) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Failed to seek to MTK header at %" PRIu64 ": %s",
-                               offset, mb_file_error_string(file));
-        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-    }
-
-    ret = mb_file_read_fully(file, &mtkhdr, sizeof(mtkhdr), &n);
+    ret = mb_file_pread_fully(file, &mtkhdr, sizeof(mtkhdr), offset, &n);
     if (ret < 0) {
         mb_bi_reader_set_error(bir, mb_file_error(file),
                                "Failed to read MTK header: %s",
@@ -367,6 +359,26 @@ int mtk_reader_read_data(MbBiReader *bir, void *userdata,
                                      bytes_read, bir);
 }
 
+int mtk_reader_read_data_range(MbBiReader *bir, void *userdata,
+                               uint64_t size, uint64_t *offset_out,
+                               uint64_t *size_out)
+{
+    MtkReaderCtx *const ctx = static_cast<MtkReaderCtx *>(userdata);
+
+    return _segment_reader_read_data_range(&ctx->segctx, bir->file, size,
+                                           offset_out, size_out, bir);
+}
+
+int mtk_reader_get_entry_table(MbBiReader *bir, void *userdata,
+                               MbBiEntryInfo *table,
+                               size_t table_size, size_t *count)
+{
+    MtkReaderCtx *const ctx = static_cast<MtkReaderCtx *>(userdata);
+
+    return _segment_reader_get_entry_table(&ctx->segctx, table, table_size,
+                                           count, bir);
+}
+
 int mtk_reader_free(MbBiReader *bir, void *userdata)
 {
     (void) bir;
@@ -409,6 +421,8 @@ int mb_bi_reader_enable_format_mtk(MbBiReader *bir)
                                          &mtk_reader_read_entry,
                                          &mtk_reader_go_to_entry,
                                          &mtk_reader_read_data,
+                                         &mtk_reader_read_data_range,
+                                         &mtk_reader_get_entry_table,
                                          &mtk_reader_free);
 }
 
@@ -332,6 +332,16 @@ int mtk_writer_write_data(MbBiWriter *biw, void *userdata,
                                       bytes_written, biw);
 }
 
+int mtk_writer_copy_data(MbBiWriter *biw, void *userdata,
+                         MbFile *src, uint64_t src_offset,
+                         uint64_t size, uint64_t *bytes_copied)
+{
+    MtkWriterCtx *const ctx = static_cast<MtkWriterCtx *>(userdata);
+
+    return _segment_writer_copy_data(&ctx->segctx, biw->file, src, src_offset,
+                                     size, bytes_copied, biw);
+}
+
 int mtk_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     MtkWriterCtx *const ctx = static_cast<MtkWriterCtx *>(userdata);
@@ -393,6 +403,9 @@ int mtk_writer_close(MbBiWriter *biw, void *userdata)
             return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
         }
 
+        // The last entry's padding is not written yet. Truncating to the
+        // full size below fills it in.
+        ctx->file_size += _segment_writer_padding_size(&ctx->segctx);
         ctx->have_file_size = true;
     }
 
@@ -511,6 +524,7 @@ int mb_bi_writer_set_format_mtk(MbBiWriter *biw)
                                          &mtk_writer_get_entry,
                                          &mtk_writer_write_entry,
                                          &mtk_writer_write_data,
+                                         &mtk_writer_copy_data,
                                          &mtk_writer_finish_entry,
                                          &mtk_writer_close,
                                          &mtk_writer_free);
@@ -239,3 +239,73 @@ int _segment_reader_read_data(SegmentReaderCtx *ctx, MbFile *file,
 
     return *bytes_read == 0 ? MB_BI_EOF : MB_BI_OK;
 }
+
+int _segment_reader_read_data_range(SegmentReaderCtx *ctx, MbFile *file,
+                                    uint64_t size, uint64_t *offset_out,
+                                    uint64_t *size_out, MbBiReader *bir)
+{
+    uint64_t end_offset = ctx->read_end_offset;
+    int ret;
+
+    // The data is allowed to end early, so clamp the range to the file size
+    if (ctx->entry->can_truncate) {
+        uint64_t file_size;
+
+        ret = mb_file_seek(file, 0, SEEK_END, &file_size);
+        if (ret < 0) {
+            mb_bi_reader_set_error(bir, mb_file_error(file),
+                                   "Failed to seek file: %s",
+                                   mb_file_error_string(file));
+            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+        }
+
+        end_offset = std::max(std::min(end_offset, file_size),
+                              ctx->read_cur_offset);
+    }
+
+    uint64_t to_consume = std::min<uint64_t>(
+            size, end_offset - ctx->read_cur_offset);
+
+    if (to_consume == 0) {
+        return MB_BI_EOF;
+    }
+
+    // Keep the file position in sync so that reads can continue afterwards
+    ret = mb_file_seek(file, ctx->read_cur_offset + to_consume, SEEK_SET,
+                       nullptr);
+    if (ret < 0) {
+        mb_bi_reader_set_error(bir, mb_file_error(file),
+                               "Failed to seek file: %s",
+                               mb_file_error_string(file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    }
+
+    *offset_out = ctx->read_cur_offset;
+    *size_out = to_consume;
+    ctx->read_cur_offset += to_consume;
+
+    return MB_BI_OK;
+}
+
+int _segment_reader_get_entry_table(SegmentReaderCtx *ctx,
+                                    MbBiEntryInfo *table, size_t table_size,
+                                    size_t *count, MbBiReader *bir)
+{
+    if (ctx->entries_len > table_size) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
+                               "Too many entries for entry table");
+        return MB_BI_FAILED;
+    }
+
+    for (size_t i = 0; i < ctx->entries_len; ++i) {
+        table[i].type = ctx->entries[i].type;
+        table[i].offset = ctx->entries[i].offset;
+        table[i].size = ctx->entries[i].size;
+        table[i].can_truncate = ctx->entries[i].can_truncate;
+        table[i].compression = MB_BI_COMPRESSION_UNKNOWN;
+    }
+
+    *count = ctx->entries_len;
+
+    return MB_BI_OK;
+}
@@ -212,23 +212,58 @@ int _segment_writer_write_data(SegmentWriterCtx *ctx, MbFile *file,
         return MB_BI_FAILED;
     }
 
-    ret = mb_file_write_fully(file, buf, buf_size, bytes_written);
-    if (ret != MB_FILE_OK) {
+    ret = _segment_writer_write_padded(ctx, file, buf, buf_size, biw);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    *bytes_written = buf_size;
+    ctx->entry_size += buf_size;
+    ctx->pos += buf_size;
+
+    return MB_BI_OK;
+}
+
+int _segment_writer_copy_data(SegmentWriterCtx *ctx, MbFile *file,
+                              MbFile *src, uint64_t src_offset,
+                              uint64_t size, uint64_t *bytes_copied,
+                              MbBiWriter *biw)
+{
+    uint64_t n;
+    int ret;
+
+    // Check for overflow
+    if (size > UINT32_MAX || ctx->entry_size > UINT32_MAX - size
+            || ctx->pos > UINT64_MAX - size) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INVALID_ARGUMENT,
+                               "Overflow in entry size");
+        return MB_BI_FAILED;
+    }
+
+    // Flush pending padding first since the copy goes directly to the file
+    ret = _segment_writer_write_padded(ctx, file, nullptr, 0, biw);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    ret = mb_file_copy_from(file, src, src_offset, size, &n);
+    if (ret != MB_FILE_OK && n == 0) {
         mb_bi_writer_set_error(biw, mb_file_error(file),
-                               "Failed to write data: %s",
+                               "Failed to copy data: %s",
                                mb_file_error_string(file));
         return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-    } else if (*bytes_written != buf_size) {
+    } else if (n != size) {
         mb_bi_writer_set_error(biw, mb_file_error(file),
-                               "Write was truncated: %s",
+                               "Copy was truncated: %s",
                                mb_file_error_string(file));
-        // This is a fatal error. We must guarantee that buf_size bytes will be
+        // This is a fatal error. We must guarantee that size bytes will be
         // written.
         return MB_BI_FATAL;
     }
 
-    ctx->entry_size += buf_size;
-    ctx->pos += buf_size;
+    *bytes_copied = size;
+    ctx->entry_size += size;
+    ctx->pos += size;
 
     return MB_BI_OK;
 }
@@ -236,25 +271,105 @@ int _segment_writer_write_data(SegmentWriterCtx *ctx, MbFile *file,
 int _segment_writer_finish_entry(SegmentWriterCtx *ctx, MbFile *file,
                                  MbBiWriter *biw)
 {
-    int ret;
+    (void) file;
 
     // Update size with number of bytes written
     _segment_writer_update_size_if_unset(ctx, ctx->entry_size);
 
-    // Finish previous entry by aligning to page
+    // Finish previous entry by aligning to page. The padding is written
+    // together with whatever comes next.
     if (ctx->entry->align > 0) {
         uint64_t skip = align_page_size<uint64_t>(ctx->pos, ctx->entry->align);
-        uint64_t new_pos;
 
-        ret = mb_file_seek(file, skip, SEEK_CUR, &new_pos);
-        if (ret != MB_FILE_OK) {
+        if (ctx->pos > UINT64_MAX - skip) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_INVALID_ARGUMENT,
+                                   "Overflow in padding size");
+            return MB_BI_FAILED;
+        }
+
+        ctx->pad_size += skip;
+        ctx->pos += skip;
+    }
+
+    return MB_BI_OK;
+}
+
+uint64_t _segment_writer_padding_size(SegmentWriterCtx *ctx)
+{
+    return ctx->pad_size;
+}
+
+/*!
+ * \brief Write pending padding followed by \p buf
+ *
+ * The padding and the data are submitted with a single vectored write (unless
+ * the padding is unusually large). Unlike _segment_writer_write_data(), this
+ * does not count towards the current entry.
+ *
+ * \return
+ *   * #MB_BI_OK if the padding and all of \p buf were written
+ *   * #MB_BI_FAILED if nothing was written and the operation can be retried
+ *   * #MB_BI_FATAL if the data was partially written
+ */
+int _segment_writer_write_padded(SegmentWriterCtx *ctx, MbFile *file,
+                                 const void *buf, size_t buf_size,
+                                 MbBiWriter *biw)
+{
+    static const unsigned char zeros[4096] = {};
+    MbFileIoVec iov[SEGMENT_WRITER_MAX_PAD_IOVS + 1];
+    size_t n;
+    int ret;
+
+    while (true) {
+        uint64_t pad_remain = ctx->pad_size;
+        size_t iov_count = 0;
+        size_t total = 0;
+
+        while (pad_remain > 0 && iov_count < SEGMENT_WRITER_MAX_PAD_IOVS) {
+            size_t to_write = std::min<uint64_t>(pad_remain, sizeof(zeros));
+
+            iov[iov_count].base = const_cast<unsigned char *>(zeros);
+            iov[iov_count].size = to_write;
+            ++iov_count;
+
+            pad_remain -= to_write;
+            total += to_write;
+        }
+
+        bool last = pad_remain == 0;
+
+        if (last && buf_size > 0) {
+            iov[iov_count].base = const_cast<void *>(buf);
+            iov[iov_count].size = buf_size;
+            ++iov_count;
+
+            total += buf_size;
+        }
+
+        if (iov_count == 0) {
+            break;
+        }
+
+        ret = mb_file_writev_fully(file, iov, iov_count, &n);
+        if (ret != MB_FILE_OK && n == 0) {
             mb_bi_writer_set_error(biw, mb_file_error(file),
-                                   "Failed to seek to page boundary: %s",
+                                   "Failed to write data: %s",
                                    mb_file_error_string(file));
-            return ret == MB_BI_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+        } else if (n != total) {
+            mb_bi_writer_set_error(biw, mb_file_error(file),
+                                   "Write was truncated: %s",
+                                   mb_file_error_string(file));
+            // This is a fatal error. We must guarantee that buf_size bytes will
+            // be written.
+            return MB_BI_FATAL;
         }
 
-        ctx->pos = new_pos;
+        ctx->pad_size = pad_remain;
+
+        if (last) {
+            break;
+        }
     }
 
     return MB_BI_OK;
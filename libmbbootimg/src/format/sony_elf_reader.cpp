@@ -69,15 +69,7 @@ int find_sony_elf_header(MbBiReader *bir, MbFile *file,
     size_t n;
     int ret;
 
-    ret = mb_file_seek(file, 0, SEEK_SET, nullptr);
-    if (ret != MB_FILE_OK) {
-        mb_bi_reader_set_error(bir, mb_file_error(file),
-                               "Failed to seek to beginning: %s",
-                               mb_file_error_string(file));
-        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-    }
-
-    ret = mb_file_read_fully(file, &header, sizeof(header), &n);
+    ret = mb_file_pread_fully(file, &header, sizeof(header), 0, &n);
     if (ret != MB_FILE_OK) {
         mb_bi_reader_set_error(bir, mb_file_error(file),
                                "Failed to read header: %s",
@@ -177,16 +169,7 @@ int sony_elf_reader_read_header(MbBiReader *bir, void *userdata,
         Sony_Elf32_Phdr phdr;
         size_t n;
 
-        ret = mb_file_seek(bir->file, pos, SEEK_SET, nullptr);
-        if (ret < 0) {
-            mb_bi_reader_set_error(bir, mb_file_error(bir->file),
-                                   "Failed to seek to segment %" PRIu16
-                                   " at %" PRIu64 ": %s", i, pos,
-                                   mb_file_error_string(bir->file));
-            return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-        }
-
-        ret = mb_file_read_fully(bir->file, &phdr, sizeof(phdr), &n);
+        ret = mb_file_pread_fully(bir->file, &phdr, sizeof(phdr), pos, &n);
         if (ret < 0) {
             mb_bi_reader_set_error(bir, mb_file_error(bir->file),
                                    "Failed to read segment %" PRIu16 ": %s",
@@ -215,15 +198,8 @@ int sony_elf_reader_read_header(MbBiReader *bir, void *userdata,
                 return MB_BI_WARN;
             }
 
-            ret = mb_file_seek(bir->file, phdr.p_offset, SEEK_SET, nullptr);
-            if (ret < 0) {
-                mb_bi_reader_set_error(bir, mb_file_error(bir->file),
-                                       "Failed to seek to cmdline: %s",
-                                       mb_file_error_string(bir->file));
-                return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
-            }
-
-            ret = mb_file_read_fully(bir->file, cmdline, phdr.p_memsz, &n);
+            ret = mb_file_pread_fully(bir->file, cmdline, phdr.p_memsz,
+                                      phdr.p_offset, &n);
             if (ret < 0) {
                 mb_bi_reader_set_error(bir, mb_file_error(bir->file),
                                        "Failed to read cmdline: %s",
@@ -331,6 +307,26 @@ int sony_elf_reader_read_data(MbBiReader *bir, void *userdata,
                                      bytes_read, bir);
 }
 
+int sony_elf_reader_read_data_range(MbBiReader *bir, void *userdata,
+                                    uint64_t size, uint64_t *offset_out,
+                                    uint64_t *size_out)
+{
+    SonyElfReaderCtx *const ctx = static_cast<SonyElfReaderCtx *>(userdata);
+
+    return _segment_reader_read_data_range(&ctx->segctx, bir->file, size,
+                                           offset_out, size_out, bir);
+}
+
+int sony_elf_reader_get_entry_table(MbBiReader *bir, void *userdata,
+                                    MbBiEntryInfo *table,
+                                    size_t table_size, size_t *count)
+{
+    SonyElfReaderCtx *const ctx = static_cast<SonyElfReaderCtx *>(userdata);
+
+    return _segment_reader_get_entry_table(&ctx->segctx, table, table_size,
+                                           count, bir);
+}
+
 int sony_elf_reader_free(MbBiReader *bir, void *userdata)
 {
     (void) bir;
@@ -373,6 +369,8 @@ int mb_bi_reader_enable_format_sony_elf(MbBiReader *bir)
                                          &sony_elf_reader_read_entry,
                                          &sony_elf_reader_go_to_entry,
                                          &sony_elf_reader_read_data,
+                                         &sony_elf_reader_read_data_range,
+                                         &sony_elf_reader_get_entry_table,
                                          &sony_elf_reader_free);
 }
 
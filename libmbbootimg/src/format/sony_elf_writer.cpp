@@ -262,6 +262,16 @@ int sony_elf_writer_write_data(MbBiWriter *biw, void *userdata,
                                       bytes_written, biw);
 }
 
+int sony_elf_writer_copy_data(MbBiWriter *biw, void *userdata,
+                              MbFile *src, uint64_t src_offset,
+                              uint64_t size, uint64_t *bytes_copied)
+{
+    SonyElfWriterCtx *const ctx = static_cast<SonyElfWriterCtx *>(userdata);
+
+    return _segment_writer_copy_data(&ctx->segctx, biw->file, src, src_offset,
+                                     size, bytes_copied, biw);
+}
+
 int sony_elf_writer_finish_entry(MbBiWriter *biw, void *userdata)
 {
     SonyElfWriterCtx *const ctx = static_cast<SonyElfWriterCtx *>(userdata);
@@ -437,6 +447,7 @@ int mb_bi_writer_set_format_sony_elf(MbBiWriter *biw)
                                          &sony_elf_writer_get_entry,
                                          &sony_elf_writer_write_entry,
                                          &sony_elf_writer_write_data,
+                                         &sony_elf_writer_copy_data,
                                          &sony_elf_writer_finish_entry,
                                          &sony_elf_writer_close,
                                          &sony_elf_writer_free);
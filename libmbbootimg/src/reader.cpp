@@ -19,18 +19,33 @@
 
 #include "mbbootimg/reader.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
 #include "mbcommon/file/filename.h"
+#ifndef _WIN32
+#include "mbcommon/file/mmap.h"
+#endif
+#include "mbcommon/file_util.h"
+#include "mbcommon/locale.h"
 #include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader_p.h"
+#include "mbbootimg/reader_range_p.h"
 
 /*!
  * \file mbbootimg/reader.h
@@ -42,6 +57,11 @@
  * \brief Boot image reader private API
  */
 
+/*!
+ * \file mbbootimg/reader_range_p.h
+ * \brief Boot image reader private API for locating entry data
+ */
+
 /*!
  * \defgroup MB_BI_READER_FORMAT_CALLBACKS Format reader callbacks
  */
@@ -57,6 +77,11 @@
  * that conform to the file format (eg. magic string). The file position will be
  * set to the beginning of the file before this function is called.
  *
+ * While bidding, `bir->file` refers to a read-only handle that serves the
+ * probe window (see mb_bi_reader_set_probe_size()) from memory and only reads
+ * from the underlying file for data beyond the window. Bidders must not keep a
+ * reference to it.
+ *
  * \param bir MbBiReader
  * \param userdata User callback data
  * \param best_bid Current best bid
@@ -156,6 +181,53 @@
  *   * Return \<= #MB_BI_WARN if an error occurs
  */
 
+/*!
+ * \typedef FormatReaderReadDataRange
+ * \ingroup MB_BI_READER_FORMAT_CALLBACKS
+ *
+ * \brief Format reader callback to locate entry data in the file
+ *
+ * Like #FormatReaderReadData, this consumes up to \p size bytes of the current
+ * entry's data. However, instead of reading the data, the callback returns
+ * where it is stored in `bir->file`. This allows the data to be copied without
+ * going through a buffer.
+ *
+ * \note The file position must be left at the end of the returned range.
+ *
+ * \param[in] bir MbBiReader
+ * \param[in] userdata User callback data
+ * \param[in] size Maximum number of bytes to consume
+ * \param[out] offset_out Output offset of data in `bir->file`
+ * \param[out] size_out Output number of bytes that were consumed
+ *
+ * \return
+ *   * Return #MB_BI_OK if the range is returned
+ *   * Return #MB_BI_EOF if the end of the current entry has been reached
+ *   * Return #MB_BI_UNSUPPORTED if the data must be read with
+ *     #FormatReaderReadData. Nothing is consumed in this case.
+ *   * Return \<= #MB_BI_WARN if an error occurs
+ */
+
+/*!
+ * \typedef FormatReaderGetEntryTable
+ * \ingroup MB_BI_READER_FORMAT_CALLBACKS
+ *
+ * \brief Format reader callback to get the location of all entries
+ *
+ * This is called right after the header is successfully read. The callback
+ * does not need to fill in MbBiEntryInfo::compression.
+ *
+ * \param[in] bir MbBiReader
+ * \param[in] userdata User callback data
+ * \param[out] table Array to store entry information
+ * \param[in] table_size Number of elements in \p table
+ * \param[out] count Output number of entries
+ *
+ * \return
+ *   * Return #MB_BI_OK if the table is successfully filled
+ *   * Return \<= #MB_BI_WARN if an error occurs
+ */
+
 /*!
  * \typedef FormatReaderFree
  * \ingroup MB_BI_READER_FORMAT_CALLBACKS
@@ -231,6 +303,8 @@ static struct
  * \param read_entry_cb Read entry callback (required)
  * \param go_to_entry_cb Go to entry callback (optional)
  * \param read_data_cb Read data callback (required)
+ * \param read_data_range_cb Read data range callback (optional)
+ * \param get_entry_table_cb Get entry table callback (optional)
  * \param free_cb Free callback (optional)
  *
  * \return
@@ -248,6 +322,8 @@ int _mb_bi_reader_register_format(MbBiReader *bir,
                                   FormatReaderReadEntry read_entry_cb,
                                   FormatReaderGoToEntry go_to_entry_cb,
                                   FormatReaderReadData read_data_cb,
+                                  FormatReaderReadDataRange read_data_range_cb,
+                                  FormatReaderGetEntryTable get_entry_table_cb,
                                   FormatReaderFree free_cb)
 {
     int ret;
@@ -265,6 +341,8 @@ int _mb_bi_reader_register_format(MbBiReader *bir,
     format.read_entry_cb = read_entry_cb;
     format.go_to_entry_cb = go_to_entry_cb;
     format.read_data_cb = read_data_cb;
+    format.read_data_range_cb = read_data_range_cb;
+    format.get_entry_table_cb = get_entry_table_cb;
     format.free_cb = free_cb;
     format.userdata = userdata;
 
@@ -353,6 +431,7 @@ MbBiReader * mb_bi_reader_new()
     MbBiReader *bir = static_cast<MbBiReader *>(calloc(1, sizeof(MbBiReader)));
     if (bir) {
         bir->state = ReaderState::NEW;
+        bir->probe_size = DEFAULT_PROBE_SIZE;
         bir->header = mb_bi_header_new();
         bir->entry = mb_bi_entry_new();
 
@@ -406,6 +485,89 @@ int mb_bi_reader_free(MbBiReader *bir)
     return ret;
 }
 
+/*!
+ * \brief Wrap an opened file in a buffered handle and open the boot image
+ *
+ * The format readers perform many small reads and seeks, which would otherwise
+ * each result in a system call.
+ *
+ * \param bir MbBiReader
+ * \param file Opened MbFile handle. Ownership is always taken.
+ *
+ * \return Return value of mb_bi_reader_open() or #MB_BI_FAILED if the
+ *         buffered handle cannot be opened
+ */
+static int open_buffered(MbBiReader *bir, MbFile *file)
+{
+    int ret;
+
+    MbFile *buffered = mb_file_new();
+    if (!buffered) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
+                               "%s", strerror(errno));
+        mb_file_free(file);
+        return MB_BI_FAILED;
+    }
+
+    ret = mb_file_open_buffered(buffered, file, 0, true);
+    if (ret != MB_FILE_OK) {
+        mb_bi_reader_set_error(bir, mb_file_error(buffered),
+                               "Failed to open buffered file: %s",
+                               mb_file_error_string(buffered));
+        mb_file_free(buffered);
+        return MB_BI_FAILED;
+    }
+
+    return mb_bi_reader_open(bir, buffered, true);
+}
+
+#ifndef _WIN32
+/*!
+ * \brief Memory map a regular file so that the format readers can scan it in
+ *        place
+ *
+ * Other file types (eg. block devices and pipes) are not mapped because their
+ * contents can change or disappear while they are being read.
+ *
+ * \return Opened MbFile handle or NULL if the file could not be mapped
+ */
+static MbFile * open_mmap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    MbFile *file = nullptr;
+    struct stat sb;
+
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        file = mb_file_new();
+        if (file && mb_file_open_mmap(file, fd) != MB_FILE_OK) {
+            mb_file_free(file);
+            file = nullptr;
+        }
+    }
+
+    // The mapping does not need the file descriptor to remain open
+    close(fd);
+
+    return file;
+}
+
+static MbFile * open_mmap_w(const wchar_t *filename)
+{
+    char *mbs_filename = mb::wcs_to_mbs(filename);
+    if (!mbs_filename) {
+        return nullptr;
+    }
+
+    MbFile *file = open_mmap(mbs_filename);
+    free(mbs_filename);
+    return file;
+}
+#endif
+
 /*!
  * \brief Open boot image from filename (MBS).
  *
@@ -421,6 +583,16 @@ int mb_bi_reader_open_filename(MbBiReader *bir, const char *filename)
     READER_ENSURE_STATE(bir, ReaderState::NEW);
     int ret;
 
+#ifndef _WIN32
+    if (bir->use_mmap) {
+        MbFile *mapped = open_mmap(filename);
+        if (mapped) {
+            return mb_bi_reader_open(bir, mapped, true);
+        }
+    }
+#endif
+
+    // Fall back to buffered reads if the file can't be mapped
     MbFile *file = mb_file_new();
     if (!file) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
@@ -439,7 +611,7 @@ int mb_bi_reader_open_filename(MbBiReader *bir, const char *filename)
         return MB_BI_FAILED;
     }
 
-    return mb_bi_reader_open(bir, file, true);
+    return open_buffered(bir, file);
 }
 
 /*!
@@ -457,6 +629,16 @@ int mb_bi_reader_open_filename_w(MbBiReader *bir, const wchar_t *filename)
     READER_ENSURE_STATE(bir, ReaderState::NEW);
     int ret;
 
+#ifndef _WIN32
+    if (bir->use_mmap) {
+        MbFile *mapped = open_mmap_w(filename);
+        if (mapped) {
+            return mb_bi_reader_open(bir, mapped, true);
+        }
+    }
+#endif
+
+    // Fall back to buffered reads if the file can't be mapped
     MbFile *file = mb_file_new();
     if (!file) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
@@ -475,7 +657,328 @@ int mb_bi_reader_open_filename_w(MbBiReader *bir, const wchar_t *filename)
         return MB_BI_FAILED;
     }
 
-    return mb_bi_reader_open(bir, file, true);
+    return open_buffered(bir, file);
+}
+
+/*!
+ * \brief State for the probe handle used while bidding
+ */
+struct ProbeCtx
+{
+    // Underlying file
+    MbFile *file;
+
+    // Data at the beginning of the file
+    unsigned char *window;
+    size_t window_size;
+    // Whether the window covers the entire file
+    bool window_eof;
+
+    // Most recent small read beyond the window
+    unsigned char block[PROBE_BLOCK_SIZE];
+    uint64_t block_offset;
+    size_t block_size;
+    bool have_block;
+
+    // Size of underlying file (only valid if have_file_size is true)
+    uint64_t file_size;
+    bool have_file_size;
+
+    // Current position of probe handle
+    uint64_t pos;
+};
+
+static void probe_copy_error(MbFile *file, MbFile *source)
+{
+    mb_file_set_error(file, mb_file_error(source), "%s",
+                      mb_file_error_string(source));
+}
+
+static int probe_pread_cb(MbFile *file, void *userdata,
+                          void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_read)
+{
+    ProbeCtx *ctx = static_cast<ProbeCtx *>(userdata);
+    int ret;
+
+    if (offset < ctx->window_size) {
+        size_t to_copy = std::min<uint64_t>(size, ctx->window_size - offset);
+        memcpy(buf, ctx->window + offset, to_copy);
+        *bytes_read = to_copy;
+        return MB_FILE_OK;
+    } else if (ctx->window_eof) {
+        *bytes_read = 0;
+        return MB_FILE_OK;
+    }
+
+    // Large reads (eg. from mb_file_search()) go straight to the file
+    if (size >= sizeof(ctx->block)) {
+        ret = mb_file_pread(ctx->file, buf, size, offset, bytes_read);
+        if (ret != MB_FILE_OK) {
+            probe_copy_error(file, ctx->file);
+        }
+        return ret;
+    }
+
+    // Several formats check the same trailer, so keep the last small read
+    if (!ctx->have_block || offset < ctx->block_offset
+            || offset - ctx->block_offset >= sizeof(ctx->block)) {
+        ctx->have_block = false;
+
+        ret = mb_file_pread_fully(ctx->file, ctx->block, sizeof(ctx->block),
+                                  offset, &ctx->block_size);
+        if (ret != MB_FILE_OK) {
+            probe_copy_error(file, ctx->file);
+            return ret;
+        }
+
+        ctx->block_offset = offset;
+        ctx->have_block = true;
+    }
+
+    uint64_t block_pos = offset - ctx->block_offset;
+    size_t to_copy = 0;
+
+    if (block_pos < ctx->block_size) {
+        to_copy = std::min<uint64_t>(size, ctx->block_size - block_pos);
+        memcpy(buf, ctx->block + block_pos, to_copy);
+    }
+
+    *bytes_read = to_copy;
+    return MB_FILE_OK;
+}
+
+static int probe_read_cb(MbFile *file, void *userdata,
+                         void *buf, size_t size, size_t *bytes_read)
+{
+    ProbeCtx *ctx = static_cast<ProbeCtx *>(userdata);
+
+    int ret = probe_pread_cb(file, userdata, buf, size, ctx->pos, bytes_read);
+    if (ret == MB_FILE_OK) {
+        ctx->pos += *bytes_read;
+    }
+    return ret;
+}
+
+static int probe_seek_cb(MbFile *file, void *userdata,
+                         int64_t offset, int whence, uint64_t *new_offset)
+{
+    ProbeCtx *ctx = static_cast<ProbeCtx *>(userdata);
+    uint64_t base;
+    int ret;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = ctx->pos;
+        break;
+    case SEEK_END:
+        if (ctx->window_eof) {
+            base = ctx->window_size;
+        } else {
+            if (!ctx->have_file_size) {
+                ret = mb_file_seek(ctx->file, 0, SEEK_END, &ctx->file_size);
+                if (ret != MB_FILE_OK) {
+                    probe_copy_error(file, ctx->file);
+                    return ret;
+                }
+                ctx->have_file_size = true;
+            }
+            base = ctx->file_size;
+        }
+        break;
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid whence argument: %d", whence);
+        return MB_FILE_FAILED;
+    }
+
+    if ((offset < 0 && static_cast<uint64_t>(-offset) > base)
+            || (offset > 0 && static_cast<uint64_t>(offset)
+                    > UINT64_MAX - base)) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset out of range");
+        return MB_FILE_FAILED;
+    }
+
+    ctx->pos = base + offset;
+    *new_offset = ctx->pos;
+
+    return MB_FILE_OK;
+}
+
+static int probe_peek_cb(MbFile *file, void *userdata,
+                         uint64_t offset, size_t size,
+                         const void **buf, size_t *bytes_available)
+{
+    ProbeCtx *ctx = static_cast<ProbeCtx *>(userdata);
+
+    // Only the window can be accessed in place. Returning fewer bytes than
+    // requested would signal EOF, so refuse anything that extends past it.
+    if (offset > ctx->window_size || (!ctx->window_eof
+            && size > ctx->window_size - offset)) {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "Data is outside of probe window");
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    *buf = ctx->window + offset;
+    *bytes_available = std::min<uint64_t>(size, ctx->window_size - offset);
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Read the probe window and open a handle that serves it
+ *
+ * If the probe window is disabled or \p file already provides direct access
+ * to its data, then no handle is opened and \p probe_file_out is set to NULL.
+ *
+ * \param[in] bir MbBiReader for setting error messages
+ * \param[in] ctx Probe context to initialize. If a handle is returned, it must
+ *                be freed with mb_file_free() before the window is freed.
+ * \param[out] probe_file_out Pointer to store probe handle
+ *
+ * \return
+ *   * #MB_BI_OK if successful
+ *   * #MB_BI_FAILED if the window cannot be read or the handle cannot be
+ *     opened
+ *   * #MB_BI_FATAL if reading the window fails fatally
+ */
+static int open_probe(MbBiReader *bir, ProbeCtx *ctx, MbFile **probe_file_out)
+{
+    const void *data;
+    size_t n;
+    int ret;
+
+    *probe_file_out = nullptr;
+
+    if (bir->probe_size == 0) {
+        return MB_BI_OK;
+    }
+
+    // Memory mapped and memory-backed files don't benefit from a copy
+    ret = mb_file_peek(bir->file, 0, bir->probe_size, &data, &n);
+    if (ret == MB_FILE_OK) {
+        return MB_BI_OK;
+    }
+
+    ctx->file = bir->file;
+    ctx->window = static_cast<unsigned char *>(malloc(bir->probe_size));
+    if (!ctx->window) {
+        mb_bi_reader_set_error(bir, -errno,
+                               "Failed to allocate probe window: %s",
+                               strerror(errno));
+        return MB_BI_FAILED;
+    }
+
+    ret = mb_file_pread_fully(bir->file, ctx->window, bir->probe_size, 0,
+                              &ctx->window_size);
+    if (ret != MB_FILE_OK) {
+        mb_bi_reader_set_error(bir, mb_file_error(bir->file),
+                               "Failed to read probe window: %s",
+                               mb_file_error_string(bir->file));
+        return ret == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+    }
+
+    ctx->window_eof = ctx->window_size < bir->probe_size;
+
+    MbFile *probe_file = mb_file_new();
+    if (!probe_file) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
+                               "%s", strerror(errno));
+        return MB_BI_FAILED;
+    }
+
+    if (mb_file_set_read_callback(probe_file, &probe_read_cb) != MB_FILE_OK
+            || mb_file_set_seek_callback(probe_file, &probe_seek_cb)
+                    != MB_FILE_OK
+            || mb_file_set_peek_callback(probe_file, &probe_peek_cb)
+                    != MB_FILE_OK
+            || mb_file_set_pread_callback(probe_file, &probe_pread_cb)
+                    != MB_FILE_OK
+            || mb_file_set_callback_data(probe_file, ctx) != MB_FILE_OK
+            || mb_file_open(probe_file) != MB_FILE_OK) {
+        mb_bi_reader_set_error(bir, mb_file_error(probe_file),
+                               "Failed to open probe handle: %s",
+                               mb_file_error_string(probe_file));
+        mb_file_free(probe_file);
+        return MB_BI_FAILED;
+    }
+
+    *probe_file_out = probe_file;
+    return MB_BI_OK;
+}
+
+/*!
+ * \brief Let each enabled format bid on the opened file
+ *
+ * All bidders read from a single probe window, which is read from the file
+ * once, instead of each performing its own seeks and reads.
+ *
+ * \param[in] bir MbBiReader
+ * \param[out] format_out Pointer to store winning format (NULL if no format
+ *                        placed a bid)
+ *
+ * \return
+ *   * #MB_BI_OK if bidding completes
+ *   * \<= #MB_BI_FAILED if a file operation or bidder fails
+ */
+static int bid_formats(MbBiReader *bir, FormatReader **format_out)
+{
+    MbFile *file = bir->file;
+    MbFile *probe_file;
+    ProbeCtx probe = {};
+    FormatReader *format = nullptr;
+    int best_bid = 0;
+    int ret;
+
+    ret = open_probe(bir, &probe, &probe_file);
+    if (ret != MB_BI_OK) {
+        goto done;
+    }
+
+    if (probe_file) {
+        bir->file = probe_file;
+    }
+
+    for (size_t i = 0; i < bir->formats_len; ++i) {
+        FormatReader *cur = &bir->formats[i];
+
+        if (cur->bidder_cb) {
+            // Seek to beginning
+            ret = mb_file_seek(bir->file, 0, SEEK_SET, nullptr);
+            if (ret < 0) {
+                mb_bi_reader_set_error(bir, mb_file_error(bir->file),
+                                       "Failed to seek file: %s",
+                                       mb_file_error_string(bir->file));
+                goto done;
+            }
+
+            // Call bidder
+            ret = cur->bidder_cb(bir, cur->userdata, best_bid);
+            if (ret > best_bid) {
+                best_bid = ret;
+                format = cur;
+            } else if (ret == MB_BI_WARN) {
+                continue;
+            } else if (ret < 0) {
+                goto done;
+            }
+        }
+    }
+
+    *format_out = format;
+    ret = MB_BI_OK;
+
+done:
+    bir->file = file;
+    mb_file_free(probe_file);
+    free(probe.window);
+
+    return ret;
 }
 
 /*!
@@ -498,7 +1001,6 @@ int mb_bi_reader_open_filename_w(MbBiReader *bir, const wchar_t *filename)
 int mb_bi_reader_open(MbBiReader *bir, MbFile *file, bool owned)
 {
     int ret;
-    int best_bid = 0;
     bool forced_format = !!bir->format;
 
     // Ensure that the file is freed even if called in an incorrect state
@@ -516,32 +1018,11 @@ int mb_bi_reader_open(MbBiReader *bir, MbFile *file, bool owned)
 
     // Perform bid if a format wasn't explicitly chosen
     if (!bir->format) {
-        FormatReader *format = nullptr, *cur;
+        FormatReader *format;
 
-        for (size_t i = 0; i < bir->formats_len; ++i) {
-            cur = &bir->formats[i];
-
-            if (cur->bidder_cb) {
-                // Seek to beginning
-                ret = mb_file_seek(bir->file, 0, SEEK_SET, nullptr);
-                if (ret < 0) {
-                    mb_bi_reader_set_error(bir, mb_file_error(bir->file),
-                                           "Failed to seek file: %s",
-                                           mb_file_error_string(bir->file));
-                    goto done;
-                }
-
-                // Call bidder
-                ret = cur->bidder_cb(bir, cur->userdata, best_bid);
-                if (ret > best_bid) {
-                    best_bid = ret;
-                    format = cur;
-                } else if (ret == MB_BI_WARN) {
-                    continue;
-                } else if (ret < 0) {
-                    goto done;
-                }
-            }
+        ret = bid_formats(bir, &format);
+        if (ret != MB_BI_OK) {
+            goto done;
         }
 
         if (format) {
@@ -618,6 +1099,69 @@ int mb_bi_reader_close(MbBiReader *bir)
     return ret;
 }
 
+static int detect_compression(const unsigned char *data, size_t size)
+{
+    static const struct
+    {
+        int compression;
+        const char *magic;
+        size_t magic_size;
+    } magics[] = {
+        { MB_BI_COMPRESSION_GZIP,  "\x1f\x8b",                 2 },
+        // Legacy and frame formats
+        { MB_BI_COMPRESSION_LZ4,   "\x02\x21\x4c\x18",         4 },
+        { MB_BI_COMPRESSION_LZ4,   "\x04\x22\x4d\x18",         4 },
+        { MB_BI_COMPRESSION_XZ,    "\xfd\x37\x7a\x58\x5a\x00", 6 },
+        { MB_BI_COMPRESSION_BZIP2, "BZh",                      3 },
+        { MB_BI_COMPRESSION_LZOP,  "\x89\x4c\x5a\x4f",         4 },
+        // lzma-alone has no real magic, but this matches the default
+        // properties and dictionary size that are used for kernels and
+        // ramdisks
+        { MB_BI_COMPRESSION_LZMA,  "\x5d\x00\x00",             3 },
+    };
+
+    for (auto const &m : magics) {
+        if (size >= m.magic_size && memcmp(data, m.magic, m.magic_size) == 0) {
+            return m.compression;
+        }
+    }
+
+    return MB_BI_COMPRESSION_UNKNOWN;
+}
+
+static int load_entry_table(MbBiReader *bir)
+{
+    unsigned char magic[8];
+    size_t n;
+    int ret;
+
+    if (!bir->format->get_entry_table_cb) {
+        return MB_BI_OK;
+    }
+
+    ret = bir->format->get_entry_table_cb(bir, bir->format->userdata,
+                                          bir->entry_table, MAX_ENTRIES,
+                                          &bir->entry_table_len);
+    if (ret != MB_BI_OK) {
+        return ret;
+    }
+
+    // The compression method is only a hint, so read errors are not fatal
+    for (size_t i = 0; i < bir->entry_table_len; ++i) {
+        MbBiEntryInfo *info = &bir->entry_table[i];
+
+        ret = mb_file_pread_fully(bir->file, magic,
+                                  std::min<uint64_t>(info->size, sizeof(magic)),
+                                  info->offset, &n);
+        info->compression = ret == MB_FILE_OK
+                ? detect_compression(magic, n) : MB_BI_COMPRESSION_UNKNOWN;
+    }
+
+    bir->entry_table_valid = true;
+
+    return MB_BI_OK;
+}
+
 /*!
  * \brief Read boot image header.
  *
@@ -675,6 +1219,8 @@ int mb_bi_reader_read_header2(MbBiReader *bir, MbBiHeader *header)
     }
 
     mb_bi_header_clear(header);
+    bir->entry_table_len = 0;
+    bir->entry_table_valid = false;
 
     if (!bir->format->read_header_cb) {
         mb_bi_reader_set_error(bir, MB_BI_ERROR_INTERNAL_ERROR,
@@ -684,6 +1230,9 @@ int mb_bi_reader_read_header2(MbBiReader *bir, MbBiHeader *header)
     }
 
     ret = bir->format->read_header_cb(bir, bir->format->userdata, header);
+    if (ret == MB_BI_OK) {
+        ret = load_entry_table(bir);
+    }
     if (ret == MB_BI_OK) {
         bir->state = ReaderState::ENTRY;
     } else if (ret <= MB_BI_FATAL) {
@@ -872,6 +1421,170 @@ int mb_bi_reader_read_data(MbBiReader *bir, void *buf, size_t size,
     return ret;
 }
 
+/*!
+ * \brief Get the location of all boot image entries.
+ *
+ * The table is built when the header is read, so this may be called at any
+ * time afterwards. The entries are listed in the order that they appear in the
+ * boot image. The value of \p table is owned by the MbBiReader and is valid
+ * until the header is read again or the reader is freed.
+ *
+ * \param[in] bir MbBiReader
+ * \param[out] table Pointer to store entry table
+ * \param[out] count Pointer to store number of entries in \p table
+ *
+ * \return
+ *   * #MB_BI_OK if the entry table is returned
+ *   * #MB_BI_UNSUPPORTED if the boot image format does not provide an entry
+ *     table
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int mb_bi_reader_get_entry_table(MbBiReader *bir,
+                                 const MbBiEntryInfo **table, size_t *count)
+{
+    READER_ENSURE_STATE(bir, ReaderState::ENTRY | ReaderState::DATA);
+
+    if (!bir->entry_table_valid) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_UNSUPPORTED,
+                               "Format does not provide an entry table");
+        return MB_BI_UNSUPPORTED;
+    }
+
+    *table = bir->entry_table;
+    *count = bir->entry_table_len;
+
+    return MB_BI_OK;
+}
+
+/*!
+ * \brief Read boot image entry data at an offset.
+ *
+ * Read up to \p size bytes from offset \p offset in the data of the entry with
+ * type \p entry_type. Unlike mb_bi_reader_read_data(), this does not depend on
+ * or change the current entry or the file position, so it can be mixed freely
+ * with the sequential API.
+ *
+ * \note This function does not modify the MbBiReader unless an error occurs.
+ *       If the underlying MbFile supports concurrent positional reads (eg. file
+ *       descriptors and memory files) and does not have statistics enabled, it
+ *       may be called from several threads at once. However, the error string
+ *       is not synchronized and is only meaningful if no other thread fails at
+ *       the same time.
+ *
+ * \param[in] bir MbBiReader
+ * \param[in] entry_type Entry type
+ * \param[in] offset Offset in entry data
+ * \param[out] buf Output buffer
+ * \param[in] size Size of output buffer
+ * \param[out] bytes_read Pointer to store number of bytes read
+ *
+ * \return
+ *   * #MB_BI_OK if data is successfully read. Fewer than \p size bytes are
+ *     only read if the end of the entry is reached.
+ *   * #MB_BI_EOF if \p offset is at or past the end of the entry or if the
+ *     boot image has no entry of type \p entry_type
+ *   * #MB_BI_UNSUPPORTED if the boot image format does not provide an entry
+ *     table
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int mb_bi_reader_read_entry_data_at(MbBiReader *bir, int entry_type,
+                                    uint64_t offset, void *buf, size_t size,
+                                    size_t *bytes_read)
+{
+    READER_ENSURE_STATE(bir, ReaderState::ENTRY | ReaderState::DATA);
+    const MbBiEntryInfo *info = nullptr;
+    size_t to_read;
+    int ret;
+
+    if (!bir->entry_table_valid) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_UNSUPPORTED,
+                               "Format does not provide an entry table");
+        return MB_BI_UNSUPPORTED;
+    }
+
+    for (size_t i = 0; i < bir->entry_table_len; ++i) {
+        if (bir->entry_table[i].type == entry_type) {
+            info = &bir->entry_table[i];
+            break;
+        }
+    }
+
+    if (!info || offset >= info->size) {
+        *bytes_read = 0;
+        return MB_BI_EOF;
+    }
+
+    if (info->offset > UINT64_MAX - offset) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                               "Entry offset %" PRIu64 " with read offset %"
+                               PRIu64 " would overflow integer",
+                               info->offset, offset);
+        return MB_BI_FAILED;
+    }
+
+    to_read = std::min<uint64_t>(size, info->size - offset);
+
+    ret = mb_file_pread_fully(bir->file, buf, to_read, info->offset + offset,
+                              bytes_read);
+    if (ret < 0) {
+        mb_bi_reader_set_error(bir, mb_file_error(bir->file),
+                               "Failed to read data: %s",
+                               mb_file_error_string(bir->file));
+        return MB_BI_FAILED;
+    }
+
+    if (*bytes_read != to_read && !info->can_truncate) {
+        mb_bi_reader_set_error(bir, MB_BI_ERROR_FILE_FORMAT,
+                               "Entry is truncated "
+                               "(expected %" MB_PRIzu " more bytes)",
+                               to_read - *bytes_read);
+        return MB_BI_FAILED;
+    }
+
+    return *bytes_read == 0 ? MB_BI_EOF : MB_BI_OK;
+}
+
+/*!
+ * \brief Consume entry data without reading it
+ *
+ * This is like mb_bi_reader_read_data(), except that the location of the data
+ * in the underlying file is returned instead of the data itself.
+ *
+ * \param[in] bir MbBiReader
+ * \param[in] size Maximum number of bytes to consume
+ * \param[out] file_out Pointer to store MbFile handle containing the data
+ * \param[out] offset_out Pointer to store offset of data
+ * \param[out] size_out Pointer to store number of bytes consumed
+ *
+ * \return
+ *   * #MB_BI_OK if a range is returned
+ *   * #MB_BI_EOF if the end of the entry has been reached
+ *   * #MB_BI_UNSUPPORTED if the format cannot provide the location of the
+ *     data. mb_bi_reader_read_data() must be used instead.
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int _mb_bi_reader_read_data_range(MbBiReader *bir, uint64_t size,
+                                  MbFile **file_out,
+                                  uint64_t *offset_out, uint64_t *size_out)
+{
+    READER_ENSURE_STATE(bir, ReaderState::DATA);
+    int ret;
+
+    if (!bir->format->read_data_range_cb) {
+        return MB_BI_UNSUPPORTED;
+    }
+
+    ret = bir->format->read_data_range_cb(bir, bir->format->userdata, size,
+                                          offset_out, size_out);
+    if (ret == MB_BI_OK) {
+        *file_out = bir->file;
+    } else if (ret <= MB_BI_FATAL) {
+        bir->state = ReaderState::FATAL;
+    }
+
+    return ret;
+}
+
 /*!
  * \brief Get detected or forced boot image format code.
  *
@@ -1011,6 +1724,65 @@ int mb_bi_reader_set_format_by_name(MbBiReader *bir, const char *name)
     return MB_BI_OK;
 }
 
+/*!
+ * \brief Set size of the probe window used for format detection.
+ *
+ * When mb_bi_reader_open() needs to determine the boot image format, the
+ * first \p size bytes of the file are read once and shared by all enabled
+ * formats. Data beyond the window is read from the file as needed. This avoids
+ * repeated seeks and small reads when the file is slow to access. The window
+ * is not used if the file can already be accessed in place (eg. if it is
+ * memory mapped).
+ *
+ * The default window size is 64 KiB.
+ *
+ * \param bir MbBiReader
+ * \param size Size of probe window in bytes or 0 to disable the window
+ *
+ * \return
+ *   * #MB_BI_OK if the size is successfully set
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int mb_bi_reader_set_probe_size(MbBiReader *bir, size_t size)
+{
+    READER_ENSURE_STATE(bir, ReaderState::NEW);
+
+    bir->probe_size = size;
+
+    return MB_BI_OK;
+}
+
+/*!
+ * \brief Set whether mb_bi_reader_open_filename() may memory map the file.
+ *
+ * When enabled, regular files are mapped read-only so that the format readers
+ * can scan them in place without copying. Other file types and files that
+ * cannot be mapped are read through a buffered handle as usual. Memory mapping
+ * is not supported on Windows and this option has no effect there.
+ *
+ * Memory mapping is disabled by default.
+ *
+ * \warning If the file is truncated by another process while it is mapped,
+ *          accessing the truncated region raises `SIGBUS` instead of
+ *          returning a read error. Only enable this option if nothing else
+ *          can modify the file while the reader is open.
+ *
+ * \param bir MbBiReader
+ * \param enable Whether to memory map the file
+ *
+ * \return
+ *   * #MB_BI_OK if the option is successfully set
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int mb_bi_reader_set_use_mmap(MbBiReader *bir, bool enable)
+{
+    READER_ENSURE_STATE(bir, ReaderState::NEW);
+
+    bir->use_mmap = enable;
+
+    return MB_BI_OK;
+}
+
 /*!
  * \brief Enable support for all boot image formats.
  *
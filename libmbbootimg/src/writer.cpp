@@ -19,17 +19,24 @@
 
 #include "mbbootimg/writer.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
 #include "mbcommon/file/filename.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/reader_range_p.h"
 #include "mbbootimg/writer_p.h"
 
 /*!
@@ -143,6 +150,29 @@
  *   * Return \<= #MB_BI_WARN if an error occurs
  */
 
+/*!
+ * \typedef FormatWriterCopyData
+ * \ingroup MB_BI_WRITER_FORMAT_CALLBACKS
+ *
+ * \brief Format writer callback to copy entry data from another file
+ *
+ * \note The callback function *must* copy \p size bytes or return an error if
+ *       it cannot do so. Unlike the reader callbacks, #MB_BI_UNSUPPORTED is not
+ *       a valid return value. Formats that cannot copy data directly should not
+ *       register this callback.
+ *
+ * \param[in] biw MbBiWriter
+ * \param[in] userdata User callback data
+ * \param[in] src MbFile handle containing the data
+ * \param[in] src_offset Offset of data in \p src
+ * \param[in] size Size of data
+ * \param[out] bytes_copied Output number of bytes that were copied
+ *
+ * \return
+ *   * Return #MB_BI_OK if the data is successfully copied
+ *   * Return \<= #MB_BI_WARN if an error occurs
+ */
+
 /*!
  * \typedef FormatWriterFinishEntry
  * \ingroup MB_BI_WRITER_FORMAT_CALLBACKS
@@ -241,6 +271,7 @@ static struct
  * \param get_entry_cb Get entry callback (required)
  * \param write_entry_cb Write entry callback (required)
  * \param write_data_cb Write data callback (required)
+ * \param copy_data_cb Copy data callback (optional)
  * \param finish_entry_cb Finish entry callback (optional)
  * \param close_cb Close callback (optional)
  * \param free_cb Free callback (optional)
@@ -259,6 +290,7 @@ int _mb_bi_writer_register_format(MbBiWriter *biw,
                                   FormatWriterGetEntry get_entry_cb,
                                   FormatWriterWriteEntry write_entry_cb,
                                   FormatWriterWriteData write_data_cb,
+                                  FormatWriterCopyData copy_data_cb,
                                   FormatWriterFinishEntry finish_entry_cb,
                                   FormatWriterClose close_cb,
                                   FormatWriterFree free_cb)
@@ -278,6 +310,7 @@ int _mb_bi_writer_register_format(MbBiWriter *biw,
     format.get_entry_cb = get_entry_cb;
     format.write_entry_cb = write_entry_cb;
     format.write_data_cb = write_data_cb;
+    format.copy_data_cb = copy_data_cb;
     format.finish_entry_cb = finish_entry_cb;
     format.close_cb = close_cb;
     format.free_cb = free_cb;
@@ -345,6 +378,69 @@ int _mb_bi_writer_free_format(MbBiWriter *biw, FormatWriter *format)
     return ret;
 }
 
+/*!
+ * \brief Pass data from a file to a callback
+ *
+ * This is meant for formats that need to see the data that is passed to
+ * FormatWriterCopyData (eg. for computing checksums). If \p src supports
+ * mb_file_peek(), the data is passed directly from the memory backing it.
+ * Otherwise, it is read into a buffer with mb_file_pread(). The file position
+ * of \p src is not changed.
+ *
+ * \param biw MbBiWriter
+ * \param src MbFile handle containing the data
+ * \param offset Offset of data in \p src
+ * \param size Size of data
+ * \param cb Callback to pass data to
+ * \param userdata User data for \p cb
+ *
+ * \return
+ *   * #MB_BI_OK if all of the data is passed to \p cb
+ *   * #MB_BI_FAILED if the data cannot be read
+ */
+int _mb_bi_writer_visit_file_data(MbBiWriter *biw, MbFile *src,
+                                  uint64_t offset, uint64_t size,
+                                  MbBiWriterVisitFileDataCb cb,
+                                  void *userdata)
+{
+    char buf[10240];
+    const void *data;
+    size_t n;
+    int ret;
+
+    while (size > 0) {
+        size_t to_read = std::min<uint64_t>(size, SIZE_MAX);
+
+        ret = mb_file_peek(src, offset, to_read, &data, &n);
+        if (ret == MB_FILE_UNSUPPORTED) {
+            ret = mb_file_pread_fully(src, buf,
+                                      std::min<uint64_t>(size, sizeof(buf)),
+                                      offset, &n);
+            data = buf;
+        }
+        if (ret != MB_FILE_OK) {
+            mb_bi_writer_set_error(biw, mb_file_error(src),
+                                   "Failed to read data: %s",
+                                   mb_file_error_string(src));
+            return MB_BI_FAILED;
+        } else if (n == 0) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_FILE_FORMAT,
+                                   "Unexpected EOF when reading data");
+            return MB_BI_FAILED;
+        }
+
+        ret = cb(data, n, userdata);
+        if (ret != MB_BI_OK) {
+            return ret;
+        }
+
+        offset += n;
+        size -= n;
+    }
+
+    return MB_BI_OK;
+}
+
 /*!
  * \brief Allocate new MbBiWriter.
  *
@@ -409,6 +505,42 @@ int mb_bi_writer_free(MbBiWriter *biw)
     return ret;
 }
 
+/*!
+ * \brief Wrap an opened file in a buffered handle and open the boot image
+ *
+ * The format writers perform many small writes, which would otherwise
+ * each result in a system call.
+ *
+ * \param biw MbBiWriter
+ * \param file Opened MbFile handle. Ownership is always taken.
+ *
+ * \return Return value of mb_bi_writer_open() or #MB_BI_FAILED if the
+ *         buffered handle cannot be opened
+ */
+static int open_buffered(MbBiWriter *biw, MbFile *file)
+{
+    int ret;
+
+    MbFile *buffered = mb_file_new();
+    if (!buffered) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "%s", strerror(errno));
+        mb_file_free(file);
+        return MB_BI_FAILED;
+    }
+
+    ret = mb_file_open_buffered(buffered, file, 0, true);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(buffered),
+                               "Failed to open buffered file: %s",
+                               mb_file_error_string(buffered));
+        mb_file_free(buffered);
+        return MB_BI_FAILED;
+    }
+
+    return mb_bi_writer_open(biw, buffered, true);
+}
+
 /*!
  * \brief Open boot image from filename (MBS).
  *
@@ -443,7 +575,7 @@ int mb_bi_writer_open_filename(MbBiWriter *biw, const char *filename)
         return MB_BI_FAILED;
     }
 
-    return mb_bi_writer_open(biw, file, true);
+    return open_buffered(biw, file);
 }
 
 /*!
@@ -481,7 +613,74 @@ int mb_bi_writer_open_filename_w(MbBiWriter *biw, const wchar_t *filename)
         return MB_BI_FAILED;
     }
 
-    return mb_bi_writer_open(biw, file, true);
+    return open_buffered(biw, file);
+}
+
+/*!
+ * \brief Set up in-memory staging file for streaming output
+ *
+ * \param biw MbBiWriter
+ * \param file Output MbFile handle
+ * \param owned Whether the MbBiWriter should take ownership of \p file. If
+ *              this function fails, the caller is responsible for freeing it.
+ *
+ * \return
+ *   * #MB_BI_OK if the staging file is successfully opened
+ *   * #MB_BI_FAILED if an error occurs
+ */
+static int open_staging(MbBiWriter *biw, MbFile *file, bool owned)
+{
+    int ret;
+
+    MbFile *staging = mb_file_new();
+    if (!staging) {
+        mb_bi_writer_set_error(biw, MB_BI_ERROR_INTERNAL_ERROR,
+                               "%s", strerror(errno));
+        return MB_BI_FAILED;
+    }
+
+    ret = mb_file_open_memory_dynamic(staging, &biw->stream_buf,
+                                      &biw->stream_buf_size);
+    if (ret != MB_FILE_OK) {
+        mb_bi_writer_set_error(biw, mb_file_error(staging),
+                               "Failed to open staging file: %s",
+                               mb_file_error_string(staging));
+        mb_file_free(staging);
+        return MB_BI_FAILED;
+    }
+
+    biw->file = staging;
+    biw->file_owned = true;
+    biw->stream_file = file;
+    biw->stream_file_owned = owned;
+
+    return MB_BI_OK;
+}
+
+/*!
+ * \brief Write completed boot image from staging file to the output file
+ *
+ * \param biw MbBiWriter
+ *
+ * \return
+ *   * #MB_BI_OK if the entire boot image is written
+ *   * #MB_BI_FAILED if an error occurs
+ */
+static int flush_staging(MbBiWriter *biw)
+{
+    size_t n;
+    int ret;
+
+    ret = mb_file_write_fully(biw->stream_file, biw->stream_buf,
+                              biw->stream_buf_size, &n);
+    if (ret != MB_FILE_OK || n != biw->stream_buf_size) {
+        mb_bi_writer_set_error(biw, mb_file_error(biw->stream_file),
+                               "Failed to write boot image: %s",
+                               mb_file_error_string(biw->stream_file));
+        return MB_BI_FAILED;
+    }
+
+    return MB_BI_OK;
 }
 
 /*!
@@ -515,8 +714,16 @@ int mb_bi_writer_open(MbBiWriter *biw, MbFile *file, bool owned)
         goto done;
     }
 
-    biw->file = file;
-    biw->file_owned = owned;
+    if (biw->streaming) {
+        ret = open_staging(biw, file, owned);
+        if (ret != MB_BI_OK) {
+            goto done;
+        }
+    } else {
+        biw->file = file;
+        biw->file_owned = owned;
+    }
+
     biw->state = WriterState::HEADER;
 
     ret = MB_BI_OK;
@@ -554,6 +761,19 @@ int mb_bi_writer_close(MbBiWriter *biw)
             ret = biw->format.close_cb(biw, biw->format.userdata);
         }
 
+        // Only emit the staged image if every entry was written and the
+        // format writer finished it
+        if (biw->stream_file && ret == MB_BI_OK) {
+            if (biw->stream_complete) {
+                ret = flush_staging(biw);
+            } else {
+                mb_bi_writer_set_error(biw, MB_BI_ERROR_PROGRAMMER_ERROR,
+                                       "Boot image is incomplete; "
+                                       "nothing was written");
+                ret = MB_BI_FAILED;
+            }
+        }
+
         if (biw->file && biw->file_owned) {
             ret2 = mb_file_free(biw->file);
             if (ret2 < 0) {
@@ -564,8 +784,26 @@ int mb_bi_writer_close(MbBiWriter *biw)
             }
         }
 
+        if (biw->stream_file && biw->stream_file_owned) {
+            ret2 = mb_file_free(biw->stream_file);
+            if (ret2 < 0) {
+                ret2 = ret2 == MB_FILE_FATAL ? MB_BI_FATAL : MB_BI_FAILED;
+            }
+            if (ret2 < ret) {
+                ret = ret2;
+            }
+        }
+
+        // Must be freed after the staging file
+        free(biw->stream_buf);
+
         biw->file = nullptr;
         biw->file_owned = false;
+        biw->stream_file = nullptr;
+        biw->stream_file_owned = false;
+        biw->stream_buf = nullptr;
+        biw->stream_buf_size = 0;
+        biw->stream_complete = false;
 
         // Don't change state to WriterState::FATAL if MB_BI_FATAL is returned.
         // Otherwise, we risk double-closing the boot image. CLOSED and FATAL
@@ -759,6 +997,8 @@ int mb_bi_writer_get_entry2(MbBiWriter *biw, MbBiEntry *entry)
     ret = biw->format.get_entry_cb(biw, biw->format.userdata, entry);
     if (ret == MB_BI_OK) {
         biw->state = WriterState::ENTRY;
+    } else if (ret == MB_BI_EOF) {
+        biw->stream_complete = true;
     } else if (ret <= MB_BI_FATAL) {
         biw->state = WriterState::FATAL;
     }
@@ -841,6 +1081,134 @@ int mb_bi_writer_write_data(MbBiWriter *biw, const void *buf, size_t size,
     return ret;
 }
 
+/*!
+ * \brief Copy the current entry's data from a boot image reader.
+ *
+ * This copies the remaining data of the current entry in \p bir to the current
+ * entry in \p biw. If both the reader and writer formats support it, the data
+ * is copied directly between the underlying files without being read into a
+ * buffer (eg. with `copy_file_range()` on Linux). Otherwise, this falls back to
+ * mb_bi_reader_read_data() and mb_bi_writer_write_data().
+ *
+ * \note If an error occurs while reading from \p bir, the error is copied to
+ *       \p biw.
+ *
+ * \param[in] biw MbBiWriter
+ * \param[in] bir MbBiReader
+ * \param[out] bytes_copied Pointer to store number of bytes copied
+ *
+ * \return
+ *   * #MB_BI_OK if the data is successfully copied
+ *   * \<= #MB_BI_WARN if an error occurs
+ */
+int mb_bi_writer_copy_data(MbBiWriter *biw, MbBiReader *bir,
+                           uint64_t *bytes_copied)
+{
+    WRITER_ENSURE_STATE(biw, WriterState::DATA);
+    char buf[10240];
+    uint64_t total = 0;
+    MbFile *src;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t n_copied;
+    size_t n_read;
+    size_t n_written;
+    int ret;
+
+    if (biw->format.copy_data_cb) {
+        while (true) {
+            ret = _mb_bi_reader_read_data_range(bir, UINT32_MAX, &src,
+                                                &offset, &size);
+            if (ret == MB_BI_EOF) {
+                *bytes_copied = total;
+                return MB_BI_OK;
+            } else if (ret == MB_BI_UNSUPPORTED) {
+                // Nothing was consumed, so the data can still be read
+                break;
+            } else if (ret != MB_BI_OK) {
+                goto read_error;
+            }
+
+            ret = biw->format.copy_data_cb(biw, biw->format.userdata,
+                                           src, offset, size,
+                                           &n_copied);
+            if (ret != MB_BI_OK) {
+                if (ret <= MB_BI_FATAL) {
+                    biw->state = WriterState::FATAL;
+                }
+                return ret;
+            }
+
+            total += n_copied;
+        }
+    }
+
+    while (true) {
+        ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n_read);
+        if (ret == MB_BI_EOF) {
+            break;
+        } else if (ret != MB_BI_OK) {
+            goto read_error;
+        }
+
+        ret = mb_bi_writer_write_data(biw, buf, n_read, &n_written);
+        if (ret != MB_BI_OK) {
+            return ret;
+        } else if (n_written != n_read) {
+            mb_bi_writer_set_error(biw, MB_BI_ERROR_FILE_FORMAT,
+                                   "Write was truncated");
+            biw->state = WriterState::FATAL;
+            return MB_BI_FATAL;
+        }
+
+        total += n_read;
+    }
+
+    *bytes_copied = total;
+    return MB_BI_OK;
+
+read_error:
+    mb_bi_writer_set_error(biw, mb_bi_reader_error(bir),
+                           "Failed to read data: %s",
+                           mb_bi_reader_error_string(bir));
+    return ret < MB_BI_FAILED ? MB_BI_FAILED : ret;
+}
+
+/*!
+ * \brief Enable or disable streaming output
+ *
+ * Most boot image formats contain a header that depends on all of the entries
+ * (eg. the sizes and SHA1 ID in Android boot images), so format writers
+ * normally seek back to the beginning of the file to write the header once all
+ * of the entries have been written. This requires the output file to be
+ * seekable (and, for some formats, readable).
+ *
+ * When streaming is enabled, the format writer instead writes to an in-memory
+ * staging file and the completed boot image is written to the output file in a
+ * single forward pass when the writer is closed. This allows the output file to
+ * be a pipe or socket. Nothing is written to the output file unless
+ * mb_bi_writer_get_entry() has returned #MB_BI_EOF (ie. every entry has been
+ * written) and the format writer successfully finalizes the boot image. If the
+ * writer is closed before that, mb_bi_writer_close() fails.
+ *
+ * \note The entire boot image is kept in memory until the writer is closed.
+ *
+ * \param biw MbBiWriter
+ * \param enabled Whether to enable streaming output
+ *
+ * \return
+ *   * #MB_BI_OK if the option is successfully set
+ *   * \<= #MB_BI_FATAL if the writer is not in the new state
+ */
+int mb_bi_writer_set_streaming(MbBiWriter *biw, bool enabled)
+{
+    WRITER_ENSURE_STATE(biw, WriterState::NEW);
+
+    biw->streaming = enabled;
+
+    return MB_BI_OK;
+}
+
 /*!
  * \brief Get selected boot image format code.
  *
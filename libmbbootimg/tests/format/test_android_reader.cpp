@@ -20,8 +20,10 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <vector>
 
 #include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
 #include "mbcommon/file/memory.h"
 
 #include "mbbootimg/entry.h"
@@ -427,3 +429,208 @@ TEST_F(AndroidReaderGoToEntryTest, GoToMissingEntryShouldFail)
     // In EOF state now, so next read should return MB_BI_EOF
     ASSERT_EQ(mb_bi_reader_read_entry(_bir.get(), &entry), MB_BI_EOF);
 }
+
+struct AndroidReaderEntryTableTest : testing::Test
+{
+    ScopedFile _file;
+    ScopedReader _bir;
+    std::vector<unsigned char> _data;
+    MbBiHeader *_header;
+
+    AndroidReaderEntryTableTest()
+        : _file(mb_file_new(), &mb_file_free)
+        , _bir(mb_bi_reader_new(), &mb_bi_reader_free)
+    {
+    }
+
+    virtual ~AndroidReaderEntryTableTest()
+    {
+    }
+
+    virtual void SetUp() override
+    {
+        ASSERT_TRUE(!!_file);
+        ASSERT_TRUE(!!_bir);
+
+        AndroidHeader ahdr = {};
+        memcpy(ahdr.magic, ANDROID_BOOT_MAGIC, ANDROID_BOOT_MAGIC_SIZE);
+        ahdr.kernel_size = 6;
+        ahdr.ramdisk_size = 8;
+        ahdr.dt_size = 2;
+        ahdr.page_size = 2048;
+
+        _data.resize(3 * ahdr.page_size + 1);
+
+        // Write headers
+        memcpy(_data.data(), &ahdr, sizeof(ahdr));
+        // Write kernel
+        memcpy(_data.data() + ahdr.page_size, "kernel", 6);
+        // Write gzip-compressed ramdisk
+        memcpy(_data.data() + 2 * ahdr.page_size,
+               "\x1f\x8b\x08\x00" "data", 8);
+        // Write truncated DT image
+        _data[3 * ahdr.page_size] = 'd';
+
+        ASSERT_EQ(mb_file_open_memory_static(_file.get(), _data.data(),
+                                             _data.size()), MB_FILE_OK);
+
+        ASSERT_EQ(mb_bi_reader_enable_format_android(_bir.get()), MB_BI_OK);
+        ASSERT_EQ(mb_bi_reader_open(_bir.get(), _file.get(), false), MB_BI_OK);
+
+        ASSERT_EQ(mb_bi_reader_read_header(_bir.get(), &_header), MB_BI_OK);
+    }
+};
+
+TEST_F(AndroidReaderEntryTableTest, EntryTableShouldMatchHeader)
+{
+    const MbBiEntryInfo *table;
+    size_t count;
+
+    ASSERT_EQ(mb_bi_reader_get_entry_table(_bir.get(), &table, &count),
+              MB_BI_OK);
+    ASSERT_EQ(count, 3);
+
+    ASSERT_EQ(table[0].type, MB_BI_ENTRY_KERNEL);
+    ASSERT_EQ(table[0].offset, 2048);
+    ASSERT_EQ(table[0].size, 6);
+    ASSERT_FALSE(table[0].can_truncate);
+    ASSERT_EQ(table[0].compression, MB_BI_COMPRESSION_UNKNOWN);
+
+    ASSERT_EQ(table[1].type, MB_BI_ENTRY_RAMDISK);
+    ASSERT_EQ(table[1].offset, 4096);
+    ASSERT_EQ(table[1].size, 8);
+    ASSERT_FALSE(table[1].can_truncate);
+    ASSERT_EQ(table[1].compression, MB_BI_COMPRESSION_GZIP);
+
+    ASSERT_EQ(table[2].type, MB_BI_ENTRY_DEVICE_TREE);
+    ASSERT_EQ(table[2].offset, 6144);
+    ASSERT_EQ(table[2].size, 2);
+    ASSERT_TRUE(table[2].can_truncate);
+}
+
+TEST_F(AndroidReaderEntryTableTest, ReadEntryDataAtShouldNotAffectCursor)
+{
+    MbBiEntry *entry;
+    char buf[50];
+    size_t n;
+
+    ASSERT_EQ(mb_bi_reader_read_entry(_bir.get(), &entry), MB_BI_OK);
+    ASSERT_EQ(mb_bi_entry_type(entry), MB_BI_ENTRY_KERNEL);
+    ASSERT_EQ(mb_bi_reader_read_data(_bir.get(), buf, 3, &n), MB_BI_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(buf, "ker", n), 0);
+
+    // Read from a different entry
+    ASSERT_EQ(mb_bi_reader_read_entry_data_at(_bir.get(), MB_BI_ENTRY_RAMDISK,
+                                              4, buf, sizeof(buf), &n),
+              MB_BI_OK);
+    ASSERT_EQ(n, 4);
+    ASSERT_EQ(memcmp(buf, "data", n), 0);
+
+    // Sequential read should continue where it left off
+    ASSERT_EQ(mb_bi_reader_read_data(_bir.get(), buf, sizeof(buf), &n),
+              MB_BI_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(buf, "nel", n), 0);
+}
+
+TEST_F(AndroidReaderEntryTableTest, ReadEntryDataAtShouldHandleEntryEnd)
+{
+    char buf[50];
+    size_t n;
+
+    // Past end of entry
+    ASSERT_EQ(mb_bi_reader_read_entry_data_at(_bir.get(), MB_BI_ENTRY_KERNEL,
+                                              6, buf, sizeof(buf), &n),
+              MB_BI_EOF);
+    ASSERT_EQ(n, 0);
+
+    // Missing entry
+    ASSERT_EQ(mb_bi_reader_read_entry_data_at(_bir.get(),
+                                              MB_BI_ENTRY_SECONDBOOT,
+                                              0, buf, sizeof(buf), &n),
+              MB_BI_EOF);
+
+    // Truncated entry
+    ASSERT_EQ(mb_bi_reader_read_entry_data_at(_bir.get(),
+                                              MB_BI_ENTRY_DEVICE_TREE,
+                                              0, buf, sizeof(buf), &n),
+              MB_BI_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(buf[0], 'd');
+}
+
+// Tests for reading through a buffered file
+
+TEST(AndroidReaderBufferedTest, ReadThroughBufferShouldReduceFileOperations)
+{
+    ScopedFile inner(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!inner);
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    AndroidHeader ahdr = {};
+    memcpy(ahdr.magic, ANDROID_BOOT_MAGIC, ANDROID_BOOT_MAGIC_SIZE);
+    ahdr.kernel_size = 6;
+    ahdr.ramdisk_size = 7;
+    ahdr.second_size = 10;
+    ahdr.page_size = 2048;
+
+    std::vector<unsigned char> data(4 * ahdr.page_size);
+    memcpy(data.data(), &ahdr, sizeof(ahdr));
+    memcpy(data.data() + ahdr.page_size, "kernel", 6);
+    memcpy(data.data() + 2 * ahdr.page_size, "ramdisk", 7);
+    memcpy(data.data() + 3 * ahdr.page_size, "secondboot", 10);
+
+    ASSERT_EQ(mb_file_set_stats_enabled(inner.get(), true), MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_stats_enabled(file.get(), true), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_static(inner.get(), data.data(),
+                                         data.size()), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_buffered(file.get(), inner.get(), 0, false),
+              MB_FILE_OK);
+
+    // Let all of the formats bid so that the usual probing pattern is used
+    ASSERT_EQ(mb_bi_reader_enable_format_all(bir.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_format_code(bir.get()), MB_BI_FORMAT_ANDROID);
+
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    char buf[50];
+    size_t n;
+    int ret;
+
+    ASSERT_EQ(mb_bi_reader_read_header(bir.get(), &header), MB_BI_OK);
+
+    while ((ret = mb_bi_reader_read_entry(bir.get(), &entry)) == MB_BI_OK) {
+        ASSERT_EQ(mb_bi_reader_read_data(bir.get(), buf, sizeof(buf), &n),
+                  MB_BI_OK);
+    }
+    ASSERT_EQ(ret, MB_BI_EOF);
+
+    ASSERT_EQ(mb_bi_reader_go_to_entry(bir.get(), &entry, MB_BI_ENTRY_KERNEL),
+              MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_read_data(bir.get(), buf, sizeof(buf), &n),
+              MB_BI_OK);
+    ASSERT_EQ(n, 6);
+    ASSERT_EQ(memcmp(buf, "kernel", n), 0);
+
+    MbFileStats stats;
+    MbFileStats inner_stats;
+    ASSERT_EQ(mb_file_get_stats(file.get(), &stats), MB_FILE_OK);
+    ASSERT_EQ(mb_file_get_stats(inner.get(), &inner_stats), MB_FILE_OK);
+
+    uint64_t reads = stats.ops[MB_FILE_STATS_OP_READ].calls
+            + stats.ops[MB_FILE_STATS_OP_PREAD].calls;
+    uint64_t seeks = stats.ops[MB_FILE_STATS_OP_SEEK].calls;
+    uint64_t inner_reads = inner_stats.ops[MB_FILE_STATS_OP_READ].calls
+            + inner_stats.ops[MB_FILE_STATS_OP_PREAD].calls;
+    uint64_t inner_seeks = inner_stats.ops[MB_FILE_STATS_OP_SEEK].calls;
+
+    // Most of the small header reads and seeks done by the format bidders and
+    // the reader are absorbed by the read-ahead buffer
+    ASSERT_LT(inner_seeks * 2, seeks);
+    ASSERT_LT((inner_reads + inner_seeks) * 2, reads + seeks);
+}
@@ -20,14 +20,19 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <vector>
 
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/callbacks.h"
 #include "mbcommon/file/memory.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
 typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
 typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
 
 struct AndroidWriterSHA1Test : public ::testing::Test
@@ -158,3 +163,243 @@ TEST_F(AndroidWriterSHA1Test, HandlesKernelRamdiskSecondbootDT)
     TestChecksum(expected, MB_BI_ENTRY_KERNEL | MB_BI_ENTRY_RAMDISK
             | MB_BI_ENTRY_SECONDBOOT | MB_BI_ENTRY_DEVICE_TREE);
 }
+
+static void write_test_image(MbFile *file, bool streaming = false)
+{
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    ASSERT_TRUE(!!biw);
+
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    int ret;
+    size_t n;
+
+    ASSERT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_set_streaming(biw.get(), streaming), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_open(biw.get(), file, false), MB_BI_OK);
+
+    ASSERT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+    ASSERT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+
+    // Write entries in small pieces
+    while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
+        ASSERT_EQ(mb_bi_writer_write_entry(biw.get(), entry), MB_BI_OK);
+
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_EQ(mb_bi_writer_write_data(biw.get(), "hello", 5, &n),
+                      MB_BI_OK);
+            ASSERT_EQ(n, 5);
+        }
+    }
+    ASSERT_EQ(ret, MB_BI_EOF);
+
+    ASSERT_EQ(mb_bi_writer_close(biw.get()), MB_BI_OK);
+}
+
+TEST(AndroidWriterBufferedTest, WriteThroughBufferShouldReduceFileOperations)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    void *expected_buf = nullptr;
+    size_t expected_buf_size = 0;
+
+    ScopedFile inner(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!inner);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedFile unbuffered(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!unbuffered);
+
+    ASSERT_EQ(mb_file_open_memory_dynamic(inner.get(), &buf, &buf_size),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_stats_enabled(inner.get(), true), MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_stats_enabled(file.get(), true), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_buffered(file.get(), inner.get(), 0, false),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_dynamic(unbuffered.get(), &expected_buf,
+                                          &expected_buf_size), MB_FILE_OK);
+
+    write_test_image(file.get());
+    write_test_image(unbuffered.get());
+
+    MbFileStats stats;
+    MbFileStats inner_stats;
+    ASSERT_EQ(mb_file_get_stats(file.get(), &stats), MB_FILE_OK);
+    ASSERT_EQ(mb_file_get_stats(inner.get(), &inner_stats), MB_FILE_OK);
+    ASSERT_LT(inner_stats.ops[MB_FILE_STATS_OP_WRITE].calls * 10,
+              stats.ops[MB_FILE_STATS_OP_WRITE].calls);
+
+    // Pending data is written when the buffered file is closed
+    ASSERT_EQ(mb_file_close(file.get()), MB_FILE_OK);
+
+    // Output must match what is written without buffering
+    ASSERT_EQ(buf_size, expected_buf_size);
+    ASSERT_EQ(memcmp(buf, expected_buf, buf_size), 0);
+
+    free(buf);
+    free(expected_buf);
+}
+
+// Write-only file that does not support seeking (like a pipe)
+static int pipe_write_cb(MbFile *file, void *userdata,
+                         const void *buf, size_t size, size_t *bytes_written)
+{
+    (void) file;
+
+    auto *data = static_cast<std::vector<unsigned char> *>(userdata);
+    auto *ptr = static_cast<const unsigned char *>(buf);
+
+    data->insert(data->end(), ptr, ptr + size);
+    *bytes_written = size;
+
+    return MB_FILE_OK;
+}
+
+TEST(AndroidWriterStreamingTest, StreamingOutputShouldMatchSeekableOutput)
+{
+    std::vector<unsigned char> data;
+    void *expected_buf = nullptr;
+    size_t expected_buf_size = 0;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedFile seekable(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!seekable);
+
+    ASSERT_EQ(mb_file_open_callbacks(file.get(), nullptr, nullptr, nullptr,
+                                     &pipe_write_cb, nullptr, nullptr, &data),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_dynamic(seekable.get(), &expected_buf,
+                                          &expected_buf_size), MB_FILE_OK);
+
+    write_test_image(file.get(), true);
+    write_test_image(seekable.get());
+
+    ASSERT_EQ(data.size(), expected_buf_size);
+    ASSERT_EQ(memcmp(data.data(), expected_buf, expected_buf_size), 0);
+
+    seekable.reset();
+    free(expected_buf);
+}
+
+TEST(AndroidWriterStreamingTest, IncompleteImageShouldNotBeWritten)
+{
+    std::vector<unsigned char> data;
+    MbBiHeader *header;
+    MbBiEntry *entry;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    ASSERT_TRUE(!!biw);
+
+    ASSERT_EQ(mb_file_open_callbacks(file.get(), nullptr, nullptr, nullptr,
+                                     &pipe_write_cb, nullptr, nullptr, &data),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_set_streaming(biw.get(), true), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+    ASSERT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_get_entry(biw.get(), &entry), MB_BI_OK);
+
+    // Stop before all of the entries are written
+    ASSERT_EQ(mb_bi_writer_close(biw.get()), MB_BI_FAILED);
+    ASSERT_EQ(mb_bi_writer_error(biw.get()), MB_BI_ERROR_PROGRAMMER_ERROR);
+    ASSERT_TRUE(data.empty());
+}
+
+TEST(AndroidWriterStreamingTest, NonSeekableOutputShouldFailWithoutStreaming)
+{
+    std::vector<unsigned char> data;
+    MbBiHeader *header;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    ASSERT_TRUE(!!biw);
+
+    ASSERT_EQ(mb_file_open_callbacks(file.get(), nullptr, nullptr, nullptr,
+                                     &pipe_write_cb, nullptr, nullptr, &data),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+    ASSERT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+    ASSERT_LT(mb_bi_writer_write_header(biw.get(), header), 0);
+}
+
+TEST(AndroidWriterCopyTest, CopyDataShouldMatchSourceImage)
+{
+    void *src_buf = nullptr;
+    size_t src_buf_size = 0;
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    ScopedFile src(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!src);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    ASSERT_TRUE(!!biw);
+
+    ASSERT_EQ(mb_file_open_memory_dynamic(src.get(), &src_buf, &src_buf_size),
+              MB_FILE_OK);
+    write_test_image(src.get());
+    ASSERT_EQ(mb_file_seek(src.get(), 0, SEEK_SET, nullptr), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_open_memory_dynamic(file.get(), &buf, &buf_size),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_bi_reader_enable_format_android(bir.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), src.get(), false), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+
+    MbBiHeader *header;
+    MbBiEntry *in_entry;
+    MbBiEntry *out_entry;
+    uint64_t n;
+    int ret;
+
+    ASSERT_EQ(mb_bi_reader_read_header(bir.get(), &header), MB_BI_OK);
+    ASSERT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+
+    // Entry data should not be read into a buffer
+    ASSERT_EQ(mb_file_set_stats_enabled(src.get(), true), MB_FILE_OK);
+
+    while ((ret = mb_bi_writer_get_entry(biw.get(), &out_entry)) == MB_BI_OK) {
+        int type = mb_bi_entry_type(out_entry);
+
+        ASSERT_EQ(mb_bi_writer_write_entry(biw.get(), out_entry), MB_BI_OK);
+        ASSERT_EQ(mb_bi_reader_go_to_entry(bir.get(), &in_entry, type),
+                  MB_BI_OK);
+        ASSERT_EQ(mb_bi_writer_copy_data(biw.get(), bir.get(), &n), MB_BI_OK);
+        ASSERT_EQ(n, 500);
+    }
+    ASSERT_EQ(ret, MB_BI_EOF);
+
+    ASSERT_EQ(mb_bi_writer_close(biw.get()), MB_BI_OK);
+
+    MbFileStats stats;
+    ASSERT_EQ(mb_file_get_stats(src.get(), &stats), MB_FILE_OK);
+    ASSERT_EQ(stats.ops[MB_FILE_STATS_OP_READ].bytes, 0);
+    ASSERT_GT(stats.ops[MB_FILE_STATS_OP_PEEK].calls, 0);
+
+    // Output, including the SHA1 ID, must match the source image
+    ASSERT_EQ(buf_size, src_buf_size);
+    ASSERT_EQ(memcmp(buf, src_buf, buf_size), 0);
+
+    bir.reset();
+    src.reset();
+    free(src_buf);
+    biw.reset();
+    file.reset();
+    free(buf);
+}
@@ -365,6 +365,110 @@ TEST(LokiOldFindGzipOffsetTest, MissingFlagsShouldWarn)
                        "No gzip headers found"));
 }
 
+// Tests for loki_old_find_gzip_offset_and_ramdisk_address()
+
+TEST(LokiOldFindGzipOffsetAndRamdiskAddressTest, ShellcodeBeforeStartOffsetShouldSucceed)
+{
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    AndroidHeader ahdr = {};
+
+    LokiHeader lhdr = {};
+    lhdr.ramdisk_addr = 0x82200000;
+
+    std::vector<unsigned char> data;
+    data.push_back(0x00);
+    data.insert(data.end(), LOKI_SHELLCODE,
+                LOKI_SHELLCODE + LOKI_SHELLCODE_SIZE - 5);
+    data.push_back(0xaa);
+    data.push_back(0xbb);
+    data.push_back(0xcc);
+    data.push_back(0xdd);
+    data.push_back(0x00);
+    size_t start_offset = data.size();
+    // Should be ignored since it's before the start offset
+    data[start_offset - 1] = 0x1f;
+    data.insert(data.end(), { 0x8b, 0x08, 0x08 });
+    data.insert(data.end(), { 0x1f, 0x8b, 0x08, 0x00 });
+    data.insert(data.end(), { 0x1f, 0x8b, 0x08, 0x08 });
+
+    uint64_t gzip_offset;
+    uint32_t ramdisk_addr;
+
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), data.data(), data.size()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(loki_old_find_gzip_offset_and_ramdisk_address(
+            bir.get(), file.get(), &ahdr, &lhdr, start_offset, &gzip_offset,
+            &ramdisk_addr), MB_BI_OK);
+
+    ASSERT_EQ(gzip_offset, start_offset + 7);
+    ASSERT_EQ(ramdisk_addr, 0xddccbbaa);
+}
+
+TEST(LokiOldFindGzipOffsetAndRamdiskAddressTest, OldImageShouldUseJflteAddress)
+{
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    AndroidHeader ahdr = {};
+    ahdr.kernel_addr = 0x80208000;
+
+    LokiHeader lhdr = {};
+
+    unsigned char data[] = {
+        0x1f, 0x8b, 0x08, 0x00,
+        0x1f, 0x8b, 0x08, 0x00,
+    };
+
+    uint64_t gzip_offset;
+    uint32_t ramdisk_addr;
+
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), data, sizeof(data)),
+              MB_FILE_OK);
+
+    ASSERT_EQ(loki_old_find_gzip_offset_and_ramdisk_address(
+            bir.get(), file.get(), &ahdr, &lhdr, 4, &gzip_offset,
+            &ramdisk_addr), MB_BI_OK);
+
+    ASSERT_EQ(gzip_offset, 4);
+    ASSERT_EQ(ramdisk_addr, ahdr.kernel_addr + 0x01ff8000);
+}
+
+TEST(LokiOldFindGzipOffsetAndRamdiskAddressTest, MissingShellcodeShouldWarn)
+{
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    AndroidHeader ahdr = {};
+
+    LokiHeader lhdr = {};
+    lhdr.ramdisk_addr = 0x82200000;
+
+    unsigned char data[] = {
+        0x1f, 0x8b, 0x08, 0x08,
+    };
+
+    uint64_t gzip_offset;
+    uint32_t ramdisk_addr;
+
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), data, sizeof(data)),
+              MB_FILE_OK);
+
+    ASSERT_EQ(loki_old_find_gzip_offset_and_ramdisk_address(
+            bir.get(), file.get(), &ahdr, &lhdr, 0, &gzip_offset,
+            &ramdisk_addr), MB_BI_WARN);
+    ASSERT_TRUE(strstr(mb_bi_reader_error_string(bir.get()),
+                       "Loki shellcode not found"));
+}
+
 // Tests for loki_old_find_ramdisk_size()
 
 TEST(LokiOldFindRamdiskSizeTest, ValidSamsungImageShouldSucceed)
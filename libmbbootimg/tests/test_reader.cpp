@@ -19,12 +19,137 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/defs.h"
 #include "mbbootimg/reader.h"
 #include "mbbootimg/reader_p.h"
 
 typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+
+// Unbuffered, non-peekable file that counts the reads performed on it
+struct CountingFile
+{
+    std::vector<unsigned char> data;
+    uint64_t pos = 0;
+    unsigned int n_read = 0;
+
+    static int read_cb(MbFile *file, void *userdata,
+                       void *buf, size_t size, size_t *bytes_read)
+    {
+        (void) file;
+        CountingFile *cf = static_cast<CountingFile *>(userdata);
+
+        size_t n = 0;
+        if (cf->pos < cf->data.size()) {
+            n = std::min<uint64_t>(size, cf->data.size() - cf->pos);
+            memcpy(buf, cf->data.data() + cf->pos, n);
+        }
+        cf->pos += n;
+        ++cf->n_read;
+        *bytes_read = n;
+        return MB_FILE_OK;
+    }
+
+    static int seek_cb(MbFile *file, void *userdata,
+                       int64_t offset, int whence, uint64_t *new_offset)
+    {
+        (void) file;
+        CountingFile *cf = static_cast<CountingFile *>(userdata);
+
+        switch (whence) {
+        case SEEK_SET:
+            cf->pos = offset;
+            break;
+        case SEEK_CUR:
+            cf->pos += offset;
+            break;
+        case SEEK_END:
+            cf->pos = cf->data.size() + offset;
+            break;
+        }
+        *new_offset = cf->pos;
+        return MB_FILE_OK;
+    }
+};
+
+static void open_counting_file(MbFile *file, CountingFile *cf)
+{
+    ASSERT_EQ(mb_file_set_read_callback(file, &CountingFile::read_cb),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_seek_callback(file, &CountingFile::seek_cb),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_callback_data(file, cf), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open(file), MB_FILE_OK);
+}
+
+// Bidder that checks for a magic at the start and end of the file
+struct TestBidder
+{
+    uint64_t trailer_offset;
+    unsigned int n_bids = 0;
+    bool found_header = false;
+    bool found_trailer = false;
+    bool peeked_trailer = false;
+
+    explicit TestBidder(uint64_t offset) : trailer_offset(offset)
+    {
+    }
+
+    static int bid_cb(MbBiReader *bir, void *userdata, int best_bid)
+    {
+        (void) best_bid;
+        TestBidder *tb = static_cast<TestBidder *>(userdata);
+        char buf[4];
+        size_t n;
+
+        ++tb->n_bids;
+
+        if (mb_file_read_fully(bir->file, buf, sizeof(buf), &n) != MB_FILE_OK) {
+            return MB_BI_FAILED;
+        }
+        tb->found_header = n == sizeof(buf) && memcmp(buf, "HEAD", 4) == 0;
+
+        if (mb_file_pread_fully(bir->file, buf, sizeof(buf),
+                                tb->trailer_offset, &n) != MB_FILE_OK) {
+            return MB_BI_FAILED;
+        }
+        tb->found_trailer = n == sizeof(buf) && memcmp(buf, "TAIL", 4) == 0;
+
+        // Only possible if the trailer can be accessed in place
+        const void *data;
+        tb->peeked_trailer = mb_file_peek(bir->file, tb->trailer_offset,
+                                          sizeof(buf), &data, &n) == MB_FILE_OK
+                && n == sizeof(buf) && memcmp(data, "TAIL", 4) == 0;
+
+        return tb->found_header && tb->found_trailer ? 64 : 0;
+    }
+};
+
+static void register_test_bidder(MbBiReader *bir, TestBidder *tb,
+                                 int type, const char *name)
+{
+    ASSERT_EQ(_mb_bi_reader_register_format(bir, tb, type,
+                                            name, &TestBidder::bid_cb,
+                                            nullptr, nullptr, nullptr,
+                                            nullptr, nullptr, nullptr,
+                                            nullptr, nullptr),
+              MB_BI_OK);
+}
 
 
 TEST(BootImgReaderTest, CheckInitialValues)
@@ -47,7 +172,158 @@ TEST(BootImgReaderTest, CheckInitialValues)
     ASSERT_EQ(bir->formats_len, 0);
     ASSERT_EQ(bir->format, nullptr);
 
+    // Probe window enabled
+    ASSERT_EQ(bir->probe_size, DEFAULT_PROBE_SIZE);
+
+    // Memory mapping disabled
+    ASSERT_FALSE(bir->use_mmap);
+
     // Header and entry allocated
     ASSERT_NE(bir->header, nullptr);
     ASSERT_NE(bir->entry, nullptr);
 }
+
+TEST(BootImgReaderTest, BiddersShouldShareProbeWindow)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+
+    CountingFile cf;
+    cf.data.resize(1024);
+    memcpy(cf.data.data(), "HEAD", 4);
+    memcpy(cf.data.data() + 1000, "TAIL", 4);
+    ASSERT_NO_FATAL_FAILURE(open_counting_file(file.get(), &cf));
+
+    TestBidder tb1(1000);
+    TestBidder tb2(1000);
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb1, MB_BI_FORMAT_ANDROID, "test1"));
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb2, MB_BI_FORMAT_BUMP, "test2"));
+
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+    ASSERT_EQ(tb1.n_bids, 1u);
+    ASSERT_EQ(tb2.n_bids, 1u);
+    ASSERT_TRUE(tb1.found_header && tb1.found_trailer);
+    ASSERT_TRUE(tb2.found_header && tb2.found_trailer);
+    ASSERT_STREQ(mb_bi_reader_format_name(bir.get()), "test1");
+
+    // The whole file fits in the window, so it should be read exactly once
+    // (plus the read that hits EOF)
+    ASSERT_EQ(cf.n_read, 2u);
+
+    // The reader should be handed the original file
+    ASSERT_EQ(bir->file, file.get());
+}
+
+TEST(BootImgReaderTest, ProbeWindowShouldFallBackToFile)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+
+    CountingFile cf;
+    cf.data.resize(16384);
+    memcpy(cf.data.data(), "HEAD", 4);
+    memcpy(cf.data.data() + 10000, "TAIL", 4);
+    ASSERT_NO_FATAL_FAILURE(open_counting_file(file.get(), &cf));
+
+    TestBidder tb1(10000);
+    TestBidder tb2(10000);
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb1, MB_BI_FORMAT_ANDROID, "test1"));
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb2, MB_BI_FORMAT_BUMP, "test2"));
+
+    ASSERT_EQ(mb_bi_reader_set_probe_size(bir.get(), 512), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+    ASSERT_TRUE(tb1.found_header && tb1.found_trailer);
+    ASSERT_TRUE(tb2.found_header && tb2.found_trailer);
+
+    // One read for the window and one for the trailer, which is then shared
+    ASSERT_EQ(cf.n_read, 2u);
+}
+
+TEST(BootImgReaderTest, DisabledProbeWindowShouldReadFileDirectly)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+
+    CountingFile cf;
+    cf.data.resize(1024);
+    memcpy(cf.data.data(), "HEAD", 4);
+    memcpy(cf.data.data() + 1000, "TAIL", 4);
+    ASSERT_NO_FATAL_FAILURE(open_counting_file(file.get(), &cf));
+
+    TestBidder tb1(1000);
+    TestBidder tb2(1000);
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb1, MB_BI_FORMAT_ANDROID, "test1"));
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb2, MB_BI_FORMAT_BUMP, "test2"));
+
+    ASSERT_EQ(mb_bi_reader_set_probe_size(bir.get(), 0), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open(bir.get(), file.get(), false), MB_BI_OK);
+    ASSERT_TRUE(tb1.found_header && tb1.found_trailer);
+    ASSERT_TRUE(tb2.found_header && tb2.found_trailer);
+
+    // Each bidder reads the header and the trailer separately
+    ASSERT_EQ(cf.n_read, 4u);
+}
+
+#ifndef _WIN32
+struct BootImgReaderFilenameTest : testing::Test
+{
+protected:
+    std::string _path;
+
+    virtual void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        _path = tmpdir ? tmpdir : "/tmp";
+        _path += "/mbbootimg_test_reader.XXXXXX";
+
+        int fd = mkstemp(&_path[0]);
+        ASSERT_GE(fd, 0);
+
+        // Trailer is past the default probe window
+        std::vector<unsigned char> data(128 * 1024);
+        memcpy(data.data(), "HEAD", 4);
+        memcpy(data.data() + 100000, "TAIL", 4);
+        ASSERT_EQ(write(fd, data.data(), data.size()),
+                  static_cast<ssize_t>(data.size()));
+        close(fd);
+    }
+
+    virtual void TearDown() override
+    {
+        unlink(_path.c_str());
+    }
+};
+
+TEST_F(BootImgReaderFilenameTest, ShouldNotMapFileByDefault)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    TestBidder tb(100000);
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb, MB_BI_FORMAT_ANDROID, "test"));
+
+    ASSERT_EQ(mb_bi_reader_open_filename(bir.get(), _path.c_str()), MB_BI_OK);
+    ASSERT_TRUE(tb.found_header && tb.found_trailer);
+    ASSERT_FALSE(tb.peeked_trailer);
+}
+
+TEST_F(BootImgReaderFilenameTest, ShouldMapRegularFileIfEnabled)
+{
+    ScopedReader bir(mb_bi_reader_new(), mb_bi_reader_free);
+    ASSERT_TRUE(!!bir);
+
+    TestBidder tb(100000);
+    ASSERT_NO_FATAL_FAILURE(register_test_bidder(bir.get(), &tb, MB_BI_FORMAT_ANDROID, "test"));
+
+    ASSERT_EQ(mb_bi_reader_set_use_mmap(bir.get(), true), MB_BI_OK);
+    ASSERT_EQ(mb_bi_reader_open_filename(bir.get(), _path.c_str()), MB_BI_OK);
+    ASSERT_TRUE(tb.found_header && tb.found_trailer);
+    ASSERT_TRUE(tb.peeked_trailer);
+}
+#endif
@@ -23,10 +23,12 @@
 
 #ifdef __cplusplus
 #  include <cstdarg>
+#  include <cstdbool>
 #  include <cstddef>
 #  include <cstdint>
 #else
 #  include <stdarg.h>
+#  include <stdbool.h>
 #  include <stddef.h>
 #  include <stdint.h>
 #endif
@@ -50,10 +52,50 @@ enum MbFileError
     MB_FILE_ERROR_INTERNAL_ERROR    = 4,
 };
 
+enum MbFileStatsOp
+{
+    MB_FILE_STATS_OP_READ           = 0,
+    MB_FILE_STATS_OP_WRITE          = 1,
+    MB_FILE_STATS_OP_SEEK           = 2,
+    MB_FILE_STATS_OP_TRUNCATE       = 3,
+    MB_FILE_STATS_OP_PEEK           = 4,
+    MB_FILE_STATS_OP_PREAD          = 5,
+    MB_FILE_STATS_OP_PWRITE         = 6,
+    MB_FILE_STATS_OP_MOVE           = 7,
+    MB_FILE_STATS_OP_READV          = 8,
+    MB_FILE_STATS_OP_WRITEV         = 9,
+    MB_FILE_STATS_OP_PREADV         = 10,
+    MB_FILE_STATS_OP_PWRITEV        = 11,
+    MB_FILE_STATS_OP_COPY           = 12,
+    MB_FILE_STATS_OP_COUNT          = 13,
+};
+
+#define MB_FILE_STATS_LATENCY_BUCKETS   7
+
+struct MbFileOpStats
+{
+    uint64_t calls;
+    uint64_t failures;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t latency[MB_FILE_STATS_LATENCY_BUCKETS];
+};
+
+struct MbFileStats
+{
+    struct MbFileOpStats ops[MB_FILE_STATS_OP_COUNT];
+};
+
 MB_BEGIN_C_DECLS
 
 struct MbFile;
 
+struct MbFileIoVec
+{
+    void *base;
+    size_t size;
+};
+
 typedef int (*MbFileOpenCb)(struct MbFile *file, void *userdata);
 typedef int (*MbFileCloseCb)(struct MbFile *file, void *userdata);
 typedef int (*MbFileReadCb)(struct MbFile *file, void *userdata,
@@ -67,6 +109,36 @@ typedef int (*MbFileSeekCb)(struct MbFile *file, void *userdata,
                             uint64_t *new_offset);
 typedef int (*MbFileTruncateCb)(struct MbFile *file, void *userdata,
                                 uint64_t size);
+typedef int (*MbFilePeekCb)(struct MbFile *file, void *userdata,
+                            uint64_t offset, size_t size,
+                            const void **buf, size_t *bytes_available);
+typedef int (*MbFilePreadCb)(struct MbFile *file, void *userdata,
+                             void *buf, size_t size, uint64_t offset,
+                             size_t *bytes_read);
+typedef int (*MbFilePwriteCb)(struct MbFile *file, void *userdata,
+                              const void *buf, size_t size, uint64_t offset,
+                              size_t *bytes_written);
+typedef int (*MbFileMoveCb)(struct MbFile *file, void *userdata,
+                            uint64_t src, uint64_t dest, uint64_t size,
+                            uint64_t *size_moved);
+typedef int (*MbFileCopyFromCb)(struct MbFile *file, void *userdata,
+                                struct MbFile *src, uint64_t src_offset,
+                                uint64_t size, uint64_t *size_copied);
+typedef void (*MbFileStatsReportCb)(struct MbFile *file,
+                                    const struct MbFileStats *stats,
+                                    void *userdata);
+typedef int (*MbFileReadvCb)(struct MbFile *file, void *userdata,
+                             const struct MbFileIoVec *iov, size_t iov_count,
+                             size_t *bytes_read);
+typedef int (*MbFileWritevCb)(struct MbFile *file, void *userdata,
+                              const struct MbFileIoVec *iov, size_t iov_count,
+                              size_t *bytes_written);
+typedef int (*MbFilePreadvCb)(struct MbFile *file, void *userdata,
+                              const struct MbFileIoVec *iov, size_t iov_count,
+                              uint64_t offset, size_t *bytes_read);
+typedef int (*MbFilePwritevCb)(struct MbFile *file, void *userdata,
+                               const struct MbFileIoVec *iov, size_t iov_count,
+                               uint64_t offset, size_t *bytes_written);
 
 // Handle creation/destruction
 MB_EXPORT struct MbFile * mb_file_new();
@@ -85,6 +157,24 @@ MB_EXPORT int mb_file_set_seek_callback(struct MbFile *file,
                                         MbFileSeekCb seek_cb);
 MB_EXPORT int mb_file_set_truncate_callback(struct MbFile *file,
                                             MbFileTruncateCb truncate_cb);
+MB_EXPORT int mb_file_set_peek_callback(struct MbFile *file,
+                                        MbFilePeekCb peek_cb);
+MB_EXPORT int mb_file_set_pread_callback(struct MbFile *file,
+                                         MbFilePreadCb pread_cb);
+MB_EXPORT int mb_file_set_pwrite_callback(struct MbFile *file,
+                                          MbFilePwriteCb pwrite_cb);
+MB_EXPORT int mb_file_set_move_callback(struct MbFile *file,
+                                        MbFileMoveCb move_cb);
+MB_EXPORT int mb_file_set_copy_from_callback(struct MbFile *file,
+                                             MbFileCopyFromCb copy_from_cb);
+MB_EXPORT int mb_file_set_readv_callback(struct MbFile *file,
+                                         MbFileReadvCb readv_cb);
+MB_EXPORT int mb_file_set_writev_callback(struct MbFile *file,
+                                          MbFileWritevCb writev_cb);
+MB_EXPORT int mb_file_set_preadv_callback(struct MbFile *file,
+                                          MbFilePreadvCb preadv_cb);
+MB_EXPORT int mb_file_set_pwritev_callback(struct MbFile *file,
+                                           MbFilePwritevCb pwritev_cb);
 MB_EXPORT int mb_file_set_callback_data(struct MbFile *file, void *userdata);
 
 // File open/close
@@ -96,9 +186,35 @@ MB_EXPORT int mb_file_read(struct MbFile *file, void *buf, size_t size,
                            size_t *bytes_read);
 MB_EXPORT int mb_file_write(struct MbFile *file, const void *buf, size_t size,
                             size_t *bytes_written);
+MB_EXPORT int mb_file_pread(struct MbFile *file, void *buf, size_t size,
+                            uint64_t offset, size_t *bytes_read);
+MB_EXPORT int mb_file_pwrite(struct MbFile *file, const void *buf, size_t size,
+                             uint64_t offset, size_t *bytes_written);
 MB_EXPORT int mb_file_seek(struct MbFile *file, int64_t offset, int whence,
                            uint64_t *new_offset);
 MB_EXPORT int mb_file_truncate(struct MbFile *file, uint64_t size);
+MB_EXPORT int mb_file_peek(struct MbFile *file, uint64_t offset, size_t size,
+                           const void **buf, size_t *bytes_available);
+MB_EXPORT int mb_file_readv(struct MbFile *file,
+                            const struct MbFileIoVec *iov, size_t iov_count,
+                            size_t *bytes_read);
+MB_EXPORT int mb_file_writev(struct MbFile *file,
+                             const struct MbFileIoVec *iov, size_t iov_count,
+                             size_t *bytes_written);
+MB_EXPORT int mb_file_preadv(struct MbFile *file,
+                             const struct MbFileIoVec *iov, size_t iov_count,
+                             uint64_t offset, size_t *bytes_read);
+MB_EXPORT int mb_file_pwritev(struct MbFile *file,
+                              const struct MbFileIoVec *iov, size_t iov_count,
+                              uint64_t offset, size_t *bytes_written);
+
+// Statistics
+MB_EXPORT int mb_file_set_stats_enabled(struct MbFile *file, bool enabled);
+MB_EXPORT int mb_file_get_stats(struct MbFile *file, struct MbFileStats *stats);
+MB_EXPORT const char * mb_file_stats_op_name(int op);
+MB_EXPORT char * mb_file_stats_to_string(const struct MbFileStats *stats);
+MB_EXPORT void mb_file_set_stats_report_callback(MbFileStatsReportCb report_cb,
+                                                 void *userdata);
 
 // Error handling functions
 MB_EXPORT int mb_file_error(struct MbFile *file);
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include "mbcommon/file/buffered.h"
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+struct BufferedFileCtx
+{
+    struct MbFile *inner;
+    bool owned;
+
+    // Shared read/write buffer. At most one of read_len and write_len is
+    // non-zero. The buffered data starts at file offset buf_offset.
+    char *buf;
+    size_t buf_size;
+    uint64_t buf_offset;
+    size_t read_len;
+    size_t write_len;
+
+    // Logical file position and file position of the underlying handle
+    uint64_t pos;
+    uint64_t inner_pos;
+};
+
+MB_END_C_DECLS
+/*! \endcond */
@@ -25,6 +25,9 @@
 #include <cstdio>
 
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 
 #ifdef _WIN32
 #  ifdef __cplusplus
@@ -105,11 +108,51 @@ struct SysVtable
                                    size_t count);
     typedef ssize_t (*PosixWriteFn)(void *userdata, int fd, const void *buf,
                                     size_t count);
+#ifndef _WIN32
+    typedef ssize_t (*PosixPread64Fn)(void *userdata, int fd, void *buf,
+                                      size_t count, off64_t offset);
+    typedef ssize_t (*PosixPwrite64Fn)(void *userdata, int fd, const void *buf,
+                                       size_t count, off64_t offset);
+#endif
+
+    // sys/uio.h
+#ifndef _WIN32
+    typedef ssize_t (*PosixReadvFn)(void *userdata, int fd,
+                                    const struct iovec *iov, int iovcnt);
+    typedef ssize_t (*PosixWritevFn)(void *userdata, int fd,
+                                     const struct iovec *iov, int iovcnt);
+    typedef ssize_t (*PosixPreadv64Fn)(void *userdata, int fd,
+                                       const struct iovec *iov, int iovcnt,
+                                       off64_t offset);
+    typedef ssize_t (*PosixPwritev64Fn)(void *userdata, int fd,
+                                        const struct iovec *iov, int iovcnt,
+                                        off64_t offset);
+#endif
     PosixCloseFn fn_close;
     PosixFtruncate64Fn fn_ftruncate64;
     PosixLseek64Fn fn_lseek64;
     PosixReadFn fn_read;
     PosixWriteFn fn_write;
+#ifndef _WIN32
+    PosixPread64Fn fn_pread64;
+    PosixPwrite64Fn fn_pwrite64;
+    PosixReadvFn fn_readv;
+    PosixWritevFn fn_writev;
+    PosixPreadv64Fn fn_preadv64;
+    PosixPwritev64Fn fn_pwritev64;
+#endif
+
+#ifdef __linux__
+    // Linux-specific
+    typedef ssize_t (*LinuxCopyFileRangeFn)(void *userdata, int fd_in,
+                                            off64_t *off_in, int fd_out,
+                                            off64_t *off_out, size_t len,
+                                            unsigned int flags);
+    typedef int (*LinuxFallocate64Fn)(void *userdata, int fd, int mode,
+                                      off64_t offset, off64_t len);
+    LinuxCopyFileRangeFn fn_copy_file_range;
+    LinuxFallocate64Fn fn_fallocate64;
+#endif
 
 #ifdef _WIN32
     // windows.h
@@ -21,6 +21,8 @@
 
 #include "mbcommon/guard_p.h"
 
+#include <atomic>
+
 #include "mbcommon/file.h"
 
 /*! \cond INTERNAL */
@@ -35,6 +37,22 @@ enum MbFileState : uint16_t
     ANY             = ANY_NONFATAL | FATAL,
 };
 
+// Counters are atomic so that positional I/O from multiple threads on the same
+// handle can be recorded. They are copied into MbFileOpStats on retrieval.
+struct MbFileOpStatsCounters
+{
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> latency[MB_FILE_STATS_LATENCY_BUCKETS];
+};
+
+struct MbFileStatsCounters
+{
+    MbFileOpStatsCounters ops[MB_FILE_STATS_OP_COUNT];
+};
+
 struct MbFile
 {
     uint16_t state;
@@ -46,10 +64,33 @@ struct MbFile
     MbFileWriteCb write_cb;
     MbFileSeekCb seek_cb;
     MbFileTruncateCb truncate_cb;
+    MbFilePeekCb peek_cb;
+    MbFilePreadCb pread_cb;
+    MbFilePwriteCb pwrite_cb;
+    MbFileMoveCb move_cb;
+    MbFileCopyFromCb copy_from_cb;
+    MbFileReadvCb readv_cb;
+    MbFileWritevCb writev_cb;
+    MbFilePreadvCb preadv_cb;
+    MbFilePwritevCb pwritev_cb;
     void *cb_userdata;
 
+    // Statistics (NULL if disabled)
+    struct MbFileStatsCounters *stats;
+    bool stats_report;
+
     // Error
     int error_code;
     char *error_string;
 };
+
+MB_BEGIN_C_DECLS
+
+int _mb_file_move_native(struct MbFile *file, uint64_t src, uint64_t dest,
+                         uint64_t size, uint64_t *size_moved);
+int _mb_file_copy_from_native(struct MbFile *file, struct MbFile *src,
+                              uint64_t src_offset, uint64_t size,
+                              uint64_t *size_copied);
+
+MB_END_C_DECLS
 /*! \endcond */
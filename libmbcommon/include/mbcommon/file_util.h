@@ -25,6 +25,10 @@ MB_BEGIN_C_DECLS
 
 typedef int (*MbFileSearchResultCallback)(struct MbFile *file, void *userdata,
                                           uint64_t offset);
+typedef int (*MbFileMultiSearchResultCallback)(struct MbFile *file,
+                                               void *userdata,
+                                               size_t pattern_id,
+                                               uint64_t offset);
 
 MB_EXPORT int mb_file_read_fully(struct MbFile *file,
                                  void *buf, size_t size,
@@ -33,6 +37,20 @@ MB_EXPORT int mb_file_write_fully(struct MbFile *file,
                                   const void *buf, size_t size,
                                   size_t *bytes_written);
 
+MB_EXPORT int mb_file_readv_fully(struct MbFile *file,
+                                  const struct MbFileIoVec *iov,
+                                  size_t iov_count, size_t *bytes_read);
+MB_EXPORT int mb_file_writev_fully(struct MbFile *file,
+                                   const struct MbFileIoVec *iov,
+                                   size_t iov_count, size_t *bytes_written);
+
+MB_EXPORT int mb_file_pread_fully(struct MbFile *file,
+                                  void *buf, size_t size, uint64_t offset,
+                                  size_t *bytes_read);
+MB_EXPORT int mb_file_pwrite_fully(struct MbFile *file,
+                                   const void *buf, size_t size,
+                                   uint64_t offset, size_t *bytes_written);
+
 MB_EXPORT int mb_file_read_discard(struct MbFile *file, uint64_t size,
                                    uint64_t *bytes_discarded);
 
@@ -42,7 +60,18 @@ MB_EXPORT int mb_file_search(struct MbFile *file, int64_t start, int64_t end,
                              MbFileSearchResultCallback result_cb,
                              void *userdata);
 
+MB_EXPORT int mb_file_search_multi(struct MbFile *file,
+                                   int64_t start, int64_t end,
+                                   size_t bsize, const void * const *patterns,
+                                   const size_t *pattern_sizes,
+                                   size_t num_patterns, int64_t max_matches,
+                                   MbFileMultiSearchResultCallback result_cb,
+                                   void *userdata);
+
 MB_EXPORT int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
                            uint64_t size, uint64_t *size_moved);
+MB_EXPORT int mb_file_copy_from(struct MbFile *file, struct MbFile *src,
+                                uint64_t src_offset, uint64_t size,
+                                uint64_t *size_copied);
 
 MB_END_C_DECLS
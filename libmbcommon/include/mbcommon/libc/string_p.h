@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/guard_p.h"
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+        && (defined(__x86_64__) || defined(__i386__))
+#  define MB_MEMMEM_HAVE_X86 1
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+        && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#  define MB_MEMMEM_HAVE_NEON 1
+#endif
+
+/*! \cond INTERNAL */
+MB_BEGIN_C_DECLS
+
+typedef void * (*MbMemmemFn)(const void *haystack, size_t haystacklen,
+                             const void *needle, size_t needlelen);
+
+enum MbMemmemImpl
+{
+    MB_MEMMEM_IMPL_GENERIC,
+    MB_MEMMEM_IMPL_SSE2,
+    MB_MEMMEM_IMPL_AVX2,
+    MB_MEMMEM_IMPL_NEON,
+    MB_MEMMEM_IMPL_COUNT
+};
+
+// libc (or bundled musl) implementation
+void * _mb_memmem_generic(const void *haystack, size_t haystacklen,
+                          const void *needle, size_t needlelen);
+
+#ifdef MB_MEMMEM_HAVE_X86
+void * _mb_memmem_sse2(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen);
+void * _mb_memmem_avx2(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen);
+#endif
+
+#ifdef MB_MEMMEM_HAVE_NEON
+void * _mb_memmem_neon(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen);
+#endif
+
+// Get implementation if it is supported by the compiler and the CPU
+MbMemmemFn _mb_memmem_get_impl(MbMemmemImpl impl);
+const char * _mb_memmem_impl_name(MbMemmemImpl impl);
+
+MB_END_C_DECLS
+/*! \endcond */
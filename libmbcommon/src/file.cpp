@@ -19,9 +19,15 @@
 
 #include "mbcommon/file.h"
 
+#include <chrono>
+#include <new>
+#include <string>
+
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "mbcommon/file_p.h"
 #include "mbcommon/string.h"
@@ -261,6 +267,403 @@
  *   * Return \<= #MB_FILE_WARN if an error occurs
  */
 
+/*!
+ * \typedef MbFilePeekCb
+ *
+ * \brief File peek callback
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] offset Offset of data
+ * \param[in] size Number of bytes requested
+ * \param[out] buf Output pointer to data at \p offset. This parameter is
+ *                 guaranteed to be non-NULL.
+ * \param[out] bytes_available Output number of bytes available at \p buf. This
+ *                             may be less than \p size only if EOF is reached.
+ *                             This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if the data is available
+ *   * Return #MB_FILE_UNSUPPORTED if the file cannot provide direct access to
+ *     its data (Not registering a peek callback has the same effect.)
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFilePreadCb
+ *
+ * \brief File positional read callback
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the file does not support reading
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFilePwriteCb
+ *
+ * \brief File positional write callback
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] buf Buffer to write from
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were written
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the file does not support writing
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFileMoveCb
+ *
+ * \brief File move callback
+ *
+ * This callback provides a faster implementation of mb_file_move() for
+ * handles that can move data without copying it through userspace. It has the
+ * same semantics as mb_file_move(), except that it is never called when
+ * \p src == \p dest or \p size == 0.
+ *
+ * The callback may decline to handle a particular move (eg. because the
+ * underlying filesystem does not support the operation) by returning
+ * #MB_FILE_UNSUPPORTED *before* modifying the file. mb_file_move() will then
+ * fall back to copying the data with mb_file_pread() and mb_file_pwrite().
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] src Source offset
+ * \param[in] dest Destination offset
+ * \param[in] size Size of data to move
+ * \param[out] size_moved Output size of data that was moved. This parameter is
+ *                        guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if the data was moved
+ *   * Return #MB_FILE_UNSUPPORTED if the move should be done by copying
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFileCopyFromCb
+ *
+ * \brief File copy callback
+ *
+ * This callback provides a faster implementation of mb_file_copy_from() for
+ * handles that can copy data from another handle without going through
+ * userspace. Data is read from \p src at \p src_offset and written at the
+ * current file position of \p file, which is advanced by the number of bytes
+ * copied. The file position of \p src is not changed. The callback is never
+ * called when \p size == 0.
+ *
+ * The callback may decline to handle a particular copy (eg. because \p src is
+ * a different type of handle) by returning #MB_FILE_UNSUPPORTED *before*
+ * modifying the file. mb_file_copy_from() will then fall back to copying the
+ * data itself.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] src Source MbFile handle
+ * \param[in] src_offset Offset of data in \p src
+ * \param[in] size Size of data to copy
+ * \param[out] size_copied Output size of data that was copied. This may be
+ *                         less than \p size only if EOF is reached in \p src.
+ *                         This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if the data was copied
+ *   * Return #MB_FILE_UNSUPPORTED if the data should be copied through a buffer
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \struct MbFileIoVec
+ *
+ * \brief Buffer descriptor for vectored I/O
+ *
+ * This has the same meaning as `struct iovec` from `sys/uio.h`, but is
+ * available on all platforms. For writes, the data at \p base is not modified.
+ */
+
+/*!
+ * \typedef MbFileReadvCb
+ *
+ * \brief File vectored read callback
+ *
+ * The callback fills the buffers in order, as with `readv()`. If it returns
+ * #MB_FILE_UNSUPPORTED, mb_file_readv() will be emulated with mb_file_read().
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to read into
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the read should be emulated
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFileWritevCb
+ *
+ * \brief File vectored write callback
+ *
+ * The callback writes the buffers in order, as with `writev()`. If it returns
+ * #MB_FILE_UNSUPPORTED, mb_file_writev() will be emulated with mb_file_write().
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to write from
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were written
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the write should be emulated
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFilePreadvCb
+ *
+ * \brief File positional vectored read callback
+ *
+ * If this callback returns #MB_FILE_UNSUPPORTED, mb_file_preadv() will be
+ * emulated with mb_file_pread().
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to read into
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[in] offset Offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the read should be emulated
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \typedef MbFilePwritevCb
+ *
+ * \brief File positional vectored write callback
+ *
+ * If this callback returns #MB_FILE_UNSUPPORTED, mb_file_pwritev() will be
+ * emulated with mb_file_pwrite().
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to write from
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[in] offset Offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter is guaranteed to be non-NULL.
+ *
+ * \return
+ *   * Return #MB_FILE_OK if some bytes were written
+ *   * Return #MB_FILE_RETRY if the same operation should be reattempted
+ *   * Return #MB_FILE_UNSUPPORTED if the write should be emulated
+ *   * Return \<= #MB_FILE_WARN if an error occurs
+ */
+
+/*!
+ * \enum MbFileStatsOp
+ *
+ * \brief File operations tracked by #MbFileStats
+ */
+
+/*!
+ * \struct MbFileOpStats
+ *
+ * \brief Statistics for a single file operation
+ *
+ * \var MbFileOpStats::calls
+ * Number of times the operation was called
+ *
+ * \var MbFileOpStats::failures
+ * Number of calls that returned \<= #MB_FILE_WARN
+ *
+ * \var MbFileOpStats::bytes
+ * Number of bytes read, written, peeked, moved, or copied
+ *
+ * \var MbFileOpStats::total_ns
+ * Total time spent in the operation in nanoseconds
+ *
+ * \var MbFileOpStats::latency
+ * Latency histogram. Bucket `i` counts the calls that took less than `10^i`
+ * microseconds. The last bucket counts all remaining calls (\>= 100ms).
+ */
+
+/*!
+ * \struct MbFileStats
+ *
+ * \brief Statistics for an MbFile handle
+ *
+ * \var MbFileStats::ops
+ * Statistics for each operation, indexed by #MbFileStatsOp
+ */
+
+/*!
+ * \typedef MbFileStatsReportCb
+ *
+ * \brief Statistics report callback
+ *
+ * \param file MbFile handle that was closed
+ * \param stats Statistics for \p file
+ * \param userdata User callback data
+ */
+
+typedef std::chrono::steady_clock StatsClock;
+
+static MbFileStatsReportCb g_stats_report_cb;
+static void *g_stats_report_userdata;
+
+static const char *g_stats_op_names[] = {
+    "read",
+    "write",
+    "seek",
+    "truncate",
+    "peek",
+    "pread",
+    "pwrite",
+    "move",
+    "readv",
+    "writev",
+    "preadv",
+    "pwritev",
+    "copy",
+};
+
+static_assert(sizeof(g_stats_op_names) / sizeof(g_stats_op_names[0])
+                      == MB_FILE_STATS_OP_COUNT,
+              "Missing statistics operation names");
+
+// Upper bound of each latency bucket, except the last one
+static const char *g_stats_latency_names[] = {
+    "<1us",
+    "<10us",
+    "<100us",
+    "<1ms",
+    "<10ms",
+    "<100ms",
+    ">=100ms",
+};
+
+static_assert(sizeof(g_stats_latency_names) / sizeof(g_stats_latency_names[0])
+                      == MB_FILE_STATS_LATENCY_BUCKETS,
+              "Missing latency bucket names");
+
+/*!
+ * \brief Check if statistics should be collected and reported for all handles
+ *
+ * Statistics are enabled for every new handle if the `MB_FILE_STATS`
+ * environment variable is set to a non-empty value other than `0`. The
+ * variable is only read once per process.
+ */
+static bool stats_env_enabled()
+{
+    static const bool enabled = []{
+        const char *value = getenv("MB_FILE_STATS");
+        return value && *value && strcmp(value, "0") != 0;
+    }();
+    return enabled;
+}
+
+static struct MbFileStatsCounters * stats_new()
+{
+    // Value-initialization zeroes the counters
+    return new(std::nothrow) MbFileStatsCounters();
+}
+
+static inline StatsClock::time_point stats_start(struct MbFile *file)
+{
+    return file->stats ? StatsClock::now() : StatsClock::time_point();
+}
+
+static void stats_record(struct MbFile *file, MbFileStatsOp op,
+                         StatsClock::time_point start, int ret,
+                         uint64_t bytes)
+{
+    if (!file->stats) {
+        return;
+    }
+
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            StatsClock::now() - start).count();
+    MbFileOpStatsCounters *op_stats = &file->stats->ops[op];
+
+    // The counters are independent, so no ordering is needed
+    op_stats->calls.fetch_add(1, std::memory_order_relaxed);
+    if (ret <= MB_FILE_WARN) {
+        op_stats->failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    op_stats->bytes.fetch_add(bytes, std::memory_order_relaxed);
+    op_stats->total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    // Buckets are powers of 10, starting at 1us
+    size_t bucket = 0;
+    for (uint64_t limit = 1000; bucket < MB_FILE_STATS_LATENCY_BUCKETS - 1
+            && ns >= limit; limit *= 10) {
+        ++bucket;
+    }
+    op_stats->latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void stats_copy(const struct MbFileStatsCounters *counters,
+                       struct MbFileStats *stats)
+{
+    for (int op = 0; op < MB_FILE_STATS_OP_COUNT; ++op) {
+        const MbFileOpStatsCounters *src = &counters->ops[op];
+        MbFileOpStats *dest = &stats->ops[op];
+
+        dest->calls = src->calls.load(std::memory_order_relaxed);
+        dest->failures = src->failures.load(std::memory_order_relaxed);
+        dest->bytes = src->bytes.load(std::memory_order_relaxed);
+        dest->total_ns = src->total_ns.load(std::memory_order_relaxed);
+
+        for (int i = 0; i < MB_FILE_STATS_LATENCY_BUCKETS; ++i) {
+            dest->latency[i] = src->latency[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void stats_report(struct MbFile *file)
+{
+    // libmbcommon has no logger, so reports are only delivered to the
+    // application's callback
+    if (g_stats_report_cb) {
+        MbFileStats stats;
+        stats_copy(file->stats, &stats);
+        g_stats_report_cb(file, &stats, g_stats_report_userdata);
+    }
+}
+
 MB_BEGIN_C_DECLS
 
 /*!
@@ -275,6 +678,12 @@ struct MbFile * mb_file_new()
             calloc(1, sizeof(struct MbFile)));
     if (file) {
         file->state = MbFileState::NEW;
+
+        // Statistics are optional, so allocation failures are not fatal
+        if (stats_env_enabled()) {
+            file->stats = stats_new();
+            file->stats_report = !!file->stats;
+        }
     }
     return file;
 }
@@ -301,6 +710,7 @@ int mb_file_free(struct MbFile *file)
         }
 
         free(file->error_string);
+        delete file->stats;
         free(file);
     }
 
@@ -411,83 +821,267 @@ int mb_file_set_truncate_callback(struct MbFile *file,
 }
 
 /*!
- * \brief Set the data to provide to callbacks for an MbFile handle.
+ * \brief Set the file peek callback for an MbFile handle.
  *
  * \param file MbFile handle
- * \param userdata User-provided data pointer for callbacks
+ * \param peek_cb File peek callback
  *
  * \return
- *   * #MB_FILE_OK if the userdata was successfully set
+ *   * #MB_FILE_OK if the callback was successfully set
  *   * #MB_FILE_FATAL if the file has already been opened
  */
-int mb_file_set_callback_data(struct MbFile *file, void *userdata)
+int mb_file_set_peek_callback(struct MbFile *file, MbFilePeekCb peek_cb)
 {
     ENSURE_STATE(file, MbFileState::NEW);
-    file->cb_userdata = userdata;
+    file->peek_cb = peek_cb;
     return MB_FILE_OK;
 }
 
 /*!
- * \brief Open an MbFile handle.
+ * \brief Set the file positional read callback for an MbFile handle.
  *
- * Once the handle has been opened, the file operation functions, such as
- * mb_file_read(), are available to use. It will no longer be possible to set
- * the callback functions for this handle.
+ * If no positional read callback is set, mb_file_pread() will be emulated with
+ * mb_file_seek() and mb_file_read().
  *
  * \param file MbFile handle
+ * \param pread_cb File positional read callback
  *
  * \return
- *   * #MB_FILE_OK if there is no file open handle or if the file open handle
- *     succeeds
- *   * \<= #MB_FILE_WARN if an error occurs
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
  */
-int mb_file_open(struct MbFile *file)
+int mb_file_set_pread_callback(struct MbFile *file, MbFilePreadCb pread_cb)
 {
-    int ret = MB_FILE_OK;
-
     ENSURE_STATE(file, MbFileState::NEW);
+    file->pread_cb = pread_cb;
+    return MB_FILE_OK;
+}
 
-    if (file->open_cb) {
-        ret = file->open_cb(file, file->cb_userdata);
-    }
-    if (ret == MB_FILE_OK) {
-        file->state = MbFileState::OPENED;
-    } else if (ret <= MB_FILE_FATAL) {
-        file->state = MbFileState::FATAL;
-    }
-
-    // If the file was not successfully opened, then close it
-    if (ret != MB_FILE_OK && file->close_cb) {
-        file->close_cb(file, file->cb_userdata);
-    }
-
-    return ret;
+/*!
+ * \brief Set the file positional write callback for an MbFile handle.
+ *
+ * If no positional write callback is set, mb_file_pwrite() will be emulated
+ * with mb_file_seek() and mb_file_write().
+ *
+ * \param file MbFile handle
+ * \param pwrite_cb File positional write callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_pwrite_callback(struct MbFile *file, MbFilePwriteCb pwrite_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->pwrite_cb = pwrite_cb;
+    return MB_FILE_OK;
 }
 
 /*!
- * \brief Close an MbFile handle.
+ * \brief Set the file move callback for an MbFile handle.
  *
- * This function will close an MbFile handle if it is open. Regardless of the
- * return value, the handle is closed and can no longer be used for further
- * operations. It should be freed with mb_file_free().
+ * If no move callback is set, mb_file_move() will copy the data with
+ * mb_file_pread() and mb_file_pwrite().
  *
  * \param file MbFile handle
+ * \param move_cb File move callback
  *
  * \return
- *   * #MB_FILE_OK if no error was encountered when closing the handle.
- *   * \<= #MB_FILE_WARN if the handle is opened and an error occurs while
- *     closing the file
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
  */
-int mb_file_close(struct MbFile *file)
+int mb_file_set_move_callback(struct MbFile *file, MbFileMoveCb move_cb)
 {
-    int ret = MB_FILE_OK;
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->move_cb = move_cb;
+    return MB_FILE_OK;
+}
 
-    // Avoid double-closing or closing nothing
+/*!
+ * \brief Set the file copy callback for an MbFile handle.
+ *
+ * If no copy callback is set, mb_file_copy_from() will copy the data with
+ * mb_file_peek() or mb_file_pread() on the source handle and mb_file_write().
+ *
+ * \param file MbFile handle
+ * \param copy_from_cb File copy callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_copy_from_callback(struct MbFile *file,
+                                   MbFileCopyFromCb copy_from_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->copy_from_cb = copy_from_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file vectored read callback for an MbFile handle.
+ *
+ * If no vectored read callback is set, mb_file_readv() will be emulated with
+ * mb_file_read().
+ *
+ * \param file MbFile handle
+ * \param readv_cb File vectored read callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_readv_callback(struct MbFile *file, MbFileReadvCb readv_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->readv_cb = readv_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file vectored write callback for an MbFile handle.
+ *
+ * If no vectored write callback is set, mb_file_writev() will be emulated
+ * with mb_file_write().
+ *
+ * \param file MbFile handle
+ * \param writev_cb File vectored write callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_writev_callback(struct MbFile *file, MbFileWritevCb writev_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->writev_cb = writev_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file positional vectored read callback for an MbFile handle.
+ *
+ * If no positional vectored read callback is set, mb_file_preadv() will be
+ * emulated with mb_file_pread().
+ *
+ * \param file MbFile handle
+ * \param preadv_cb File positional vectored read callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_preadv_callback(struct MbFile *file, MbFilePreadvCb preadv_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->preadv_cb = preadv_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the file positional vectored write callback for an MbFile handle.
+ *
+ * If no positional vectored write callback is set, mb_file_pwritev() will be
+ * emulated with mb_file_pwrite().
+ *
+ * \param file MbFile handle
+ * \param pwritev_cb File positional vectored write callback
+ *
+ * \return
+ *   * #MB_FILE_OK if the callback was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_pwritev_callback(struct MbFile *file,
+                                 MbFilePwritevCb pwritev_cb)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->pwritev_cb = pwritev_cb;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Set the data to provide to callbacks for an MbFile handle.
+ *
+ * \param file MbFile handle
+ * \param userdata User-provided data pointer for callbacks
+ *
+ * \return
+ *   * #MB_FILE_OK if the userdata was successfully set
+ *   * #MB_FILE_FATAL if the file has already been opened
+ */
+int mb_file_set_callback_data(struct MbFile *file, void *userdata)
+{
+    ENSURE_STATE(file, MbFileState::NEW);
+    file->cb_userdata = userdata;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Open an MbFile handle.
+ *
+ * Once the handle has been opened, the file operation functions, such as
+ * mb_file_read(), are available to use. It will no longer be possible to set
+ * the callback functions for this handle.
+ *
+ * \param file MbFile handle
+ *
+ * \return
+ *   * #MB_FILE_OK if there is no file open handle or if the file open handle
+ *     succeeds
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open(struct MbFile *file)
+{
+    int ret = MB_FILE_OK;
+
+    ENSURE_STATE(file, MbFileState::NEW);
+
+    if (file->open_cb) {
+        ret = file->open_cb(file, file->cb_userdata);
+    }
+    if (ret == MB_FILE_OK) {
+        file->state = MbFileState::OPENED;
+    } else if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    // If the file was not successfully opened, then close it
+    if (ret != MB_FILE_OK && file->close_cb) {
+        file->close_cb(file, file->cb_userdata);
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Close an MbFile handle.
+ *
+ * This function will close an MbFile handle if it is open. Regardless of the
+ * return value, the handle is closed and can no longer be used for further
+ * operations. It should be freed with mb_file_free().
+ *
+ * \param file MbFile handle
+ *
+ * \return
+ *   * #MB_FILE_OK if no error was encountered when closing the handle.
+ *   * \<= #MB_FILE_WARN if the handle is opened and an error occurs while
+ *     closing the file
+ */
+int mb_file_close(struct MbFile *file)
+{
+    int ret = MB_FILE_OK;
+
+    // Avoid double-closing or closing nothing
     if (!(file->state & (MbFileState::CLOSED | MbFileState::NEW))) {
         if (file->close_cb) {
             ret = file->close_cb(file, file->cb_userdata);
         }
 
+        if (file->stats_report) {
+            stats_report(file);
+            file->stats_report = false;
+        }
+
         // Don't change state to MbFileState::FATAL if MB_FILE_FATAL is
         // returned. Otherwise, we risk double-closing the file. CLOSED and
         // FATAL are the same anyway, aside from the fact that files can be
@@ -536,6 +1130,8 @@ int mb_file_read(struct MbFile *file, void *buf, size_t size,
 
     ENSURE_STATE(file, MbFileState::OPENED);
 
+    StatsClock::time_point start = stats_start(file);
+
     if (!bytes_read) {
         mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
                           "%s: bytes_read is NULL",
@@ -548,6 +1144,8 @@ int mb_file_read(struct MbFile *file, void *buf, size_t size,
                           "%s: No read callback registered",
                           __func__);
     }
+    stats_record(file, MB_FILE_STATS_OP_READ, start, ret,
+                 ret == MB_FILE_OK ? *bytes_read : 0);
     if (ret <= MB_FILE_FATAL) {
         file->state = MbFileState::FATAL;
     }
@@ -585,6 +1183,8 @@ int mb_file_write(struct MbFile *file, const void *buf, size_t size,
 
     ENSURE_STATE(file, MbFileState::OPENED);
 
+    StatsClock::time_point start = stats_start(file);
+
     if (!bytes_written) {
         mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
                           "%s: bytes_written is NULL",
@@ -597,6 +1197,8 @@ int mb_file_write(struct MbFile *file, const void *buf, size_t size,
                           "%s: No write callback registered",
                           __func__);
     }
+    stats_record(file, MB_FILE_STATS_OP_WRITE, start, ret,
+                 ret == MB_FILE_OK ? *bytes_written : 0);
     if (ret <= MB_FILE_FATAL) {
         file->state = MbFileState::FATAL;
     }
@@ -625,6 +1227,8 @@ int mb_file_seek(struct MbFile *file, int64_t offset, int whence,
 
     ENSURE_STATE(file, MbFileState::OPENED);
 
+    StatsClock::time_point start = stats_start(file);
+
     if (file->seek_cb) {
         ret = file->seek_cb(file, file->cb_userdata, offset, whence,
                             &new_offset_temp);
@@ -633,6 +1237,7 @@ int mb_file_seek(struct MbFile *file, int64_t offset, int whence,
                           "%s: No seek callback registered",
                           __func__);
     }
+    stats_record(file, MB_FILE_STATS_OP_SEEK, start, ret, 0);
     if (ret == MB_FILE_OK) {
         if (new_offset) {
             *new_offset = new_offset_temp;
@@ -665,6 +1270,8 @@ int mb_file_truncate(struct MbFile *file, uint64_t size)
 
     ENSURE_STATE(file, MbFileState::OPENED);
 
+    StatsClock::time_point start = stats_start(file);
+
     if (file->truncate_cb) {
         ret = file->truncate_cb(file, file->cb_userdata, size);
     } else {
@@ -672,6 +1279,162 @@ int mb_file_truncate(struct MbFile *file, uint64_t size)
                           "%s: No truncate callback registered",
                           __func__);
     }
+    stats_record(file, MB_FILE_STATS_OP_TRUNCATE, start, ret, 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Get direct access to the data backing an MbFile handle.
+ *
+ * For handles backed by memory or a memory mapping, this returns a pointer to
+ * the data at \p offset without copying it. This allows data to be scanned in
+ * place. Callers should fall back to mb_file_read() if #MB_FILE_UNSUPPORTED is
+ * returned.
+ *
+ * \note The returned pointer is only valid until the next write, truncate, or
+ *       close operation on the handle. The file position is not changed.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] offset Offset of data
+ * \param[in] size Number of bytes requested
+ * \param[out] buf Output pointer to data at \p offset. This parameter cannot be
+ *                 NULL.
+ * \param[out] bytes_available Output number of bytes available at \p buf. This
+ *                             is less than \p size only if EOF is reached. This
+ *                             parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if the data is available
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support peeking
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_peek(struct MbFile *file, uint64_t offset, size_t size,
+                 const void **buf, size_t *bytes_available)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!buf || !bytes_available) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: buf or bytes_available is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (file->peek_cb) {
+        ret = file->peek_cb(file, file->cb_userdata, offset, size, buf,
+                            bytes_available);
+    } else {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "%s: No peek callback registered",
+                          __func__);
+    }
+    stats_record(file, MB_FILE_STATS_OP_PEEK, start, ret,
+                 ret == MB_FILE_OK ? *bytes_available : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Save the file position and seek to \p offset
+ *
+ * Used for emulating positional I/O on handles without native support.
+ */
+static int emulate_seek_to(struct MbFile *file, uint64_t offset,
+                           uint64_t *orig_offset)
+{
+    int ret;
+
+    if (offset > INT64_MAX) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset %" PRIu64 " exceeds INT64_MAX", offset);
+        return MB_FILE_FAILED;
+    }
+
+    ret = mb_file_seek(file, 0, SEEK_CUR, orig_offset);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    return mb_file_seek(file, static_cast<int64_t>(offset), SEEK_SET, nullptr);
+}
+
+/*!
+ * \brief Restore the file position saved by emulate_seek_to()
+ *
+ * \return \p ret if the position was restored. Otherwise, the result of the
+ *         failed seek.
+ */
+static int emulate_restore(struct MbFile *file, uint64_t orig_offset, int ret)
+{
+    // Don't touch the handle if the operation failed fatally
+    if (ret <= MB_FILE_FATAL) {
+        return ret;
+    }
+
+    int seek_ret = mb_file_seek(file, static_cast<int64_t>(orig_offset),
+                                SEEK_SET, nullptr);
+    return seek_ret == MB_FILE_OK ? ret : seek_ret;
+}
+
+/*!
+ * \brief Read from an MbFile handle at a specific offset.
+ *
+ * This function reads from \p offset without changing the file position. If
+ * the handle source does not provide a positional read callback, the operation
+ * is emulated by saving the file position, seeking, reading, and restoring the
+ * file position.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support reading or
+ *     seeking
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pread(struct MbFile *file, void *buf, size_t size,
+                  uint64_t offset, size_t *bytes_read)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_read) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_read is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (file->pread_cb) {
+        ret = file->pread_cb(file, file->cb_userdata, buf, size, offset,
+                             bytes_read);
+    } else {
+        uint64_t orig_offset;
+
+        ret = emulate_seek_to(file, offset, &orig_offset);
+        if (ret == MB_FILE_OK) {
+            ret = mb_file_read(file, buf, size, bytes_read);
+            ret = emulate_restore(file, orig_offset, ret);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_PREAD, start, ret,
+                 ret == MB_FILE_OK ? *bytes_read : 0);
     if (ret <= MB_FILE_FATAL) {
         file->state = MbFileState::FATAL;
     }
@@ -679,6 +1442,629 @@ int mb_file_truncate(struct MbFile *file, uint64_t size)
     return ret;
 }
 
+/*!
+ * \brief Write to an MbFile handle at a specific offset.
+ *
+ * This function writes to \p offset without changing the file position. If the
+ * handle source does not provide a positional write callback, the operation is
+ * emulated by saving the file position, seeking, writing, and restoring the
+ * file position.
+ *
+ * \note As with `pwrite()`, the behavior for handles opened in append mode is
+ *       implementation-defined.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] buf Buffer to write from
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were written
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support writing or
+ *     seeking
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pwrite(struct MbFile *file, const void *buf, size_t size,
+                   uint64_t offset, size_t *bytes_written)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_written) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_written is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (file->pwrite_cb) {
+        ret = file->pwrite_cb(file, file->cb_userdata, buf, size, offset,
+                              bytes_written);
+    } else {
+        uint64_t orig_offset;
+
+        ret = emulate_seek_to(file, offset, &orig_offset);
+        if (ret == MB_FILE_OK) {
+            ret = mb_file_write(file, buf, size, bytes_written);
+            ret = emulate_restore(file, orig_offset, ret);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_PWRITE, start, ret,
+                 ret == MB_FILE_OK ? *bytes_written : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Check that the total size of the buffers in \p iov fits in a `size_t`
+ */
+static bool check_iov_size(struct MbFile *file, const struct MbFileIoVec *iov,
+                           size_t iov_count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < iov_count; ++i) {
+        if (iov[i].size > SIZE_MAX - total) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Total size of I/O vector overflows");
+            return false;
+        }
+        total += iov[i].size;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Emulate a vectored read with one read per buffer
+ *
+ * Like `readv()`, a partial read is reported as success. The error, if any,
+ * will be returned by the next read.
+ */
+static int emulate_readv(struct MbFile *file, const struct MbFileIoVec *iov,
+                         size_t iov_count, bool positional, uint64_t offset,
+                         size_t *bytes_read)
+{
+    size_t total = 0;
+    int ret = MB_FILE_OK;
+
+    for (size_t i = 0; i < iov_count; ++i) {
+        size_t n;
+
+        if (iov[i].size == 0) {
+            continue;
+        }
+
+        if (positional) {
+            ret = mb_file_pread(file, iov[i].base, iov[i].size,
+                                offset + total, &n);
+        } else {
+            ret = mb_file_read(file, iov[i].base, iov[i].size, &n);
+        }
+        if (ret != MB_FILE_OK) {
+            break;
+        }
+
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
+        }
+    }
+
+    if (ret != MB_FILE_OK && ret > MB_FILE_FATAL && total > 0) {
+        ret = MB_FILE_OK;
+    }
+
+    *bytes_read = total;
+    return ret;
+}
+
+/*!
+ * \brief Emulate a vectored write with one write per buffer
+ *
+ * Like `writev()`, a partial write is reported as success. The error, if any,
+ * will be returned by the next write.
+ */
+static int emulate_writev(struct MbFile *file, const struct MbFileIoVec *iov,
+                          size_t iov_count, bool positional, uint64_t offset,
+                          size_t *bytes_written)
+{
+    size_t total = 0;
+    int ret = MB_FILE_OK;
+
+    for (size_t i = 0; i < iov_count; ++i) {
+        size_t n;
+
+        if (iov[i].size == 0) {
+            continue;
+        }
+
+        if (positional) {
+            ret = mb_file_pwrite(file, iov[i].base, iov[i].size,
+                                 offset + total, &n);
+        } else {
+            ret = mb_file_write(file, iov[i].base, iov[i].size, &n);
+        }
+        if (ret != MB_FILE_OK) {
+            break;
+        }
+
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
+        }
+    }
+
+    if (ret != MB_FILE_OK && ret > MB_FILE_FATAL && total > 0) {
+        ret = MB_FILE_OK;
+    }
+
+    *bytes_written = total;
+    return ret;
+}
+
+/*!
+ * \brief Read from an MbFile handle into multiple buffers.
+ *
+ * This function fills the buffers in \p iov in order, as with `readv()`. If
+ * the handle source does not provide a vectored read callback, the operation
+ * is emulated by calling mb_file_read() for each buffer.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to read into
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support reading
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_readv(struct MbFile *file, const struct MbFileIoVec *iov,
+                  size_t iov_count, size_t *bytes_read)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_read) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_read is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (!check_iov_size(file, iov, iov_count)) {
+        ret = MB_FILE_FAILED;
+    } else {
+        ret = MB_FILE_UNSUPPORTED;
+        if (file->readv_cb) {
+            ret = file->readv_cb(file, file->cb_userdata, iov, iov_count,
+                                 bytes_read);
+        }
+        if (ret == MB_FILE_UNSUPPORTED) {
+            ret = emulate_readv(file, iov, iov_count, false, 0, bytes_read);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_READV, start, ret,
+                 ret == MB_FILE_OK ? *bytes_read : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Write to an MbFile handle from multiple buffers.
+ *
+ * This function writes the buffers in \p iov in order, as with `writev()`. If
+ * the handle source does not provide a vectored write callback, the operation
+ * is emulated by calling mb_file_write() for each buffer.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to write from
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were written
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support writing
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_writev(struct MbFile *file, const struct MbFileIoVec *iov,
+                   size_t iov_count, size_t *bytes_written)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_written) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_written is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (!check_iov_size(file, iov, iov_count)) {
+        ret = MB_FILE_FAILED;
+    } else {
+        ret = MB_FILE_UNSUPPORTED;
+        if (file->writev_cb) {
+            ret = file->writev_cb(file, file->cb_userdata, iov, iov_count,
+                                  bytes_written);
+        }
+        if (ret == MB_FILE_UNSUPPORTED) {
+            ret = emulate_writev(file, iov, iov_count, false, 0,
+                                 bytes_written);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_WRITEV, start, ret,
+                 ret == MB_FILE_OK ? *bytes_written : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Read from an MbFile handle at a specific offset into multiple
+ *        buffers.
+ *
+ * This function is the vectored equivalent of mb_file_pread(). If the handle
+ * source does not provide a positional vectored read callback, the operation
+ * is emulated by calling mb_file_pread() for each buffer.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to read into
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[in] offset Offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. 0 indicates end
+ *                        of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were read or EOF is reached
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support reading or
+ *     seeking
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_preadv(struct MbFile *file, const struct MbFileIoVec *iov,
+                   size_t iov_count, uint64_t offset, size_t *bytes_read)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_read) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_read is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (!check_iov_size(file, iov, iov_count)) {
+        ret = MB_FILE_FAILED;
+    } else {
+        ret = MB_FILE_UNSUPPORTED;
+        if (file->preadv_cb) {
+            ret = file->preadv_cb(file, file->cb_userdata, iov, iov_count,
+                                  offset, bytes_read);
+        }
+        if (ret == MB_FILE_UNSUPPORTED) {
+            ret = emulate_readv(file, iov, iov_count, true, offset,
+                                bytes_read);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_PREADV, start, ret,
+                 ret == MB_FILE_OK ? *bytes_read : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Write to an MbFile handle at a specific offset from multiple
+ *        buffers.
+ *
+ * This function is the vectored equivalent of mb_file_pwrite(). If the handle
+ * source does not provide a positional vectored write callback, the operation
+ * is emulated by calling mb_file_pwrite() for each buffer.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to write from
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[in] offset Offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes were written
+ *   * #MB_FILE_RETRY if the same operation should be reattempted
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support writing or
+ *     seeking
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pwritev(struct MbFile *file, const struct MbFileIoVec *iov,
+                    size_t iov_count, uint64_t offset, size_t *bytes_written)
+{
+    int ret;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (!bytes_written) {
+        mb_file_set_error(file, MB_FILE_ERROR_PROGRAMMER_ERROR,
+                          "%s: bytes_written is NULL",
+                          __func__);
+        ret = MB_FILE_FATAL;
+    } else if (!check_iov_size(file, iov, iov_count)) {
+        ret = MB_FILE_FAILED;
+    } else {
+        ret = MB_FILE_UNSUPPORTED;
+        if (file->pwritev_cb) {
+            ret = file->pwritev_cb(file, file->cb_userdata, iov, iov_count,
+                                   offset, bytes_written);
+        }
+        if (ret == MB_FILE_UNSUPPORTED) {
+            ret = emulate_writev(file, iov, iov_count, true, offset,
+                                 bytes_written);
+        }
+    }
+    stats_record(file, MB_FILE_STATS_OP_PWRITEV, start, ret,
+                 ret == MB_FILE_OK ? *bytes_written : 0);
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Move data using the handle's move callback
+ *
+ * \return
+ *   * #MB_FILE_UNSUPPORTED if there is no move callback or the callback
+ *     declined to handle the move. The file is not modified in this case.
+ *   * Otherwise, the return value of the move callback
+ */
+int _mb_file_move_native(struct MbFile *file, uint64_t src, uint64_t dest,
+                         uint64_t size, uint64_t *size_moved)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (file->move_cb) {
+        ret = file->move_cb(file, file->cb_userdata, src, dest, size,
+                            size_moved);
+        stats_record(file, MB_FILE_STATS_OP_MOVE, start, ret,
+                     ret == MB_FILE_OK ? *size_moved : 0);
+    }
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Copy data from another handle using the handle's copy callback
+ *
+ * \return
+ *   * #MB_FILE_UNSUPPORTED if there is no copy callback or the callback
+ *     declined to handle the copy. The file is not modified in this case.
+ *   * Otherwise, the return value of the copy callback
+ */
+int _mb_file_copy_from_native(struct MbFile *file, struct MbFile *src,
+                              uint64_t src_offset, uint64_t size,
+                              uint64_t *size_copied)
+{
+    int ret = MB_FILE_UNSUPPORTED;
+
+    ENSURE_STATE(file, MbFileState::OPENED);
+
+    StatsClock::time_point start = stats_start(file);
+
+    if (file->copy_from_cb) {
+        ret = file->copy_from_cb(file, file->cb_userdata, src, src_offset,
+                                 size, size_copied);
+        stats_record(file, MB_FILE_STATS_OP_COPY, start, ret,
+                     ret == MB_FILE_OK ? *size_copied : 0);
+    }
+    if (ret <= MB_FILE_FATAL) {
+        file->state = MbFileState::FATAL;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Enable or disable statistics collection for an MbFile handle.
+ *
+ * When enabled, the handle records the number of calls, the number of failed
+ * calls, the number of bytes transferred, and a coarse latency histogram for
+ * each file operation. The statistics can be retrieved with
+ * mb_file_get_stats(). Disabling statistics discards the collected data.
+ *
+ * Statistics are recorded atomically, so operations that may be called
+ * concurrently on the same handle, such as mb_file_pread(), are counted
+ * correctly. However, this function itself must not be called while other
+ * operations are in progress.
+ *
+ * Statistics are enabled automatically for new handles if the `MB_FILE_STATS`
+ * environment variable is set to a non-empty value other than `0`. In that
+ * case, the statistics are also reported when the handle is closed (see
+ * mb_file_set_stats_report_callback()).
+ *
+ * \param file MbFile handle
+ * \param enabled Whether statistics should be collected
+ *
+ * \return
+ *   * #MB_FILE_OK if statistics were successfully enabled or disabled
+ *   * #MB_FILE_FAILED if memory could not be allocated
+ *   * #MB_FILE_FATAL if the handle is in a fatal state
+ */
+int mb_file_set_stats_enabled(struct MbFile *file, bool enabled)
+{
+    ENSURE_STATE(file, MbFileState::ANY_NONFATAL);
+
+    if (enabled && !file->stats) {
+        file->stats = stats_new();
+        if (!file->stats) {
+            mb_file_set_error(file, -ENOMEM,
+                              "Failed to allocate statistics: %s",
+                              strerror(ENOMEM));
+            return MB_FILE_FAILED;
+        }
+    } else if (!enabled) {
+        delete file->stats;
+        file->stats = nullptr;
+        file->stats_report = false;
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Get statistics for an MbFile handle.
+ *
+ * The statistics remain available after the handle is closed.
+ *
+ * \note Operations that are emulated using other operations are counted for
+ *       all of the operations involved. For example, an emulated
+ *       mb_file_pread() also counts towards the seek and read statistics.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] stats Output statistics
+ *
+ * \return
+ *   * #MB_FILE_OK if the statistics were retrieved
+ *   * #MB_FILE_UNSUPPORTED if statistics are not enabled for the handle
+ */
+int mb_file_get_stats(struct MbFile *file, struct MbFileStats *stats)
+{
+    if (!file->stats) {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "%s: Statistics are not enabled", __func__);
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    stats_copy(file->stats, stats);
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Get name of a file operation in #MbFileStats.
+ *
+ * \param op #MbFileStatsOp value
+ *
+ * \return Operation name or NULL if \p op is invalid
+ */
+const char * mb_file_stats_op_name(int op)
+{
+    if (op < 0 || op >= MB_FILE_STATS_OP_COUNT) {
+        return nullptr;
+    }
+    return g_stats_op_names[op];
+}
+
+/*!
+ * \brief Format statistics as a human-readable string.
+ *
+ * The string contains one line (without a trailing newline) for each operation
+ * that was called at least once.
+ *
+ * \param stats Statistics from mb_file_get_stats()
+ *
+ * \return Newly allocated string that must be freed with `free()` or NULL if
+ *         memory could not be allocated
+ */
+char * mb_file_stats_to_string(const struct MbFileStats *stats)
+{
+    std::string result;
+
+    for (int op = 0; op < MB_FILE_STATS_OP_COUNT; ++op) {
+        const MbFileOpStats *op_stats = &stats->ops[op];
+
+        if (op_stats->calls == 0) {
+            continue;
+        }
+
+        char *line = mb_format("%s: calls=%" PRIu64 " failures=%" PRIu64
+                               " bytes=%" PRIu64 " time=%" PRIu64 "us",
+                               g_stats_op_names[op], op_stats->calls,
+                               op_stats->failures, op_stats->bytes,
+                               op_stats->total_ns / 1000);
+        if (!line) {
+            return nullptr;
+        }
+
+        if (!result.empty()) {
+            result += '\n';
+        }
+        result += line;
+        free(line);
+
+        for (int i = 0; i < MB_FILE_STATS_LATENCY_BUCKETS; ++i) {
+            if (op_stats->latency[i] == 0) {
+                continue;
+            }
+
+            line = mb_format(" %s=%" PRIu64, g_stats_latency_names[i],
+                             op_stats->latency[i]);
+            if (!line) {
+                return nullptr;
+            }
+
+            result += line;
+            free(line);
+        }
+    }
+
+    return strdup(result.c_str());
+}
+
+/*!
+ * \brief Set the callback for reporting statistics of closed handles.
+ *
+ * This callback is invoked when a handle, for which statistics were enabled via
+ * the `MB_FILE_STATS` environment variable, is closed. If no callback is set,
+ * the statistics are not reported, but can still be retrieved with
+ * mb_file_get_stats() before the handle is freed.
+ *
+ * \note This is a process-wide setting and is not thread safe. It should be
+ *       called once during startup.
+ *
+ * \param report_cb Report callback or NULL to disable reporting
+ * \param userdata User-provided data pointer for the callback
+ */
+void mb_file_set_stats_report_callback(MbFileStatsReportCb report_cb,
+                                       void *userdata)
+{
+    g_stats_report_cb = report_cb;
+    g_stats_report_userdata = userdata;
+}
+
 /*!
  * \brief Get error code for a failed operation.
  *
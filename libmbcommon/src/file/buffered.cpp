@@ -0,0 +1,598 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/buffered_p.h"
+#include "mbcommon/file_p.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+#define DEFAULT_BUFFER_SIZE             (64 * 1024)
+
+// Position of the underlying handle after a failed operation
+#define UNKNOWN_POS                     UINT64_MAX
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Open file with read-ahead and write-behind buffering
+ */
+
+MB_BEGIN_C_DECLS
+
+static int set_inner_error(struct MbFile *file, BufferedFileCtx *ctx, int ret)
+{
+    // Force the next operation to seek the underlying handle
+    ctx->inner_pos = UNKNOWN_POS;
+
+    mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                      mb_file_error_string(ctx->inner));
+    return ret;
+}
+
+/*!
+ * \brief Seek the underlying handle to \p offset if it is not already there
+ */
+static int sync_inner_pos(struct MbFile *file, BufferedFileCtx *ctx,
+                          uint64_t offset)
+{
+    if (ctx->inner_pos == offset) {
+        return MB_FILE_OK;
+    }
+
+    if (offset > INT64_MAX) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset %" PRIu64 " exceeds int64_t", offset);
+        return MB_FILE_FAILED;
+    }
+
+    int ret = mb_file_seek(ctx->inner, static_cast<int64_t>(offset), SEEK_SET,
+                           nullptr);
+    if (ret != MB_FILE_OK) {
+        return set_inner_error(file, ctx, ret);
+    }
+
+    ctx->inner_pos = offset;
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Write out pending data in the write buffer
+ */
+static int flush_write_buf(struct MbFile *file, BufferedFileCtx *ctx)
+{
+    if (ctx->write_len == 0) {
+        return MB_FILE_OK;
+    }
+
+    int ret = sync_inner_pos(file, ctx, ctx->buf_offset);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    size_t total = 0;
+
+    while (total < ctx->write_len) {
+        size_t n;
+
+        ret = mb_file_write(ctx->inner, ctx->buf + total,
+                            ctx->write_len - total, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret != MB_FILE_OK) {
+            return set_inner_error(file, ctx, ret);
+        } else if (n == 0) {
+            break;
+        }
+
+        total += n;
+    }
+
+    ctx->inner_pos += total;
+
+    if (total != ctx->write_len) {
+        // The caller was already told that these bytes were written, so this
+        // cannot be reported as a short write
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to flush write buffer: only wrote %"
+                          MB_PRIzu " of %" MB_PRIzu " bytes",
+                          total, ctx->write_len);
+        ctx->write_len = 0;
+        return MB_FILE_FAILED;
+    }
+
+    ctx->write_len = 0;
+    return MB_FILE_OK;
+}
+
+static void free_ctx(BufferedFileCtx *ctx)
+{
+    free(ctx->buf);
+    free(ctx);
+}
+
+static int buffered_open_cb(struct MbFile *file, void *userdata)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+
+    ctx->buf = static_cast<char *>(malloc(ctx->buf_size));
+    if (!ctx->buf) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate buffer: %s", strerror(errno));
+        return MB_FILE_FAILED;
+    }
+
+    // Pick up where the underlying handle currently is. Unseekable handles
+    // start at 0 and will fail if a backwards seek is ever needed.
+    if (mb_file_seek(ctx->inner, 0, SEEK_CUR, &ctx->inner_pos)
+            != MB_FILE_OK) {
+        ctx->inner_pos = 0;
+    }
+    ctx->pos = ctx->inner_pos;
+
+    return MB_FILE_OK;
+}
+
+static int buffered_close_cb(struct MbFile *file, void *userdata)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    // The buffer is not allocated if opening failed
+    if (ctx->buf) {
+        ret = flush_write_buf(file, ctx);
+    }
+
+    if (ctx->owned) {
+        int ret2 = mb_file_close(ctx->inner);
+        if (ret2 < ret) {
+            if (ret == MB_FILE_OK) {
+                set_inner_error(file, ctx, ret2);
+            }
+            ret = ret2;
+        }
+        mb_file_free(ctx->inner);
+    }
+
+    free_ctx(ctx);
+
+    return ret;
+}
+
+static int buffered_read_cb(struct MbFile *file, void *userdata,
+                            void *buf, size_t size, size_t *bytes_read)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    char *out = static_cast<char *>(buf);
+    size_t total = 0;
+    size_t n;
+    int ret;
+
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // Serve as much as possible from the read buffer
+    if (ctx->read_len > 0 && ctx->pos >= ctx->buf_offset
+            && ctx->pos < ctx->buf_offset + ctx->read_len) {
+        size_t buf_pos = static_cast<size_t>(ctx->pos - ctx->buf_offset);
+        total = std::min(ctx->read_len - buf_pos, size);
+
+        memcpy(out, ctx->buf + buf_pos, total);
+        ctx->pos += total;
+
+        if (total == size) {
+            *bytes_read = total;
+            return MB_FILE_OK;
+        }
+    }
+
+    // At most one read of the underlying handle is done per call so that
+    // this behaves like an ordinary short read if the source would block
+    ret = sync_inner_pos(file, ctx, ctx->pos);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    if (size - total >= ctx->buf_size) {
+        // Large reads bypass the buffer entirely
+        ret = mb_file_read(ctx->inner, out + total, size - total, &n);
+        if (ret != MB_FILE_OK) {
+            if (total > 0 && ret == MB_FILE_RETRY) {
+                ctx->inner_pos = UNKNOWN_POS;
+                *bytes_read = total;
+                return MB_FILE_OK;
+            }
+            return set_inner_error(file, ctx, ret);
+        }
+
+        ctx->inner_pos += n;
+        ctx->pos += n;
+        total += n;
+    } else {
+        ret = mb_file_read(ctx->inner, ctx->buf, ctx->buf_size, &n);
+        if (ret != MB_FILE_OK) {
+            ctx->read_len = 0;
+            if (total > 0 && ret == MB_FILE_RETRY) {
+                ctx->inner_pos = UNKNOWN_POS;
+                *bytes_read = total;
+                return MB_FILE_OK;
+            }
+            return set_inner_error(file, ctx, ret);
+        }
+
+        ctx->buf_offset = ctx->pos;
+        ctx->read_len = n;
+        ctx->inner_pos += n;
+
+        size_t to_copy = std::min(n, size - total);
+        memcpy(out + total, ctx->buf, to_copy);
+        ctx->pos += to_copy;
+        total += to_copy;
+    }
+
+    *bytes_read = total;
+    return MB_FILE_OK;
+}
+
+static int buffered_write_cb(struct MbFile *file, void *userdata,
+                             const void *buf, size_t size,
+                             size_t *bytes_written)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    // Writing invalidates the read buffer
+    ctx->read_len = 0;
+
+    // Pending data must be flushed if this write is not contiguous with it
+    if (ctx->write_len > 0 && ctx->pos != ctx->buf_offset + ctx->write_len) {
+        ret = flush_write_buf(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+    }
+
+    if (ctx->write_len + size > ctx->buf_size) {
+        ret = flush_write_buf(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        if (size >= ctx->buf_size) {
+            // Large writes bypass the buffer entirely
+            ret = sync_inner_pos(file, ctx, ctx->pos);
+            if (ret != MB_FILE_OK) {
+                return ret;
+            }
+
+            size_t n;
+            ret = mb_file_write(ctx->inner, buf, size, &n);
+            if (ret != MB_FILE_OK) {
+                return set_inner_error(file, ctx, ret);
+            }
+
+            ctx->inner_pos += n;
+            ctx->pos += n;
+
+            *bytes_written = n;
+            return MB_FILE_OK;
+        }
+    }
+
+    if (ctx->write_len == 0) {
+        ctx->buf_offset = ctx->pos;
+    }
+
+    memcpy(ctx->buf + ctx->write_len, buf, size);
+    ctx->write_len += size;
+    ctx->pos += size;
+
+    *bytes_written = size;
+    return MB_FILE_OK;
+}
+
+static int buffered_seek_cb(struct MbFile *file, void *userdata,
+                            int64_t offset, int whence, uint64_t *new_offset)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    // SEEK_SET and SEEK_CUR only move the logical position. The underlying
+    // handle is seeked lazily when data actually needs to be transferred.
+    // The buffers remain valid because they are keyed by file offset.
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid SEEK_SET offset %" PRId64,
+                              offset);
+            return MB_FILE_FAILED;
+        }
+        *new_offset = ctx->pos = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > ctx->pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > INT64_MAX - ctx->pos)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid SEEK_CUR offset %" PRId64
+                              " for position %" PRIu64,
+                              offset, ctx->pos);
+            return MB_FILE_FAILED;
+        }
+        *new_offset = ctx->pos += offset;
+        break;
+    case SEEK_END:
+        // The file size is only known by the underlying handle and may grow
+        // once pending writes are flushed
+        ret = flush_write_buf(file, ctx);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        ret = mb_file_seek(ctx->inner, offset, SEEK_END, &ctx->inner_pos);
+        if (ret != MB_FILE_OK) {
+            return set_inner_error(file, ctx, ret);
+        }
+
+        *new_offset = ctx->pos = ctx->inner_pos;
+        break;
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid whence argument: %d", whence);
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_truncate_cb(struct MbFile *file, void *userdata,
+                                uint64_t size)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // Data past the new end of the file (or zeros, if extended) may differ
+    // from what is buffered
+    ctx->read_len = 0;
+
+    ret = mb_file_truncate(ctx->inner, size);
+    if (ret != MB_FILE_OK) {
+        return set_inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_peek_cb(struct MbFile *file, void *userdata,
+                            uint64_t offset, size_t size,
+                            const void **buf, size_t *bytes_available)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    // Peeking is only possible if the underlying handle supports it. Pending
+    // writes must be visible in the data that it returns.
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ret = mb_file_peek(ctx->inner, offset, size, buf, bytes_available);
+    if (ret != MB_FILE_OK) {
+        mb_file_set_error(file, mb_file_error(ctx->inner), "%s",
+                          mb_file_error_string(ctx->inner));
+        return ret;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_pread_cb(struct MbFile *file, void *userdata,
+                             void *buf, size_t size, uint64_t offset,
+                             size_t *bytes_read)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // Serve from the read buffer if possible. This may be a short read.
+    if (ctx->read_len > 0 && offset >= ctx->buf_offset
+            && offset < ctx->buf_offset + ctx->read_len) {
+        size_t buf_pos = static_cast<size_t>(offset - ctx->buf_offset);
+        size_t n = std::min(ctx->read_len - buf_pos, size);
+
+        memcpy(buf, ctx->buf + buf_pos, n);
+
+        *bytes_read = n;
+        return MB_FILE_OK;
+    }
+
+    // Positional reads never change the underlying handle's position, so the
+    // cached position remains valid
+    ret = mb_file_pread(ctx->inner, buf, size, offset, bytes_read);
+    if (ret != MB_FILE_OK) {
+        return set_inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_pwrite_cb(struct MbFile *file, void *userdata,
+                              const void *buf, size_t size, uint64_t offset,
+                              size_t *bytes_written)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // Drop the read buffer if it overlaps the written region
+    if (ctx->read_len > 0 && offset < ctx->buf_offset + ctx->read_len
+            && offset + size > ctx->buf_offset) {
+        ctx->read_len = 0;
+    }
+
+    ret = mb_file_pwrite(ctx->inner, buf, size, offset, bytes_written);
+    if (ret != MB_FILE_OK) {
+        return set_inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+static int buffered_move_cb(struct MbFile *file, void *userdata,
+                            uint64_t src, uint64_t dest, uint64_t size,
+                            uint64_t *size_moved)
+{
+    BufferedFileCtx *const ctx = static_cast<BufferedFileCtx *>(userdata);
+    int ret;
+
+    ret = flush_write_buf(file, ctx);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    // Drop the read buffer if it overlaps the destination region
+    if (ctx->read_len > 0 && dest < ctx->buf_offset + ctx->read_len
+            && dest + size > ctx->buf_offset) {
+        ctx->read_len = 0;
+    }
+
+    // Let the inner handle use its own fast path instead of copying through
+    // this handle's buffers
+    ret = mb_file_move(ctx->inner, src, dest, size, size_moved);
+    if (ret != MB_FILE_OK) {
+        return set_inner_error(file, ctx, ret);
+    }
+
+    return MB_FILE_OK;
+}
+
+static BufferedFileCtx * create_ctx(struct MbFile *file)
+{
+    BufferedFileCtx *ctx = static_cast<BufferedFileCtx *>(
+            calloc(1, sizeof(BufferedFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to allocate BufferedFileCtx: %s",
+                          strerror(errno));
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+static int open_ctx(struct MbFile *file, BufferedFileCtx *ctx)
+{
+    int ret = mb_file_set_peek_callback(file, &buffered_peek_cb);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pread_callback(file, &buffered_pread_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pwrite_callback(file, &buffered_pwrite_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_move_callback(file, &buffered_move_cb);
+    }
+    if (ret != MB_FILE_OK) {
+        if (ctx->owned) {
+            mb_file_free(ctx->inner);
+        }
+        free_ctx(ctx);
+        return ret;
+    }
+
+    return mb_file_open_callbacks(file,
+                                  &buffered_open_cb,
+                                  &buffered_close_cb,
+                                  &buffered_read_cb,
+                                  &buffered_write_cb,
+                                  &buffered_seek_cb,
+                                  &buffered_truncate_cb,
+                                  ctx);
+}
+
+/*!
+ * Open buffered MbFile handle on top of another MbFile handle.
+ *
+ * Small reads are served from a read-ahead buffer and small, contiguous writes
+ * are coalesced in a write-behind buffer, so that the underlying handle sees
+ * far fewer operations. Seeking with `SEEK_SET` or `SEEK_CUR` does not touch
+ * the underlying handle, so seeking back into recently read data is free.
+ * Pending writes are flushed before reads, before non-contiguous writes, before
+ * `SEEK_END` seeks, before truncation, and when the handle is closed.
+ *
+ * \note The underlying handle must not be used directly while the buffered
+ *       handle is open.
+ *
+ * If \p owned is true, then \p inner will be closed and freed when the
+ * buffered handle is closed. This is true even if this function fails.
+ *
+ * \param file MbFile handle
+ * \param inner Opened MbFile handle to wrap
+ * \param buffer_size Size of the buffer, or 0 to use the default size
+ * \param owned Whether the MbFile handle should take ownership of \p inner
+ *
+ * \return
+ *   * #MB_FILE_OK if the handle is successfully opened
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_buffered(struct MbFile *file, struct MbFile *inner,
+                          size_t buffer_size, bool owned)
+{
+    BufferedFileCtx *ctx = create_ctx(file);
+    if (!ctx) {
+        if (owned) {
+            mb_file_free(inner);
+        }
+        return MB_FILE_FATAL;
+    }
+
+    ctx->inner = inner;
+    ctx->owned = owned;
+    ctx->buf_size = buffer_size == 0 ? DEFAULT_BUFFER_SIZE : buffer_size;
+
+    return open_ctx(file, ctx);
+}
+
+MB_END_C_DECLS
@@ -19,6 +19,8 @@
 
 #include "mbcommon/file/fd.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -28,14 +30,41 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
+
 #include "mbcommon/locale.h"
 
 #include "mbcommon/file/callbacks.h"
 #include "mbcommon/file/fd_p.h"
+#include "mbcommon/file_p.h"
+#include "mbcommon/file_util.h"
 
 #define DEFAULT_MODE \
     (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
+#ifndef _WIN32
+// Maximum number of buffers passed to a single vectored I/O call. This is well
+// below IOV_MAX on every supported platform.
+#  define MAX_IOV_PER_CALL              64
+#endif
+
+#ifdef __linux__
+// Older kernel headers don't define these
+#  ifndef FALLOC_FL_COLLAPSE_RANGE
+#    define FALLOC_FL_COLLAPSE_RANGE    0x08
+#  endif
+#  ifndef FALLOC_FL_INSERT_RANGE
+#    define FALLOC_FL_INSERT_RANGE      0x20
+#  endif
+
+// Overlapping moves are done with copy_file_range() in chunks of the distance
+// between the source and destination. Below this distance, there would be too
+// many calls, so mb_file_move() copies through a buffer instead.
+#  define MIN_COPY_RANGE_DISTANCE       (1024 * 1024)
+#endif
+
 /*!
  * \file mbcommon/file/fd.h
  * \brief Open file with POSIX file descriptors API
@@ -141,6 +170,395 @@ static int fd_write_cb(struct MbFile *file, void *userdata,
     return MB_FILE_OK;
 }
 
+#ifndef _WIN32
+static int fd_pread_cb(struct MbFile *file, void *userdata,
+                       void *buf, size_t size, uint64_t offset,
+                       size_t *bytes_read)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = ctx->vtable.fn_pread64(
+            ctx->vtable.userdata, ctx->fd, buf, size, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to read file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int fd_pwrite_cb(struct MbFile *file, void *userdata,
+                        const void *buf, size_t size, uint64_t offset,
+                        size_t *bytes_written)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = ctx->vtable.fn_pwrite64(
+            ctx->vtable.userdata, ctx->fd, buf, size, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to write file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_written = n;
+    return MB_FILE_OK;
+}
+
+static int fill_iovec(struct iovec *out, const struct MbFileIoVec *iov,
+                      size_t iov_count)
+{
+    size_t total = 0;
+    int n = 0;
+
+    // Like read() and write(), the total size is capped to SSIZE_MAX
+    for (size_t i = 0; i < iov_count && n < MAX_IOV_PER_CALL
+            && total < SSIZE_MAX; ++i) {
+        size_t size = std::min<size_t>(iov[i].size, SSIZE_MAX - total);
+
+        out[n].iov_base = iov[i].base;
+        out[n].iov_len = size;
+        ++n;
+
+        total += size;
+    }
+
+    return n;
+}
+
+static int fd_readv_cb(struct MbFile *file, void *userdata,
+                       const struct MbFileIoVec *iov, size_t iov_count,
+                       size_t *bytes_read)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+    struct iovec buf[MAX_IOV_PER_CALL];
+    int buf_count = fill_iovec(buf, iov, iov_count);
+
+    ssize_t n = ctx->vtable.fn_readv(
+            ctx->vtable.userdata, ctx->fd, buf, buf_count);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to read file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int fd_writev_cb(struct MbFile *file, void *userdata,
+                        const struct MbFileIoVec *iov, size_t iov_count,
+                        size_t *bytes_written)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+    struct iovec buf[MAX_IOV_PER_CALL];
+    int buf_count = fill_iovec(buf, iov, iov_count);
+
+    ssize_t n = ctx->vtable.fn_writev(
+            ctx->vtable.userdata, ctx->fd, buf, buf_count);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to write file: %s", strerror(errno));
+        return errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_written = n;
+    return MB_FILE_OK;
+}
+
+static int fd_preadv_cb(struct MbFile *file, void *userdata,
+                        const struct MbFileIoVec *iov, size_t iov_count,
+                        uint64_t offset, size_t *bytes_read)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+    struct iovec buf[MAX_IOV_PER_CALL];
+    int buf_count = fill_iovec(buf, iov, iov_count);
+
+    ssize_t n = ctx->vtable.fn_preadv64(
+            ctx->vtable.userdata, ctx->fd, buf, buf_count, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to read file: %s", strerror(errno));
+        // Fall back to pread() if preadv() is not available
+        return errno == ENOSYS ? MB_FILE_UNSUPPORTED
+                : errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int fd_pwritev_cb(struct MbFile *file, void *userdata,
+                         const struct MbFileIoVec *iov, size_t iov_count,
+                         uint64_t offset, size_t *bytes_written)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+    struct iovec buf[MAX_IOV_PER_CALL];
+    int buf_count = fill_iovec(buf, iov, iov_count);
+
+    ssize_t n = ctx->vtable.fn_pwritev64(
+            ctx->vtable.userdata, ctx->fd, buf, buf_count, offset);
+    if (n < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to write file: %s", strerror(errno));
+        // Fall back to pwrite() if pwritev() is not available
+        return errno == ENOSYS ? MB_FILE_UNSUPPORTED
+                : errno == EINTR ? MB_FILE_RETRY : MB_FILE_FAILED;
+    }
+
+    *bytes_written = n;
+    return MB_FILE_OK;
+}
+#endif
+
+#ifdef __linux__
+static bool is_unsupported_errno(int error)
+{
+    return error == ENOSYS || error == EOPNOTSUPP || error == EXDEV
+            || error == EINVAL || error == EBADF;
+}
+
+/*!
+ * \brief Copy data within the file with copy_file_range()
+ *
+ * \pre The source and destination regions must not overlap
+ *
+ * \return
+ *   * #MB_FILE_OK if the data was copied or EOF was reached
+ *   * #MB_FILE_UNSUPPORTED if copy_file_range() cannot be used. Nothing was
+ *     copied in this case.
+ *   * #MB_FILE_FAILED if an error occurs
+ */
+static int fd_copy_range(struct MbFile *file, FdFileCtx *ctx,
+                         uint64_t src, uint64_t dest, uint64_t size,
+                         uint64_t *size_copied)
+{
+    *size_copied = 0;
+
+    while (*size_copied < size) {
+        off64_t off_in = src + *size_copied;
+        off64_t off_out = dest + *size_copied;
+        size_t len = std::min<uint64_t>(size - *size_copied, SSIZE_MAX);
+
+        ssize_t n = ctx->vtable.fn_copy_file_range(
+                ctx->vtable.userdata, ctx->fd, &off_in, ctx->fd, &off_out,
+                len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (*size_copied == 0 && is_unsupported_errno(errno)) {
+                return MB_FILE_UNSUPPORTED;
+            }
+
+            mb_file_set_error(file, -errno,
+                              "Failed to copy file range: %s",
+                              strerror(errno));
+            return MB_FILE_FAILED;
+        } else if (n == 0) {
+            break;
+        }
+
+        *size_copied += n;
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Move the data at the end of the file by inserting or removing a range
+ *
+ * The moved data itself isn't copied. Only the region that `memmove()` would
+ * leave untouched, which is \p distance bytes long, needs to be restored
+ * afterwards.
+ *
+ * \pre \p src + \p size must be the file size
+ * \pre \p src and \p dest must be aligned to the filesystem block size
+ * \pre The distance between \p src and \p dest must be less than \p size
+ */
+static int fd_move_tail(struct MbFile *file, FdFileCtx *ctx,
+                        uint64_t src, uint64_t dest, uint64_t size,
+                        uint64_t *size_moved)
+{
+    uint64_t restore_src;
+    uint64_t restore_dest;
+    uint64_t distance;
+    uint64_t n;
+    int ret;
+
+    if (dest > src) {
+        distance = dest - src;
+        ret = ctx->vtable.fn_fallocate64(
+                ctx->vtable.userdata, ctx->fd, FALLOC_FL_INSERT_RANGE,
+                src, distance);
+
+        // The original data at [src, dest) is now at [dest, dest + distance)
+        restore_src = dest;
+        restore_dest = src;
+    } else {
+        distance = src - dest;
+        ret = ctx->vtable.fn_fallocate64(
+                ctx->vtable.userdata, ctx->fd, FALLOC_FL_COLLAPSE_RANGE,
+                dest, distance);
+
+        // The original data after the destination region was shifted down and
+        // the file was shrunk
+        restore_src = dest + size - distance;
+        restore_dest = dest + size;
+    }
+
+    if (ret < 0) {
+        if (is_unsupported_errno(errno)) {
+            return MB_FILE_UNSUPPORTED;
+        }
+
+        mb_file_set_error(file, -errno,
+                          "Failed to shift file data: %s", strerror(errno));
+        return MB_FILE_FAILED;
+    }
+
+    *size_moved = size;
+
+    // This won't end up here again since the regions don't overlap
+    ret = mb_file_move(file, restore_src, restore_dest, distance, &n);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    } else if (n != distance) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "File was truncated while moving data");
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int fd_move_cb(struct MbFile *file, void *userdata,
+                      uint64_t src, uint64_t dest, uint64_t size,
+                      uint64_t *size_moved)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+    struct stat sb;
+    uint64_t distance = dest > src ? dest - src : src - dest;
+    uint64_t n;
+    int ret;
+
+    if (src > INT64_MAX - size || dest > INT64_MAX - size) {
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    if (ctx->vtable.fn_fstat(ctx->vtable.userdata, ctx->fd, &sb) < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to stat file: %s", strerror(errno));
+        return MB_FILE_FAILED;
+    }
+
+    // Leave partial moves past EOF to mb_file_move()
+    if (!S_ISREG(sb.st_mode) || src + size > static_cast<uint64_t>(sb.st_size)) {
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    // Moving the end of the file only requires copying `distance` bytes if the
+    // filesystem can insert or remove blocks
+    if (src + size == static_cast<uint64_t>(sb.st_size) && distance < size
+            && sb.st_blksize > 0 && src % sb.st_blksize == 0
+            && dest % sb.st_blksize == 0) {
+        ret = fd_move_tail(file, ctx, src, dest, size, size_moved);
+        if (ret != MB_FILE_UNSUPPORTED) {
+            return ret;
+        }
+    }
+
+    if (distance >= size) {
+        return fd_copy_range(file, ctx, src, dest, size, size_moved);
+    } else if (distance < MIN_COPY_RANGE_DISTANCE) {
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    // Copy chunks that are at most `distance` bytes long so that the source
+    // and destination never overlap
+    *size_moved = 0;
+
+    while (*size_moved < size) {
+        uint64_t chunk = std::min(distance, size - *size_moved);
+        uint64_t offset = dest < src
+                ? *size_moved
+                : size - *size_moved - chunk;
+
+        ret = fd_copy_range(file, ctx, src + offset, dest + offset, chunk, &n);
+        if (ret == MB_FILE_UNSUPPORTED && *size_moved > 0) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "copy_file_range() failed after partial move");
+            ret = MB_FILE_FAILED;
+        }
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        *size_moved += n;
+
+        if (n < chunk) {
+            break;
+        }
+    }
+
+    return MB_FILE_OK;
+}
+
+static int fd_copy_from_cb(struct MbFile *file, void *userdata,
+                           struct MbFile *src, uint64_t src_offset,
+                           uint64_t size, uint64_t *size_copied)
+{
+    FdFileCtx *ctx = static_cast<FdFileCtx *>(userdata);
+
+    // Only other file descriptor handles can be copied from directly
+    if (src->state != MbFileState::OPENED || src->read_cb != &fd_read_cb
+            || src_offset > INT64_MAX || size > INT64_MAX - src_offset) {
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    FdFileCtx *src_ctx = static_cast<FdFileCtx *>(src->cb_userdata);
+
+    *size_copied = 0;
+
+    while (*size_copied < size) {
+        off64_t off_in = src_offset + *size_copied;
+        size_t len = std::min<uint64_t>(size - *size_copied, SSIZE_MAX);
+
+        // Write at (and advance) the current file position
+        ssize_t n = ctx->vtable.fn_copy_file_range(
+                ctx->vtable.userdata, src_ctx->fd, &off_in, ctx->fd, nullptr,
+                len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (*size_copied == 0 && is_unsupported_errno(errno)) {
+                return MB_FILE_UNSUPPORTED;
+            }
+
+            mb_file_set_error(file, -errno,
+                              "Failed to copy file range: %s",
+                              strerror(errno));
+            return MB_FILE_FAILED;
+        } else if (n == 0) {
+            break;
+        }
+
+        *size_copied += n;
+    }
+
+    return MB_FILE_OK;
+}
+#endif
+
 static int fd_seek_cb(struct MbFile *file, void *userdata,
                       int64_t offset, int whence,
                       uint64_t *new_offset)
@@ -186,7 +604,20 @@ static bool check_vtable(SysVtable *vtable, bool needs_open)
             && vtable->fn_ftruncate64
             && vtable->fn_lseek64
             && vtable->fn_read
-            && vtable->fn_write;
+            && vtable->fn_write
+#ifndef _WIN32
+            && vtable->fn_pread64
+            && vtable->fn_pwrite64
+            && vtable->fn_readv
+            && vtable->fn_writev
+            && vtable->fn_preadv64
+            && vtable->fn_pwritev64
+#endif
+#ifdef __linux__
+            && vtable->fn_copy_file_range
+            && vtable->fn_fallocate64
+#endif
+            ;
 }
 
 static FdFileCtx * create_ctx(struct MbFile *file, SysVtable *vtable,
@@ -213,6 +644,39 @@ static FdFileCtx * create_ctx(struct MbFile *file, SysVtable *vtable,
 
 static int open_ctx(struct MbFile *file, FdFileCtx *ctx)
 {
+#ifndef _WIN32
+    int ret;
+
+    ret = mb_file_set_pread_callback(file, &fd_pread_cb);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pwrite_callback(file, &fd_pwrite_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_readv_callback(file, &fd_readv_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_writev_callback(file, &fd_writev_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_preadv_callback(file, &fd_preadv_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pwritev_callback(file, &fd_pwritev_cb);
+    }
+#ifdef __linux__
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_move_callback(file, &fd_move_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_copy_from_callback(file, &fd_copy_from_cb);
+    }
+#endif
+    if (ret != MB_FILE_OK) {
+        free_ctx(ctx);
+        return ret;
+    }
+#endif
+
     return mb_file_open_callbacks(file,
                                   &fd_open_cb,
                                   &fd_close_cb,
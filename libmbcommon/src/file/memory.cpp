@@ -52,41 +52,33 @@ static int memory_close_cb(struct MbFile *file, void *userdata)
     return MB_FILE_OK;
 }
 
-static int memory_read_cb(struct MbFile *file, void *userdata,
-                          void *buf, size_t size, size_t *bytes_read)
+static size_t read_at(MemoryFileCtx *ctx, uint64_t offset,
+                      void *buf, size_t size)
 {
-    (void) file;
-    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
-
     size_t to_read = 0;
-    if (ctx->pos < ctx->size) {
-        to_read = std::min(ctx->size - ctx->pos, size);
+    if (offset < ctx->size) {
+        to_read = std::min<uint64_t>(ctx->size - offset, size);
+        memcpy(buf, static_cast<char *>(ctx->data) + offset, to_read);
     }
 
-    memcpy(buf, static_cast<char *>(ctx->data) + ctx->pos, to_read);
-    ctx->pos += to_read;
-
-    *bytes_read = to_read;
-    return MB_FILE_OK;
+    return to_read;
 }
 
-static int memory_write_cb(struct MbFile *file, void *userdata,
-                           const void *buf, size_t size, size_t *bytes_written)
+static int write_at(struct MbFile *file, MemoryFileCtx *ctx, uint64_t offset,
+                    const void *buf, size_t size, size_t *bytes_written)
 {
-    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
-
-    if (ctx->pos > SIZE_MAX - size) {
+    if (offset > SIZE_MAX - size) {
         mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
                           "Write would overflow size_t");
         return MB_FILE_FAILED;
     }
 
-    size_t desired_size = ctx->pos + size;
+    size_t desired_size = offset + size;
     size_t to_write = size;
 
     if (desired_size > ctx->size) {
         if (ctx->fixed_size) {
-            to_write = ctx->pos <= ctx->size ? ctx->size - ctx->pos : 0;
+            to_write = offset <= ctx->size ? ctx->size - offset : 0;
         } else {
             // Enlarge buffer
             void *new_data = realloc(ctx->data, desired_size);
@@ -112,13 +104,38 @@ static int memory_write_cb(struct MbFile *file, void *userdata,
         }
     }
 
-    memcpy(static_cast<char *>(ctx->data) + ctx->pos, buf, to_write);
-    ctx->pos += to_write;
+    memcpy(static_cast<char *>(ctx->data) + offset, buf, to_write);
 
     *bytes_written = to_write;
     return MB_FILE_OK;
 }
 
+static int memory_read_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    size_t n = read_at(ctx, ctx->pos, buf, size);
+    ctx->pos += n;
+
+    *bytes_read = n;
+    return MB_FILE_OK;
+}
+
+static int memory_write_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size, size_t *bytes_written)
+{
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    int ret = write_at(file, ctx, ctx->pos, buf, size, bytes_written);
+    if (ret == MB_FILE_OK) {
+        ctx->pos += *bytes_written;
+    }
+
+    return ret;
+}
+
 static int memory_seek_cb(struct MbFile *file, void *userdata,
                           int64_t offset, int whence, uint64_t *new_offset)
 {
@@ -204,6 +221,63 @@ static int memory_truncate_cb(struct MbFile *file, void *userdata,
     return MB_FILE_OK;
 }
 
+static int memory_peek_cb(struct MbFile *file, void *userdata,
+                          uint64_t offset, size_t size,
+                          const void **buf, size_t *bytes_available)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    size_t available = 0;
+    if (offset < ctx->size) {
+        available = std::min<uint64_t>(ctx->size - offset, size);
+    }
+
+    *buf = static_cast<char *>(ctx->data) + (available > 0 ? offset : 0);
+    *bytes_available = available;
+    return MB_FILE_OK;
+}
+
+static int memory_pread_cb(struct MbFile *file, void *userdata,
+                           void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_read)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    *bytes_read = read_at(ctx, offset, buf, size);
+    return MB_FILE_OK;
+}
+
+static int memory_pwrite_cb(struct MbFile *file, void *userdata,
+                            const void *buf, size_t size, uint64_t offset,
+                            size_t *bytes_written)
+{
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    return write_at(file, ctx, offset, buf, size, bytes_written);
+}
+
+static int memory_move_cb(struct MbFile *file, void *userdata,
+                          uint64_t src, uint64_t dest, uint64_t size,
+                          uint64_t *size_moved)
+{
+    (void) file;
+    MemoryFileCtx *const ctx = static_cast<MemoryFileCtx *>(userdata);
+
+    // Let mb_file_move() handle partial moves and buffer resizing
+    if (src > ctx->size || size > ctx->size - src
+            || dest > ctx->size || size > ctx->size - dest) {
+        return MB_FILE_UNSUPPORTED;
+    }
+
+    memmove(static_cast<char *>(ctx->data) + dest,
+            static_cast<char *>(ctx->data) + src, size);
+
+    *size_moved = size;
+    return MB_FILE_OK;
+}
+
 static MemoryFileCtx * create_ctx(struct MbFile *file)
 {
     MemoryFileCtx *ctx = static_cast<MemoryFileCtx *>(
@@ -220,6 +294,21 @@ static MemoryFileCtx * create_ctx(struct MbFile *file)
 
 static int open_ctx(struct MbFile *file, MemoryFileCtx *ctx)
 {
+    int ret = mb_file_set_peek_callback(file, &memory_peek_cb);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pread_callback(file, &memory_pread_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pwrite_callback(file, &memory_pwrite_cb);
+    }
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_move_callback(file, &memory_move_cb);
+    }
+    if (ret != MB_FILE_OK) {
+        free_ctx(ctx);
+        return ret;
+    }
+
     return mb_file_open_callbacks(file,
                                   nullptr,
                                   &memory_close_cb,
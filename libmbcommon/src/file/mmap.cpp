@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/locale.h"
+#include "mbcommon/string.h"
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/mmap_p.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open read-only file with a memory mapping
+ */
+
+MB_BEGIN_C_DECLS
+
+static void free_ctx(MmapFileCtx *ctx)
+{
+    free(ctx->filename);
+    free(ctx);
+}
+
+static int mmap_open_cb(struct MbFile *file, void *userdata)
+{
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+    int fd = ctx->fd;
+    int ret = MB_FILE_OK;
+    struct stat sb;
+    off64_t size;
+
+    if (ctx->filename) {
+        fd = open(ctx->filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            mb_file_set_error(file, -errno, "Failed to open file: %s",
+                              strerror(errno));
+            return MB_FILE_FAILED;
+        }
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to stat file: %s", strerror(errno));
+        ret = MB_FILE_FAILED;
+        goto done;
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        mb_file_set_error(file, -EISDIR, "Cannot open directory");
+        ret = MB_FILE_FAILED;
+        goto done;
+    }
+
+    if (S_ISREG(sb.st_mode)) {
+        size = sb.st_size;
+    } else {
+        // st_size is 0 for block devices, so get the size by seeking. The
+        // file position is restored in case the caller still uses the fd.
+        off64_t orig = lseek64(fd, 0, SEEK_CUR);
+        size = orig < 0 ? orig : lseek64(fd, 0, SEEK_END);
+        if (size >= 0 && lseek64(fd, orig, SEEK_SET) < 0) {
+            size = -1;
+        }
+    }
+    if (size < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to get file size: %s", strerror(errno));
+        ret = MB_FILE_FAILED;
+        goto done;
+    } else if (static_cast<uint64_t>(size) > SIZE_MAX) {
+        mb_file_set_error(file, MB_FILE_ERROR_UNSUPPORTED,
+                          "File too large to map");
+        ret = MB_FILE_UNSUPPORTED;
+        goto done;
+    }
+
+    // Empty files cannot be mapped
+    if (size > 0) {
+        ctx->data = mmap(nullptr, static_cast<size_t>(size), PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+        if (ctx->data == MAP_FAILED) {
+            ctx->data = nullptr;
+            mb_file_set_error(file, -errno,
+                              "Failed to map file: %s", strerror(errno));
+            ret = MB_FILE_FAILED;
+            goto done;
+        }
+    }
+
+    ctx->size = static_cast<size_t>(size);
+
+done:
+    // The mapping does not need the file descriptor to remain open
+    if (ctx->filename) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+static int mmap_close_cb(struct MbFile *file, void *userdata)
+{
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+    int ret = MB_FILE_OK;
+
+    if (ctx->data && munmap(ctx->data, ctx->size) < 0) {
+        mb_file_set_error(file, -errno,
+                          "Failed to unmap file: %s", strerror(errno));
+        ret = MB_FILE_FAILED;
+    }
+
+    free_ctx(ctx);
+
+    return ret;
+}
+
+static int mmap_read_cb(struct MbFile *file, void *userdata,
+                        void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+
+    size_t to_read = 0;
+    if (ctx->pos < ctx->size) {
+        to_read = std::min(ctx->size - ctx->pos, size);
+        memcpy(buf, static_cast<char *>(ctx->data) + ctx->pos, to_read);
+    }
+
+    ctx->pos += to_read;
+
+    *bytes_read = to_read;
+    return MB_FILE_OK;
+}
+
+static int mmap_pread_cb(struct MbFile *file, void *userdata,
+                         void *buf, size_t size, uint64_t offset,
+                         size_t *bytes_read)
+{
+    (void) file;
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+
+    size_t to_read = 0;
+    if (offset < ctx->size) {
+        to_read = std::min<uint64_t>(ctx->size - offset, size);
+        memcpy(buf, static_cast<char *>(ctx->data) + offset, to_read);
+    }
+
+    *bytes_read = to_read;
+    return MB_FILE_OK;
+}
+
+static int mmap_seek_cb(struct MbFile *file, void *userdata,
+                        int64_t offset, int whence, uint64_t *new_offset)
+{
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid SEEK_SET offset %" PRId64,
+                              offset);
+            return MB_FILE_FAILED;
+        }
+        *new_offset = ctx->pos = offset;
+        break;
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > ctx->pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - ctx->pos)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid SEEK_CUR offset %" PRId64
+                              " for position %" MB_PRIzu,
+                              offset, ctx->pos);
+            return MB_FILE_FAILED;
+        }
+        *new_offset = ctx->pos += offset;
+        break;
+    case SEEK_END:
+        if ((offset < 0 && static_cast<size_t>(-offset) > ctx->size)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > SIZE_MAX - ctx->size)) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Invalid SEEK_END offset %" PRId64
+                              " for file of size %" MB_PRIzu,
+                              offset, ctx->size);
+            return MB_FILE_FAILED;
+        }
+        *new_offset = ctx->pos = ctx->size + offset;
+        break;
+    default:
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Invalid whence argument: %d", whence);
+        return MB_FILE_FAILED;
+    }
+
+    return MB_FILE_OK;
+}
+
+static int mmap_peek_cb(struct MbFile *file, void *userdata,
+                        uint64_t offset, size_t size,
+                        const void **buf, size_t *bytes_available)
+{
+    (void) file;
+    MmapFileCtx *const ctx = static_cast<MmapFileCtx *>(userdata);
+
+    size_t available = 0;
+    if (offset < ctx->size) {
+        available = std::min<uint64_t>(ctx->size - offset, size);
+    }
+
+    *buf = static_cast<char *>(ctx->data) + (available > 0 ? offset : 0);
+    *bytes_available = available;
+    return MB_FILE_OK;
+}
+
+static MmapFileCtx * create_ctx(struct MbFile *file)
+{
+    MmapFileCtx *ctx = static_cast<MmapFileCtx *>(
+            calloc(1, sizeof(MmapFileCtx)));
+    if (!ctx) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to allocate MmapFileCtx: %s",
+                          strerror(errno));
+        return nullptr;
+    }
+
+    ctx->fd = -1;
+
+    return ctx;
+}
+
+static int open_ctx(struct MbFile *file, MmapFileCtx *ctx)
+{
+    int ret = mb_file_set_peek_callback(file, &mmap_peek_cb);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pread_callback(file, &mmap_pread_cb);
+    }
+    if (ret != MB_FILE_OK) {
+        free_ctx(ctx);
+        return ret;
+    }
+
+    return mb_file_open_callbacks(file,
+                                  &mmap_open_cb,
+                                  &mmap_close_cb,
+                                  &mmap_read_cb,
+                                  nullptr,
+                                  &mmap_seek_cb,
+                                  nullptr,
+                                  ctx);
+}
+
+/*!
+ * Open read-only MbFile handle by memory mapping a file descriptor.
+ *
+ * The entire file is mapped, so reads are simple copies from the mapping and
+ * mb_file_peek() can return pointers directly into the file's data. The file
+ * descriptor is not needed once this function returns and is not closed by
+ * the MbFile handle.
+ *
+ * \note If the file is truncated by another process while it is mapped,
+ *       accessing the truncated region will raise `SIGBUS`.
+ *
+ * \param file MbFile handle
+ * \param fd File descriptor opened for reading
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully mapped
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_mmap(struct MbFile *file, int fd)
+{
+    MmapFileCtx *ctx = create_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FATAL;
+    }
+
+    ctx->fd = fd;
+
+    return open_ctx(file, ctx);
+}
+
+/*!
+ * Open read-only MbFile handle by memory mapping a file (MBS).
+ *
+ * \sa mb_file_open_mmap()
+ *
+ * \param file MbFile handle
+ * \param filename MBS filename
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully mapped
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_mmap_filename(struct MbFile *file, const char *filename)
+{
+    MmapFileCtx *ctx = create_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FATAL;
+    }
+
+    ctx->filename = strdup(filename);
+    if (!ctx->filename) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to allocate string: %s", strerror(errno));
+        free_ctx(ctx);
+        return MB_FILE_FATAL;
+    }
+
+    return open_ctx(file, ctx);
+}
+
+/*!
+ * Open read-only MbFile handle by memory mapping a file (WCS).
+ *
+ * \sa mb_file_open_mmap()
+ *
+ * \param file MbFile handle
+ * \param filename WCS filename
+ *
+ * \return
+ *   * #MB_FILE_OK if the file is successfully mapped
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_open_mmap_filename_w(struct MbFile *file, const wchar_t *filename)
+{
+    MmapFileCtx *ctx = create_ctx(file);
+    if (!ctx) {
+        return MB_FILE_FATAL;
+    }
+
+    ctx->filename = mb::wcs_to_mbs(filename);
+    if (!ctx->filename) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Failed to convert WCS filename to MBS");
+        free_ctx(ctx);
+        return MB_FILE_FATAL;
+    }
+
+    return open_ctx(file, ctx);
+}
+
+MB_END_C_DECLS
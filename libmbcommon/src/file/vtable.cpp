@@ -19,9 +19,15 @@
 
 #include "mbcommon/file/vtable_p.h"
 
+#include <cerrno>
+
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
 MB_BEGIN_C_DECLS
 
 // fcntl.h
@@ -148,6 +154,116 @@ static ssize_t _default_write(void *userdata, int fd, const void *buf,
     return write(fd, buf, count);
 }
 
+#ifndef _WIN32
+static ssize_t _default_pread64(void *userdata, int fd, void *buf,
+                                size_t count, off64_t offset)
+{
+    (void) userdata;
+    return pread64(fd, buf, count, offset);
+}
+
+static ssize_t _default_pwrite64(void *userdata, int fd, const void *buf,
+                                 size_t count, off64_t offset)
+{
+    (void) userdata;
+    return pwrite64(fd, buf, count, offset);
+}
+#endif
+
+// sys/uio.h
+
+#ifndef _WIN32
+static ssize_t _default_readv(void *userdata, int fd, const struct iovec *iov,
+                              int iovcnt)
+{
+    (void) userdata;
+    return readv(fd, iov, iovcnt);
+}
+
+static ssize_t _default_writev(void *userdata, int fd, const struct iovec *iov,
+                               int iovcnt)
+{
+    (void) userdata;
+    return writev(fd, iov, iovcnt);
+}
+
+static ssize_t _default_preadv64(void *userdata, int fd,
+                                 const struct iovec *iov, int iovcnt,
+                                 off64_t offset)
+{
+    (void) userdata;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 24
+    return preadv64(fd, iov, iovcnt, offset);
+#else
+    (void) fd;
+    (void) iov;
+    (void) iovcnt;
+    (void) offset;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static ssize_t _default_pwritev64(void *userdata, int fd,
+                                  const struct iovec *iov, int iovcnt,
+                                  off64_t offset)
+{
+    (void) userdata;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 24
+    return pwritev64(fd, iov, iovcnt, offset);
+#else
+    (void) fd;
+    (void) iov;
+    (void) iovcnt;
+    (void) offset;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+#endif
+
+#ifdef __linux__
+// Linux-specific
+
+static ssize_t _default_copy_file_range(void *userdata, int fd_in,
+                                        off64_t *off_in, int fd_out,
+                                        off64_t *off_out, size_t len,
+                                        unsigned int flags)
+{
+    (void) userdata;
+    // Older libc versions don't have a wrapper
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len,
+                   flags);
+#else
+    (void) fd_in;
+    (void) off_in;
+    (void) fd_out;
+    (void) off_out;
+    (void) len;
+    (void) flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int _default_fallocate64(void *userdata, int fd, int mode,
+                                off64_t offset, off64_t len)
+{
+    (void) userdata;
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+    return fallocate64(fd, mode, offset, len);
+#else
+    (void) fd;
+    (void) mode;
+    (void) offset;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+#endif
+
 #ifdef _WIN32
 static BOOL _default_CloseHandle(void *userdata, HANDLE hObject)
 {
@@ -236,6 +352,22 @@ void _vtable_fill_system_funcs(SysVtable *vtable)
     vtable->fn_lseek64 = _default_lseek64;
     vtable->fn_read = _default_read;
     vtable->fn_write = _default_write;
+#ifndef _WIN32
+    vtable->fn_pread64 = _default_pread64;
+    vtable->fn_pwrite64 = _default_pwrite64;
+#endif
+    // sys/uio.h
+#ifndef _WIN32
+    vtable->fn_readv = _default_readv;
+    vtable->fn_writev = _default_writev;
+    vtable->fn_preadv64 = _default_preadv64;
+    vtable->fn_pwritev64 = _default_pwritev64;
+#endif
+#ifdef __linux__
+    // Linux-specific
+    vtable->fn_copy_file_range = _default_copy_file_range;
+    vtable->fn_fallocate64 = _default_fallocate64;
+#endif
 #ifdef _WIN32
     // windows.h
     vtable->fn_CloseHandle = _default_CloseHandle;
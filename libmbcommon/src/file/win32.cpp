@@ -222,6 +222,100 @@ static int win32_write_cb(struct MbFile *file, void *userdata,
     return MB_FILE_OK;
 }
 
+// ReadFile() and WriteFile() accept an offset via OVERLAPPED, but they still
+// move the file pointer for synchronous handles, so it has to be restored
+// afterwards.
+static int win32_pread_cb(struct MbFile *file, void *userdata,
+                          void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_read)
+{
+    Win32FileCtx *ctx = static_cast<Win32FileCtx *>(userdata);
+    int ret = MB_FILE_OK, ret2;
+    uint64_t current_pos;
+    uint64_t temp;
+    OVERLAPPED overlapped{};
+    DWORD n = 0;
+
+    ret2 = win32_seek_cb(file, userdata, 0, SEEK_CUR, &current_pos);
+    if (ret2 != MB_FILE_OK) {
+        return ret2;
+    }
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (!ctx->vtable.fn_ReadFile(ctx->vtable.userdata, ctx->handle, buf, size,
+                                 &n, &overlapped)) {
+        // Reading at or past EOF is not an error
+        if (GetLastError() != ERROR_HANDLE_EOF) {
+            mb_file_set_error(file, -GetLastError(),
+                              "Failed to read file: %ls",
+                              win32_error_string(ctx, GetLastError()));
+            ret = MB_FILE_FAILED;
+        }
+    }
+
+    ret2 = win32_seek_cb(file, userdata, current_pos, SEEK_SET, &temp);
+    if (ret2 != MB_FILE_OK) {
+        // We can't guarantee the file position so the handle shouldn't be used
+        // anymore
+        return MB_FILE_FATAL;
+    }
+
+    if (ret == MB_FILE_OK) {
+        *bytes_read = n;
+    }
+    return ret;
+}
+
+static int win32_pwrite_cb(struct MbFile *file, void *userdata,
+                           const void *buf, size_t size, uint64_t offset,
+                           size_t *bytes_written)
+{
+    Win32FileCtx *ctx = static_cast<Win32FileCtx *>(userdata);
+    int ret = MB_FILE_OK, ret2;
+    uint64_t current_pos;
+    uint64_t temp;
+    OVERLAPPED overlapped{};
+    DWORD n = 0;
+
+    ret2 = win32_seek_cb(file, userdata, 0, SEEK_CUR, &current_pos);
+    if (ret2 != MB_FILE_OK) {
+        return ret2;
+    }
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (!ctx->vtable.fn_WriteFile(ctx->vtable.userdata, ctx->handle, buf, size,
+                                  &n, &overlapped)) {
+        mb_file_set_error(file, -GetLastError(),
+                          "Failed to write file: %ls",
+                          win32_error_string(ctx, GetLastError()));
+        ret = MB_FILE_FAILED;
+    }
+
+    ret2 = win32_seek_cb(file, userdata, current_pos, SEEK_SET, &temp);
+    if (ret2 != MB_FILE_OK) {
+        // We can't guarantee the file position so the handle shouldn't be used
+        // anymore
+        return MB_FILE_FATAL;
+    }
+
+    if (ret == MB_FILE_OK) {
+        *bytes_written = n;
+    }
+    return ret;
+}
+
 static int win32_truncate_cb(struct MbFile *file, void *userdata,
                               uint64_t size)
 {
@@ -297,6 +391,17 @@ static Win32FileCtx * create_ctx(struct MbFile *file, SysVtable *vtable,
 
 static int open_ctx(struct MbFile *file, Win32FileCtx *ctx)
 {
+    int ret;
+
+    ret = mb_file_set_pread_callback(file, &win32_pread_cb);
+    if (ret == MB_FILE_OK) {
+        ret = mb_file_set_pwrite_callback(file, &win32_pwrite_cb);
+    }
+    if (ret != MB_FILE_OK) {
+        free_ctx(ctx);
+        return ret;
+    }
+
     return mb_file_open_callbacks(file,
                                   &win32_open_cb,
                                   &win32_close_cb,
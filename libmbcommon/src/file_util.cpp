@@ -23,11 +23,15 @@
 
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include "mbcommon/file_p.h"
 #include "mbcommon/libc/string.h"
 
 #define DEFAULT_BUFFER_SIZE             (8 * 1024 * 1024)
+#define MOVE_MAX_BUFFER_SIZE            (4 * 1024 * 1024)
+#define IOV_BATCH_SIZE                  16
 
 /*!
  * \file mbcommon/file_util.h
@@ -38,9 +42,10 @@
  * \typedef MbFileSearchResultCallback
  *
  * \note The file position must not change after a successful return of this
- *       callback. If file operations need to be performed, save the file
- *       position beforehand with mb_file_seek() and restore it afterwards. Note
- *       that the file position is unlikely to match \p offset.
+ *       callback. If file operations need to be performed, use mb_file_pread()
+ *       or save the file position beforehand with mb_file_seek() and restore
+ *       it afterwards. Note that the file position is unlikely to match
+ *       \p offset.
  *
  * \param file MbFile handle
  * \param offset Offset of match
@@ -52,6 +57,22 @@
  *   * Return \<= #MB_FILE_FAILED if the search should fail
  */
 
+/*!
+ * \typedef MbFileMultiSearchResultCallback
+ *
+ * \note The same restrictions as for #MbFileSearchResultCallback apply.
+ *
+ * \param file MbFile handle
+ * \param userdata User callback data
+ * \param pattern_id Index of the matching pattern
+ * \param offset Offset of match
+ *
+ * \return
+ *   * Return #MB_FILE_OK if the search can continue
+ *   * Return #MB_FILE_WARN if the search should stop, but return MB_FILE_OK
+ *   * Return \<= #MB_FILE_FAILED if the search should fail
+ */
+
 MB_BEGIN_C_DECLS
 
 /*!
@@ -152,6 +173,269 @@ int mb_file_write_fully(struct MbFile *file, const void *buf, size_t size,
     return MB_FILE_OK;
 }
 
+/*!
+ * \brief Cursor into an array of buffers for the vectored *_fully() functions
+ */
+struct IoVecCursor
+{
+    const struct MbFileIoVec *iov;
+    size_t iov_count;
+    size_t index;
+    size_t offset;
+};
+
+/*!
+ * \brief Fill \p batch with the remaining (non-empty) buffers
+ *
+ * \return Number of elements in \p batch that were filled
+ */
+static size_t iov_cursor_fill(const IoVecCursor *cursor,
+                              struct MbFileIoVec *batch, size_t batch_size)
+{
+    size_t offset = cursor->offset;
+    size_t n = 0;
+
+    for (size_t i = cursor->index; i < cursor->iov_count && n < batch_size;
+            ++i, offset = 0) {
+        if (cursor->iov[i].size == offset) {
+            continue;
+        }
+
+        batch[n].base = static_cast<char *>(cursor->iov[i].base) + offset;
+        batch[n].size = cursor->iov[i].size - offset;
+        ++n;
+    }
+
+    return n;
+}
+
+/*!
+ * \brief Advance cursor by \p size bytes
+ */
+static void iov_cursor_advance(IoVecCursor *cursor, size_t size)
+{
+    while (cursor->index < cursor->iov_count) {
+        size_t remain = cursor->iov[cursor->index].size - cursor->offset;
+
+        if (size < remain) {
+            cursor->offset += size;
+            break;
+        }
+
+        size -= remain;
+        ++cursor->index;
+        cursor->offset = 0;
+    }
+}
+
+/*!
+ * \brief Read from an MbFile handle into multiple buffers.
+ *
+ * This function differs from mb_file_readv() in that it will call
+ * mb_file_readv() repeatedly until all of the buffers are filled or EOF is
+ * reached. If mb_file_readv() returns #MB_FILE_RETRY, the read operation will
+ * be automatically reattempted. Thus, this function will never return
+ * #MB_FILE_RETRY.
+ *
+ * \note \p bytes_read is updated with the number of bytes successfully read
+ *       even when this function fails. Take this into account if reattempting
+ *       the read operation.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to read into
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_read Output number of bytes that were read. A short read
+ *                        indicates end of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes are read or EOF is reached
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support reading
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_readv_fully(struct MbFile *file, const struct MbFileIoVec *iov,
+                        size_t iov_count, size_t *bytes_read)
+{
+    IoVecCursor cursor{iov, iov_count, 0, 0};
+    struct MbFileIoVec batch[IOV_BATCH_SIZE];
+    size_t batch_count;
+    size_t n;
+    int ret;
+
+    *bytes_read = 0;
+
+    while ((batch_count = iov_cursor_fill(&cursor, batch, IOV_BATCH_SIZE))
+            > 0) {
+        ret = mb_file_readv(file, batch, batch_count, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_read += n;
+        iov_cursor_advance(&cursor, n);
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Write to an MbFile handle from multiple buffers.
+ *
+ * This function differs from mb_file_writev() in that it will call
+ * mb_file_writev() repeatedly until all of the buffers are written or EOF is
+ * reached. If mb_file_writev() returns #MB_FILE_RETRY, the write operation
+ * will be automatically reattempted. Thus, this function will never return
+ * #MB_FILE_RETRY.
+ *
+ * \note \p bytes_written is updated with the number of bytes successfully
+ *       written even when this function fails. Take this into account if
+ *       reattempting the write operation.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] iov Array of buffers to write from
+ * \param[in] iov_count Number of elements in \p iov
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes are written
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support writing
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_writev_fully(struct MbFile *file, const struct MbFileIoVec *iov,
+                         size_t iov_count, size_t *bytes_written)
+{
+    IoVecCursor cursor{iov, iov_count, 0, 0};
+    struct MbFileIoVec batch[IOV_BATCH_SIZE];
+    size_t batch_count;
+    size_t n;
+    int ret;
+
+    *bytes_written = 0;
+
+    while ((batch_count = iov_cursor_fill(&cursor, batch, IOV_BATCH_SIZE))
+            > 0) {
+        ret = mb_file_writev(file, batch, batch_count, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_written += n;
+        iov_cursor_advance(&cursor, n);
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Read from an MbFile handle at a specific offset.
+ *
+ * This function differs from mb_file_pread() in that it will call
+ * mb_file_pread() repeatedly until the buffer is filled or EOF is reached. If
+ * mb_file_pread() returns #MB_FILE_RETRY, the read operation will be
+ * automatically reattempted. Thus, this function will never return
+ * #MB_FILE_RETRY. The file position is not changed.
+ *
+ * \note \p bytes_read is updated with the number of bytes successfully read
+ *       even when this function fails. Take this into account if reattempting
+ *       the read operation.
+ *
+ * \param[in] file MbFile handle
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to read from
+ * \param[out] bytes_read Output number of bytes that were read. A short read
+ *                        indicates end of file. This parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes are read or EOF is reached
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support reading
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pread_fully(struct MbFile *file, void *buf, size_t size,
+                        uint64_t offset, size_t *bytes_read)
+{
+    size_t n;
+    int ret;
+
+    *bytes_read = 0;
+
+    while (*bytes_read < size) {
+        ret = mb_file_pread(file, static_cast<char *>(buf) + *bytes_read,
+                            size - *bytes_read, offset + *bytes_read, &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_read += n;
+    }
+
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Write to an MbFile handle at a specific offset.
+ *
+ * This function differs from mb_file_pwrite() in that it will call
+ * mb_file_pwrite() repeatedly until the buffer is written or EOF is reached. If
+ * mb_file_pwrite() returns #MB_FILE_RETRY, the write operation will be
+ * automatically reattempted. Thus, this function will never return
+ * #MB_FILE_RETRY. The file position is not changed.
+ *
+ * \note \p bytes_written is updated with the number of bytes successfully
+ *       written even when this function fails. Take this into account if
+ *       reattempting the write operation.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] buf Buffer to write from
+ * \param[in] size Buffer size
+ * \param[in] offset Offset to write to
+ * \param[out] bytes_written Output number of bytes that were written. This
+ *                           parameter cannot be NULL.
+ *
+ * \return
+ *   * #MB_FILE_OK if some bytes are written
+ *   * #MB_FILE_UNSUPPORTED if the handle source does not support writing
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_pwrite_fully(struct MbFile *file, const void *buf, size_t size,
+                         uint64_t offset, size_t *bytes_written)
+{
+    size_t n;
+    int ret;
+
+    *bytes_written = 0;
+
+    while (*bytes_written < size) {
+        ret = mb_file_pwrite(file,
+                             static_cast<const char *>(buf) + *bytes_written,
+                             size - *bytes_written, offset + *bytes_written,
+                             &n);
+        if (ret == MB_FILE_RETRY) {
+            continue;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            break;
+        }
+
+        *bytes_written += n;
+    }
+
+    return MB_FILE_OK;
+}
+
 /*!
  * \brief Read from an MbFile handle and discard the data.
  *
@@ -200,6 +484,62 @@ int mb_file_read_discard(struct MbFile *file, uint64_t size,
     return MB_FILE_OK;
 }
 
+/*!
+ * \brief Search data that is directly accessible via mb_file_peek()
+ *
+ * \return #MB_FILE_UNSUPPORTED if the file does not support peeking.
+ *         Otherwise, the same values as mb_file_search().
+ */
+static int search_in_place(struct MbFile *file, int64_t start, int64_t end,
+                           const void *pattern, size_t pattern_size,
+                           int64_t max_matches,
+                           MbFileSearchResultCallback result_cb,
+                           void *userdata)
+{
+    uint64_t offset = start >= 0 ? start : 0;
+    uint64_t size = end >= 0 ? end - offset : UINT64_MAX;
+    const void *data;
+    size_t n;
+    int ret;
+
+    ret = mb_file_peek(file, offset, std::min<uint64_t>(size, SIZE_MAX),
+                       &data, &n);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    const char *match = static_cast<const char *>(data);
+    size_t match_remain = n;
+
+    while ((match = static_cast<const char *>(
+            mb_memmem(match, match_remain, pattern, pattern_size)))) {
+        uint64_t match_offset = offset
+                + (match - static_cast<const char *>(data));
+
+        // Invoke callback
+        ret = result_cb(file, userdata, match_offset);
+        if (ret == MB_FILE_WARN) {
+            // Stop searching early
+            return MB_FILE_OK;
+        } else if (ret < 0) {
+            return ret;
+        }
+
+        if (max_matches > 0) {
+            --max_matches;
+            if (max_matches == 0) {
+                break;
+            }
+        }
+
+        // We don't do overlapping searches
+        match += pattern_size;
+        match_remain = n - (match - static_cast<const char *>(data));
+    }
+
+    return MB_FILE_OK;
+}
+
 /*!
  * \brief Search file for binary sequence
  *
@@ -214,6 +554,10 @@ int mb_file_read_discard(struct MbFile *file, uint64_t size,
  * the beginning of the file before calling this function. Instead of seeking,
  * the function will read and discard any data before \p start.
  *
+ * If \p file supports mb_file_peek(), the data is searched in place and no
+ * buffer is allocated. \p result_cb must not write to or truncate the file in
+ * that case.
+ *
  * \note We do not do overlapping searches. For example, if a file's contents
  *       is "ababababab" and the search pattern is "abab", the resulting offsets
  *       will be (0 and 4), *not* (0, 2, 4, 6). In other words, the next search
@@ -287,6 +631,13 @@ int mb_file_search(struct MbFile *file, int64_t start, int64_t end,
         goto done;
     }
 
+    // No buffer is needed if the data can be accessed directly
+    ret = search_in_place(file, start, end, pattern, pattern_size,
+                          max_matches, result_cb, userdata);
+    if (ret != MB_FILE_UNSUPPORTED) {
+        goto done;
+    }
+
     buf = static_cast<char *>(malloc(buf_size));
     if (!buf) {
         mb_file_set_error(file, -errno, "Failed to allocate buffer: %s",
@@ -402,84 +753,556 @@ done:
     return ret;
 }
 
+#define NO_STATE                        UINT32_MAX
+#define NO_PATTERN                      SIZE_MAX
+#define HAS_OUTPUT                      0x80000000u
+
 /*!
- * \brief Move data in file
- *
- * This function is equivalent to `memmove()`, except it operates on a MbFile
- * handle. The source and destination regions can overlap. In the degenerate
- * case where \p src == \p dest or \p size == 0, no operation will be performed,
- * but the function will return #MB_BI_OK and set \p size_moved accordingly.
- *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
- *
- * \note If \p *size_moved is less than \p size, then the *first* \p *size_moved
- *       bytes have been copied from offset \p src to offset \p dest. This is
- *       true even if \p src \< \p dest, resulting in a backwards copy.
+ * \brief Aho-Corasick automaton for mb_file_search_multi()
  *
- * \param[in] file MbFile handle
- * \param[in] src Source offset
- * \param[in] dest Destination offset
- * \param[in] size Size of data to move
- * \param[out] size_moved Pointer to store size of data that is moved
+ * The automaton is stored as a complete DFA so that scanning costs one table
+ * lookup per byte regardless of the number of patterns. To keep the table
+ * small, bytes that do not occur in any pattern share a single input class.
  *
- * \return
- *   * #MB_FILE_OK if the data is successfully moved
- *   * \<= #MB_FILE_WARN if an error occurs
+ * Transitions are stored as offsets to the target state's row (ie. state *
+ * num_classes) with #HAS_OUTPUT set if any pattern ends at the target state.
+ * This keeps the per-byte dependency chain down to a single load.
  */
-int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
-                 uint64_t size, uint64_t *size_moved)
+struct SearchAutomaton
 {
-    char buf[10240];
-    size_t n_read;
-    size_t n_written;
-    int ret;
+    // Byte -> input class
+    uint16_t classes[256];
+    size_t num_classes;
+    size_t num_states;
 
-    // Check if we need to do anything
-    if (src == dest || size == 0) {
-        *size_moved = size;
-        return MB_FILE_OK;
-    }
+    // Whether a byte can leave the root state
+    bool start[256];
 
-    if (src > UINT64_MAX - size || dest > UINT64_MAX - size) {
-        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
-                          "Offset + size overflows integer");
-        return MB_FILE_FAILED;
+    // Transitions: row + class -> target row | HAS_OUTPUT
+    uint32_t *delta;
+    // First state in the output chain of each state or NO_STATE
+    uint32_t *out;
+    // Next state in the output chain or NO_STATE
+    uint32_t *dict;
+    // First pattern ending at each state or NO_PATTERN
+    size_t *term;
+    // Next pattern ending at the same state or NO_PATTERN
+    size_t *next_term;
+};
+
+static void automaton_free(SearchAutomaton *ac)
+{
+    free(ac->delta);
+    free(ac->out);
+    free(ac->dict);
+    free(ac->term);
+    free(ac->next_term);
+}
+
+static int automaton_build(struct MbFile *file, SearchAutomaton *ac,
+                           const void * const *patterns,
+                           const size_t *pattern_sizes, size_t num_patterns)
+{
+    bool used[256] = {};
+    uint64_t total_size = 1;
+    uint32_t *fail = nullptr;
+    uint32_t *queue = nullptr;
+    size_t head = 0;
+    size_t tail = 0;
+    int ret = MB_FILE_OK;
+
+    memset(ac, 0, sizeof(*ac));
+
+    for (size_t p = 0; p < num_patterns; ++p) {
+        auto data = static_cast<const unsigned char *>(patterns[p]);
+
+        for (size_t i = 0; i < pattern_sizes[p]; ++i) {
+            used[data[i]] = true;
+        }
+
+        total_size += pattern_sizes[p];
+        if (total_size >= NO_STATE) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Patterns are too large");
+            return MB_FILE_FAILED;
+        }
+    }
+
+    // Class 0 is shared by all bytes that can't be part of a match
+    ac->num_classes = 1;
+    for (int c = 0; c < 256; ++c) {
+        if (used[c]) {
+            ac->classes[c] = static_cast<uint16_t>(ac->num_classes++);
+        }
+    }
+
+    // Upper bound on the number of trie nodes
+    size_t max_states = total_size;
+
+    if (max_states > HAS_OUTPUT / ac->num_classes) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Patterns are too large");
+        return MB_FILE_FAILED;
+    }
+
+    ac->delta = static_cast<uint32_t *>(
+            calloc(max_states * ac->num_classes, sizeof(uint32_t)));
+    ac->out = static_cast<uint32_t *>(malloc(max_states * sizeof(uint32_t)));
+    ac->dict = static_cast<uint32_t *>(malloc(max_states * sizeof(uint32_t)));
+    ac->term = static_cast<size_t *>(malloc(max_states * sizeof(size_t)));
+    ac->next_term = static_cast<size_t *>(
+            malloc(num_patterns * sizeof(size_t)));
+    fail = static_cast<uint32_t *>(malloc(max_states * sizeof(uint32_t)));
+    queue = static_cast<uint32_t *>(malloc(max_states * sizeof(uint32_t)));
+    if (!ac->delta || !ac->out || !ac->dict || !ac->term || !ac->next_term
+            || !fail || !queue) {
+        mb_file_set_error(file, -errno,
+                          "Failed to allocate search automaton: %s",
+                          strerror(errno));
+        ret = MB_FILE_FAILED;
+        goto done;
+    }
+
+    for (size_t s = 0; s < max_states; ++s) {
+        ac->term[s] = NO_PATTERN;
+        ac->dict[s] = NO_STATE;
+    }
+
+    // Build trie. Since no trie edge can lead back to the root, a transition
+    // of 0 means that the edge does not exist yet.
+    ac->num_states = 1;
+
+    for (size_t p = 0; p < num_patterns; ++p) {
+        auto data = static_cast<const unsigned char *>(patterns[p]);
+        uint32_t s = 0;
+
+        ac->next_term[p] = NO_PATTERN;
+
+        // Empty patterns never match
+        if (pattern_sizes[p] == 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < pattern_sizes[p]; ++i) {
+            uint32_t *t = &ac->delta[s * ac->num_classes
+                    + ac->classes[data[i]]];
+            if (*t == 0) {
+                *t = static_cast<uint32_t>(ac->num_states++);
+            }
+            s = *t;
+        }
+
+        ac->next_term[p] = ac->term[s];
+        ac->term[s] = p;
+    }
+
+    // Compute failure links in breadth-first order and fill in the missing
+    // transitions to turn the trie into a DFA
+    fail[0] = 0;
+
+    for (size_t c = 0; c < ac->num_classes; ++c) {
+        uint32_t v = ac->delta[c];
+        if (v != 0) {
+            fail[v] = 0;
+            queue[tail++] = v;
+        }
+    }
+
+    while (head < tail) {
+        uint32_t u = queue[head++];
+        uint32_t *row = &ac->delta[u * ac->num_classes];
+        const uint32_t *fail_row = &ac->delta[fail[u] * ac->num_classes];
+
+        for (size_t c = 0; c < ac->num_classes; ++c) {
+            uint32_t v = row[c];
+            if (v != 0) {
+                uint32_t f = fail_row[c];
+                fail[v] = f;
+                ac->dict[v] = ac->term[f] != NO_PATTERN ? f : ac->dict[f];
+                queue[tail++] = v;
+            } else {
+                row[c] = fail_row[c];
+            }
+        }
+    }
+
+    for (size_t s = 0; s < ac->num_states; ++s) {
+        ac->out[s] = ac->term[s] != NO_PATTERN ? s : ac->dict[s];
+    }
+
+    for (size_t i = 0; i < ac->num_states * ac->num_classes; ++i) {
+        uint32_t v = ac->delta[i];
+        ac->delta[i] = static_cast<uint32_t>(v * ac->num_classes)
+                | (ac->out[v] != NO_STATE ? HAS_OUTPUT : 0);
+    }
+
+    for (int c = 0; c < 256; ++c) {
+        ac->start[c] = ac->delta[ac->classes[c]] != 0;
+    }
+
+done:
+    free(fail);
+    free(queue);
+    if (ret != MB_FILE_OK) {
+        automaton_free(ac);
+    }
+    return ret;
+}
+
+struct MultiSearchCtx
+{
+    SearchAutomaton ac;
+    // Current state's row in the transition table
+    uint32_t row;
+    const size_t *pattern_sizes;
+    // End offset of the last reported match for each pattern
+    uint64_t *last_end;
+    int64_t max_matches;
+    MbFileMultiSearchResultCallback result_cb;
+    void *userdata;
+};
+
+/*!
+ * \brief Feed data to the automaton
+ *
+ * \return
+ *   * #MB_FILE_OK if the search should continue
+ *   * #MB_FILE_WARN if the search should stop successfully
+ *   * \<= #MB_FILE_FAILED if the callback failed
+ */
+static int multi_search_scan(struct MbFile *file, MultiSearchCtx *ctx,
+                             const unsigned char *data, size_t size,
+                             uint64_t offset)
+{
+    const SearchAutomaton *ac = &ctx->ac;
+    uint32_t row = ctx->row;
+    size_t i = 0;
+    int ret = MB_FILE_OK;
+
+    while (i < size) {
+        if (row == 0) {
+            // Nothing is partially matched, so skip ahead to the next byte
+            // that can start a match. There's no dependency between the
+            // iterations here, so this is much faster than stepping the DFA.
+            while (i < size && !ac->start[data[i]]) {
+                ++i;
+            }
+            if (i == size) {
+                break;
+            }
+        }
+
+        uint32_t next = ac->delta[row + ac->classes[data[i]]];
+        row = next & ~HAS_OUTPUT;
+        ++i;
+
+        if (!(next & HAS_OUTPUT)) {
+            continue;
+        }
+
+        uint64_t match_end = offset + i;
+
+        for (uint32_t t = ac->out[row / ac->num_classes]; t != NO_STATE;
+                t = ac->dict[t]) {
+            for (size_t p = ac->term[t]; p != NO_PATTERN;
+                    p = ac->next_term[p]) {
+                uint64_t match_start = match_end - ctx->pattern_sizes[p];
+
+                // We don't do overlapping searches for the same pattern
+                if (match_start < ctx->last_end[p]) {
+                    continue;
+                }
+                ctx->last_end[p] = match_end;
+
+                ret = ctx->result_cb(file, ctx->userdata, p, match_start);
+                if (ret != MB_FILE_OK) {
+                    goto done;
+                }
+
+                if (ctx->max_matches > 0) {
+                    --ctx->max_matches;
+                    if (ctx->max_matches == 0) {
+                        ret = MB_FILE_WARN;
+                        goto done;
+                    }
+                }
+            }
+        }
+    }
+
+done:
+    ctx->row = row;
+    return ret;
+}
+
+/*!
+ * \brief Search file for several binary sequences at once
+ *
+ * This function is similar to mb_file_search(), except that it searches for
+ * \p num_patterns patterns in a single pass over the file. This is much faster
+ * than calling mb_file_search() once per pattern because the data is only
+ * read once and each byte is only examined once, regardless of the number of
+ * patterns. The patterns may share prefixes, be substrings of one another, or
+ * be duplicates.
+ *
+ * Matches are reported to \p result_cb along with the index of the pattern in
+ * \p patterns. Matches are reported in the order of their *end* offsets. If
+ * several matches end at the same offset, longer patterns are reported first.
+ *
+ * If \p buf_size is non-zero, a buffer of size \p buf_size will be used for
+ * reading. Otherwise, an 8 MiB buffer will be used. Unlike mb_file_search(),
+ * the buffer size is not limited by the pattern sizes. If \p file supports
+ * mb_file_peek(), the data is searched in place and no buffer is allocated.
+ * \p result_cb must not write to or truncate the file in that case.
+ *
+ * If \p file does not support seeking, then the file position must be set to
+ * the beginning of the file before calling this function. Instead of seeking,
+ * the function will read and discard any data before \p start.
+ *
+ * \note As with mb_file_search(), overlapping matches of the *same* pattern
+ *       are not reported. Matches of different patterns may overlap.
+ *
+ * \note The file position after this function returns is undefined. Be sure to
+ *       seek to a known location before attempting further read or write
+ *       operations.
+ *
+ * \param file MbFile handle
+ * \param start Start offset or negative number for beginning of file
+ * \param end End offset or negative number for end of file
+ * \param bsize Buffer size or 0 to automatically choose a size
+ * \param patterns Array of patterns to search
+ * \param pattern_sizes Array of pattern sizes
+ * \param num_patterns Number of patterns
+ * \param max_matches Maximum number of matches (for all patterns combined) or
+ *                    -1 to find all matches
+ * \param result_cb Callback to invoke upon finding a match
+ * \param userdata User callback data
+ *
+ * \return
+ *   * #MB_FILE_OK if the search completes successfully
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_search_multi(struct MbFile *file, int64_t start, int64_t end,
+                         size_t bsize, const void * const *patterns,
+                         const size_t *pattern_sizes, size_t num_patterns,
+                         int64_t max_matches,
+                         MbFileMultiSearchResultCallback result_cb,
+                         void *userdata)
+{
+    MultiSearchCtx ctx;
+    unsigned char *buf = nullptr;
+    size_t buf_size = bsize != 0 ? bsize : DEFAULT_BUFFER_SIZE;
+    uint64_t offset = start >= 0 ? start : 0;
+    uint64_t remain = end >= 0 ? end - offset : UINT64_MAX;
+    const void *data;
+    size_t n;
+    int ret;
+
+    // Check boundaries
+    if (start >= 0 && end >= 0 && end < start) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "End offset < start offset");
+        return MB_FILE_FAILED;
+    }
+
+    // Trivial case
+    if (max_matches == 0 || num_patterns == 0) {
+        return MB_FILE_OK;
+    }
+
+    ret = automaton_build(file, &ctx.ac, patterns, pattern_sizes,
+                          num_patterns);
+    if (ret != MB_FILE_OK) {
+        return ret;
+    }
+
+    ctx.row = 0;
+    ctx.pattern_sizes = pattern_sizes;
+    ctx.last_end = static_cast<uint64_t *>(
+            calloc(num_patterns, sizeof(uint64_t)));
+    ctx.max_matches = max_matches;
+    ctx.result_cb = result_cb;
+    ctx.userdata = userdata;
+
+    if (!ctx.last_end) {
+        mb_file_set_error(file, -errno, "Failed to allocate buffer: %s",
+                          strerror(errno));
+        ret = MB_FILE_FAILED;
+        goto done;
+    }
+
+    // No buffer is needed if the data can be accessed directly
+    ret = mb_file_peek(file, offset, std::min<uint64_t>(remain, SIZE_MAX),
+                       &data, &n);
+    if (ret == MB_FILE_OK) {
+        ret = multi_search_scan(file, &ctx,
+                                static_cast<const unsigned char *>(data), n,
+                                offset);
+        goto done;
+    } else if (ret != MB_FILE_UNSUPPORTED) {
+        goto done;
+    }
+
+    buf = static_cast<unsigned char *>(malloc(buf_size));
+    if (!buf) {
+        mb_file_set_error(file, -errno, "Failed to allocate buffer: %s",
+                          strerror(errno));
+        ret = MB_FILE_FAILED;
+        goto done;
+    }
+
+    // Seek to starting point
+    ret = mb_file_seek(file, offset, SEEK_SET, nullptr);
+    if (ret == MB_FILE_UNSUPPORTED) {
+        uint64_t discarded;
+        ret = mb_file_read_discard(file, offset, &discarded);
+        if (ret < 0) {
+            goto done;
+        } else if (discarded != offset) {
+            mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                              "Reached EOF before starting offset");
+            ret = MB_FILE_FATAL;
+            goto done;
+        }
+    } else if (ret < 0) {
+        goto done;
+    }
+
+    while (remain > 0) {
+        ret = mb_file_read_fully(file, buf,
+                                 std::min<uint64_t>(buf_size, remain), &n);
+        if (ret < 0) {
+            goto done;
+        } else if (n == 0) {
+            break;
+        }
+
+        if (n > UINT64_MAX - offset) {
+            mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                              "Read overflows offset value");
+            ret = MB_FILE_FAILED;
+            goto done;
+        }
+
+        ret = multi_search_scan(file, &ctx, buf, n, offset);
+        if (ret != MB_FILE_OK) {
+            goto done;
+        }
+
+        offset += n;
+        remain -= n;
+    }
+
+done:
+    // Stopping early is not an error
+    if (ret == MB_FILE_WARN) {
+        ret = MB_FILE_OK;
+    }
+
+    free(buf);
+    free(ctx.last_end);
+    automaton_free(&ctx.ac);
+    return ret;
+}
+
+/*!
+ * \brief Move data in file
+ *
+ * This function is equivalent to `memmove()`, except it operates on a MbFile
+ * handle. The source and destination regions can overlap. In the degenerate
+ * case where \p src == \p dest or \p size == 0, no operation will be performed,
+ * but the function will return #MB_BI_OK and set \p size_moved accordingly.
+ *
+ * \note If the handle provides a move callback (eg. file descriptors on Linux,
+ *       which can use `copy_file_range()` and `fallocate()`), it is used to
+ *       move the data without copying it through userspace. Otherwise, the data
+ *       is copied with mb_file_pread() and mb_file_pwrite() using a buffer of
+ *       up to 4 MiB, depending on \p size. The file position is not changed
+ *       either way.
+ *
+ * \note If \p *size_moved is less than \p size, then the *first* \p *size_moved
+ *       bytes have been copied from offset \p src to offset \p dest. This is
+ *       true even if \p src \< \p dest, resulting in a backwards copy.
+ *
+ * \param[in] file MbFile handle
+ * \param[in] src Source offset
+ * \param[in] dest Destination offset
+ * \param[in] size Size of data to move
+ * \param[out] size_moved Pointer to store size of data that is moved
+ *
+ * \return
+ *   * #MB_FILE_OK if the data is successfully moved
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
+                 uint64_t size, uint64_t *size_moved)
+{
+    char stack_buf[10240];
+    char *buf = nullptr;
+    size_t buf_size = 0;
+    size_t n_read;
+    size_t n_written;
+    int ret;
+
+    // Check if we need to do anything
+    if (src == dest || size == 0) {
+        *size_moved = size;
+        return MB_FILE_OK;
+    }
+
+    if (src > UINT64_MAX - size || dest > UINT64_MAX - size) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset + size overflows integer");
+        return MB_FILE_FAILED;
     }
 
     *size_moved = 0;
 
+    ret = _mb_file_move_native(file, src, dest, size, size_moved);
+    if (ret != MB_FILE_UNSUPPORTED) {
+        return ret;
+    }
+
+    *size_moved = 0;
+
+    // Large moves are dominated by the number of I/O operations, so use a
+    // buffer proportional to the size, falling back to smaller sizes if memory
+    // is tight
+    for (size_t try_size = std::min<uint64_t>(size, MOVE_MAX_BUFFER_SIZE);
+            try_size > sizeof(stack_buf); try_size /= 2) {
+        buf = static_cast<char *>(malloc(try_size));
+        if (buf) {
+            buf_size = try_size;
+            break;
+        }
+    }
+    if (!buf) {
+        buf = stack_buf;
+        buf_size = sizeof(stack_buf);
+    }
+
+    ret = MB_FILE_OK;
+
     if (dest < src) {
         // Copy forwards
         while (*size_moved < size) {
             size_t to_read = std::min<uint64_t>(
-                    sizeof(buf), size - *size_moved);
-
-            // Seek to source offset
-            ret = mb_file_seek(file, src + *size_moved, SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
+                    buf_size, size - *size_moved);
 
             // Read data from source
-            ret = mb_file_read_fully(file, buf, to_read, &n_read);
+            ret = mb_file_pread_fully(file, buf, to_read, src + *size_moved,
+                                      &n_read);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             } else if (n_read == 0) {
                 break;
             }
 
-            // Seek to destination offset
-            ret = mb_file_seek(file, dest + *size_moved, SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
-
             // Write data to destination
-            ret = mb_file_write_fully(file, buf, n_read, &n_written);
+            ret = mb_file_pwrite_fully(file, buf, n_read, dest + *size_moved,
+                                       &n_written);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             }
 
             *size_moved += n_written;
@@ -492,34 +1315,24 @@ int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
         // Copy backwards
         while (*size_moved < size) {
             size_t to_read = std::min<uint64_t>(
-                    sizeof(buf), size - *size_moved);
-
-            // Seek to source offset
-            ret = mb_file_seek(file, src + size - *size_moved - to_read,
-                               SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
+                    buf_size, size - *size_moved);
 
             // Read data form source
-            ret = mb_file_read_fully(file, buf, to_read, &n_read);
+            ret = mb_file_pread_fully(file, buf, to_read,
+                                      src + size - *size_moved - to_read,
+                                      &n_read);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             } else if (n_read == 0) {
                 break;
             }
 
-            // Seek to destination offset
-            ret = mb_file_seek(file, dest + size - *size_moved - n_read,
-                               SEEK_SET, nullptr);
-            if (ret != MB_FILE_OK) {
-                return ret;
-            }
-
             // Write data to destination
-            ret = mb_file_write_fully(file, buf, n_read, &n_written);
+            ret = mb_file_pwrite_fully(file, buf, n_read,
+                                       dest + size - *size_moved - n_read,
+                                       &n_written);
             if (ret != MB_FILE_OK) {
-                return ret;
+                goto done;
             }
 
             *size_moved += n_written;
@@ -531,7 +1344,153 @@ int mb_file_move(struct MbFile *file, uint64_t src, uint64_t dest,
         }
     }
 
-    return MB_FILE_OK;
+done:
+    if (buf != stack_buf) {
+        free(buf);
+    }
+    return ret;
+}
+
+/*!
+ * \brief Copy data from another file
+ *
+ * Copy \p size bytes at offset \p src_offset in \p src to the current file
+ * position of \p file. The file position of \p file is advanced by the
+ * number of bytes copied. Fewer than \p size bytes are copied only if EOF is
+ * reached in \p src or if \p file cannot be written to any further.
+ *
+ * \note If \p file provides a copy callback (eg. file descriptors on Linux,
+ *       which can use `copy_file_range()` if \p src is also backed by a file
+ *       descriptor), it is used to copy the data without going through
+ *       userspace. Otherwise, if \p src supports mb_file_peek(), the data is
+ *       written directly from the memory backing \p src. As a last resort, the
+ *       data is copied with mb_file_pread() and mb_file_write() using a buffer
+ *       of up to 4 MiB, depending on \p size. The file position of \p src is
+ *       not changed in any case.
+ *
+ * \note Errors are always reported on \p file, including those that occur
+ *       when reading from \p src.
+ *
+ * \param[in] file MbFile handle to write to
+ * \param[in] src MbFile handle to read from
+ * \param[in] src_offset Offset of data in \p src
+ * \param[in] size Size of data to copy
+ * \param[out] size_copied Pointer to store size of data that is copied
+ *
+ * \return
+ *   * #MB_FILE_OK if the data is successfully copied
+ *   * \<= #MB_FILE_WARN if an error occurs
+ */
+int mb_file_copy_from(struct MbFile *file, struct MbFile *src,
+                      uint64_t src_offset, uint64_t size,
+                      uint64_t *size_copied)
+{
+    char stack_buf[10240];
+    char *buf = nullptr;
+    size_t buf_size = 0;
+    const void *data;
+    size_t n_read;
+    size_t n_written;
+    int ret;
+
+    *size_copied = 0;
+
+    if (size == 0) {
+        return MB_FILE_OK;
+    }
+
+    if (src_offset > UINT64_MAX - size) {
+        mb_file_set_error(file, MB_FILE_ERROR_INVALID_ARGUMENT,
+                          "Offset + size overflows integer");
+        return MB_FILE_FAILED;
+    }
+
+    ret = _mb_file_copy_from_native(file, src, src_offset, size, size_copied);
+    if (ret != MB_FILE_UNSUPPORTED) {
+        return ret;
+    }
+
+    *size_copied = 0;
+
+    // Write straight from the source's memory if possible
+    while (*size_copied < size) {
+        ret = mb_file_peek(src, src_offset + *size_copied,
+                           std::min<uint64_t>(size - *size_copied, SIZE_MAX),
+                           &data, &n_read);
+        if (ret == MB_FILE_UNSUPPORTED) {
+            break;
+        } else if (ret != MB_FILE_OK) {
+            mb_file_set_error(file, mb_file_error(src),
+                              "Failed to access source data: %s",
+                              mb_file_error_string(src));
+            return MB_FILE_FAILED;
+        } else if (n_read == 0) {
+            return MB_FILE_OK;
+        }
+
+        ret = mb_file_write_fully(file, data, n_read, &n_written);
+        if (ret != MB_FILE_OK) {
+            return ret;
+        }
+
+        *size_copied += n_written;
+
+        if (n_written < n_read) {
+            return MB_FILE_OK;
+        }
+    }
+
+    if (*size_copied == size) {
+        return MB_FILE_OK;
+    }
+
+    for (size_t try_size = std::min<uint64_t>(size - *size_copied,
+                                              MOVE_MAX_BUFFER_SIZE);
+            try_size > sizeof(stack_buf); try_size /= 2) {
+        buf = static_cast<char *>(malloc(try_size));
+        if (buf) {
+            buf_size = try_size;
+            break;
+        }
+    }
+    if (!buf) {
+        buf = stack_buf;
+        buf_size = sizeof(stack_buf);
+    }
+
+    ret = MB_FILE_OK;
+
+    while (*size_copied < size) {
+        size_t to_read = std::min<uint64_t>(buf_size, size - *size_copied);
+
+        ret = mb_file_pread_fully(src, buf, to_read, src_offset + *size_copied,
+                                  &n_read);
+        if (ret != MB_FILE_OK) {
+            mb_file_set_error(file, mb_file_error(src),
+                              "Failed to read source data: %s",
+                              mb_file_error_string(src));
+            ret = MB_FILE_FAILED;
+            break;
+        } else if (n_read == 0) {
+            break;
+        }
+
+        ret = mb_file_write_fully(file, buf, n_read, &n_written);
+        if (ret != MB_FILE_OK) {
+            break;
+        }
+
+        *size_copied += n_written;
+
+        if (n_written < n_read) {
+            break;
+        }
+    }
+
+    if (buf != stack_buf) {
+        free(buf);
+    }
+    return ret;
 }
 
 MB_END_C_DECLS
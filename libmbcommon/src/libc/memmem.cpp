@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/libc/string_p.h"
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef MB_MEMMEM_HAVE_X86
+#  include <immintrin.h>
+#endif
+
+#ifdef MB_MEMMEM_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+// Vectorized memmem() based on first and last byte filtering. For each block
+// of candidate positions, the haystack is compared against the first byte of
+// the needle at the candidate and against the last byte of the needle at
+// (candidate + needlelen - 1). Only positions where both match are verified
+// with memcmp(). For typical binary data, this rejects almost all positions
+// with two vector compares per block.
+//
+// Unlike the two-way algorithm used by libc, this is O(haystacklen *
+// needlelen) in the worst case (eg. searching for "aaab" in "aaaa..."). To
+// avoid that, the kernels give up and switch to the generic implementation
+// once too many candidates fail verification.
+
+#if defined(MB_MEMMEM_HAVE_X86) || defined(MB_MEMMEM_HAVE_NEON)
+
+// Number of failed verifications allowed before switching to the generic
+// implementation is (scanned bytes / FALSE_POSITIVE_RATIO + FALSE_POSITIVE_MIN)
+#define FALSE_POSITIVE_RATIO    16
+#define FALSE_POSITIVE_MIN      64
+
+/*!
+ * \brief Handle cases that the vectorized kernels don't need to deal with
+ *
+ * \return Whether the result was computed and stored in \p result
+ */
+static inline bool memmem_trivial(const unsigned char *h, size_t k,
+                                  const unsigned char *n, size_t l,
+                                  void **result)
+{
+    if (l == 0) {
+        *result = const_cast<unsigned char *>(h);
+        return true;
+    } else if (l > k) {
+        *result = nullptr;
+        return true;
+    } else if (l == 1) {
+        *result = const_cast<void *>(memchr(h, n[0], k));
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Search the remaining positions with the generic implementation
+ */
+static inline void * memmem_rest(const unsigned char *h, size_t k,
+                                 const unsigned char *n, size_t l,
+                                 size_t pos)
+{
+    return _mb_memmem_generic(h + pos, k - pos, n, l);
+}
+
+static inline bool too_many_false_positives(size_t count, size_t pos)
+{
+    return count > pos / FALSE_POSITIVE_RATIO + FALSE_POSITIVE_MIN;
+}
+
+#endif
+
+#ifdef MB_MEMMEM_HAVE_X86
+
+__attribute__((target("sse2")))
+void * _mb_memmem_sse2(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen)
+{
+    auto h = static_cast<const unsigned char *>(haystack);
+    auto n = static_cast<const unsigned char *>(needle);
+    void *result;
+
+    if (memmem_trivial(h, haystacklen, n, needlelen, &result)) {
+        return result;
+    }
+
+    const __m128i first = _mm_set1_epi8(static_cast<char>(n[0]));
+    const __m128i last = _mm_set1_epi8(static_cast<char>(n[needlelen - 1]));
+    // Number of positions where the needle can start
+    const size_t limit = haystacklen - needlelen + 1;
+    size_t false_positives = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= limit; i += 16) {
+        __m128i block_first = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(h + i));
+        __m128i block_last = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(h + i + needlelen - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                              _mm_cmpeq_epi8(block_last, last))));
+
+        while (mask != 0) {
+            size_t pos = i + static_cast<size_t>(__builtin_ctz(mask));
+
+            if (memcmp(h + pos + 1, n + 1, needlelen - 2) == 0) {
+                return const_cast<unsigned char *>(h + pos);
+            } else if (too_many_false_positives(++false_positives, pos)) {
+                return memmem_rest(h, haystacklen, n, needlelen, pos + 1);
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    return memmem_rest(h, haystacklen, n, needlelen, i);
+}
+
+__attribute__((target("avx2")))
+void * _mb_memmem_avx2(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen)
+{
+    auto h = static_cast<const unsigned char *>(haystack);
+    auto n = static_cast<const unsigned char *>(needle);
+    void *result;
+
+    if (memmem_trivial(h, haystacklen, n, needlelen, &result)) {
+        return result;
+    }
+
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(n[0]));
+    const __m256i last = _mm256_set1_epi8(
+            static_cast<char>(n[needlelen - 1]));
+    // Number of positions where the needle can start
+    const size_t limit = haystacklen - needlelen + 1;
+    size_t false_positives = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= limit; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(h + i));
+        __m256i block_last = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(h + i + needlelen - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                 _mm256_cmpeq_epi8(block_last, last))));
+
+        while (mask != 0) {
+            size_t pos = i + static_cast<size_t>(__builtin_ctz(mask));
+
+            if (memcmp(h + pos + 1, n + 1, needlelen - 2) == 0) {
+                return const_cast<unsigned char *>(h + pos);
+            } else if (too_many_false_positives(++false_positives, pos)) {
+                return memmem_rest(h, haystacklen, n, needlelen, pos + 1);
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    // Finish with 16-byte blocks instead of going straight to the generic
+    // implementation since the tail can be up to 31 + needlelen bytes
+    if (i < limit) {
+        result = _mb_memmem_sse2(h + i, haystacklen - i, n, needlelen);
+    } else {
+        result = nullptr;
+    }
+
+    return result;
+}
+
+#endif
+
+#ifdef MB_MEMMEM_HAVE_NEON
+
+void * _mb_memmem_neon(const void *haystack, size_t haystacklen,
+                       const void *needle, size_t needlelen)
+{
+    auto h = static_cast<const unsigned char *>(haystack);
+    auto n = static_cast<const unsigned char *>(needle);
+    void *result;
+
+    if (memmem_trivial(h, haystacklen, n, needlelen, &result)) {
+        return result;
+    }
+
+    const uint8x16_t first = vdupq_n_u8(n[0]);
+    const uint8x16_t last = vdupq_n_u8(n[needlelen - 1]);
+    // Number of positions where the needle can start
+    const size_t limit = haystacklen - needlelen + 1;
+    size_t false_positives = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= limit; i += 16) {
+        uint8x16_t block_first = vld1q_u8(h + i);
+        uint8x16_t block_last = vld1q_u8(h + i + needlelen - 1);
+        uint8x16_t eq = vandq_u8(vceqq_u8(block_first, first),
+                                 vceqq_u8(block_last, last));
+
+        // NEON has no movemask, so narrow each byte to 4 bits instead
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+        while (mask != 0) {
+            unsigned int bit = static_cast<unsigned int>(
+                    __builtin_ctzll(mask));
+            size_t pos = i + bit / 4;
+
+            if (memcmp(h + pos + 1, n + 1, needlelen - 2) == 0) {
+                return const_cast<unsigned char *>(h + pos);
+            } else if (too_many_false_positives(++false_positives, pos)) {
+                return memmem_rest(h, haystacklen, n, needlelen, pos + 1);
+            }
+
+            mask &= ~(UINT64_C(0xf) << (bit & ~3u));
+        }
+    }
+
+    return memmem_rest(h, haystacklen, n, needlelen, i);
+}
+
+#endif
@@ -21,6 +21,8 @@
 
 #include <cstring>
 
+#include "mbcommon/libc/string_p.h"
+
 #ifndef __GLIBC__
 #  include "mbcommon/external/musl/memmem.h"
 #endif
@@ -31,10 +33,76 @@
 
 MB_BEGIN_C_DECLS
 
+void * _mb_memmem_generic(const void *haystack, size_t haystacklen,
+                          const void *needle, size_t needlelen)
+{
+    return memmem(haystack, haystacklen, needle, needlelen);
+}
+
+MbMemmemFn _mb_memmem_get_impl(MbMemmemImpl impl)
+{
+    switch (impl) {
+    case MB_MEMMEM_IMPL_GENERIC:
+        return &_mb_memmem_generic;
+#ifdef MB_MEMMEM_HAVE_X86
+    case MB_MEMMEM_IMPL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2") ? &_mb_memmem_sse2 : nullptr;
+    case MB_MEMMEM_IMPL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? &_mb_memmem_avx2 : nullptr;
+#endif
+#ifdef MB_MEMMEM_HAVE_NEON
+    case MB_MEMMEM_IMPL_NEON:
+        // Only compiled in when NEON is part of the target's baseline
+        return &_mb_memmem_neon;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const char * _mb_memmem_impl_name(MbMemmemImpl impl)
+{
+    switch (impl) {
+    case MB_MEMMEM_IMPL_GENERIC:
+        return "generic";
+    case MB_MEMMEM_IMPL_SSE2:
+        return "sse2";
+    case MB_MEMMEM_IMPL_AVX2:
+        return "avx2";
+    case MB_MEMMEM_IMPL_NEON:
+        return "neon";
+    default:
+        return nullptr;
+    }
+}
+
+static MbMemmemFn select_memmem()
+{
+    // In order of preference
+    static const MbMemmemImpl impls[] = {
+        MB_MEMMEM_IMPL_AVX2,
+        MB_MEMMEM_IMPL_SSE2,
+        MB_MEMMEM_IMPL_NEON,
+    };
+
+    for (MbMemmemImpl impl : impls) {
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+        if (fn) {
+            return fn;
+        }
+    }
+
+    return &_mb_memmem_generic;
+}
+
 void * mb_memmem(const void *haystack, size_t haystacklen,
                  const void *needle, size_t needlelen)
 {
-    return memmem(haystack, haystacklen, needle, needlelen);
+    static const MbMemmemFn fn = select_memmem();
+
+    return fn(haystack, haystacklen, needle, needlelen);
 }
 
 MB_END_C_DECLS
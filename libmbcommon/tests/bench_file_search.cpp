@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#define IMAGE_SIZE          (64 * 1024 * 1024)
+#define MAGIC_INTERVAL      (1024 * 1024)
+#define NUM_RUNS            3
+
+struct Magic
+{
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+};
+
+static const unsigned char android_magic[] = "ANDROID!";
+static const unsigned char samsung_magic[] = "SEANDROIDENFORCE";
+static const unsigned char bump_magic[] = {
+    0x41, 0xa9, 0xe4, 0x67, 0x74, 0x4d, 0x1d, 0x1b,
+    0xa4, 0x29, 0xf2, 0xec, 0xea, 0x65, 0x52, 0x79,
+};
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b, 0x08 };
+static const unsigned char loki_magic[] = "LOKI";
+static const unsigned char elf_magic[] = { 0x7f, 'E', 'L', 'F' };
+
+static const Magic magics[] = {
+    { "android", android_magic, sizeof(android_magic) - 1 },
+    { "samsung", samsung_magic, sizeof(samsung_magic) - 1 },
+    { "bump",    bump_magic,    sizeof(bump_magic) },
+    { "gzip",    gzip_magic,    sizeof(gzip_magic) },
+    { "loki",    loki_magic,    sizeof(loki_magic) - 1 },
+    { "elf",     elf_magic,     sizeof(elf_magic) },
+};
+
+#define NUM_MAGICS          (sizeof(magics) / sizeof(magics[0]))
+
+// Forwards reads and seeks to another handle, but does not support peeking
+static int no_peek_read_cb(MbFile *file, void *userdata,
+                           void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    return mb_file_read(static_cast<MbFile *>(userdata), buf, size,
+                        bytes_read);
+}
+
+static int no_peek_seek_cb(MbFile *file, void *userdata,
+                           int64_t offset, int whence, uint64_t *new_offset)
+{
+    (void) file;
+    return mb_file_seek(static_cast<MbFile *>(userdata), offset, whence,
+                        new_offset);
+}
+
+static int count_cb(MbFile *file, void *userdata, uint64_t offset)
+{
+    (void) file;
+    (void) offset;
+    ++*static_cast<uint64_t *>(userdata);
+    return MB_FILE_OK;
+}
+
+static int count_multi_cb(MbFile *file, void *userdata, size_t pattern_id,
+                          uint64_t offset)
+{
+    (void) file;
+    (void) pattern_id;
+    (void) offset;
+    ++*static_cast<uint64_t *>(userdata);
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Build random image with every magic placed once per interval
+ */
+static void build_image(std::vector<unsigned char> &data)
+{
+    std::mt19937 gen(0x5eed);
+
+    data.resize(IMAGE_SIZE);
+    for (size_t i = 0; i + sizeof(uint32_t) <= data.size();
+            i += sizeof(uint32_t)) {
+        uint32_t value = gen();
+        memcpy(data.data() + i, &value, sizeof(value));
+    }
+
+    for (size_t base = 0; base < data.size(); base += MAGIC_INTERVAL) {
+        size_t offset = base;
+        for (size_t i = 0; i < NUM_MAGICS; ++i) {
+            offset += 4096 + gen() % 4096;
+            memcpy(data.data() + offset, magics[i].data, magics[i].size);
+        }
+    }
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    auto diff = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(diff).count();
+}
+
+static void print_throughput(const char *name, uint64_t bytes, double ms,
+                             uint64_t matches)
+{
+    printf("  %-12s %9.3f ms (%9.1f MiB/s scanned, %" PRIu64 " matches)\n",
+           name, ms, bytes / 1024.0 / 1024.0 / (ms / 1000.0), matches);
+}
+
+/*!
+ * \brief Compare one search per magic against a single multi-pattern search
+ */
+static bool bench_search(MbFile *file, const char *desc)
+{
+    const void *patterns[NUM_MAGICS];
+    size_t pattern_sizes[NUM_MAGICS];
+    double sequential_ms = 0;
+    double multi_ms = 0;
+    uint64_t sequential_matches = 0;
+    uint64_t multi_matches = 0;
+
+    for (size_t i = 0; i < NUM_MAGICS; ++i) {
+        patterns[i] = magics[i].data;
+        pattern_sizes[i] = magics[i].size;
+    }
+
+    printf("%s: %d bytes, %zu patterns, best of %d runs\n",
+           desc, IMAGE_SIZE, NUM_MAGICS, NUM_RUNS);
+
+    for (int run = 0; run < NUM_RUNS; ++run) {
+        uint64_t matches = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < NUM_MAGICS; ++i) {
+            if (mb_file_search(file, -1, -1, 0, patterns[i], pattern_sizes[i],
+                               -1, &count_cb, &matches) != MB_FILE_OK) {
+                fprintf(stderr, "Search failed: %s\n",
+                        mb_file_error_string(file));
+                return false;
+            }
+        }
+        double ms = elapsed_ms(start);
+        if (run == 0 || ms < sequential_ms) {
+            sequential_ms = ms;
+        }
+        sequential_matches = matches;
+
+        matches = 0;
+
+        start = std::chrono::steady_clock::now();
+        if (mb_file_search_multi(file, -1, -1, 0, patterns, pattern_sizes,
+                                 NUM_MAGICS, -1, &count_multi_cb, &matches)
+                != MB_FILE_OK) {
+            fprintf(stderr, "Multi-pattern search failed: %s\n",
+                    mb_file_error_string(file));
+            return false;
+        }
+        ms = elapsed_ms(start);
+        if (run == 0 || ms < multi_ms) {
+            multi_ms = ms;
+        }
+        multi_matches = matches;
+    }
+
+    print_throughput("sequential", static_cast<uint64_t>(IMAGE_SIZE)
+                     * NUM_MAGICS, sequential_ms, sequential_matches);
+    print_throughput("multi", IMAGE_SIZE, multi_ms, multi_matches);
+    printf("  speedup      %9.2fx\n", sequential_ms / multi_ms);
+
+    if (sequential_matches != multi_matches) {
+        fprintf(stderr, "Match count mismatch: %" PRIu64 " != %" PRIu64 "\n",
+                sequential_matches, multi_matches);
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    std::vector<unsigned char> data;
+    build_image(data);
+
+    MbFile *file = mb_file_new();
+    MbFile *no_peek = mb_file_new();
+    bool ret = file && no_peek;
+
+    ret = ret && mb_file_open_memory_static(file, data.data(), data.size())
+            == MB_FILE_OK;
+    ret = ret && mb_file_open_callbacks(no_peek, nullptr, nullptr,
+                                        &no_peek_read_cb, nullptr,
+                                        &no_peek_seek_cb, nullptr, file)
+            == MB_FILE_OK;
+    if (!ret) {
+        fprintf(stderr, "Failed to open files\n");
+    }
+
+    ret = ret && bench_search(file, "In-place search (memory file)");
+    ret = ret && bench_search(no_peek, "Buffered search (no peek support)");
+
+    if (no_peek) {
+        mb_file_free(no_peek);
+    }
+    if (file) {
+        mb_file_free(file);
+    }
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/external/musl/memmem.h"
+#include "mbcommon/libc/string_p.h"
+
+#define TOTAL_BYTES         (256 * 1024 * 1024)
+
+struct Candidate
+{
+    const char *name;
+    MbMemmemFn fn;
+};
+
+#ifdef __GLIBC__
+static void * glibc_memmem(const void *haystack, size_t haystacklen,
+                           const void *needle, size_t needlelen)
+{
+    return memmem(haystack, haystacklen, needle, needlelen);
+}
+#endif
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    auto diff = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(diff).count();
+}
+
+/*!
+ * \brief Time searches for a needle that only occurs at the very end
+ *
+ * Each search scans the whole haystack. The number of iterations is chosen so
+ * that every combination scans roughly the same number of bytes.
+ */
+static bool bench(const Candidate &c, const std::vector<unsigned char> &data,
+                  size_t needle_size, double *mib_s)
+{
+    const unsigned char *haystack = data.data();
+    const unsigned char *needle = haystack + data.size() - needle_size;
+    size_t iters = std::max<size_t>(1, TOTAL_BYTES / data.size());
+    // Prevent the searches from being optimized out
+    volatile uintptr_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+        sink = sink + reinterpret_cast<uintptr_t>(
+                c.fn(haystack, data.size(), needle, needle_size));
+    }
+    double ms = elapsed_ms(start);
+
+    if (c.fn(haystack, data.size(), needle, needle_size) != needle) {
+        fprintf(stderr, "%s: wrong result for haystack size %zu, "
+                "needle size %zu\n", c.name, data.size(), needle_size);
+        return false;
+    }
+
+    *mib_s = static_cast<double>(data.size()) * iters / 1024.0 / 1024.0
+            / (ms / 1000.0);
+    return true;
+}
+
+int main()
+{
+    static const size_t haystack_sizes[] = {
+        4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+    };
+    static const size_t needle_sizes[] = {
+        2, 4, 8, 16, 40, 64, 256,
+    };
+
+    std::vector<Candidate> candidates;
+#ifdef __GLIBC__
+    candidates.push_back({ "glibc", &glibc_memmem });
+#endif
+    candidates.push_back({ "musl", &musl_memmem });
+    for (int i = MB_MEMMEM_IMPL_SSE2; i < MB_MEMMEM_IMPL_COUNT; ++i) {
+        MbMemmemImpl impl = static_cast<MbMemmemImpl>(i);
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+        if (fn) {
+            candidates.push_back({ _mb_memmem_impl_name(impl), fn });
+        }
+    }
+
+    // Random bytes with a skewed distribution, similar to code. Zero bytes
+    // are much more common than anything else. 0xff is reserved so that the
+    // needle is guaranteed to only occur at the end.
+    std::mt19937 gen(0x5eed);
+    std::vector<unsigned char> random_data(16 * 1024 * 1024);
+    for (auto &c : random_data) {
+        uint32_t r = gen();
+        c = (r & 0x300) == 0 ? 0 : static_cast<unsigned char>(r % 255);
+    }
+
+    printf("Throughput in MiB/s (needle only occurs at end of haystack)\n");
+    printf("%-10s %-8s", "haystack", "needle");
+    for (auto const &c : candidates) {
+        printf(" %10s", c.name);
+    }
+    printf("\n");
+
+    for (size_t haystack_size : haystack_sizes) {
+        std::vector<unsigned char> data(random_data.begin(),
+                                        random_data.begin() + haystack_size);
+        data.back() = 0xff;
+
+        for (size_t needle_size : needle_sizes) {
+            printf("%-10zu %-8zu", haystack_size, needle_size);
+
+            for (auto const &c : candidates) {
+                double mib_s;
+                if (!bench(c, data, needle_size, &mib_s)) {
+                    return EXIT_FAILURE;
+                }
+                printf(" %10.1f", mib_s);
+            }
+
+            printf("\n");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+
+struct FileBufferedTest : testing::Test
+{
+protected:
+    ScopedFile _file;
+    MbFile *_inner;
+    void *_buf;
+    size_t _buf_size;
+
+    FileBufferedTest()
+        : _file(mb_file_new(), mb_file_free)
+        , _inner(mb_file_new())
+        , _buf(nullptr)
+        , _buf_size(0)
+    {
+    }
+
+    virtual ~FileBufferedTest()
+    {
+        // Close outer handle first since it owns the inner handle
+        _file.reset();
+        free(_buf);
+    }
+
+    virtual void SetUp() override
+    {
+        ASSERT_TRUE(!!_file);
+        ASSERT_TRUE(!!_inner);
+        ASSERT_EQ(mb_file_set_stats_enabled(_file.get(), true), MB_FILE_OK);
+        ASSERT_EQ(mb_file_set_stats_enabled(_inner, true), MB_FILE_OK);
+    }
+
+    void open_buffered(const std::vector<char> &data, size_t buffer_size)
+    {
+        _buf_size = data.size();
+        _buf = malloc(_buf_size);
+        ASSERT_TRUE(!!_buf);
+        memcpy(_buf, data.data(), data.size());
+
+        ASSERT_EQ(mb_file_open_memory_dynamic(_inner, &_buf, &_buf_size),
+                  MB_FILE_OK);
+        ASSERT_EQ(mb_file_open_buffered(_file.get(), _inner, buffer_size,
+                                        true), MB_FILE_OK);
+    }
+
+    // Operation counts for the buffered handle and, in the inner_* fields, the
+    // operations that actually reached the underlying handle
+    struct Counts
+    {
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t seeks;
+        uint64_t truncates;
+        uint64_t inner_reads;
+        uint64_t inner_writes;
+        uint64_t inner_seeks;
+        uint64_t inner_truncates;
+    };
+
+    Counts stats()
+    {
+        MbFileStats outer;
+        MbFileStats inner;
+        EXPECT_EQ(mb_file_get_stats(_file.get(), &outer), MB_FILE_OK);
+        EXPECT_EQ(mb_file_get_stats(_inner, &inner), MB_FILE_OK);
+
+        Counts c;
+        c.reads = outer.ops[MB_FILE_STATS_OP_READ].calls
+                + outer.ops[MB_FILE_STATS_OP_PREAD].calls;
+        c.writes = outer.ops[MB_FILE_STATS_OP_WRITE].calls
+                + outer.ops[MB_FILE_STATS_OP_PWRITE].calls;
+        c.seeks = outer.ops[MB_FILE_STATS_OP_SEEK].calls;
+        c.truncates = outer.ops[MB_FILE_STATS_OP_TRUNCATE].calls;
+        c.inner_reads = inner.ops[MB_FILE_STATS_OP_READ].calls
+                + inner.ops[MB_FILE_STATS_OP_PREAD].calls;
+        c.inner_writes = inner.ops[MB_FILE_STATS_OP_WRITE].calls
+                + inner.ops[MB_FILE_STATS_OP_PWRITE].calls;
+        c.inner_seeks = inner.ops[MB_FILE_STATS_OP_SEEK].calls;
+        c.inner_truncates = inner.ops[MB_FILE_STATS_OP_TRUNCATE].calls;
+        return c;
+    }
+};
+
+static std::vector<char> make_data(size_t size)
+{
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(i * 7 + i / 256);
+    }
+    return data;
+}
+
+TEST_F(FileBufferedTest, SmallReadsShouldBeCoalesced)
+{
+    auto data = make_data(1000);
+    open_buffered(data, 256);
+
+    std::vector<char> out;
+    char c[10];
+    size_t n;
+
+    while (mb_file_read(_file.get(), c, sizeof(c), &n) == MB_FILE_OK && n > 0) {
+        out.insert(out.end(), c, c + n);
+    }
+
+    ASSERT_EQ(out, data);
+
+    auto s = stats();
+    // 100 full reads + 1 EOF read
+    ASSERT_EQ(s.reads, 101u);
+    // 4 buffer fills (3 full + 1 partial) + 1 EOF read
+    ASSERT_EQ(s.inner_reads, 5u);
+}
+
+TEST_F(FileBufferedTest, LargeReadsShouldBypassBuffer)
+{
+    auto data = make_data(1000);
+    open_buffered(data, 64);
+
+    std::vector<char> out(1000);
+    size_t n;
+
+    ASSERT_EQ(mb_file_read_fully(_file.get(), out.data(), out.size(), &n),
+              MB_FILE_OK);
+    ASSERT_EQ(n, 1000u);
+    ASSERT_EQ(out, data);
+    ASSERT_EQ(stats().inner_reads, 1u);
+}
+
+TEST_F(FileBufferedTest, SeekWithinReadBufferShouldNotTouchInner)
+{
+    auto data = make_data(1000);
+    open_buffered(data, 256);
+
+    char c[4];
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_seek(_file.get(), 100, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(memcmp(c, data.data() + 100, sizeof(c)), 0);
+
+    auto before = stats();
+
+    ASSERT_EQ(mb_file_seek(_file.get(), -50, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 54u);
+    ASSERT_EQ(mb_file_seek(_file.get(), 200, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(memcmp(c, data.data() + 200, sizeof(c)), 0);
+
+    auto after = stats();
+    ASSERT_EQ(after.seeks, before.seeks + 2);
+    ASSERT_EQ(after.inner_seeks, before.inner_seeks);
+    ASSERT_EQ(after.inner_reads, before.inner_reads);
+
+    // Reading outside of the buffer requires a real seek
+    ASSERT_EQ(mb_file_seek(_file.get(), 900, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(memcmp(c, data.data() + 900, sizeof(c)), 0);
+    ASSERT_EQ(stats().inner_seeks, after.inner_seeks + 1);
+}
+
+TEST_F(FileBufferedTest, SmallWritesShouldBeCoalesced)
+{
+    open_buffered({}, 256);
+
+    auto data = make_data(1000);
+    size_t n;
+
+    for (size_t i = 0; i < data.size(); i += 10) {
+        ASSERT_EQ(mb_file_write(_file.get(), data.data() + i, 10, &n),
+                  MB_FILE_OK);
+        ASSERT_EQ(n, 10u);
+    }
+
+    auto s = stats();
+    ASSERT_EQ(s.writes, 100u);
+    ASSERT_EQ(s.inner_writes, 3u);
+
+    // Remaining data is written on close
+    ASSERT_EQ(mb_file_close(_file.get()), MB_FILE_OK);
+    ASSERT_EQ(_buf_size, data.size());
+    ASSERT_EQ(memcmp(_buf, data.data(), data.size()), 0);
+}
+
+TEST_F(FileBufferedTest, ReadAfterWriteShouldSeeNewData)
+{
+    auto data = make_data(100);
+    open_buffered(data, 64);
+
+    char c[8];
+    size_t n;
+
+    // Fill read buffer
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+
+    // Overwrite data inside the read buffer
+    ASSERT_EQ(mb_file_seek(_file.get(), 2, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file.get(), "abcd", 4, &n), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(n, sizeof(c));
+    ASSERT_EQ(memcmp(c, data.data(), 2), 0);
+    ASSERT_EQ(memcmp(c + 2, "abcd", 4), 0);
+    ASSERT_EQ(memcmp(c + 6, data.data() + 6, 2), 0);
+}
+
+TEST_F(FileBufferedTest, NonContiguousWritesShouldFlush)
+{
+    open_buffered(std::vector<char>(16, '-'), 64);
+
+    size_t n;
+
+    ASSERT_EQ(mb_file_write(_file.get(), "ab", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(_file.get(), 10, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file.get(), "cd", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(stats().inner_writes, 1u);
+    ASSERT_EQ(mb_file_seek(_file.get(), 2, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file.get(), "ef", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(stats().inner_writes, 2u);
+
+    ASSERT_EQ(mb_file_close(_file.get()), MB_FILE_OK);
+    ASSERT_EQ(memcmp(_buf, "abef------cd----", 16), 0);
+}
+
+TEST_F(FileBufferedTest, SeekEndShouldIncludePendingWrites)
+{
+    open_buffered(make_data(10), 64);
+
+    size_t n;
+    uint64_t offset;
+
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_END, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file.get(), "hello", 5, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_END, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 15u);
+}
+
+TEST_F(FileBufferedTest, TruncateShouldInvalidateReadBuffer)
+{
+    auto data = make_data(100);
+    open_buffered(data, 64);
+
+    char c[8];
+    size_t n;
+
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(n, sizeof(c));
+
+    ASSERT_EQ(mb_file_truncate(_file.get(), 4), MB_FILE_OK);
+    ASSERT_EQ(mb_file_truncate(_file.get(), 8), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read_fully(_file.get(), c, sizeof(c), &n), MB_FILE_OK);
+    ASSERT_EQ(n, sizeof(c));
+    ASSERT_EQ(memcmp(c, data.data(), 4), 0);
+    ASSERT_EQ(memcmp(c + 4, "\0\0\0\0", 4), 0);
+
+    ASSERT_EQ(stats().inner_truncates, 2u);
+}
+
+TEST_F(FileBufferedTest, TruncateShouldFlushPendingWrites)
+{
+    open_buffered({}, 64);
+
+    size_t n;
+
+    ASSERT_EQ(mb_file_write(_file.get(), "hello", 5, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_truncate(_file.get(), 3), MB_FILE_OK);
+    ASSERT_EQ(mb_file_close(_file.get()), MB_FILE_OK);
+
+    ASSERT_EQ(_buf_size, 3u);
+    ASSERT_EQ(memcmp(_buf, "hel", 3), 0);
+}
+
+TEST_F(FileBufferedTest, FlushErrorShouldBeReported)
+{
+    char data[4] = {};
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_memory_static(_inner, data, sizeof(data)),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_buffered(_file.get(), _inner, 64, true),
+              MB_FILE_OK);
+
+    // The fixed size buffer can't hold all of the data
+    ASSERT_EQ(mb_file_write(_file.get(), "hello", 5, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 5u);
+    ASSERT_EQ(mb_file_close(_file.get()), MB_FILE_FAILED);
+    ASSERT_EQ(memcmp(data, "hell", 4), 0);
+}
+
+TEST_F(FileBufferedTest, PeekShouldSeePendingWrites)
+{
+    open_buffered(std::vector<char>(8, '-'), 64);
+
+    const void *ptr;
+    size_t n;
+
+    ASSERT_EQ(mb_file_write(_file.get(), "ab", 2, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_peek(_file.get(), 0, 8, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 8u);
+    ASSERT_EQ(memcmp(ptr, "ab------", 8), 0);
+}
+
+TEST_F(FileBufferedTest, PreadPwriteShouldNotChangePosition)
+{
+    open_buffered(std::vector<char>(16, '-'), 8);
+
+    char buf[4];
+    size_t n;
+    uint64_t offset;
+
+    // Fill the read buffer and leave the position in the middle of it
+    ASSERT_EQ(mb_file_read(_file.get(), buf, 2, &n), MB_FILE_OK);
+
+    // Served from the read buffer
+    ASSERT_EQ(mb_file_pwrite(_file.get(), "ab", 2, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file.get(), buf, 4, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4u);
+    ASSERT_EQ(memcmp(buf, "-ab-", 4), 0);
+
+    // Beyond the read buffer
+    ASSERT_EQ(mb_file_pwrite(_file.get(), "cd", 2, 12, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_pread(_file.get(), buf, 4, 11, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4u);
+    ASSERT_EQ(memcmp(buf, "-cd-", 4), 0);
+
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 2u);
+
+    ASSERT_EQ(mb_file_read(_file.get(), buf, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4u);
+    ASSERT_EQ(memcmp(buf, "--ab", 4), 0);
+}
@@ -20,13 +20,19 @@
 #include <gtest/gtest.h>
 
 #include <climits>
+#include <cstring>
 
 #include <fcntl.h>
 
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/fd.h"
 #include "mbcommon/file/fd_p.h"
 #include "mbcommon/file/vtable_p.h"
+#include "mbcommon/file_util.h"
 
 struct FileFdTest : testing::Test
 {
@@ -44,6 +50,18 @@ struct FileFdTest : testing::Test
     int _n_lseek64 = 0;
     int _n_read = 0;
     int _n_write = 0;
+#ifndef _WIN32
+    int _n_pread64 = 0;
+    int _n_pwrite64 = 0;
+    int _n_readv = 0;
+    int _n_writev = 0;
+    int _n_preadv64 = 0;
+    int _n_pwritev64 = 0;
+#endif
+#ifdef __linux__
+    int _n_copy_file_range = 0;
+    int _n_fallocate64 = 0;
+#endif
 
     FileFdTest() : _file(mb_file_new())
     {
@@ -59,6 +77,18 @@ struct FileFdTest : testing::Test
         _vtable.fn_lseek64 = _lseek64;
         _vtable.fn_read = _read;
         _vtable.fn_write = _write;
+#ifndef _WIN32
+        _vtable.fn_pread64 = _pread64;
+        _vtable.fn_pwrite64 = _pwrite64;
+        _vtable.fn_readv = _readv;
+        _vtable.fn_writev = _writev;
+        _vtable.fn_preadv64 = _preadv64;
+        _vtable.fn_pwritev64 = _pwritev64;
+#endif
+#ifdef __linux__
+        _vtable.fn_copy_file_range = _copy_file_range;
+        _vtable.fn_fallocate64 = _fallocate64;
+#endif
 
         _vtable.userdata = this;
     }
@@ -182,6 +212,148 @@ struct FileFdTest : testing::Test
         errno = EIO;
         return -1;
     }
+
+#ifndef _WIN32
+    static ssize_t _pread64(void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset)
+    {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _pwrite64(void *userdata, int fd, const void *buf,
+                             size_t count, off64_t offset)
+    {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pwrite64;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _readv(void *userdata, int fd, const struct iovec *iov,
+                          int iovcnt)
+    {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_readv;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _writev(void *userdata, int fd, const struct iovec *iov,
+                           int iovcnt)
+    {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_writev;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _preadv64(void *userdata, int fd,
+                             const struct iovec *iov, int iovcnt,
+                             off64_t offset)
+    {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_preadv64;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static ssize_t _pwritev64(void *userdata, int fd,
+                              const struct iovec *iov, int iovcnt,
+                              off64_t offset)
+    {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pwritev64;
+
+        errno = EIO;
+        return -1;
+    }
+#endif
+
+#ifdef __linux__
+    static ssize_t _copy_file_range(void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags)
+    {
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        errno = EIO;
+        return -1;
+    }
+
+    static int _fallocate64(void *userdata, int fd, int mode, off64_t offset,
+                            off64_t len)
+    {
+        (void) fd;
+        (void) mode;
+        (void) offset;
+        (void) len;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_fallocate64;
+
+        errno = EIO;
+        return -1;
+    }
+
+    // Regular 12 KiB file with 4 KiB blocks
+    static int _fstat_12k_file(void *userdata, int fildes, struct stat *buf)
+    {
+        (void) fildes;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_fstat;
+
+        buf->st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        buf->st_size = 12288;
+        buf->st_blksize = 4096;
+        return 0;
+    }
+#endif
 };
 
 TEST_F(FileFdTest, OpenNoVtable)
@@ -516,6 +688,208 @@ TEST_F(FileFdTest, ReadFailureEINTR)
     ASSERT_EQ(mb_file_error(_file), -EINTR);
 }
 
+#ifndef _WIN32
+TEST_F(FileFdTest, PreadSuccess)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pread64 = [](void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        return offset == 10 ? count : -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    // Ensure that pread64() is used directly and no seeking is done
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_n_pread64, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_lseek64, 0);
+}
+
+TEST_F(FileFdTest, PreadFailureEINTR)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pread64 = [](void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+        (void) count;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        errno = EINTR;
+        return -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    char c;
+    size_t n;
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_RETRY);
+    ASSERT_EQ(_n_pread64, 1);
+    ASSERT_EQ(mb_file_error(_file), -EINTR);
+}
+
+TEST_F(FileFdTest, PwriteSuccess)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_pwrite64 = [](void *userdata, int fd, const void *buf,
+                             size_t count, off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) buf;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pwrite64;
+
+        return offset == 10 ? count : -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    // Ensure that pwrite64() is used directly and no seeking is done
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_n_pwrite64, 1);
+    ASSERT_EQ(_n_write, 0);
+    ASSERT_EQ(_n_lseek64, 0);
+}
+
+TEST_F(FileFdTest, PwriteFailure)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    size_t n;
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 0, &n), MB_FILE_FAILED);
+    ASSERT_EQ(_n_pwrite64, 1);
+    ASSERT_EQ(mb_file_error(_file), -EIO);
+}
+
+TEST_F(FileFdTest, WritevSuccess)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_writev = [](void *userdata, int fd, const struct iovec *iov,
+                           int iovcnt) -> ssize_t {
+        (void) fd;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_writev;
+
+        ssize_t total = 0;
+        for (int i = 0; i < iovcnt; ++i) {
+            total += iov[i].iov_len;
+        }
+        return total;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    // Ensure that all buffers are written with a single writev() call
+    char a[] = "foo";
+    char b[] = "barbaz";
+    MbFileIoVec iov[] = {
+        { a, 3 },
+        { b, 6 },
+    };
+    size_t n;
+    ASSERT_EQ(mb_file_writev(_file, iov, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 9);
+    ASSERT_EQ(_n_writev, 1);
+    ASSERT_EQ(_n_write, 0);
+}
+
+TEST_F(FileFdTest, ReadvFailureEINTR)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_readv = [](void *userdata, int fd, const struct iovec *iov,
+                          int iovcnt) -> ssize_t {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_readv;
+
+        errno = EINTR;
+        return -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    char c;
+    MbFileIoVec iov[] = { { &c, 1 } };
+    size_t n;
+    ASSERT_EQ(mb_file_readv(_file, iov, 1, &n), MB_FILE_RETRY);
+    ASSERT_EQ(_n_readv, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(mb_file_error(_file), -EINTR);
+}
+
+TEST_F(FileFdTest, PreadvShouldFallBackIfUnsupported)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_preadv64 = [](void *userdata, int fd, const struct iovec *iov,
+                             int iovcnt, off64_t offset) -> ssize_t {
+        (void) fd;
+        (void) iov;
+        (void) iovcnt;
+        (void) offset;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_preadv64;
+
+        errno = ENOSYS;
+        return -1;
+    };
+    _vtable.fn_pread64 = [](void *userdata, int fd, void *buf, size_t count,
+                            off64_t offset) -> ssize_t {
+        (void) fd;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_pread64;
+
+        memset(buf, 'a' + static_cast<int>(offset), count);
+        return count;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    // Each buffer should be read with pread64() at the right offset
+    char a[2];
+    char b[1];
+    MbFileIoVec iov[] = {
+        { a, sizeof(a) },
+        { b, sizeof(b) },
+    };
+    size_t n;
+    ASSERT_EQ(mb_file_preadv(_file, iov, 2, 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(_n_preadv64, 1);
+    ASSERT_EQ(_n_pread64, 2);
+    ASSERT_EQ(memcmp(a, "bb", 2), 0);
+    ASSERT_EQ(b[0], 'd');
+}
+#endif
+
 TEST_F(FileFdTest, WriteSuccess)
 {
     _vtable.fn_fstat = _fstat_file;
@@ -736,3 +1110,142 @@ TEST_F(FileFdTest, TruncateFailed)
     ASSERT_EQ(mb_file_error(_file), -EIO);
     ASSERT_EQ(_n_ftruncate64, 1);
 }
+
+#ifdef __linux__
+TEST_F(FileFdTest, MoveNonOverlappingShouldUseCopyFileRange)
+{
+    _vtable.fn_fstat = _fstat_12k_file;
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        (void) fd_in;
+        (void) fd_out;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        return *off_in == 100 && *off_out == 8000 ? len : -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 100, 8000, 4000, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4000);
+    ASSERT_EQ(_n_copy_file_range, 1);
+    ASSERT_EQ(_n_fallocate64, 0);
+    ASSERT_EQ(_n_pread64, 0);
+    ASSERT_EQ(_n_pwrite64, 0);
+}
+
+TEST_F(FileFdTest, MoveShouldFallBackIfCopyFileRangeUnsupported)
+{
+    _vtable.fn_fstat = _fstat_12k_file;
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        (void) fd_in;
+        (void) off_in;
+        (void) fd_out;
+        (void) off_out;
+        (void) len;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        errno = ENOSYS;
+        return -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    // The fallback copy fails with the default pread64() mock
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 100, 8000, 4000, &n), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), -EIO);
+    ASSERT_EQ(_n_copy_file_range, 1);
+    ASSERT_EQ(_n_pread64, 1);
+}
+
+TEST_F(FileFdTest, MoveFileTailShouldInsertRange)
+{
+    _vtable.fn_fstat = _fstat_12k_file;
+
+    _vtable.fn_fallocate64 = [](void *userdata, int fd, int mode,
+                                off64_t offset, off64_t len) -> int {
+        (void) fd;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_fallocate64;
+
+        return mode == FALLOC_FL_INSERT_RANGE && offset == 4096 && len == 4096
+                ? 0 : -1;
+    };
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        (void) fd_in;
+        (void) fd_out;
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        // Restores the data that was originally at [4096, 8192)
+        return *off_in == 8192 && *off_out == 4096 ? len : -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_move(_file, 4096, 8192, 8192, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 8192);
+    ASSERT_EQ(_n_fallocate64, 1);
+    ASSERT_EQ(_n_copy_file_range, 1);
+    ASSERT_EQ(_n_pread64, 0);
+    ASSERT_EQ(_n_pwrite64, 0);
+}
+
+TEST_F(FileFdTest, CopyFromFdShouldUseCopyFileRange)
+{
+    _vtable.fn_fstat = _fstat_file;
+
+    _vtable.fn_copy_file_range = [](void *userdata, int fd_in,
+                                    off64_t *off_in, int fd_out,
+                                    off64_t *off_out, size_t len,
+                                    unsigned int flags) -> ssize_t {
+        (void) flags;
+
+        FileFdTest *test = static_cast<FileFdTest *>(userdata);
+        ++test->_n_copy_file_range;
+
+        // Should read from the source at the given offset and write at the
+        // destination's file position
+        return fd_in == 1 && *off_in == 100 && fd_out == 0 && !off_out
+                ? len : -1;
+    };
+
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, _file, 0, true), MB_FILE_OK);
+
+    MbFile *src = mb_file_new();
+    ASSERT_NE(src, nullptr);
+    ASSERT_EQ(_mb_file_open_fd(&_vtable, src, 1, false), MB_FILE_OK);
+
+    uint64_t n;
+    ASSERT_EQ(mb_file_copy_from(_file, src, 100, 4000, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4000);
+    ASSERT_EQ(_n_copy_file_range, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_write, 0);
+
+    mb_file_free(src);
+}
+#endif
@@ -571,3 +571,80 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileStaticMemoryTest, PeekFile)
+{
+    char in[] = "abcdef";
+    size_t in_size = 6;
+    const void *ptr;
+    size_t n;
+    uint64_t offset;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), in, in_size), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_peek(file.get(), 2, 10, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(ptr, in + 2);
+    ASSERT_EQ(n, 4);
+
+    ASSERT_EQ(mb_file_peek(file.get(), 10, 1, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0);
+
+    // File position is not changed
+    ASSERT_EQ(mb_file_seek(file.get(), 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 0);
+}
+
+TEST(FileStaticMemoryTest, PreadPwriteFile)
+{
+    char in[] = "abcdef";
+    size_t in_size = 6;
+    char buf[10];
+    size_t n;
+    uint64_t offset;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), in, in_size), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_pread(file.get(), buf, sizeof(buf), 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4);
+    ASSERT_EQ(memcmp(buf, "cdef", 4), 0);
+
+    ASSERT_EQ(mb_file_pread(file.get(), buf, sizeof(buf), 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0);
+
+    ASSERT_EQ(mb_file_pwrite(file.get(), "xyz", 3, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2);
+    ASSERT_EQ(memcmp(in, "abcdxy", 6), 0);
+
+    // File position is not changed
+    ASSERT_EQ(mb_file_seek(file.get(), 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 0);
+}
+
+TEST(FileDynamicMemoryTest, PwriteOutOfBounds)
+{
+    void *data = nullptr;
+    size_t data_size = 0;
+    size_t n;
+    uint64_t offset;
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_dynamic(file.get(), &data, &data_size),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_pwrite(file.get(), "abc", 3, 5, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(data_size, 8);
+    ASSERT_EQ(memcmp(data, "\0\0\0\0\0abc", 8), 0);
+
+    // File position is not changed
+    ASSERT_EQ(mb_file_seek(file.get(), 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 0);
+
+    file.reset();
+    free(data);
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+
+// These tests use real files since mmap() is not part of the mockable vtable
+
+struct FileMmapTest : testing::Test
+{
+protected:
+    ScopedFile _file;
+    std::string _path;
+
+    FileMmapTest() : _file(mb_file_new(), mb_file_free)
+    {
+    }
+
+    virtual void SetUp() override
+    {
+        ASSERT_TRUE(!!_file);
+
+        const char *tmpdir = getenv("TMPDIR");
+        _path = tmpdir ? tmpdir : "/tmp";
+        _path += "/mbcommon_test_mmap.XXXXXX";
+
+        int fd = mkstemp(&_path[0]);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    virtual void TearDown() override
+    {
+        _file.reset();
+        unlink(_path.c_str());
+    }
+
+    void write_file(const void *data, size_t size)
+    {
+        int fd = open(_path.c_str(), O_WRONLY | O_TRUNC);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(write(fd, data, size), static_cast<ssize_t>(size));
+        close(fd);
+    }
+};
+
+TEST_F(FileMmapTest, ReadFile)
+{
+    char buf[10];
+    size_t n;
+
+    write_file("Hello, world!", 13);
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), _path.c_str()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_read(_file.get(), buf, 5, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 5u);
+    ASSERT_EQ(memcmp(buf, "Hello", 5), 0);
+
+    ASSERT_EQ(mb_file_read(_file.get(), buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, 8u);
+    ASSERT_EQ(memcmp(buf, ", world!", 8), 0);
+
+    ASSERT_EQ(mb_file_read(_file.get(), buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+}
+
+TEST_F(FileMmapTest, PeekFile)
+{
+    const void *ptr;
+    const void *ptr2;
+    char buf[5];
+    size_t n;
+    uint64_t offset;
+
+    write_file("Hello, world!", 13);
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), _path.c_str()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_peek(_file.get(), 7, 100, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 6u);
+    ASSERT_EQ(memcmp(ptr, "world!", 6), 0);
+
+    // Pointers are into the same mapping
+    ASSERT_EQ(mb_file_peek(_file.get(), 0, 13, &ptr2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 13u);
+    ASSERT_EQ(static_cast<const char *>(ptr2) + 7, ptr);
+
+    // Peeking past EOF returns nothing
+    ASSERT_EQ(mb_file_peek(_file.get(), 100, 1, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+
+    // File position is not changed
+    ASSERT_EQ(mb_file_seek(_file.get(), 0, SEEK_CUR, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 0u);
+    ASSERT_EQ(mb_file_read(_file.get(), buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(memcmp(buf, "Hello", 5), 0);
+}
+
+TEST_F(FileMmapTest, SeekFile)
+{
+    char buf[6];
+    size_t n;
+    uint64_t offset;
+
+    write_file("Hello, world!", 13);
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), _path.c_str()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_seek(_file.get(), -6, SEEK_END, &offset), MB_FILE_OK);
+    ASSERT_EQ(offset, 7u);
+    ASSERT_EQ(mb_file_read(_file.get(), buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, 6u);
+    ASSERT_EQ(memcmp(buf, "world!", 6), 0);
+
+    ASSERT_EQ(mb_file_seek(_file.get(), -20, SEEK_CUR, nullptr),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_seek(_file.get(), 100, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file.get(), buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFile)
+{
+    const void *ptr;
+    char c;
+    size_t n;
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), _path.c_str()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_read(_file.get(), &c, 1, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+    ASSERT_EQ(mb_file_peek(_file.get(), 0, 1, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 0u);
+}
+
+TEST_F(FileMmapTest, OpenFdKeepsPosition)
+{
+    char c;
+    size_t n;
+
+    write_file("abc", 3);
+
+    int fd = open(_path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(lseek(fd, 1, SEEK_SET), 1);
+
+    ASSERT_EQ(mb_file_open_mmap(_file.get(), fd), MB_FILE_OK);
+
+    // The mapping always starts at the beginning of the file
+    ASSERT_EQ(mb_file_read(_file.get(), &c, 1, &n), MB_FILE_OK);
+    ASSERT_EQ(c, 'a');
+
+    // Caller's fd is untouched and still open
+    ASSERT_EQ(lseek(fd, 0, SEEK_CUR), 1);
+    ASSERT_EQ(close(fd), 0);
+}
+
+TEST_F(FileMmapTest, WriteUnsupported)
+{
+    size_t n;
+
+    write_file("abc", 3);
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), _path.c_str()),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_write(_file.get(), "x", 1, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(mb_file_truncate(_file.get(), 0), MB_FILE_UNSUPPORTED);
+}
+
+TEST_F(FileMmapTest, OpenMissingFile)
+{
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(), "/nonexistent/file"),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file.get()), -ENOENT);
+}
+
+TEST_F(FileMmapTest, OpenDirectory)
+{
+    const char *tmpdir = getenv("TMPDIR");
+
+    ASSERT_EQ(mb_file_open_mmap_filename(_file.get(),
+                                         tmpdir ? tmpdir : "/tmp"),
+              MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file.get()), -EISDIR);
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/libc/string.h"
+#include "mbcommon/libc/string_p.h"
+
+static const void * naive_memmem(const void *haystack, size_t haystacklen,
+                                 const void *needle, size_t needlelen)
+{
+    auto h = static_cast<const unsigned char *>(haystack);
+
+    if (needlelen > haystacklen) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i <= haystacklen - needlelen; ++i) {
+        if (memcmp(h + i, needle, needlelen) == 0) {
+            return h + i;
+        }
+    }
+
+    return nullptr;
+}
+
+// Get all implementations supported by this compiler and CPU
+static std::vector<MbMemmemImpl> supported_impls()
+{
+    std::vector<MbMemmemImpl> impls;
+
+    for (int i = 0; i < MB_MEMMEM_IMPL_COUNT; ++i) {
+        MbMemmemImpl impl = static_cast<MbMemmemImpl>(i);
+        if (_mb_memmem_get_impl(impl)) {
+            impls.push_back(impl);
+        }
+    }
+
+    return impls;
+}
+
+// Copy to exactly sized buffers so that out of bounds reads can be caught by
+// sanitizers
+static void check_memmem(MbMemmemFn fn,
+                         const std::vector<unsigned char> &haystack,
+                         const std::vector<unsigned char> &needle)
+{
+    std::unique_ptr<unsigned char[]> h(new unsigned char[haystack.size()]);
+    std::unique_ptr<unsigned char[]> n(new unsigned char[needle.size()]);
+    std::copy(haystack.begin(), haystack.end(), h.get());
+    std::copy(needle.begin(), needle.end(), n.get());
+
+    const void *expected = naive_memmem(h.get(), haystack.size(),
+                                        n.get(), needle.size());
+    const void *actual = fn(h.get(), haystack.size(), n.get(), needle.size());
+
+    ASSERT_EQ(actual, expected)
+            << "haystack size: " << haystack.size()
+            << ", needle size: " << needle.size();
+}
+
+TEST(MemmemTest, GenericShouldAlwaysBeSupported)
+{
+    ASSERT_NE(_mb_memmem_get_impl(MB_MEMMEM_IMPL_GENERIC), nullptr);
+}
+
+TEST(MemmemTest, EmptyNeedleShouldMatchStart)
+{
+    static const char haystack[] = "abc";
+
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+
+        ASSERT_EQ(fn(haystack, 3, "", 0), haystack);
+        ASSERT_EQ(fn(haystack, 0, "", 0), haystack);
+    }
+}
+
+TEST(MemmemTest, NeedleLargerThanHaystackShouldNotMatch)
+{
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+
+        ASSERT_EQ(fn("abc", 3, "abcd", 4), nullptr);
+        ASSERT_EQ(fn("", 0, "a", 1), nullptr);
+    }
+}
+
+TEST(MemmemTest, ShouldFindFirstMatch)
+{
+    static const char haystack[] =
+            "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxabcxxxxxxxxxxxxabc";
+    static const size_t size = sizeof(haystack) - 1;
+
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+
+        ASSERT_EQ(fn(haystack, size, "abc", 3), haystack + 40);
+        ASSERT_EQ(fn(haystack, size, "a", 1), haystack + 40);
+        ASSERT_EQ(fn(haystack, size, "xa", 2), haystack + 39);
+        ASSERT_EQ(fn(haystack, size, "cxxxxxxxxxxxxa", 14), haystack + 42);
+        ASSERT_EQ(fn(haystack, size, "abd", 3), nullptr);
+    }
+
+    ASSERT_EQ(mb_memmem(haystack, size, "cxxxxxxxxxxxxa", 14), haystack + 42);
+}
+
+TEST(MemmemTest, RandomDataShouldMatchNaiveSearch)
+{
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+        std::mt19937 gen(1234);
+        std::vector<unsigned char> haystack;
+        std::vector<unsigned char> needle;
+
+        for (size_t haystack_size : { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64,
+                                      65, 100, 257, 1000 }) {
+            for (size_t needle_size = 0; needle_size <= 70; ++needle_size) {
+                // Small alphabet so that partial matches are common
+                haystack.resize(haystack_size);
+                for (auto &c : haystack) {
+                    c = static_cast<unsigned char>(gen() % 3);
+                }
+
+                // Take needle from the haystack half of the time
+                needle.resize(needle_size);
+                if (needle_size <= haystack_size && gen() % 2 == 0) {
+                    size_t offset = gen() % (haystack_size - needle_size + 1);
+                    std::copy(haystack.begin() + offset,
+                              haystack.begin() + offset + needle_size,
+                              needle.begin());
+                } else {
+                    for (auto &c : needle) {
+                        c = static_cast<unsigned char>(gen() % 3);
+                    }
+                }
+
+                check_memmem(fn, haystack, needle);
+            }
+        }
+    }
+}
+
+TEST(MemmemTest, MatchAtEndShouldBeFound)
+{
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+
+        for (size_t haystack_size = 2; haystack_size <= 100; ++haystack_size) {
+            for (size_t needle_size = 2; needle_size <= haystack_size;
+                    needle_size += 7) {
+                std::vector<unsigned char> haystack(haystack_size, 'a');
+                std::vector<unsigned char> needle(needle_size, 'a');
+                haystack.back() = 'b';
+                needle.back() = 'b';
+
+                check_memmem(fn, haystack, needle);
+            }
+        }
+    }
+}
+
+TEST(MemmemTest, PathologicalInputShouldMatchNaiveSearch)
+{
+    for (MbMemmemImpl impl : supported_impls()) {
+        SCOPED_TRACE(_mb_memmem_impl_name(impl));
+        MbMemmemFn fn = _mb_memmem_get_impl(impl);
+
+        // Every position passes the first and last byte filter
+        std::vector<unsigned char> haystack(64 * 1024, 'a');
+        std::vector<unsigned char> needle(1000, 'a');
+        needle[500] = 'b';
+
+        check_memmem(fn, haystack, needle);
+
+        haystack[haystack.size() - 500] = 'b';
+
+        check_memmem(fn, haystack, needle);
+    }
+}
@@ -19,7 +19,12 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <cinttypes>
+#include <cstdlib>
 
 #include "mbcommon/file.h"
 #include "mbcommon/file_p.h"
@@ -42,6 +47,9 @@ struct FileTest : testing::Test
     int _n_write = 0;
     int _n_seek = 0;
     int _n_truncate = 0;
+    int _n_peek = 0;
+    int _n_pread = 0;
+    int _n_pwrite = 0;
 
     FileTest() : _file(mb_file_new())
     {
@@ -66,6 +74,12 @@ struct FileTest : testing::Test
         ASSERT_EQ(_file->seek_cb, &_seek_cb);
         ASSERT_EQ(mb_file_set_truncate_callback(_file, &_truncate_cb), MB_FILE_OK);
         ASSERT_EQ(_file->truncate_cb, &_truncate_cb);
+        ASSERT_EQ(mb_file_set_peek_callback(_file, &_peek_cb), MB_FILE_OK);
+        ASSERT_EQ(_file->peek_cb, &_peek_cb);
+        ASSERT_EQ(mb_file_set_pread_callback(_file, &_pread_cb), MB_FILE_OK);
+        ASSERT_EQ(_file->pread_cb, &_pread_cb);
+        ASSERT_EQ(mb_file_set_pwrite_callback(_file, &_pwrite_cb), MB_FILE_OK);
+        ASSERT_EQ(_file->pwrite_cb, &_pwrite_cb);
         ASSERT_EQ(mb_file_set_callback_data(_file, this), MB_FILE_OK);
         ASSERT_EQ(_file->cb_userdata, this);
     }
@@ -191,6 +205,64 @@ struct FileTest : testing::Test
         test->_buf.resize(size);
         return MB_FILE_OK;
     }
+
+    static int _peek_cb(MbFile *file, void *userdata,
+                        uint64_t offset, size_t size,
+                        const void **buf, size_t *bytes_available)
+    {
+        (void) file;
+
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_peek;
+
+        size_t available = 0;
+        if (offset < test->_buf.size()) {
+            available = std::min<uint64_t>(test->_buf.size() - offset, size);
+        }
+
+        *buf = test->_buf.data() + (available > 0 ? offset : 0);
+        *bytes_available = available;
+        return MB_FILE_OK;
+    }
+
+    static int _pread_cb(MbFile *file, void *userdata,
+                         void *buf, size_t size, uint64_t offset,
+                         size_t *bytes_read)
+    {
+        (void) file;
+
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_pread;
+
+        uint64_t n = 0;
+        if (offset < test->_buf.size()) {
+            n = std::min<uint64_t>(test->_buf.size() - offset, size);
+        }
+        memcpy(buf, test->_buf.data() + offset, n);
+        *bytes_read = n;
+
+        return MB_FILE_OK;
+    }
+
+    static int _pwrite_cb(MbFile *file, void *userdata,
+                          const void *buf, size_t size, uint64_t offset,
+                          size_t *bytes_written)
+    {
+        (void) file;
+
+        FileTest *test = static_cast<FileTest *>(userdata);
+        ++test->_n_pwrite;
+
+        size_t required = offset + size;
+        if (required > test->_buf.size()) {
+            test->_buf.resize(required);
+        }
+
+        memcpy(test->_buf.data() + offset, buf, size);
+        *bytes_written = size;
+
+        return MB_FILE_OK;
+    }
 };
 
 TEST_F(FileTest, CheckInitialValues)
@@ -202,6 +274,9 @@ TEST_F(FileTest, CheckInitialValues)
     ASSERT_EQ(_file->write_cb, nullptr);
     ASSERT_EQ(_file->seek_cb, nullptr);
     ASSERT_EQ(_file->truncate_cb, nullptr);
+    ASSERT_EQ(_file->peek_cb, nullptr);
+    ASSERT_EQ(_file->pread_cb, nullptr);
+    ASSERT_EQ(_file->pwrite_cb, nullptr);
     ASSERT_EQ(_file->cb_userdata, nullptr);
     ASSERT_EQ(_file->error_code, MB_FILE_ERROR_NONE);
     ASSERT_EQ(_file->error_string, nullptr);
@@ -396,6 +471,30 @@ TEST_F(FileTest, SetCallbacksInNonNewState)
     ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_truncate_callback"));
     ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
 
+    ASSERT_EQ(mb_file_set_peek_callback(_file, nullptr), MB_FILE_FATAL);
+    ASSERT_NE(_file->peek_cb, nullptr);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_peek_callback"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+
+    ASSERT_EQ(mb_file_set_pread_callback(_file, nullptr), MB_FILE_FATAL);
+    ASSERT_NE(_file->pread_cb, nullptr);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_pread_callback"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+
+    ASSERT_EQ(mb_file_set_pwrite_callback(_file, nullptr), MB_FILE_FATAL);
+    ASSERT_NE(_file->pwrite_cb, nullptr);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_set_pwrite_callback"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+
     ASSERT_EQ(mb_file_set_callback_data(_file, nullptr), MB_FILE_FATAL);
     ASSERT_NE(_file->cb_userdata, nullptr);
     ASSERT_EQ(_file->state, MbFileState::FATAL);
@@ -1159,6 +1258,652 @@ TEST_F(FileTest, TruncateReturnFatalFailure)
     ASSERT_EQ(_n_truncate, 1);
 }
 
+TEST_F(FileTest, PeekCallbackCalled)
+{
+    const void *ptr;
+    size_t n;
+
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Peek file
+    ASSERT_EQ(mb_file_peek(_file, 10, INITIAL_BUF_SIZE, &ptr, &n), MB_FILE_OK);
+    ASSERT_EQ(ptr, _buf.data() + 10);
+    ASSERT_EQ(n, INITIAL_BUF_SIZE - 10);
+    ASSERT_EQ(_n_peek, 1);
+
+    // File position is unchanged
+    ASSERT_EQ(_position, 0);
+}
+
+TEST_F(FileTest, PeekInWrongState)
+{
+    const void *ptr;
+    size_t n;
+
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Peek file
+    ASSERT_EQ(mb_file_peek(_file, 0, 1, &ptr, &n), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_peek"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+    ASSERT_EQ(_n_peek, 0);
+}
+
+TEST_F(FileTest, PeekWithNullParams)
+{
+    size_t n;
+
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Peek file
+    ASSERT_EQ(mb_file_peek(_file, 0, 1, nullptr, &n), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_peek"));
+    ASSERT_TRUE(strstr(_file->error_string, "is NULL"));
+    ASSERT_EQ(_n_peek, 0);
+}
+
+TEST_F(FileTest, PeekNoCallback)
+{
+    const void *ptr;
+    size_t n;
+
+    ASSERT_EQ(_file->state, MbFileState::NEW);
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear peek callback
+    mb_file_set_peek_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_n_open, 1);
+
+    // Peek file
+    ASSERT_EQ(mb_file_peek(_file, 0, 1, &ptr, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_peek"));
+    ASSERT_TRUE(strstr(_file->error_string, "peek callback"));
+    ASSERT_EQ(_n_peek, 0);
+}
+
+TEST_F(FileTest, PreadCallbackCalled)
+{
+    char c;
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Read file at offset
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(c, 'b');
+    ASSERT_EQ(_n_pread, 1);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_seek, 0);
+}
+
+TEST_F(FileTest, PreadEmulated)
+{
+    char c;
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pread callback
+    mb_file_set_pread_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    _position = 5;
+
+    // Read file at offset
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(c, 'b');
+    ASSERT_EQ(_n_read, 1);
+    ASSERT_EQ(_n_seek, 3);
+
+    // File position is restored
+    ASSERT_EQ(_position, 5);
+}
+
+TEST_F(FileTest, PreadEmulatedNoSeekCallback)
+{
+    char c;
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pread and seek callbacks
+    mb_file_set_pread_callback(_file, nullptr);
+    mb_file_set_seek_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Read file at offset
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 27, &n), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_EQ(_n_read, 0);
+}
+
+TEST_F(FileTest, PreadInWrongState)
+{
+    char c;
+    size_t n;
+
+    // Read file at offset
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, &n), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pread"));
+    ASSERT_TRUE(strstr(_file->error_string, "Invalid state"));
+    ASSERT_EQ(_n_pread, 0);
+}
+
+TEST_F(FileTest, PreadWithNullBytesReadParam)
+{
+    char c;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Read file at offset
+    ASSERT_EQ(mb_file_pread(_file, &c, 1, 0, nullptr), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pread"));
+    ASSERT_TRUE(strstr(_file->error_string, "is NULL"));
+    ASSERT_EQ(_n_pread, 0);
+}
+
+TEST_F(FileTest, PwriteCallbackCalled)
+{
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Write file at offset
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_buf[27], 'x');
+    ASSERT_EQ(_n_pwrite, 1);
+    ASSERT_EQ(_n_write, 0);
+    ASSERT_EQ(_n_seek, 0);
+}
+
+TEST_F(FileTest, PwriteEmulated)
+{
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pwrite callback
+    mb_file_set_pwrite_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    _position = 5;
+
+    // Write file at offset
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(_buf[27], 'x');
+    ASSERT_EQ(_n_write, 1);
+    ASSERT_EQ(_n_seek, 3);
+
+    // File position is restored
+    ASSERT_EQ(_position, 5);
+}
+
+TEST_F(FileTest, PwriteWithNullBytesWrittenParam)
+{
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Write file at offset
+    ASSERT_EQ(mb_file_pwrite(_file, "x", 1, 0, nullptr), MB_FILE_FATAL);
+    ASSERT_EQ(_file->state, MbFileState::FATAL);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_PROGRAMMER_ERROR);
+    ASSERT_NE(_file->error_string, nullptr);
+    ASSERT_TRUE(strstr(_file->error_string, "mb_file_pwrite"));
+    ASSERT_TRUE(strstr(_file->error_string, "is NULL"));
+    ASSERT_EQ(_n_pwrite, 0);
+}
+
+TEST_F(FileTest, ReadvEmulated)
+{
+    char a[3];
+    char b[2];
+    MbFileIoVec iov[] = {
+        { a, sizeof(a) },
+        { nullptr, 0 },
+        { b, sizeof(b) },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Read file into multiple buffers
+    ASSERT_EQ(mb_file_readv(_file, iov, 3, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 5);
+    ASSERT_EQ(memcmp(a, "abc", 3), 0);
+    ASSERT_EQ(memcmp(b, "de", 2), 0);
+    ASSERT_EQ(_n_read, 2);
+    ASSERT_EQ(_position, 5);
+}
+
+TEST_F(FileTest, ReadvEmulatedStopsAtEof)
+{
+    char a[10];
+    char b[10];
+    MbFileIoVec iov[] = {
+        { a, sizeof(a) },
+        { b, sizeof(b) },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    _position = INITIAL_BUF_SIZE - 5;
+
+    // Short read in first buffer should not touch the second buffer
+    ASSERT_EQ(mb_file_readv(_file, iov, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 5);
+    ASSERT_EQ(_n_read, 1);
+}
+
+TEST_F(FileTest, ReadvWithOverflowingSize)
+{
+    char c;
+    MbFileIoVec iov[] = {
+        { &c, SIZE_MAX },
+        { &c, 1 },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    ASSERT_EQ(mb_file_readv(_file, iov, 2, &n), MB_FILE_FAILED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_INVALID_ARGUMENT);
+    ASSERT_EQ(_n_read, 0);
+}
+
+TEST_F(FileTest, WritevEmulated)
+{
+    char a[] = "xy";
+    char b[] = "z";
+    MbFileIoVec iov[] = {
+        { a, 2 },
+        { b, 1 },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Write file from multiple buffers
+    ASSERT_EQ(mb_file_writev(_file, iov, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(_buf.data(), "xyz", 3), 0);
+    ASSERT_EQ(_n_write, 2);
+    ASSERT_EQ(_position, 3);
+}
+
+TEST_F(FileTest, WritevCallbackUnsupportedShouldBeEmulated)
+{
+    char a[] = "xy";
+    char b[] = "z";
+    MbFileIoVec iov[] = {
+        { a, 2 },
+        { b, 1 },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_writev_callback(_file, [](MbFile *file,
+            void *userdata, const MbFileIoVec *iov, size_t iov_count,
+            size_t *bytes_written) -> int {
+        (void) file;
+        (void) userdata;
+        (void) iov;
+        (void) iov_count;
+        (void) bytes_written;
+        return MB_FILE_UNSUPPORTED;
+    }), MB_FILE_OK);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    ASSERT_EQ(mb_file_writev(_file, iov, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(_buf.data(), "xyz", 3), 0);
+    ASSERT_EQ(_n_write, 2);
+}
+
+TEST_F(FileTest, PreadvEmulated)
+{
+    char a[2];
+    char b[1];
+    MbFileIoVec iov[] = {
+        { a, sizeof(a) },
+        { b, sizeof(b) },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+
+    // Buffers should be read with the positional read callback
+    ASSERT_EQ(mb_file_preadv(_file, iov, 2, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(a, "bc", 2), 0);
+    ASSERT_EQ(b[0], 'd');
+    ASSERT_EQ(_n_pread, 2);
+    ASSERT_EQ(_n_read, 0);
+    ASSERT_EQ(_n_seek, 0);
+}
+
+TEST_F(FileTest, PwritevEmulated)
+{
+    char a[] = "xy";
+    char b[] = "z";
+    MbFileIoVec iov[] = {
+        { a, 2 },
+        { b, 1 },
+    };
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+
+    // Clear pwrite callback
+    mb_file_set_pwrite_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+    _position = 5;
+
+    // Write file at offset by seeking
+    ASSERT_EQ(mb_file_pwritev(_file, iov, 2, 27, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(memcmp(_buf.data() + 27, "xyz", 3), 0);
+    ASSERT_EQ(_n_write, 2);
+
+    // File position is restored
+    ASSERT_EQ(_position, 5);
+}
+
+TEST_F(FileTest, StatsNotEnabled)
+{
+    MbFileStats stats;
+
+    // Set callbacks
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_stats_enabled(_file, false), MB_FILE_OK);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_get_stats(_file, &stats), MB_FILE_UNSUPPORTED);
+    ASSERT_EQ(_file->error_code, MB_FILE_ERROR_UNSUPPORTED);
+    ASSERT_EQ(_file->state, MbFileState::OPENED);
+}
+
+TEST_F(FileTest, StatsCountOperations)
+{
+    MbFileStats stats;
+    char buf[10];
+    size_t n;
+
+    // Set callbacks
+    set_all_callbacks();
+    ASSERT_EQ(mb_file_set_stats_enabled(_file, true), MB_FILE_OK);
+
+    // Clear pread callback so that it is emulated
+    mb_file_set_pread_callback(_file, nullptr);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_read(_file, buf, sizeof(buf), &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_read(_file, buf, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_write(_file, "x", 1, &n), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(_file, -1, SEEK_SET, nullptr), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_pread(_file, buf, 2, 0, &n), MB_FILE_OK);
+
+    // Statistics are kept after closing
+    ASSERT_EQ(mb_file_close(_file), MB_FILE_OK);
+    ASSERT_EQ(mb_file_get_stats(_file, &stats), MB_FILE_OK);
+
+    auto const &read_stats = stats.ops[MB_FILE_STATS_OP_READ];
+    ASSERT_EQ(read_stats.calls, 3u);
+    ASSERT_EQ(read_stats.failures, 0u);
+    ASSERT_EQ(read_stats.bytes, 16u);
+
+    uint64_t total = 0;
+    for (int i = 0; i < MB_FILE_STATS_LATENCY_BUCKETS; ++i) {
+        total += read_stats.latency[i];
+    }
+    ASSERT_EQ(total, read_stats.calls);
+
+    auto const &write_stats = stats.ops[MB_FILE_STATS_OP_WRITE];
+    ASSERT_EQ(write_stats.calls, 1u);
+    ASSERT_EQ(write_stats.bytes, 1u);
+
+    // 1 failed seek + 3 seeks for emulating pread
+    auto const &seek_stats = stats.ops[MB_FILE_STATS_OP_SEEK];
+    ASSERT_EQ(seek_stats.calls, 4u);
+    ASSERT_EQ(seek_stats.failures, 1u);
+    ASSERT_EQ(seek_stats.bytes, 0u);
+
+    auto const &pread_stats = stats.ops[MB_FILE_STATS_OP_PREAD];
+    ASSERT_EQ(pread_stats.calls, 1u);
+    ASSERT_EQ(pread_stats.bytes, 2u);
+
+    ASSERT_EQ(stats.ops[MB_FILE_STATS_OP_TRUNCATE].calls, 0u);
+
+    char *str = mb_file_stats_to_string(&stats);
+    ASSERT_NE(str, nullptr);
+    ASSERT_TRUE(strstr(str, "read: calls=3 failures=0 bytes=16"));
+    ASSERT_TRUE(strstr(str, "seek: calls=4 failures=1 bytes=0"));
+    ASSERT_FALSE(strstr(str, "truncate"));
+    free(str);
+}
+
+TEST_F(FileTest, StatsOpNames)
+{
+    ASSERT_STREQ(mb_file_stats_op_name(MB_FILE_STATS_OP_READ), "read");
+    ASSERT_STREQ(mb_file_stats_op_name(MB_FILE_STATS_OP_PWRITEV), "pwritev");
+    ASSERT_EQ(mb_file_stats_op_name(MB_FILE_STATS_OP_COUNT), nullptr);
+    ASSERT_EQ(mb_file_stats_op_name(-1), nullptr);
+}
+
+TEST(FileStatsTest, ConcurrentPreadsShouldBeCounted)
+{
+    auto pread_cb = [](MbFile *file, void *userdata, void *buf, size_t size,
+                       uint64_t offset, size_t *bytes_read) -> int {
+        (void) file;
+        (void) userdata;
+        (void) buf;
+        (void) offset;
+        *bytes_read = size;
+        return MB_FILE_OK;
+    };
+
+    MbFile *file = mb_file_new();
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(mb_file_set_stats_enabled(file, true), MB_FILE_OK);
+    ASSERT_EQ(mb_file_set_pread_callback(file, pread_cb), MB_FILE_OK);
+    ASSERT_EQ(mb_file_open(file), MB_FILE_OK);
+
+    const int n_threads = 4;
+    const int n_calls = 10000;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back([file]{
+            char c[2];
+            size_t n;
+            for (int j = 0; j < n_calls; ++j) {
+                mb_file_pread(file, c, sizeof(c), j, &n);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    MbFileStats stats;
+    ASSERT_EQ(mb_file_get_stats(file, &stats), MB_FILE_OK);
+    ASSERT_EQ(stats.ops[MB_FILE_STATS_OP_PREAD].calls,
+              static_cast<uint64_t>(n_threads * n_calls));
+    ASSERT_EQ(stats.ops[MB_FILE_STATS_OP_PREAD].bytes,
+              static_cast<uint64_t>(n_threads * n_calls * 2));
+
+    ASSERT_EQ(mb_file_free(file), MB_FILE_OK);
+}
+
+#ifndef _WIN32
+struct ReportData
+{
+    MbFile *file = nullptr;
+    uint64_t truncate_calls = 0;
+    int n_reports = 0;
+};
+
+static void stats_report_cb(MbFile *file, const MbFileStats *stats,
+                            void *userdata)
+{
+    ReportData *data = static_cast<ReportData *>(userdata);
+    data->file = file;
+    data->truncate_calls = stats->ops[MB_FILE_STATS_OP_TRUNCATE].calls;
+    ++data->n_reports;
+}
+
+static int stats_truncate_cb(MbFile *file, void *userdata, uint64_t size)
+{
+    (void) file;
+    (void) userdata;
+    (void) size;
+    return MB_FILE_OK;
+}
+
+// Exits with 0 if the report callback was invoked once with the right data
+static void check_report_on_close()
+{
+    ReportData data;
+
+    if (setenv("MB_FILE_STATS", "1", 1) != 0) {
+        exit(1);
+    }
+    mb_file_set_stats_report_callback(&stats_report_cb, &data);
+
+    MbFile *file = mb_file_new();
+    if (!file
+            || mb_file_set_truncate_callback(file, &stats_truncate_cb)
+                    != MB_FILE_OK
+            || mb_file_open(file) != MB_FILE_OK
+            || mb_file_truncate(file, 0) != MB_FILE_OK
+            || mb_file_truncate(file, 0) != MB_FILE_OK
+            || mb_file_close(file) != MB_FILE_OK) {
+        exit(1);
+    }
+    mb_file_free(file);
+
+    exit(data.n_reports == 1 && data.file == file && data.truncate_calls == 2
+            ? 0 : 2);
+}
+
+TEST(FileStatsTest, ReportOnCloseIfEnabledByEnvironment)
+{
+    // MB_FILE_STATS is only read once per process, so the check must run in a
+    // freshly executed process instead of a forked copy of this one
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
+
+    ASSERT_EXIT(check_report_on_close(), testing::ExitedWithCode(0), "");
+}
+#endif
+
 TEST_F(FileTest, SetError)
 {
     ASSERT_EQ(_file->error_code, MB_FILE_ERROR_NONE);
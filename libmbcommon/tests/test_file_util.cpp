@@ -20,9 +20,15 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <cinttypes>
 
+#include <unistd.h>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/fd.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_p.h"
 #include "mbcommon/file_util.h"
@@ -402,6 +408,112 @@ TEST_F(FileUtilTest, WriteFullyPartialFail)
     ASSERT_EQ(_n_write, 5);
 }
 
+TEST_F(FileUtilTest, WritevFullyNormal)
+{
+    set_all_callbacks();
+
+    // Writes at most 3 bytes at a time, possibly spanning buffers
+    auto writev_cb = [](MbFile *file, void *userdata,
+                        const MbFileIoVec *iov, size_t iov_count,
+                        size_t *bytes_written) -> int {
+        (void) file;
+        FileUtilTest *test = static_cast<FileUtilTest *>(userdata);
+        ++test->_n_write;
+        size_t total = 0;
+        for (size_t i = 0; i < iov_count && total < 3; ++i) {
+            size_t n = std::min<size_t>(iov[i].size, 3 - total);
+            EXPECT_GT(n, 0u);
+            auto ptr = static_cast<const unsigned char *>(iov[i].base);
+            test->_buf.insert(test->_buf.end(), ptr, ptr + n);
+            total += n;
+        }
+        *bytes_written = total;
+        return MB_FILE_OK;
+    };
+    ASSERT_EQ(mb_file_set_writev_callback(_file, writev_cb), MB_FILE_OK);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    _buf.clear();
+
+    char a[] = "ab";
+    char b[] = "cdefg";
+    char c[] = "h";
+    MbFileIoVec iov[] = {
+        { a, 2 },
+        { nullptr, 0 },
+        { b, 5 },
+        { c, 1 },
+    };
+
+    size_t n;
+    ASSERT_EQ(mb_file_writev_fully(_file, iov, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 8);
+    ASSERT_EQ(_n_write, 3);
+    ASSERT_EQ(std::string(_buf.begin(), _buf.end()), "abcdefgh");
+}
+
+TEST_F(FileUtilTest, WritevFullyPartialFail)
+{
+    set_all_callbacks();
+
+    auto write_cb = [](MbFile *file, void *userdata,
+                       const void *buf, size_t size,
+                       size_t *bytes_written) -> int {
+        (void) file;
+        (void) buf;
+        FileUtilTest *test = static_cast<FileUtilTest *>(userdata);
+        ++test->_n_write;
+        switch (test->_n_write) {
+        case 1:
+        case 2:
+            *bytes_written = std::min<size_t>(size, 2);
+            return MB_FILE_OK;
+        default:
+            *bytes_written = 0;
+            return MB_FILE_FAILED;
+        }
+    };
+    ASSERT_EQ(mb_file_set_write_callback(_file, write_cb), MB_FILE_OK);
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+
+    char a[] = "xxx";
+    char b[] = "xxx";
+    MbFileIoVec iov[] = {
+        { a, 3 },
+        { b, 3 },
+    };
+
+    size_t n;
+    ASSERT_EQ(mb_file_writev_fully(_file, iov, 2, &n), MB_FILE_FAILED);
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(_n_write, 4);
+}
+
+TEST_F(FileUtilTest, ReadvFullyEOF)
+{
+    set_all_callbacks();
+
+    // Open file
+    ASSERT_EQ(mb_file_open(_file), MB_FILE_OK);
+    _position = INITIAL_BUF_SIZE - 4;
+
+    char a[3];
+    char b[3];
+    MbFileIoVec iov[] = {
+        { a, sizeof(a) },
+        { b, sizeof(b) },
+    };
+
+    size_t n;
+    ASSERT_EQ(mb_file_readv_fully(_file, iov, 2, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4);
+    ASSERT_EQ(memcmp(a, "ghi", 3), 0);
+    ASSERT_EQ(b[0], 'j');
+}
+
 TEST_F(FileUtilTest, ReadDiscardNormal)
 {
     set_all_callbacks();
@@ -583,6 +695,262 @@ TEST_F(FileSearchTest, FindNormal)
                              &_result_cb, this), MB_FILE_OK);
 }
 
+static int collect_offsets_cb(MbFile *file, void *userdata, uint64_t offset)
+{
+    (void) file;
+    static_cast<std::vector<uint64_t> *>(userdata)->push_back(offset);
+    return MB_FILE_OK;
+}
+
+// Forwards reads and seeks to another handle, but does not support peeking
+static int no_peek_read_cb(MbFile *file, void *userdata,
+                           void *buf, size_t size, size_t *bytes_read)
+{
+    (void) file;
+    return mb_file_read(static_cast<MbFile *>(userdata), buf, size,
+                        bytes_read);
+}
+
+static int no_peek_seek_cb(MbFile *file, void *userdata,
+                           int64_t offset, int whence, uint64_t *new_offset)
+{
+    (void) file;
+    return mb_file_seek(static_cast<MbFile *>(userdata), offset, whence,
+                        new_offset);
+}
+
+TEST_F(FileSearchTest, InPlaceSearchShouldMatchBufferedSearch)
+{
+    static const char data[] = "abcXXabcabcYYabXcab";
+
+    struct Params
+    {
+        int64_t start;
+        int64_t end;
+        const char *pattern;
+        int64_t max_matches;
+    };
+
+    static const Params params[] = {
+        { -1, -1, "abc", -1 },
+        { -1, -1, "abc", 2 },
+        { 3, -1, "abc", -1 },
+        { -1, 10, "abc", -1 },
+        { 6, 11, "abc", -1 },
+        { -1, -1, "X", -1 },
+        { -1, -1, "XX", -1 },
+        { -1, -1, "ab", -1 },
+        { -1, -1, "zzz", -1 },
+        { 100, -1, "a", -1 },
+    };
+
+    ScopedFile inner(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!inner);
+    ScopedFile no_peek(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!no_peek);
+
+    ASSERT_EQ(mb_file_open_memory_static(_file, data, sizeof(data) - 1),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_static(inner.get(), data, sizeof(data) - 1),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_callbacks(no_peek.get(), nullptr, nullptr,
+                                     &no_peek_read_cb, nullptr,
+                                     &no_peek_seek_cb, nullptr, inner.get()),
+              MB_FILE_OK);
+
+    for (auto const &p : params) {
+        std::vector<uint64_t> expected;
+        std::vector<uint64_t> actual;
+
+        // Small buffer to exercise the chunk boundary handling
+        ASSERT_EQ(mb_file_search(no_peek.get(), p.start, p.end, 4,
+                                 p.pattern, strlen(p.pattern), p.max_matches,
+                                 &collect_offsets_cb, &expected), MB_FILE_OK);
+        ASSERT_EQ(mb_file_search(_file, p.start, p.end, 4,
+                                 p.pattern, strlen(p.pattern), p.max_matches,
+                                 &collect_offsets_cb, &actual), MB_FILE_OK);
+        ASSERT_EQ(actual, expected) << "Pattern: " << p.pattern
+                                    << ", start: " << p.start
+                                    << ", end: " << p.end;
+    }
+}
+
+struct MultiMatch
+{
+    size_t pattern_id;
+    uint64_t offset;
+};
+
+static int collect_multi_cb(MbFile *file, void *userdata, size_t pattern_id,
+                            uint64_t offset)
+{
+    (void) file;
+    static_cast<std::vector<MultiMatch> *>(userdata)->push_back(
+            { pattern_id, offset });
+    return MB_FILE_OK;
+}
+
+static int stop_after_first_multi_cb(MbFile *file, void *userdata,
+                                     size_t pattern_id, uint64_t offset)
+{
+    collect_multi_cb(file, userdata, pattern_id, offset);
+    return MB_FILE_WARN;
+}
+
+TEST_F(FileSearchTest, MultiSearchShouldMatchSequentialSearches)
+{
+    static const char data[] = "abcdXXabcabcdYYbcXabXcabzabcd";
+
+    // Includes shared prefixes, substrings, and a duplicate pattern
+    static const char * const patterns[] = {
+        "abc", "bc", "abcd", "XX", "X", "zzz", "bc",
+    };
+    static const size_t num_patterns =
+            sizeof(patterns) / sizeof(patterns[0]);
+
+    struct Params
+    {
+        int64_t start;
+        int64_t end;
+        size_t bsize;
+    };
+
+    static const Params params[] = {
+        { -1, -1, 0 },
+        { -1, -1, 1 },
+        { -1, -1, 3 },
+        { 2, -1, 4 },
+        { -1, 12, 5 },
+        { 7, 20, 2 },
+        { 100, -1, 0 },
+    };
+
+    size_t sizes[num_patterns];
+    for (size_t i = 0; i < num_patterns; ++i) {
+        sizes[i] = strlen(patterns[i]);
+    }
+
+    ScopedFile inner(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!inner);
+    ScopedFile no_peek(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!no_peek);
+
+    ASSERT_EQ(mb_file_open_memory_static(_file, data, sizeof(data) - 1),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_memory_static(inner.get(), data, sizeof(data) - 1),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_open_callbacks(no_peek.get(), nullptr, nullptr,
+                                     &no_peek_read_cb, nullptr,
+                                     &no_peek_seek_cb, nullptr, inner.get()),
+              MB_FILE_OK);
+
+    for (auto const &p : params) {
+        std::vector<uint64_t> expected[num_patterns];
+
+        for (size_t i = 0; i < num_patterns; ++i) {
+            ASSERT_EQ(mb_file_search(_file, p.start, p.end, 0, patterns[i],
+                                     sizes[i], -1, &collect_offsets_cb,
+                                     &expected[i]), MB_FILE_OK);
+        }
+
+        for (MbFile *file : { _file, no_peek.get() }) {
+            std::vector<MultiMatch> matches;
+            std::vector<uint64_t> actual[num_patterns];
+
+            ASSERT_EQ(mb_file_search_multi(
+                    file, p.start, p.end, p.bsize,
+                    reinterpret_cast<const void * const *>(patterns), sizes,
+                    num_patterns, -1, &collect_multi_cb, &matches),
+                      MB_FILE_OK);
+
+            uint64_t prev_end = 0;
+            for (auto const &m : matches) {
+                ASSERT_LT(m.pattern_id, num_patterns);
+                actual[m.pattern_id].push_back(m.offset);
+
+                // Matches are reported in order of their end offsets
+                uint64_t end = m.offset + sizes[m.pattern_id];
+                ASSERT_GE(end, prev_end);
+                prev_end = end;
+            }
+
+            for (size_t i = 0; i < num_patterns; ++i) {
+                ASSERT_EQ(actual[i], expected[i])
+                        << "Pattern: " << patterns[i]
+                        << ", start: " << p.start
+                        << ", end: " << p.end
+                        << ", bsize: " << p.bsize;
+            }
+        }
+    }
+}
+
+TEST_F(FileSearchTest, MultiSearchShouldHonorMaxMatches)
+{
+    static const char data[] = "aXbXaXb";
+    static const char * const patterns[] = { "a", "b" };
+    static const size_t sizes[] = { 1, 1 };
+    std::vector<MultiMatch> matches;
+
+    ASSERT_EQ(mb_file_open_memory_static(_file, data, sizeof(data) - 1),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_search_multi(
+            _file, -1, -1, 0,
+            reinterpret_cast<const void * const *>(patterns), sizes, 2, 3,
+            &collect_multi_cb, &matches), MB_FILE_OK);
+    ASSERT_EQ(matches.size(), 3u);
+    ASSERT_EQ(matches[0].pattern_id, 0u);
+    ASSERT_EQ(matches[0].offset, 0u);
+    ASSERT_EQ(matches[1].pattern_id, 1u);
+    ASSERT_EQ(matches[1].offset, 2u);
+    ASSERT_EQ(matches[2].pattern_id, 0u);
+    ASSERT_EQ(matches[2].offset, 4u);
+
+    matches.clear();
+
+    // Stop early
+    ASSERT_EQ(mb_file_search_multi(
+            _file, -1, -1, 0,
+            reinterpret_cast<const void * const *>(patterns), sizes, 2, -1,
+            &stop_after_first_multi_cb, &matches), MB_FILE_OK);
+    ASSERT_EQ(matches.size(), 1u);
+}
+
+TEST_F(FileSearchTest, MultiSearchShouldIgnoreEmptyPatterns)
+{
+    static const char data[] = "abc";
+    static const char * const patterns[] = { "", "b" };
+    static const size_t sizes[] = { 0, 1 };
+    std::vector<MultiMatch> matches;
+
+    ASSERT_EQ(mb_file_open_memory_static(_file, data, sizeof(data) - 1),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_search_multi(
+            _file, -1, -1, 0,
+            reinterpret_cast<const void * const *>(patterns), sizes, 2, -1,
+            &collect_multi_cb, &matches), MB_FILE_OK);
+    ASSERT_EQ(matches.size(), 1u);
+    ASSERT_EQ(matches[0].pattern_id, 1u);
+    ASSERT_EQ(matches[0].offset, 1u);
+}
+
+TEST_F(FileSearchTest, MultiSearchInvalidBoundaries)
+{
+    static const char * const patterns[] = { "a" };
+    static const size_t sizes[] = { 1 };
+
+    ASSERT_EQ(mb_file_open_memory_static(_file, "", 0), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_search_multi(
+            _file, 20, 10, 0,
+            reinterpret_cast<const void * const *>(patterns), sizes, 1, -1,
+            &collect_multi_cb, nullptr), MB_FILE_FAILED);
+    ASSERT_EQ(mb_file_error(_file), MB_FILE_ERROR_INVALID_ARGUMENT);
+    ASSERT_TRUE(strstr(mb_file_error_string(_file), "End offset < start"));
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     char buf[] = "abcdef";
@@ -716,4 +1084,231 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     free(buf);
 }
 
+TEST(FileMoveTest, MemmoveSemanticsShouldBePreservedForRealFiles)
+{
+    struct Params
+    {
+        uint64_t src;
+        uint64_t dest;
+        uint64_t size;
+    };
+
+    // Covers inserting and collapsing block-aligned ranges at the end of the
+    // file, copy_file_range() with and without overlap, and the buffered
+    // fallback. Which paths actually get used depends on the filesystem.
+    static const uint64_t file_size = 4 * 1024 * 1024;
+    static const Params params[] = {
+        // Tail moves with aligned offsets
+        { 1024 * 1024, 1024 * 1024 + 8192, file_size - 1024 * 1024 },
+        { 1024 * 1024, 1024 * 1024 - 8192, file_size - 1024 * 1024 },
+        // Non-overlapping
+        { 0, 2 * 1024 * 1024 + 5, 1024 * 1024 + 7 },
+        { 3 * 1024 * 1024, 100, 1000 },
+        // Overlapping with a large distance
+        { 10, 1024 * 1024 + 20, 2 * 1024 * 1024 },
+        { 1024 * 1024 + 20, 10, 2 * 1024 * 1024 },
+        // Overlapping with a small distance
+        { 0, 3, file_size - 3 },
+        { 3, 0, file_size - 3 },
+        // Extends past EOF
+        { file_size - 100, file_size + 100, 100 },
+    };
+
+    std::vector<unsigned char> initial(file_size);
+    for (size_t i = 0; i < initial.size(); ++i) {
+        initial[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    std::string path = tmpdir ? tmpdir : "/tmp";
+    path += "/mbcommon_test_move.XXXXXX";
+
+    int fd = mkstemp(&path[0]);
+    ASSERT_GE(fd, 0);
+    unlink(path.c_str());
+
+    ScopedFile file(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_fd(file.get(), fd, true), MB_FILE_OK);
+
+    for (auto const &p : params) {
+        SCOPED_TRACE(testing::Message() << "src: " << p.src
+                     << ", dest: " << p.dest << ", size: " << p.size);
+
+        std::vector<unsigned char> expected = initial;
+        if (p.dest + p.size > expected.size()) {
+            expected.resize(p.dest + p.size);
+        }
+        memmove(expected.data() + p.dest, expected.data() + p.src, p.size);
+
+        size_t n;
+        uint64_t moved;
+
+        ASSERT_EQ(mb_file_truncate(file.get(), 0), MB_FILE_OK);
+        ASSERT_EQ(mb_file_pwrite_fully(file.get(), initial.data(),
+                                       initial.size(), 0, &n), MB_FILE_OK);
+        ASSERT_EQ(n, initial.size());
+
+        ASSERT_EQ(mb_file_move(file.get(), p.src, p.dest, p.size, &moved),
+                  MB_FILE_OK);
+        ASSERT_EQ(moved, p.size);
+
+        std::vector<unsigned char> actual(expected.size() + 1);
+        ASSERT_EQ(mb_file_pread_fully(file.get(), actual.data(),
+                                      actual.size(), 0, &n), MB_FILE_OK);
+        ASSERT_EQ(n, expected.size());
+        actual.resize(n);
+        ASSERT_TRUE(actual == expected);
+    }
+}
+
 // TODO: Add more tests after integrating gmock
+
+TEST(FileCopyTest, CopyFromPeekableSourceShouldSucceed)
+{
+    char src_buf[] = "abcdefgh";
+    void *dest_buf = nullptr;
+    size_t dest_size = 0;
+    uint64_t n;
+    uint64_t pos;
+
+    ScopedFile src(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!src);
+    ASSERT_EQ(mb_file_open_memory_static(src.get(), src_buf,
+                                         sizeof(src_buf) - 1), MB_FILE_OK);
+
+    ScopedFile dest(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!dest);
+    ASSERT_EQ(mb_file_open_memory_dynamic(dest.get(), &dest_buf, &dest_size),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(dest.get(), 1, SEEK_SET, nullptr), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_copy_from(dest.get(), src.get(), 2, 4, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 4);
+
+    // Destination position should be advanced
+    ASSERT_EQ(mb_file_seek(dest.get(), 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 5);
+
+    ASSERT_EQ(dest_size, 5);
+    ASSERT_EQ(memcmp(static_cast<char *>(dest_buf) + 1, "cdef", 4), 0);
+
+    ASSERT_EQ(mb_file_close(dest.get()), MB_FILE_OK);
+    free(dest_buf);
+}
+
+TEST(FileCopyTest, CopyFromShouldStopAtSourceEof)
+{
+    char src_buf[] = "abc";
+    void *dest_buf = nullptr;
+    size_t dest_size = 0;
+    uint64_t n;
+
+    ScopedFile src(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!src);
+    ASSERT_EQ(mb_file_open_memory_static(src.get(), src_buf,
+                                         sizeof(src_buf) - 1), MB_FILE_OK);
+
+    ScopedFile dest(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!dest);
+    ASSERT_EQ(mb_file_open_memory_dynamic(dest.get(), &dest_buf, &dest_size),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_copy_from(dest.get(), src.get(), 1, 10, &n), MB_FILE_OK);
+    ASSERT_EQ(n, 2);
+    ASSERT_EQ(dest_size, 2);
+    ASSERT_EQ(memcmp(dest_buf, "bc", 2), 0);
+
+    ASSERT_EQ(mb_file_close(dest.get()), MB_FILE_OK);
+    free(dest_buf);
+}
+
+TEST(FileCopyTest, CopyFromNonPeekableSourceShouldSucceed)
+{
+    std::vector<unsigned char> data(100000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 7 + i / 256);
+    }
+    void *dest_buf = nullptr;
+    size_t dest_size = 0;
+    uint64_t n;
+
+    ScopedFile inner(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!inner);
+    ASSERT_EQ(mb_file_open_memory_static(inner.get(), data.data(),
+                                         data.size()), MB_FILE_OK);
+
+    ScopedFile src(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!src);
+    ASSERT_EQ(mb_file_open_callbacks(src.get(), nullptr, nullptr,
+                                     &no_peek_read_cb, nullptr,
+                                     &no_peek_seek_cb, nullptr, inner.get()),
+              MB_FILE_OK);
+
+    ScopedFile dest(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!dest);
+    ASSERT_EQ(mb_file_open_memory_dynamic(dest.get(), &dest_buf, &dest_size),
+              MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_copy_from(dest.get(), src.get(), 10, data.size() - 20,
+                                &n), MB_FILE_OK);
+    ASSERT_EQ(n, data.size() - 20);
+    ASSERT_EQ(dest_size, data.size() - 20);
+    ASSERT_EQ(memcmp(dest_buf, data.data() + 10, dest_size), 0);
+
+    ASSERT_EQ(mb_file_close(dest.get()), MB_FILE_OK);
+    free(dest_buf);
+}
+
+TEST(FileCopyTest, CopyFromShouldWorkForRealFiles)
+{
+    // Uses copy_file_range() if the filesystem supports it
+    static const size_t file_size = 2 * 1024 * 1024 + 13;
+
+    std::vector<unsigned char> data(file_size);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 31 + i / 4096);
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    std::string src_path = tmpdir ? tmpdir : "/tmp";
+    src_path += "/mbcommon_test_copy.XXXXXX";
+    std::string dest_path = src_path;
+
+    int src_fd = mkstemp(&src_path[0]);
+    ASSERT_GE(src_fd, 0);
+    unlink(src_path.c_str());
+    int dest_fd = mkstemp(&dest_path[0]);
+    ASSERT_GE(dest_fd, 0);
+    unlink(dest_path.c_str());
+
+    ScopedFile src(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!src);
+    ASSERT_EQ(mb_file_open_fd(src.get(), src_fd, true), MB_FILE_OK);
+
+    ScopedFile dest(mb_file_new(), &mb_file_free);
+    ASSERT_TRUE(!!dest);
+    ASSERT_EQ(mb_file_open_fd(dest.get(), dest_fd, true), MB_FILE_OK);
+
+    size_t n;
+    uint64_t copied;
+    uint64_t pos;
+
+    ASSERT_EQ(mb_file_write_fully(src.get(), data.data(), data.size(), &n),
+              MB_FILE_OK);
+    ASSERT_EQ(mb_file_write_fully(dest.get(), "prefix", 6, &n), MB_FILE_OK);
+
+    ASSERT_EQ(mb_file_copy_from(dest.get(), src.get(), 7, file_size - 7,
+                                &copied), MB_FILE_OK);
+    ASSERT_EQ(copied, file_size - 7);
+
+    ASSERT_EQ(mb_file_seek(dest.get(), 0, SEEK_CUR, &pos), MB_FILE_OK);
+    ASSERT_EQ(pos, 6 + file_size - 7);
+
+    std::vector<unsigned char> actual(pos + 1);
+    ASSERT_EQ(mb_file_pread_fully(dest.get(), actual.data(), actual.size(), 0,
+                                  &n), MB_FILE_OK);
+    ASSERT_EQ(n, pos);
+    ASSERT_EQ(memcmp(actual.data(), "prefix", 6), 0);
+    ASSERT_EQ(memcmp(actual.data() + 6, data.data() + 7, file_size - 7), 0);
+}
@@ -20,10 +20,18 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace io
 {
 
+struct DirEntry
+{
+    std::string name;
+    bool isDirectory;
+};
+
 bool createDirectories(const std::string &path);
+bool listDirectory(const std::string &path, std::vector<DirEntry> *entries);
 
 }
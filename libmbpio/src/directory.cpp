@@ -19,13 +19,16 @@
 
 #include "mbpio/directory.h"
 
+#include <algorithm>
 #include <vector>
 
+#include <cstdlib>
 #include <cstring>
 
 #include "mbcommon/locale.h"
 
 #include "mbpio/error.h"
+#include "mbpio/path.h"
 #include "mbpio/private/common.h"
 #include "mbpio/private/string.h"
 
@@ -33,6 +36,7 @@
 #include "mbpio/win32/error.h"
 #else
 #include <cerrno>
+#include <dirent.h>
 #include <sys/stat.h>
 #endif
 
@@ -103,4 +107,89 @@ bool createDirectories(const std::string &path)
     return true;
 }
 
+/*!
+ * \brief List the contents of a directory
+ *
+ * The "." and ".." entries are skipped and the remaining entries are sorted by
+ * name. Symlinks are followed when determining whether an entry is a
+ * directory.
+ *
+ * \param path Directory path
+ * \param entries Output list of directory entries
+ *
+ * \return Whether the directory was successfully read
+ */
+bool listDirectory(const std::string &path, std::vector<DirEntry> *entries)
+{
+    std::vector<DirEntry> result;
+
+#if IO_PLATFORM_WINDOWS
+    WIN32_FIND_DATAW data;
+    wchar_t *wPattern = mb::utf8_to_wcs(pathJoin({path, "*"}).c_str());
+    if (!wPattern) {
+        setLastError(Error::PlatformError, priv::format(
+                "%s: Failed to convert path", path.c_str()));
+        return false;
+    }
+
+    HANDLE handle = FindFirstFileW(wPattern, &data);
+    free(wPattern);
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        setLastError(Error::PlatformError, priv::format(
+                "%s: Failed to open directory: %s",
+                path.c_str(), win32::errorToString(GetLastError()).c_str()));
+        return false;
+    }
+
+    do {
+        char *name = mb::wcs_to_utf8(data.cFileName);
+        if (!name) {
+            continue;
+        }
+
+        if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            result.push_back({name, !!(data.dwFileAttributes
+                    & FILE_ATTRIBUTE_DIRECTORY)});
+        }
+
+        free(name);
+    } while (FindNextFileW(handle, &data));
+
+    FindClose(handle);
+#else
+    DIR *dp = opendir(path.c_str());
+    if (!dp) {
+        setLastError(Error::PlatformError, priv::format(
+                "%s: Failed to open directory: %s",
+                path.c_str(), strerror(errno)));
+        return false;
+    }
+
+    struct dirent *ent;
+    struct stat sb;
+
+    while ((ent = readdir(dp))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        std::string entPath = pathJoin({path, ent->d_name});
+        bool isDirectory = stat(entPath.c_str(), &sb) == 0
+                && S_ISDIR(sb.st_mode);
+        result.push_back({ent->d_name, isDirectory});
+    }
+
+    closedir(dp);
+#endif
+
+    std::sort(result.begin(), result.end(),
+              [](const DirEntry &a, const DirEntry &b) {
+        return a.name < b.name;
+    });
+
+    entries->swap(result);
+    return true;
+}
+
 }
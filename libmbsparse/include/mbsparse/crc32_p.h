@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbsparse/guard_p.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/*! \cond INTERNAL */
+namespace mb
+{
+namespace sparse
+{
+
+// All functions use the same conditioning as zlib's crc32(). The CRC of an
+// empty input is 0.
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+uint32_t crc32_zeros(uint32_t crc, uint64_t size);
+uint32_t crc32_pattern(uint32_t crc, uint32_t pattern, uint64_t size);
+
+}
+}
+/*! \endcond */
@@ -19,11 +19,6 @@
 
 #pragma once
 
-#include <archive.h>
-
-namespace mb
-{
-
-bool la_copy_data_to_fd(archive *a, int fd);
-
-}
+#ifndef MBSPARSE_BUILD
+#error libmbsparse private headers cannot be used
+#endif
@@ -17,46 +17,22 @@
  * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "archive_util.h"
+#pragma once
 
-#include <cerrno>
-#include <cstring>
+#include "mbsparse/guard_p.h"
 
-#include "mblog/logging.h"
-
-#define BUF_SIZE    10240
+#include <cstddef>
+#include <cstdint>
 
+/*! \cond INTERNAL */
 namespace mb
 {
-
-bool la_copy_data_to_fd(archive *a, int fd)
+namespace sparse
 {
-    char buf[BUF_SIZE];
-    la_ssize_t n_read;
-    ssize_t n_written;
-    la_ssize_t remain;
-
-    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
-        remain = n_read;
 
-        while (remain > 0) {
-            n_written = write(fd, buf + (n_read - remain), remain);
-            if (n_written <= 0) {
-                LOGE("Failed to write data: %s", strerror(errno));
-                return false;
-            }
+void fill_pattern32(void *buf, uint32_t pattern, uint64_t size);
+bool is_pattern32(const void *buf, size_t size, uint32_t *pattern);
 
-            remain -= n_written;
-        }
-    }
-
-    if (n_read < 0) {
-        LOGE("Failed to read archive entry data: %s",
-             archive_error_string(a));
-        return false;
-    }
-
-    return true;
 }
-
 }
+/*! \endcond */
@@ -34,12 +34,41 @@
 extern "C" {
 #endif
 
+enum SparseExtentType
+{
+    SPARSE_EXTENT_EOF   = 0,
+    SPARSE_EXTENT_RAW   = 1,
+    SPARSE_EXTENT_FILL  = 2,
+    SPARSE_EXTENT_HOLE  = 3,
+};
+
+struct SparseExtent
+{
+    /*! \brief Type of extent (#SparseExtentType) */
+    int type;
+    /*! \brief Start of byte range in output file */
+    uint64_t begin;
+    /*! \brief End of byte range in output file */
+    uint64_t end;
+    /*! \brief [#SPARSE_EXTENT_FILL only] Filler value for the extent */
+    uint32_t fillVal;
+    /*! \brief [#SPARSE_EXTENT_RAW only] Offset of \a begin in the source */
+    uint64_t srcOffset;
+};
+
 typedef bool (*SparseOpenCb)(void *userData);
 typedef bool (*SparseCloseCb)(void *userData);
 typedef bool (*SparseReadCb)(void *buf, uint64_t size, uint64_t *bytesRead,
                              void *userData);
 typedef bool (*SparseSeekCb)(int64_t offset, int whence, void *userData);
 typedef bool (*SparseSkipCb)(uint64_t offset, void *userData);
+typedef bool (*SparsePreadCb)(void *buf, uint64_t size, uint64_t offset,
+                              uint64_t *bytesRead, void *userData);
+typedef bool (*SparsePwriteCb)(const void *buf, uint64_t size, uint64_t offset,
+                               void *userData);
+typedef bool (*SparseDiscardCb)(uint64_t offset, uint64_t size, void *userData);
+typedef bool (*SparseWriteCb)(const void *buf, uint64_t size,
+                              uint64_t *bytesWritten, void *userData);
 
 struct SparseCtx;
 
@@ -51,11 +80,41 @@ MB_EXPORT bool sparseOpen(struct SparseCtx *ctx, SparseOpenCb openCb,
                           SparseSeekCb seekCb, SparseSkipCb skipCb,
                           void *userData);
 MB_EXPORT bool sparseClose(struct SparseCtx *ctx);
+MB_EXPORT bool sparseBuildIndex(struct SparseCtx *ctx);
 MB_EXPORT bool sparseRead(struct SparseCtx *ctx, void *buf, uint64_t size,
                           uint64_t *bytesRead);
 MB_EXPORT bool sparseSeek(struct SparseCtx *ctx, int64_t offset, int whence);
 MB_EXPORT bool sparseTell(struct SparseCtx *ctx, uint64_t *offset);
 MB_EXPORT bool sparseSize(struct SparseCtx *ctx, uint64_t *size);
+MB_EXPORT bool sparseGetExtent(struct SparseCtx *ctx,
+                               struct SparseExtent *extent);
+MB_EXPORT bool sparseSkipExtent(struct SparseCtx *ctx);
+MB_EXPORT bool sparseSetVerifyCrc32(struct SparseCtx *ctx, bool enabled);
+MB_EXPORT bool sparseSetPreadCallback(struct SparseCtx *ctx,
+                                      SparsePreadCb preadCb);
+MB_EXPORT bool sparseGetExtentAt(struct SparseCtx *ctx, uint64_t offset,
+                                 struct SparseExtent *extent);
+MB_EXPORT bool sparsePread(struct SparseCtx *ctx, void *buf, uint64_t size,
+                           uint64_t offset, uint64_t *bytesRead);
+MB_EXPORT bool sparseExpand(struct SparseCtx *ctx, unsigned int threads,
+                            SparsePwriteCb pwriteCb, SparseDiscardCb discardCb,
+                            void *userData);
+MB_EXPORT bool sparseCopyRawExtent(struct SparseCtx *ctx, int srcFd,
+                                   uint64_t srcBase, int destFd,
+                                   uint64_t *bytesCopied);
+
+struct SparseWriterCtx;
+
+MB_EXPORT struct SparseWriterCtx * sparseWriterCtxNew();
+MB_EXPORT bool sparseWriterCtxFree(struct SparseWriterCtx *ctx);
+
+MB_EXPORT bool sparseWriterOpen(struct SparseWriterCtx *ctx, uint32_t blockSize,
+                                SparseOpenCb openCb, SparseCloseCb closeCb,
+                                SparseWriteCb writeCb, SparseSeekCb seekCb,
+                                void *userData);
+MB_EXPORT bool sparseWriterClose(struct SparseWriterCtx *ctx);
+MB_EXPORT bool sparseWriterWrite(struct SparseWriterCtx *ctx, const void *buf,
+                                 uint64_t size, uint64_t *bytesWritten);
 
 #ifdef __cplusplus
 }
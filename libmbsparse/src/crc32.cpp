@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/crc32_p.h"
+
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARM 1
+#include <arm_acle.h>
+#endif
+
+// Reflected CRC-32 polynomial (same as zlib and Android's libsparse)
+#define CRC32_POLY 0xedb88320u
+
+namespace mb
+{
+namespace sparse
+{
+
+/*!
+ * \brief Lookup tables for slice-by-8 and for the GF(2) shift operations
+ */
+struct Crc32Tables
+{
+    // table[k][n] is the CRC of byte n followed by k zero bytes
+    uint32_t table[8][256];
+    // x2n[k] is x^(2^k) modulo the CRC polynomial
+    uint32_t x2n[32];
+
+    Crc32Tables();
+};
+
+/*!
+ * \brief Multiply \a a and \a b modulo the CRC polynomial
+ *
+ * Both operands are in the reflected bit order, where the MSB is the
+ * coefficient of x^0.
+ */
+static uint32_t mult_mod_p(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    while (true) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+Crc32Tables::Crc32Tables()
+{
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        table[0][n] = c;
+    }
+
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = table[0][n];
+        for (int k = 1; k < 8; ++k) {
+            c = table[0][c & 0xff] ^ (c >> 8);
+            table[k][n] = c;
+        }
+    }
+
+    // x^1
+    x2n[0] = 1u << 30;
+    for (int k = 1; k < 32; ++k) {
+        x2n[k] = mult_mod_p(x2n[k - 1], x2n[k - 1]);
+    }
+}
+
+static const Crc32Tables & tables()
+{
+    static const Crc32Tables t;
+    return t;
+}
+
+/*!
+ * \brief Compute x^(8 * \a size) modulo the CRC polynomial
+ *
+ * This is the operator for shifting a CRC register past \a size zero bytes.
+ */
+static uint32_t x8n_mod_p(uint64_t size)
+{
+    const Crc32Tables &t = tables();
+    uint32_t p = 1u << 31; // x^0
+    unsigned int k = 3;
+
+    while (size) {
+        if (size & 1) {
+            p = mult_mod_p(t.x2n[k & 31], p);
+        }
+        size >>= 1;
+        ++k;
+    }
+
+    return p;
+}
+
+/*!
+ * \brief Update CRC with data
+ *
+ * Uses the ARMv8 CRC32 instructions if the compiler targets them. Otherwise,
+ * a slice-by-8 table lookup is used, which processes 8 bytes per iteration.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(buf);
+    uint32_t c = ~crc;
+
+#if CRC32_ARM
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = __crc32d(c, v);
+    }
+    for (; size > 0; --size, ++p) {
+        c = __crc32b(c, *p);
+    }
+#else
+    const Crc32Tables &t = tables();
+
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t lo = c ^ (static_cast<uint32_t>(p[0])
+                | static_cast<uint32_t>(p[1]) << 8
+                | static_cast<uint32_t>(p[2]) << 16
+                | static_cast<uint32_t>(p[3]) << 24);
+        c = t.table[7][lo & 0xff]
+                ^ t.table[6][(lo >> 8) & 0xff]
+                ^ t.table[5][(lo >> 16) & 0xff]
+                ^ t.table[4][lo >> 24]
+                ^ t.table[3][p[4]]
+                ^ t.table[2][p[5]]
+                ^ t.table[1][p[6]]
+                ^ t.table[0][p[7]];
+    }
+    for (; size > 0; --size, ++p) {
+        c = t.table[0][(c ^ *p) & 0xff] ^ (c >> 8);
+    }
+#endif
+
+    return ~c;
+}
+
+/*!
+ * \brief Compute CRC of the concatenation of two inputs
+ *
+ * \param crc1 CRC of the first input
+ * \param crc2 CRC of the second input
+ * \param size2 Size of the second input
+ * \return CRC of the first input followed by the second input
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+    return mult_mod_p(x8n_mod_p(size2), crc1) ^ crc2;
+}
+
+/*!
+ * \brief Update CRC with \a size zero bytes in O(log(size)) time
+ */
+uint32_t crc32_zeros(uint32_t crc, uint64_t size)
+{
+    return ~mult_mod_p(x8n_mod_p(size), ~crc);
+}
+
+/*!
+ * \brief Update CRC with a repeating 32-bit pattern in O(log(size)^2) time
+ *
+ * The bytes of \a pattern are repeated in memory order, as with the fill
+ * chunks in sparse files. If \a size is not a multiple of 4, the last copy of
+ * the pattern is truncated.
+ */
+uint32_t crc32_pattern(uint32_t crc, uint32_t pattern, uint64_t size)
+{
+    uint64_t words = size / sizeof(pattern);
+
+    // CRC of the pattern repeated 2^k times, built up by doubling. Since every
+    // block is made of whole copies of the pattern, the order in which the
+    // blocks are appended does not matter.
+    uint32_t block_crc = crc32_update(0, &pattern, sizeof(pattern));
+    uint64_t block_size = sizeof(pattern);
+
+    while (words) {
+        if (words & 1) {
+            crc = crc32_combine(crc, block_crc, block_size);
+        }
+        words >>= 1;
+        if (words) {
+            block_crc = crc32_combine(block_crc, block_crc, block_size);
+            block_size *= 2;
+        }
+    }
+
+    return crc32_update(crc, &pattern, size % sizeof(pattern));
+}
+
+}
+}
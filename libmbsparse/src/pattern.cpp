@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/pattern_p.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+        || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPARSE_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define SPARSE_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SPARSE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace mb
+{
+namespace sparse
+{
+
+/*!
+ * \brief Fill buffer with a repeating 32-bit pattern
+ *
+ * The bytes of \a pattern are written to \a buf in memory order and repeated
+ * until \a size bytes have been written. If \a size is not a multiple of 4,
+ * the last copy of the pattern is truncated. Every store, except for the
+ * trailing partial one, is a multiple of 4 bytes, so the pattern never needs
+ * to be rotated within the loops.
+ *
+ * The widest vector unit available at compile time (AVX2, SSE2, or NEON) is
+ * used for the bulk of the buffer. Otherwise, 64-bit words are stored.
+ *
+ * \param buf Output buffer
+ * \param pattern 32-bit pattern (already rotated to match the output offset)
+ * \param size Number of bytes to write
+ */
+void fill_pattern32(void *buf, uint32_t pattern, uint64_t size)
+{
+    char *ptr = static_cast<char *>(buf);
+
+#if SPARSE_SIMD_AVX2
+    if (size >= 32) {
+        const __m256i v = _mm256_set1_epi32(static_cast<int>(pattern));
+        for (; size >= 128; size -= 128, ptr += 128) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr), v);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + 32), v);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + 64), v);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + 96), v);
+        }
+        for (; size >= 32; size -= 32, ptr += 32) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr), v);
+        }
+    }
+#endif
+
+#if SPARSE_SIMD_SSE2
+    if (size >= 16) {
+        const __m128i v = _mm_set1_epi32(static_cast<int>(pattern));
+        for (; size >= 64; size -= 64, ptr += 64) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr), v);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + 16), v);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + 32), v);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + 48), v);
+        }
+        for (; size >= 16; size -= 16, ptr += 16) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr), v);
+        }
+    }
+#elif SPARSE_SIMD_NEON
+    if (size >= 16) {
+        const uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+        for (; size >= 64; size -= 64, ptr += 64) {
+            vst1q_u8(reinterpret_cast<uint8_t *>(ptr), v);
+            vst1q_u8(reinterpret_cast<uint8_t *>(ptr + 16), v);
+            vst1q_u8(reinterpret_cast<uint8_t *>(ptr + 32), v);
+            vst1q_u8(reinterpret_cast<uint8_t *>(ptr + 48), v);
+        }
+        for (; size >= 16; size -= 16, ptr += 16) {
+            vst1q_u8(reinterpret_cast<uint8_t *>(ptr), v);
+        }
+    }
+#endif
+
+    // Both halves are identical, so the byte order is the same regardless of
+    // the host endianness
+    const uint64_t wide = (static_cast<uint64_t>(pattern) << 32) | pattern;
+    for (; size >= sizeof(wide); size -= sizeof(wide), ptr += sizeof(wide)) {
+        memcpy(ptr, &wide, sizeof(wide));
+    }
+    memcpy(ptr, &wide, size);
+}
+
+/*!
+ * \brief Check if buffer consists of a single repeating 32-bit pattern
+ *
+ * This is the inverse of fill_pattern32(). The first 4 bytes of \a buf are
+ * compared against every following 4-byte word. The vector loops check for a
+ * mismatch every 64 or 128 bytes, so blocks of real data are usually rejected
+ * after the first iteration.
+ *
+ * \param[in] buf Input buffer
+ * \param[in] size Size of buffer (must be a non-zero multiple of 4)
+ * \param[out] pattern Pattern (in memory order) if the buffer is a repeating
+ *                     pattern
+ * \return Whether the buffer consists of a single repeating pattern
+ */
+bool is_pattern32(const void *buf, size_t size, uint32_t *pattern)
+{
+    const char *ptr = static_cast<const char *>(buf);
+    uint32_t value;
+
+    if (size < sizeof(value) || size % sizeof(value) != 0) {
+        return false;
+    }
+
+    memcpy(&value, ptr, sizeof(value));
+
+#if SPARSE_SIMD_AVX2
+    if (size >= 128) {
+        const __m256i v = _mm256_set1_epi32(static_cast<int>(value));
+        for (; size >= 128; size -= 128, ptr += 128) {
+            __m256i diff = _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_xor_si256(v, _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i *>(ptr))),
+                    _mm256_xor_si256(v, _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i *>(ptr + 32)))),
+                _mm256_or_si256(
+                    _mm256_xor_si256(v, _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i *>(ptr + 64))),
+                    _mm256_xor_si256(v, _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i *>(ptr + 96)))));
+            if (!_mm256_testz_si256(diff, diff)) {
+                return false;
+            }
+        }
+    }
+#endif
+
+#if SPARSE_SIMD_SSE2
+    if (size >= 64) {
+        const __m128i v = _mm_set1_epi32(static_cast<int>(value));
+        const __m128i zero = _mm_setzero_si128();
+        for (; size >= 64; size -= 64, ptr += 64) {
+            __m128i diff = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_xor_si128(v, _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(ptr))),
+                    _mm_xor_si128(v, _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(ptr + 16)))),
+                _mm_or_si128(
+                    _mm_xor_si128(v, _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(ptr + 32))),
+                    _mm_xor_si128(v, _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(ptr + 48)))));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xffff) {
+                return false;
+            }
+        }
+    }
+#elif SPARSE_SIMD_NEON
+    if (size >= 64) {
+        const uint32x4_t v = vdupq_n_u32(value);
+        for (; size >= 64; size -= 64, ptr += 64) {
+            const uint32_t *p = reinterpret_cast<const uint32_t *>(ptr);
+            uint32x4_t diff = vorrq_u32(
+                vorrq_u32(veorq_u32(v, vreinterpretq_u32_u8(vld1q_u8(
+                                  reinterpret_cast<const uint8_t *>(p)))),
+                          veorq_u32(v, vreinterpretq_u32_u8(vld1q_u8(
+                                  reinterpret_cast<const uint8_t *>(p + 4))))),
+                vorrq_u32(veorq_u32(v, vreinterpretq_u32_u8(vld1q_u8(
+                                  reinterpret_cast<const uint8_t *>(p + 8)))),
+                          veorq_u32(v, vreinterpretq_u32_u8(vld1q_u8(
+                                  reinterpret_cast<const uint8_t *>(p + 12))))));
+            uint64x2_t diff64 = vreinterpretq_u64_u32(diff);
+            if ((vgetq_lane_u64(diff64, 0) | vgetq_lane_u64(diff64, 1)) != 0) {
+                return false;
+            }
+        }
+    }
+#endif
+
+    for (; size > 0; size -= sizeof(value), ptr += sizeof(value)) {
+        uint32_t word;
+        memcpy(&word, ptr, sizeof(word));
+        if (word != value) {
+            return false;
+        }
+    }
+
+    *pattern = value;
+    return true;
+}
+
+}
+}
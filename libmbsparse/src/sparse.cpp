@@ -38,6 +38,10 @@
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 
+#include "mbsparse/crc32_p.h"
+#include "mbsparse/pattern_p.h"
+#include "mbsparse/sparse_p.h"
+
 // Enable debug logging of headers, offsets, etc.?
 #define SPARSE_DEBUG 1
 // Enable debug logging of operations (warning! very verbose!)
@@ -86,6 +90,9 @@ struct ChunkInfo
 
     /*! \brief [CHUNK_TYPE_FILL only] Filler value for the chunk */
     uint32_t fillVal;
+
+    /*! \brief [CHUNK_TYPE_CRC32 only] Expected CRC32 of all preceding data */
+    uint32_t crc32;
 };
 
 struct SparseCtx
@@ -96,6 +103,7 @@ struct SparseCtx
     SparseReadCb cbRead;
     SparseSeekCb cbSeek;
     SparseSkipCb cbSkip;
+    SparsePreadCb cbPread = nullptr;
     void *cbUserData;
 
     void setCallbacks(SparseOpenCb openCb, SparseCloseCb closeCb,
@@ -124,6 +132,15 @@ struct SparseCtx
 
     std::vector<ChunkInfo> chunks;
     size_t chunk = 0;
+
+    // Whether all chunk headers have been read by sparseBuildIndex()
+    bool indexed = false;
+
+    // CRC32 of the output data in the range [0, crc32Offset) if verification
+    // is enabled
+    bool verifyCrc32 = false;
+    uint32_t crc32 = 0;
+    uint64_t crc32Offset = 0;
 };
 
 void SparseCtx::setCallbacks(SparseOpenCb openCb, SparseCloseCb closeCb,
@@ -289,6 +306,125 @@ static bool readFully(SparseCtx *ctx, void *buf, std::size_t size)
     return true;
 }
 
+/*!
+ * \brief Rotate fill value to match an offset within the fill chunk
+ *
+ * \param fillVal Fill value of the chunk
+ * \param shift Offset from the beginning of the chunk
+ * \return Fill value with its bytes rotated so that the first byte in memory
+ *         is the byte at \a shift
+ */
+static uint32_t rotateFillVal(uint32_t fillVal, uint64_t shift)
+{
+    shift %= sizeof(uint32_t);
+    uint32_t shifted = 0;
+    for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+        ((char *) &shifted)[i] =
+                ((char *) &fillVal)[(i + shift) % sizeof(uint32_t)];
+    }
+    return shifted;
+}
+
+/*!
+ * \brief Update CRC32 with a range of output data
+ *
+ * The CRC32 is only updated if the range extends the data that has already
+ * been verified. Ranges that are entirely before or after the verified data
+ * are ignored. Thus, the CRC32 is only complete if the output is read
+ * sequentially (seeking back to the end of the verified data is allowed).
+ *
+ * Fill and skip chunks are hashed in closed form without expanding the data.
+ *
+ * \param ctx Sparse context
+ * \param chunk Chunk that covers the range
+ * \param data [CHUNK_TYPE_RAW only] Data for the range
+ * \param offset Start of range in output file
+ * \param size Size of range
+ */
+static void updateCrc32(SparseCtx *ctx, const ChunkInfo &chunk,
+                        const void *data, uint64_t offset, uint64_t size)
+{
+    if (!ctx->verifyCrc32 || offset > ctx->crc32Offset
+            || offset + size <= ctx->crc32Offset) {
+        return;
+    }
+
+    // Skip data that has already been hashed
+    uint64_t skip = ctx->crc32Offset - offset;
+    offset += skip;
+    size -= skip;
+
+    switch (chunk.type) {
+    case CHUNK_TYPE_RAW:
+        ctx->crc32 = mb::sparse::crc32_update(
+                ctx->crc32, static_cast<const char *>(data) + skip, size);
+        break;
+    case CHUNK_TYPE_FILL:
+        ctx->crc32 = mb::sparse::crc32_pattern(
+                ctx->crc32, rotateFillVal(chunk.fillVal, offset - chunk.begin),
+                size);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        ctx->crc32 = mb::sparse::crc32_zeros(ctx->crc32, size);
+        break;
+    default:
+        return;
+    }
+
+    ctx->crc32Offset += size;
+}
+
+/*!
+ * \brief Compare the CRC32 of the data read so far with a CRC32 chunk
+ *
+ * \return False if verification is enabled, all of the data preceding the
+ *         CRC32 chunk has been hashed, and the CRC32 does not match. Otherwise,
+ *         true.
+ */
+static bool checkCrc32Chunk(SparseCtx *ctx, const ChunkInfo &chunk)
+{
+    if (!ctx->verifyCrc32 || chunk.begin != ctx->crc32Offset) {
+        return true;
+    }
+
+    if (ctx->crc32 != chunk.crc32) {
+        ERROR("CRC32 mismatch at offset %" PRIu64 ": expected 0x%08" PRIx32
+              ", but computed 0x%08" PRIx32,
+              chunk.begin, chunk.crc32, ctx->crc32);
+        return false;
+    }
+
+    DEBUG("Verified CRC32 (0x%08" PRIx32 ") of first %" PRIu64 " bytes",
+          ctx->crc32, chunk.begin);
+    return true;
+}
+
+/*!
+ * \brief Verify CRC32 chunks that were read before the data preceding them
+ *
+ * This handles the case where the chunk headers were read ahead of time, such
+ * as with sparseBuildIndex(). CRC32 chunks that are read on demand are
+ * verified by processCrc32Chunk().
+ *
+ * \return Whether all checked CRC32 chunks match
+ */
+static bool checkLoadedCrc32Chunks(SparseCtx *ctx)
+{
+    if (!ctx->verifyCrc32) {
+        return true;
+    }
+
+    for (size_t i = ctx->chunk + 1; i < ctx->chunks.size()
+            && ctx->chunks[i].begin == ctx->crc32Offset; ++i) {
+        if (ctx->chunks[i].type == CHUNK_TYPE_CRC32
+                && !checkCrc32Chunk(ctx, ctx->chunks[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /*!
  * \brief Read and verify raw chunk header
  *
@@ -434,10 +570,14 @@ static bool processCrc32Chunk(SparseCtx *ctx, ChunkHeader *chunkHeader,
         return false;
     }
 
+    uint64_t srcBegin = ctx->srcOffset - ctx->shdr.chunk_hdr_sz;
+
     if (!readFully(ctx, &expectedCrc32, sizeof(expectedCrc32))) {
         return false;
     }
 
+    uint64_t srcEnd = ctx->srcOffset;
+
     ctx->expectedCrc32 = expectedCrc32;
 
     ctx->chunks.emplace_back();
@@ -445,10 +585,12 @@ static bool processCrc32Chunk(SparseCtx *ctx, ChunkHeader *chunkHeader,
     chunk.type = chunkHeader->chunk_type;
     chunk.begin = outOffset;
     chunk.end = outOffset;
-    chunk.srcBegin = ctx->srcOffset - ctx->shdr.chunk_hdr_sz;
-    chunk.srcEnd = ctx->srcOffset + dataSize;
+    chunk.srcBegin = srcBegin;
+    chunk.srcEnd = srcEnd;
+    chunk.crc32 = expectedCrc32;
 
-    return true;
+    // If all of the preceding data was already read, then verify it now
+    return checkCrc32Chunk(ctx, chunk);
 }
 
 /*!
@@ -582,6 +724,62 @@ bool processSparseHeader(SparseCtx *ctx)
     return true;
 }
 
+/*!
+ * \brief Describe the part of a chunk starting at \a offset as an extent
+ *
+ * \return False if the chunk does not contain data (ie. CRC32 chunks)
+ */
+static bool chunkToExtent(const ChunkInfo &chunk, uint64_t offset,
+                          SparseExtent *extent)
+{
+    switch (chunk.type) {
+    case CHUNK_TYPE_RAW:
+        extent->type = SPARSE_EXTENT_RAW;
+        extent->srcOffset = chunk.rawBegin + (offset - chunk.begin);
+        break;
+    case CHUNK_TYPE_FILL:
+        extent->type = SPARSE_EXTENT_FILL;
+        extent->fillVal = chunk.fillVal;
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        extent->type = SPARSE_EXTENT_HOLE;
+        break;
+    default:
+        // CRC32 chunks are empty and are never selected
+        assert(false);
+        return false;
+    }
+
+    extent->begin = offset;
+    extent->end = chunk.end;
+
+    return true;
+}
+
+/*!
+ * \brief Find chunk containing an offset in a fully indexed chunk list
+ *
+ * If all of the chunk headers have been read, then the chunk list is sorted
+ * and contiguous, so binary search for the first chunk that ends after the
+ * offset. If there is no such chunk, then the offset is at or beyond EOF.
+ *
+ * This does not modify \a ctx, so it is safe to call concurrently.
+ *
+ * \return Index of chunk or \a ctx->chunks.size() if the offset is at or
+ *         beyond EOF
+ */
+static size_t findIndexedChunk(const SparseCtx *ctx, uint64_t offset)
+{
+    assert(ctx->indexed);
+
+    auto it = std::upper_bound(
+            ctx->chunks.begin(), ctx->chunks.end(), offset,
+            [](uint64_t o, const ChunkInfo &c) {
+                return o < c.end;
+            });
+    return it - ctx->chunks.begin();
+}
+
 /*!
  * \brief Find and move to chunk that is responsible for the specified offset
  *
@@ -592,6 +790,11 @@ bool processSparseHeader(SparseCtx *ctx)
  */
 bool tryMoveToChunkForOffset(SparseCtx *ctx, uint64_t offset)
 {
+    if (ctx->indexed) {
+        ctx->chunk = findIndexedChunk(ctx, offset);
+        return true;
+    }
+
     // If were at EOF, move back one so we can search again
     if (ctx->shdr.total_chunks != 0 && ctx->chunk == ctx->shdr.total_chunks) {
         --ctx->chunk;
@@ -697,6 +900,27 @@ bool tryMoveToChunkForOffset(SparseCtx *ctx, uint64_t offset)
     return true;
 }
 
+/*!
+ * \brief Move to chunk that covers the current file position
+ *
+ * This only searches for a new chunk if the current chunk does not cover the
+ * current file position.
+ *
+ * \warning Always check if the offset exceeds the range of all chunks (EOF) by
+ *          testing: "ctx->chunk == ctx->shdr.total_chunks"
+ *
+ * \return True unless an error occurs
+ */
+static bool moveToCurrentChunk(SparseCtx *ctx)
+{
+    if (ctx->chunks.empty()
+            || ctx->chunk == ctx->shdr.total_chunks
+            || ctx->outOffset >= ctx->chunks[ctx->chunk].end) {
+        return tryMoveToChunkForOffset(ctx, ctx->outOffset);
+    }
+    return true;
+}
+
 extern "C" {
 
 SparseCtx * sparseCtxNew()
@@ -816,6 +1040,9 @@ bool sparseClose(SparseCtx *ctx)
     ctx->expectedCrc32 = 0;
     ctx->chunks.clear();
     ctx->chunk = 0;
+    ctx->indexed = false;
+    ctx->crc32 = 0;
+    ctx->crc32Offset = 0;
 
     bool ret = true;
     if (ctx->cbClose) {
@@ -826,6 +1053,59 @@ bool sparseClose(SparseCtx *ctx)
     return ret;
 }
 
+/*!
+ * \brief Read all chunk headers to allow fast random access
+ *
+ * By default, chunk headers are read on demand and finding the chunk for an
+ * offset requires walking the chunk list one chunk at a time. This function
+ * reads all of the remaining chunk headers up front so that every subsequent
+ * seek or read can find the matching chunk with a binary search. This is
+ * useful when the sparse file is accessed randomly, such as through
+ * fuse-sparse.
+ *
+ * \note This function requires a seek callback to be provided since the data
+ *       for any chunk may be accessed afterwards. The file position of the
+ *       sparse file is not changed.
+ *
+ * \param ctx Sparse context
+ * \return Whether all chunk headers were successfully read and verified
+ */
+bool sparseBuildIndex(SparseCtx *ctx)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    if (!ctx->cbSeek) {
+        ERROR("Cannot build chunk index because no seek callback is registered");
+        return false;
+    }
+
+    if (ctx->indexed) {
+        return true;
+    }
+
+    ctx->chunks.reserve(ctx->shdr.total_chunks);
+
+    // No chunk covers the offset at EOF, so this reads every chunk header
+    if (!tryMoveToChunkForOffset(ctx, ctx->fileSize)) {
+        return false;
+    }
+
+    if (ctx->chunks.size() != ctx->shdr.total_chunks) {
+        ERROR("Read %" MB_PRIzu " chunks, but sparse header promised"
+              " %" PRIu32 " chunks", ctx->chunks.size(),
+              ctx->shdr.total_chunks);
+        return false;
+    }
+
+    ctx->indexed = true;
+
+    DEBUG("Built index of %" MB_PRIzu " chunks", ctx->chunks.size());
+
+    return tryMoveToChunkForOffset(ctx, ctx->outOffset);
+}
+
 /*!
  * \brief Read sparse file
  *
@@ -862,17 +1142,13 @@ bool sparseRead(SparseCtx *ctx, void *buf, uint64_t size, uint64_t *bytesRead)
         // If no chunks have been read yet or the current offset exceeds the
         // range of the current chunk, then look for the next chunk.
 
-        if (ctx->chunks.empty()
-                || ctx->chunk == ctx->shdr.total_chunks
-                || ctx->outOffset >= ctx->chunks[ctx->chunk].end) {
-            if (!tryMoveToChunkForOffset(ctx, ctx->outOffset)) {
-                return false;
-            }
+        if (!moveToCurrentChunk(ctx)) {
+            return false;
+        }
 
-            if (ctx->chunk == ctx->shdr.total_chunks) {
-                OPER("- Found EOF");
-                break;
-            }
+        if (ctx->chunk == ctx->shdr.total_chunks) {
+            OPER("- Found EOF");
+            break;
         }
 
         assert(ctx->outOffset >= ctx->chunks[ctx->chunk].begin
@@ -906,24 +1182,11 @@ bool sparseRead(SparseCtx *ctx, void *buf, uint64_t size, uint64_t *bytesRead)
         }
         case CHUNK_TYPE_FILL: {
             assert(sizeof(ctx->chunks[ctx->chunk].fillVal) == sizeof(uint32_t));
-            auto shift = (ctx->outOffset - ctx->chunks[ctx->chunk].begin)
-                    % sizeof(uint32_t);
-            uint32_t fillVal = ctx->chunks[ctx->chunk].fillVal;
-            uint32_t shifted = 0;
-            for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-                ((char *) &shifted)[i] =
-                        ((char *) &fillVal)[(i + shift) % sizeof(uint32_t)];
-                //uint32_t amount = 8 * ((i + shift) % sizeof(uint32_t));
-                //shifted |= (fillVal & (0xff << amount)) >> amount << i * 8;
-            }
-            char *tempBuf = (char *) buf;
-            while (toRead > 0) {
-                size_t toWrite = std::min<size_t>(sizeof(shifted), toRead);
-                memcpy(tempBuf, &shifted, toWrite);
-                nRead += toWrite;
-                toRead -= toWrite;
-                tempBuf += toWrite;
-            }
+            uint32_t shifted = rotateFillVal(
+                    ctx->chunks[ctx->chunk].fillVal,
+                    ctx->outOffset - ctx->chunks[ctx->chunk].begin);
+            mb::sparse::fill_pattern32(buf, shifted, toRead);
+            nRead = toRead;
             break;
         }
         case CHUNK_TYPE_DONT_CARE:
@@ -937,6 +1200,10 @@ bool sparseRead(SparseCtx *ctx, void *buf, uint64_t size, uint64_t *bytesRead)
         }
 
         OPER("- Read %" PRIu64 " bytes", nRead);
+        updateCrc32(ctx, ctx->chunks[ctx->chunk], buf, ctx->outOffset, nRead);
+        if (!checkLoadedCrc32Chunks(ctx)) {
+            return false;
+        }
         totalRead += nRead;
         ctx->outOffset += nRead;
         size -= nRead;
@@ -1049,4 +1316,295 @@ bool sparseSize(SparseCtx *ctx, uint64_t *size)
     return true;
 }
 
+/*!
+ * \brief Get extent at the current file position
+ *
+ * An extent is the remainder of the chunk covering the current file position.
+ * It describes how the output bytes in the range [\a begin, \a end) are
+ * produced:
+ * - #SPARSE_EXTENT_RAW: The data is stored in the sparse file and can be read
+ *   with sparseRead(). \a srcOffset is the offset of the data in the source,
+ *   so callers that read the source through a file descriptor can also copy
+ *   the data directly from there.
+ * - #SPARSE_EXTENT_FILL: Every 4 bytes of the range, starting from the
+ *   beginning of the chunk, contain \a fillVal
+ * - #SPARSE_EXTENT_HOLE: The contents of the range are unspecified. sparseRead()
+ *   returns zeros for this range, but writers can skip it entirely.
+ *
+ * This function does not change the file position. To move to the next
+ * extent, either read the range with sparseRead() or call sparseSkipExtent().
+ * This allows writers to seek, punch holes, or discard blocks in the output
+ * instead of writing data that the sparse file does not contain.
+ *
+ * \note Since \a begin is the current file position, a fill extent may start
+ *       in the middle of a 4-byte word. The pattern should be rotated by
+ *       (\a begin - chunk start) % 4 bytes, which is what sparseRead() does.
+ *
+ * \param ctx Sparse context
+ * \param extent Output pointer for the extent. If the file position is at or
+ *               past EOF, the type will be #SPARSE_EXTENT_EOF and the range
+ *               will be empty.
+ * \return True unless the file is not open or an error occurs
+ */
+bool sparseGetExtent(SparseCtx *ctx, SparseExtent *extent)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    if (!moveToCurrentChunk(ctx)) {
+        return false;
+    }
+
+    memset(extent, 0, sizeof(*extent));
+
+    if (ctx->chunk == ctx->shdr.total_chunks) {
+        extent->type = SPARSE_EXTENT_EOF;
+        extent->begin = ctx->outOffset;
+        extent->end = ctx->outOffset;
+        return true;
+    }
+
+    return chunkToExtent(ctx->chunks[ctx->chunk], ctx->outOffset, extent);
+}
+
+/*!
+ * \brief Skip past the extent at the current file position
+ *
+ * This moves the file position to the end of the extent that would be
+ * returned by sparseGetExtent(). No data is produced. Unlike sparseSeek(),
+ * this works even if no seek callback was provided. In that case, any raw data
+ * that is skipped will be skipped in the source when the next chunk is read.
+ *
+ * \param ctx Sparse context
+ * \return True unless the file is not open or an error occurs. Skipping at EOF
+ *         succeeds and does nothing.
+ */
+bool sparseSkipExtent(SparseCtx *ctx)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    if (!moveToCurrentChunk(ctx)) {
+        return false;
+    }
+
+    if (ctx->chunk != ctx->shdr.total_chunks) {
+        const ChunkInfo &chunk = ctx->chunks[ctx->chunk];
+
+        // Raw data cannot be hashed without reading it, but fill and skip
+        // chunks can still be verified
+        if (chunk.type != CHUNK_TYPE_RAW) {
+            updateCrc32(ctx, chunk, nullptr, ctx->outOffset,
+                        chunk.end - ctx->outOffset);
+            if (!checkLoadedCrc32Chunks(ctx)) {
+                return false;
+            }
+        }
+
+        ctx->outOffset = chunk.end;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Enable or disable CRC32 verification
+ *
+ * If enabled, the CRC32 of the output data is computed as it is read and is
+ * compared against every CRC32 chunk in the sparse file. If there is a
+ * mismatch, an error is logged and the sparseRead(), sparseSkipExtent(), or
+ * sparseGetExtent() call that reached the CRC32 chunk returns false.
+ *
+ * Only data that is read sequentially from the beginning of the file is
+ * hashed. Fill and skip chunks are hashed in closed form, so they can also be
+ * skipped with sparseSkipExtent() without losing the ability to verify.
+ * Skipping raw data or seeking past unread data means that later CRC32 chunks
+ * cannot be verified and are ignored.
+ *
+ * \note This setting is kept when the sparse file is closed.
+ *
+ * \param ctx Sparse context
+ * \param enabled Whether to verify CRC32 chunks
+ * \return True unless the sparse file is already open
+ */
+bool sparseSetVerifyCrc32(SparseCtx *ctx, bool enabled)
+{
+    if (ctx->isOpen) {
+        return false;
+    }
+
+    ctx->verifyCrc32 = enabled;
+    return true;
+}
+
+/*!
+ * \brief Set callback for positional reads from the source
+ *
+ * The callback is used by sparsePread() and must read from the absolute offset
+ * in the source without depending on or changing any shared file position
+ * (eg. with pread()). It receives the same \a userData that was passed to
+ * sparseOpen().
+ *
+ * \param ctx Sparse context
+ * \param preadCb Positional read callback or NULL to unset
+ * \return True unless the sparse file is already open
+ */
+bool sparseSetPreadCallback(SparseCtx *ctx, SparsePreadCb preadCb)
+{
+    if (ctx->isOpen) {
+        return false;
+    }
+
+    ctx->cbPread = preadCb;
+    return true;
+}
+
+/*!
+ * \brief Read from sparse file at an offset
+ *
+ * Unlike sparseRead(), this function neither uses nor changes the file
+ * position of the sparse file. It does not modify \a ctx at all, so multiple
+ * threads can call sparsePread() on the same context concurrently. Raw data is
+ * read with the positional read callback set by sparseSetPreadCallback().
+ *
+ * The chunk index must have already been built with sparseBuildIndex() so
+ * that the chunk list is immutable. sparseOpen(), sparseClose(), and
+ * sparseBuildIndex() must not be called while any thread is in this function.
+ *
+ * \note CRC32 verification does not apply to data read with this function.
+ *
+ * \param[in] ctx Sparse context
+ * \param[out] buf Output buffer
+ * \param[in] size Number of bytes to read
+ * \param[in] offset Offset in sparse file to read from
+ * \param[out] bytesRead Number of bytes read. This is only less than \a size
+ *                       if EOF is reached.
+ * \return Whether the read was successful
+ */
+bool sparsePread(SparseCtx *ctx, void *buf, uint64_t size, uint64_t offset,
+                 uint64_t *bytesRead)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    if (!ctx->indexed) {
+        ERROR("sparsePread() requires the chunk index to be built");
+        return false;
+    }
+
+    if (!ctx->cbPread) {
+        ERROR("Cannot pread because no pread callback is registered");
+        return false;
+    }
+
+    char *ptr = static_cast<char *>(buf);
+    uint64_t totalRead = 0;
+    size_t chunk = findIndexedChunk(ctx, offset);
+
+    while (size > 0 && chunk < ctx->chunks.size()) {
+        const ChunkInfo &c = ctx->chunks[chunk];
+        if (c.begin == c.end) {
+            // Skip CRC32 chunks
+            ++chunk;
+            continue;
+        }
+
+        uint64_t diff = offset - c.begin;
+        uint64_t toRead = std::min(size, c.end - offset);
+
+        switch (c.type) {
+        case CHUNK_TYPE_RAW: {
+            uint64_t nRead;
+            if (!ctx->cbPread(ptr, toRead, c.rawBegin + diff, &nRead,
+                              ctx->cbUserData)) {
+                ERROR("Sparse pread callback returned failure");
+                return false;
+            }
+            if (nRead != toRead) {
+                ERROR("Requested %" PRIu64 " bytes, but only read %" PRIu64
+                      " bytes", toRead, nRead);
+                return false;
+            }
+            break;
+        }
+        case CHUNK_TYPE_FILL:
+            mb::sparse::fill_pattern32(ptr, rotateFillVal(c.fillVal, diff),
+                                       toRead);
+            break;
+        case CHUNK_TYPE_DONT_CARE:
+            memset(ptr, 0, toRead);
+            break;
+        default:
+            ERROR("Attempted to read from unknown chunk type: %" PRIu16,
+                  c.type);
+            return false;
+        }
+
+        ptr += toRead;
+        size -= toRead;
+        offset += toRead;
+        totalRead += toRead;
+        ++chunk;
+    }
+
+    *bytesRead = totalRead;
+    return true;
+}
+
+/*!
+ * \brief Get extent at an offset in the sparse file
+ *
+ * This is the reentrant version of sparseGetExtent(). It neither uses nor
+ * changes the file position and has the same requirements as sparsePread():
+ * the chunk index must have been built with sparseBuildIndex() and it can be
+ * called from multiple threads concurrently.
+ *
+ * \param ctx Sparse context
+ * \param offset Offset in sparse file
+ * \param extent Output pointer for the extent. If \a offset is at or past
+ *               EOF, the type will be #SPARSE_EXTENT_EOF and the range will
+ *               be empty.
+ * \return True unless the file is not open or the chunk index is not built
+ */
+bool sparseGetExtentAt(SparseCtx *ctx, uint64_t offset, SparseExtent *extent)
+{
+    if (!ctx->isOpen || !ctx->indexed) {
+        return false;
+    }
+
+    memset(extent, 0, sizeof(*extent));
+
+    size_t chunk = findIndexedChunk(ctx, offset);
+    if (chunk == ctx->chunks.size()) {
+        extent->type = SPARSE_EXTENT_EOF;
+        extent->begin = offset;
+        extent->end = offset;
+        return true;
+    }
+
+    return chunkToExtent(ctx->chunks[chunk], offset, extent);
+}
+
+}
+
+namespace mb
+{
+namespace sparse
+{
+
+/*!
+ * \brief Check whether CRC32 chunks are being verified
+ *
+ * This allows sparseCopyRawExtent() to hash the data it copies only when the
+ * result is actually used.
+ */
+bool verify_crc32_enabled(SparseCtx *ctx)
+{
+    return ctx->verifyCrc32;
+}
+
+}
 }
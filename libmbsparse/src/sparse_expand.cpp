@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+#include "mblog/logging.h"
+
+// Output range handled by a worker at a time. Large enough to amortize the
+// extent lookups, but small enough to balance the work between threads.
+#define WORK_UNIT_SIZE          (4 * 1024 * 1024)
+// Size of each worker's buffer
+#define WORKER_BUFFER_SIZE      (1024 * 1024)
+
+struct ExpandState
+{
+    SparseCtx *ctx;
+    SparsePwriteCb pwriteCb;
+    SparseDiscardCb discardCb;
+    void *userData;
+
+    uint64_t size;
+    std::atomic<uint64_t> nextUnit;
+    std::atomic<bool> failed;
+};
+
+/*!
+ * \brief Expand output range [begin, end)
+ *
+ * Raw and fill extents are read into \a buf with sparsePread() and written
+ * with the pwrite callback. Holes are passed to the discard callback if one
+ * was provided. Otherwise, zeros are written.
+ */
+static bool expandRange(ExpandState *state, std::vector<char> &buf,
+                        uint64_t begin, uint64_t end)
+{
+    uint64_t pos = begin;
+
+    while (pos < end && !state->failed) {
+        SparseExtent extent;
+        if (!sparseGetExtentAt(state->ctx, pos, &extent)) {
+            return false;
+        } else if (extent.type == SPARSE_EXTENT_EOF) {
+            LOGE("Sparse file ended prematurely at %" PRIu64, pos);
+            return false;
+        }
+
+        uint64_t extentEnd = std::min(extent.end, end);
+
+        if (extent.type == SPARSE_EXTENT_HOLE && state->discardCb) {
+            if (!state->discardCb(pos, extentEnd - pos, state->userData)) {
+                LOGE("Failed to discard %" PRIu64 " bytes at %" PRIu64,
+                     extentEnd - pos, pos);
+                return false;
+            }
+            pos = extentEnd;
+            continue;
+        }
+
+        while (pos < extentEnd) {
+            uint64_t n = std::min<uint64_t>(extentEnd - pos, buf.size());
+            uint64_t bytesRead;
+
+            if (!sparsePread(state->ctx, buf.data(), n, pos, &bytesRead)
+                    || bytesRead != n) {
+                LOGE("Failed to read %" PRIu64 " bytes at %" PRIu64, n, pos);
+                return false;
+            }
+
+            if (!state->pwriteCb(buf.data(), n, pos, state->userData)) {
+                LOGE("Failed to write %" PRIu64 " bytes at %" PRIu64, n, pos);
+                return false;
+            }
+
+            pos += n;
+        }
+    }
+
+    return !state->failed;
+}
+
+static void expandWorker(ExpandState *state)
+{
+    std::vector<char> buf(WORKER_BUFFER_SIZE);
+
+    while (!state->failed) {
+        uint64_t unit = state->nextUnit++;
+        uint64_t begin = unit * WORK_UNIT_SIZE;
+        if (begin >= state->size) {
+            break;
+        }
+        uint64_t end = std::min<uint64_t>(begin + WORK_UNIT_SIZE, state->size);
+
+        if (!expandRange(state, buf, begin, end)) {
+            state->failed = true;
+        }
+    }
+}
+
+#ifdef _WIN32
+typedef std::thread WorkerThread;
+
+static bool startWorker(WorkerThread *thread, ExpandState *state)
+{
+    // Windows builds have exceptions enabled, so a failure throws instead
+    *thread = std::thread(&expandWorker, state);
+    return true;
+}
+
+static void joinWorker(WorkerThread *thread)
+{
+    thread->join();
+}
+#else
+// std::thread cannot report failures without exceptions, which are disabled on
+// Android, so pthreads are used directly
+typedef pthread_t WorkerThread;
+
+static void * expandWorkerThread(void *state)
+{
+    expandWorker(static_cast<ExpandState *>(state));
+    return nullptr;
+}
+
+static bool startWorker(WorkerThread *thread, ExpandState *state)
+{
+    int ret = pthread_create(thread, nullptr, &expandWorkerThread, state);
+    if (ret != 0) {
+        LOGW("Failed to create worker thread: %s", strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+static void joinWorker(WorkerThread *thread)
+{
+    pthread_join(*thread, nullptr);
+}
+#endif
+
+extern "C" {
+
+/*!
+ * \brief Expand the entire sparse file using multiple threads
+ *
+ * The output range is split into fixed-size work units, which are handed out
+ * to a pool of \a threads threads. Each thread reads its units with
+ * sparsePread() and writes them with \a pwriteCb, so the units are written in
+ * no particular order. If fewer threads can be created, the expansion continues
+ * with the ones that were started. Holes are passed to \a discardCb, which can punch
+ * holes or do nothing if the output is known to be zeroed (eg. a new file that
+ * has been truncated to the full size). If \a discardCb is NULL, zeros are
+ * written for holes.
+ *
+ * The chunk index is built with sparseBuildIndex() if it has not been built
+ * already, so a seek callback is required. A positional read callback must
+ * have been set with sparseSetPreadCallback(). Both \a pwriteCb and the pread
+ * callback are called concurrently from all threads.
+ *
+ * \note CRC32 verification does not apply to this function.
+ *
+ * \param ctx Sparse context
+ * \param threads Number of threads or 0 to use the number of CPUs
+ * \param pwriteCb Positional write callback for the output
+ * \param discardCb Optional callback for holes in the output
+ * \param userData Caller-supplied pointer to pass to \a pwriteCb and
+ *                 \a discardCb
+ * \return Whether the entire sparse file was expanded
+ */
+bool sparseExpand(SparseCtx *ctx, unsigned int threads,
+                  SparsePwriteCb pwriteCb, SparseDiscardCb discardCb,
+                  void *userData)
+{
+    uint64_t size;
+
+    if (!pwriteCb || !sparseBuildIndex(ctx) || !sparseSize(ctx, &size)) {
+        return false;
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    uint64_t units = (size + WORK_UNIT_SIZE - 1) / WORK_UNIT_SIZE;
+    threads = static_cast<unsigned int>(
+            std::min<uint64_t>(threads, std::max<uint64_t>(units, 1)));
+
+    ExpandState state;
+    state.ctx = ctx;
+    state.pwriteCb = pwriteCb;
+    state.discardCb = discardCb;
+    state.userData = userData;
+    state.size = size;
+    state.nextUnit = 0;
+    state.failed = false;
+
+    // The calling thread is one of the workers. Work units are handed out
+    // dynamically, so if a thread cannot be created, the remaining threads
+    // (possibly only the calling thread) simply process more units.
+    std::vector<WorkerThread> workers(threads - 1);
+    size_t started = 0;
+    while (started < workers.size()
+            && startWorker(&workers[started], &state)) {
+        ++started;
+    }
+
+    expandWorker(&state);
+
+    for (size_t i = 0; i < started; ++i) {
+        joinWorker(&workers[i]);
+    }
+
+    return !state.failed;
+}
+
+}
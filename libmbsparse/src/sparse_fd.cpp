@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+#include "mblog/logging.h"
+
+#include "mbsparse/sparse_p.h"
+
+// Enable logging of errors
+#define SPARSE_FD_ERROR 1
+
+#if SPARSE_FD_ERROR
+#define ERROR(...) LOGE(__VA_ARGS__)
+#else
+#define ERROR(...)
+#endif
+
+// Maximum size of a single copy_file_range() or splice() call
+#define COPY_CHUNK_SIZE         (16 * 1024 * 1024)
+// Buffer size for the fallback
+#define COPY_BUFFER_SIZE        (1024 * 1024)
+
+#ifndef _WIN32
+
+/*!
+ * \brief Check if a failed in-kernel copy should be retried by other means
+ *
+ * These errors mean that the method is not supported for this pair of file
+ * descriptors (eg. an old kernel, a block device target, or a source on a
+ * different filesystem) rather than that the I/O failed.
+ */
+static bool isUnsupportedError(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == EBADF;
+}
+
+#ifdef __NR_copy_file_range
+/*!
+ * \brief Copy with copy_file_range()
+ *
+ * The syscall is used directly because older libc versions (including older
+ * versions of bionic) do not have a wrapper for it.
+ *
+ * \return Whether the method is usable. If false, \a copied contains the
+ *         number of bytes that were copied before the method was found to be
+ *         unsupported. If true, \a copied is \a size unless an I/O error
+ *         occurred, in which case errno is set.
+ */
+static bool copyFileRange(int srcFd, uint64_t srcOffset, int destFd,
+                          uint64_t destOffset, uint64_t size, uint64_t *copied)
+{
+    loff_t inOff = srcOffset;
+    loff_t outOff = destOffset;
+
+    *copied = 0;
+
+    while (*copied < size) {
+        size_t n = std::min<uint64_t>(size - *copied, COPY_CHUNK_SIZE);
+        long ret = syscall(__NR_copy_file_range, srcFd, &inOff, destFd,
+                           &outOff, n, 0u);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return !isUnsupportedError(errno);
+        } else if (ret == 0) {
+            errno = EIO;
+            return true;
+        }
+        *copied += ret;
+    }
+
+    return true;
+}
+#endif
+
+#ifdef __linux__
+/*!
+ * \brief Copy with splice() through a pipe
+ *
+ * Unlike copy_file_range(), this works when the target is a block device.
+ *
+ * \return Same as copyFileRange()
+ */
+static bool spliceRange(int srcFd, uint64_t srcOffset, int destFd,
+                        uint64_t destOffset, uint64_t size, uint64_t *copied)
+{
+    int pipeFds[2];
+    loff_t inOff = srcOffset;
+    loff_t outOff = destOffset;
+
+    *copied = 0;
+
+    if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+        return false;
+    }
+
+    bool usable = true;
+
+    while (*copied < size) {
+        size_t n = std::min<uint64_t>(size - *copied, COPY_CHUNK_SIZE);
+
+        ssize_t nIn = splice(srcFd, &inOff, pipeFds[1], nullptr, n,
+                             SPLICE_F_MOVE);
+        if (nIn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            usable = !isUnsupportedError(errno);
+            break;
+        } else if (nIn == 0) {
+            errno = EIO;
+            break;
+        }
+
+        // Everything in the pipe must be written out before anything else is
+        // attempted, so unsupported errors are not recoverable past this point
+        while (nIn > 0) {
+            ssize_t nOut = splice(pipeFds[0], nullptr, destFd, &outOff, nIn,
+                                  SPLICE_F_MOVE);
+            if (nOut < 0 && errno == EINTR) {
+                continue;
+            } else if (nOut <= 0) {
+                if (nOut == 0) {
+                    errno = EIO;
+                }
+                usable = *copied != 0 || !isUnsupportedError(errno);
+                break;
+            }
+            nIn -= nOut;
+            *copied += nOut;
+        }
+        if (nIn > 0) {
+            break;
+        }
+    }
+
+    int savedErrno = errno;
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    errno = savedErrno;
+
+    return usable;
+}
+#endif
+
+/*!
+ * \brief Copy through a user-space buffer with pread() and pwrite()
+ */
+static bool bufferedCopy(int srcFd, uint64_t srcOffset, int destFd,
+                         uint64_t destOffset, uint64_t size)
+{
+    std::vector<char> buf(std::min<uint64_t>(size, COPY_BUFFER_SIZE));
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        size_t toRead = std::min<uint64_t>(size - copied, buf.size());
+        ssize_t n = pread64(srcFd, buf.data(), toRead, srcOffset + copied);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            ssize_t m = pwrite64(destFd, buf.data() + written, n - written,
+                                 destOffset + copied + written);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            } else if (m <= 0) {
+                if (m == 0) {
+                    errno = EIO;
+                }
+                return false;
+            }
+            written += m;
+        }
+
+        copied += n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy a byte range between file descriptors
+ *
+ * The in-kernel methods are tried first. Each one continues where the
+ * previous one left off if it turns out to be unsupported.
+ */
+static bool copyRange(int srcFd, uint64_t srcOffset, int destFd,
+                      uint64_t destOffset, uint64_t size)
+{
+#ifdef __linux__
+    uint64_t copied;
+#endif
+
+#ifdef __NR_copy_file_range
+    if (copyFileRange(srcFd, srcOffset, destFd, destOffset, size, &copied)) {
+        return copied == size;
+    }
+    srcOffset += copied;
+    destOffset += copied;
+    size -= copied;
+#endif
+
+#ifdef __linux__
+    if (spliceRange(srcFd, srcOffset, destFd, destOffset, size, &copied)) {
+        return copied == size;
+    }
+    srcOffset += copied;
+    destOffset += copied;
+    size -= copied;
+#endif
+
+    return bufferedCopy(srcFd, srcOffset, destFd, destOffset, size);
+}
+
+/*!
+ * \brief Hash the raw extent at the current position by reading it
+ *
+ * This consumes the extent through sparseRead(), which updates the CRC32 and
+ * checks any CRC32 chunks that have already been loaded.
+ */
+static bool hashExtent(SparseCtx *ctx, uint64_t size)
+{
+    std::vector<char> buf(std::min<uint64_t>(size, COPY_BUFFER_SIZE));
+    uint64_t n;
+
+    while (size > 0) {
+        if (!sparseRead(ctx, buf.data(), std::min<uint64_t>(size, buf.size()),
+                        &n)) {
+            return false;
+        } else if (n == 0) {
+            ERROR("Sparse file ended prematurely");
+            return false;
+        }
+        size -= n;
+    }
+
+    return true;
+}
+
+#endif
+
+extern "C" {
+
+/*!
+ * \brief Copy the raw extent at the current position directly between fds
+ *
+ * This is an alternative to sparseRead() for writing out raw data when the
+ * sparse file itself can be accessed via a file descriptor. The extent that
+ * would be returned by sparseGetExtent() must be a #SPARSE_EXTENT_RAW extent.
+ * Its data is copied from \a srcFd to the same offset in \a destFd with
+ * `copy_file_range()` or `splice()`, so that it never enters user space. If
+ * neither is supported for the given file descriptors, the data is copied with
+ * `pread()` and `pwrite()` instead. Afterwards, the file position is moved past
+ * the extent as if sparseSkipExtent() had been called.
+ *
+ * Neither the file position of \a srcFd nor that of \a destFd is used or
+ * changed.
+ *
+ * If CRC32 verification is enabled with sparseSetVerifyCrc32(), the extent is
+ * also read through the sparse context before it is copied so that CRC32
+ * chunks can still be checked. If the chunk index was built with
+ * sparseBuildIndex(), a CRC32 mismatch at the end of the extent is detected
+ * before anything is written to \a destFd. The copy that follows is then
+ * usually served from the page cache.
+ *
+ * \param ctx Sparse context
+ * \param srcFd File descriptor for the sparse file
+ * \param srcBase Offset in \a srcFd at which the sparse file starts (eg. the
+ *                data offset of an uncompressed zip entry)
+ * \param destFd File descriptor for the output
+ * \param bytesCopied Output number of bytes that were copied (optional)
+ * \return Whether the entire extent was copied. Returns false if the current
+ *         extent is not a raw extent.
+ */
+bool sparseCopyRawExtent(SparseCtx *ctx, int srcFd, uint64_t srcBase,
+                         int destFd, uint64_t *bytesCopied)
+{
+#ifdef _WIN32
+    (void) ctx;
+    (void) srcFd;
+    (void) srcBase;
+    (void) destFd;
+    (void) bytesCopied;
+    ERROR("Copying between file descriptors is not supported on Windows");
+    return false;
+#else
+    SparseExtent extent;
+
+    if (!sparseGetExtent(ctx, &extent)) {
+        return false;
+    } else if (extent.type != SPARSE_EXTENT_RAW) {
+        ERROR("Extent at %" PRIu64 " is not a raw extent", extent.begin);
+        return false;
+    }
+
+    uint64_t size = extent.end - extent.begin;
+    bool verify = mb::sparse::verify_crc32_enabled(ctx);
+
+    if (verify && !hashExtent(ctx, size)) {
+        return false;
+    }
+
+    if (!copyRange(srcFd, srcBase + extent.srcOffset, destFd, extent.begin,
+                   size)) {
+        ERROR("Failed to copy %" PRIu64 " bytes from %" PRIu64 " to %" PRIu64
+              ": %s", size, srcBase + extent.srcOffset, extent.begin,
+              strerror(errno));
+        return false;
+    }
+
+    if (!verify && !sparseSkipExtent(ctx)) {
+        return false;
+    }
+
+    if (bytesCopied) {
+        *bytesCopied = size;
+    }
+    return true;
+#endif
+}
+
+}
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __ANDROID__
+// Android does not support C++11 properly...
+#define __STDC_LIMIT_MACROS
+#endif
+
+#include "mbsparse/sparse.h"
+
+// For std::min()
+#include <algorithm>
+
+#include <vector>
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdint>
+#include <cstring>
+
+#include "mblog/logging.h"
+
+#include "mbsparse/crc32_p.h"
+#include "mbsparse/pattern_p.h"
+
+// Enable debug logging of chunks that are written
+#define SPARSE_WRITER_DEBUG 0
+// Enable error logging
+#define SPARSE_WRITER_ERROR 1
+
+#if SPARSE_WRITER_DEBUG
+#define DEBUG(...) LOGD(__VA_ARGS__)
+#else
+#define DEBUG(...)
+#endif
+
+#if SPARSE_WRITER_ERROR
+#define ERROR(...) LOGE(__VA_ARGS__)
+#else
+#define ERROR(...)
+#endif
+
+// Maximum amount of raw data that is buffered before it is written out as a
+// chunk. Adjacent raw blocks are merged up to this size.
+#define RAW_CHUNK_MAX_SIZE      (4 * 1024 * 1024)
+
+struct SparseWriterCtx
+{
+    // Callbacks
+    SparseOpenCb cbOpen;
+    SparseCloseCb cbClose;
+    SparseWriteCb cbWrite;
+    SparseSeekCb cbSeek;
+    void *cbUserData;
+
+    void setCallbacks(SparseOpenCb openCb, SparseCloseCb closeCb,
+                      SparseWriteCb writeCb, SparseSeekCb seekCb,
+                      void *userData);
+    void clearCallbacks();
+
+    bool isOpen = false;
+    // Set if a write failed. The output is incomplete, so nothing else can be
+    // written.
+    bool failed = false;
+
+    SparseHeader shdr;
+
+    // Partial block from the previous write
+    std::vector<unsigned char> block;
+    size_t blockUsed = 0;
+
+    // Run of blocks that has not been written yet. For raw runs, rawData
+    // contains the data for the blocks.
+    uint16_t runType = 0;
+    uint32_t runBlocks = 0;
+    uint32_t runFillVal = 0;
+    std::vector<unsigned char> rawData;
+
+    // CRC32 of all data in the chunks that were written
+    uint32_t crc32 = 0;
+};
+
+void SparseWriterCtx::setCallbacks(SparseOpenCb openCb, SparseCloseCb closeCb,
+                                   SparseWriteCb writeCb, SparseSeekCb seekCb,
+                                   void *userData)
+{
+    cbOpen = openCb;
+    cbClose = closeCb;
+    cbWrite = writeCb;
+    cbSeek = seekCb;
+    cbUserData = userData;
+}
+
+void SparseWriterCtx::clearCallbacks()
+{
+    cbOpen = nullptr;
+    cbClose = nullptr;
+    cbWrite = nullptr;
+    cbSeek = nullptr;
+    cbUserData = nullptr;
+}
+
+/*!
+ * \brief Write the specified number of bytes completely (no partial writes)
+ *
+ * \param ctx Sparse writer context
+ * \param buf Input buffer
+ * \param size Bytes to write
+ * \return Whether the specified amount of bytes were successfully written
+ */
+static bool writeFully(SparseWriterCtx *ctx, const void *buf, uint64_t size)
+{
+    auto const *ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        uint64_t bytesWritten;
+        if (!ctx->cbWrite(ptr, size, &bytesWritten, ctx->cbUserData)) {
+            ERROR("Sparse write callback returned failure");
+            return false;
+        }
+        if (bytesWritten == 0) {
+            ERROR("Sparse write callback wrote no data");
+            return false;
+        }
+        ptr += bytesWritten;
+        size -= bytesWritten;
+    }
+
+    return true;
+}
+
+static bool writeChunkHeader(SparseWriterCtx *ctx, uint16_t type,
+                             uint32_t blocks, uint32_t dataSize)
+{
+    ChunkHeader chdr;
+    memset(&chdr, 0, sizeof(chdr));
+    chdr.chunk_type = type;
+    chdr.chunk_sz = blocks;
+    chdr.total_sz = sizeof(ChunkHeader) + dataSize;
+
+    ++ctx->shdr.total_chunks;
+
+    return writeFully(ctx, &chdr, sizeof(chdr));
+}
+
+/*!
+ * \brief Write out the pending run of blocks as a chunk
+ */
+static bool flushRun(SparseWriterCtx *ctx)
+{
+    if (ctx->runBlocks == 0) {
+        return true;
+    }
+
+    uint64_t runSize = static_cast<uint64_t>(ctx->runBlocks) * ctx->shdr.blk_sz;
+    bool ret;
+
+    DEBUG("Writing chunk of type 0x%04" PRIx16 " with %" PRIu32 " blocks",
+          ctx->runType, ctx->runBlocks);
+
+    switch (ctx->runType) {
+    case CHUNK_TYPE_RAW:
+        assert(ctx->rawData.size() == runSize);
+        ret = writeChunkHeader(ctx, CHUNK_TYPE_RAW, ctx->runBlocks, runSize)
+                && writeFully(ctx, ctx->rawData.data(), runSize);
+        ctx->crc32 = mb::sparse::crc32_update(
+                ctx->crc32, ctx->rawData.data(), runSize);
+        ctx->rawData.clear();
+        break;
+    case CHUNK_TYPE_FILL:
+        ret = writeChunkHeader(ctx, CHUNK_TYPE_FILL, ctx->runBlocks,
+                               sizeof(uint32_t))
+                && writeFully(ctx, &ctx->runFillVal, sizeof(uint32_t));
+        ctx->crc32 = mb::sparse::crc32_pattern(
+                ctx->crc32, ctx->runFillVal, runSize);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        ret = writeChunkHeader(ctx, CHUNK_TYPE_DONT_CARE, ctx->runBlocks, 0);
+        ctx->crc32 = mb::sparse::crc32_zeros(ctx->crc32, runSize);
+        break;
+    default:
+        assert(false);
+        ret = false;
+        break;
+    }
+
+    ctx->runBlocks = 0;
+    return ret;
+}
+
+/*!
+ * \brief Add a complete block to the pending run
+ *
+ * All-zero blocks are added as "don't care" blocks and blocks consisting of
+ * a single repeating 32-bit value are added as fill blocks. Everything else is
+ * added as raw data. If the block cannot be merged with the pending run, then
+ * the pending run is written out first.
+ */
+static bool addBlock(SparseWriterCtx *ctx, const unsigned char *data)
+{
+    uint32_t blockSize = ctx->shdr.blk_sz;
+    uint32_t fillVal = 0;
+    uint16_t type;
+
+    if (ctx->shdr.total_blks == UINT32_MAX) {
+        ERROR("Sparse file cannot contain more than %" PRIu32 " blocks",
+              UINT32_MAX);
+        return false;
+    }
+
+    if (!mb::sparse::is_pattern32(data, blockSize, &fillVal)) {
+        type = CHUNK_TYPE_RAW;
+    } else if (fillVal == 0) {
+        type = CHUNK_TYPE_DONT_CARE;
+    } else {
+        type = CHUNK_TYPE_FILL;
+    }
+
+    bool canMerge = ctx->runBlocks > 0 && ctx->runType == type
+            && (type != CHUNK_TYPE_FILL || ctx->runFillVal == fillVal)
+            && (type != CHUNK_TYPE_RAW
+                    || ctx->rawData.size() + blockSize <= RAW_CHUNK_MAX_SIZE);
+
+    if (!canMerge) {
+        if (!flushRun(ctx)) {
+            return false;
+        }
+        ctx->runType = type;
+        ctx->runFillVal = fillVal;
+    }
+
+    if (type == CHUNK_TYPE_RAW) {
+        ctx->rawData.insert(ctx->rawData.end(), data, data + blockSize);
+    }
+
+    ++ctx->runBlocks;
+    ++ctx->shdr.total_blks;
+
+    return true;
+}
+
+static bool writeSparseHeader(SparseWriterCtx *ctx)
+{
+    return ctx->cbSeek(0, SEEK_SET, ctx->cbUserData)
+            && writeFully(ctx, &ctx->shdr, sizeof(ctx->shdr));
+}
+
+/*!
+ * \brief Pad the last block, write out all pending chunks, and fix up the
+ *        sparse header
+ */
+static bool finishSparseFile(SparseWriterCtx *ctx)
+{
+    if (ctx->blockUsed > 0) {
+        memset(ctx->block.data() + ctx->blockUsed, 0,
+               ctx->block.size() - ctx->blockUsed);
+        ctx->blockUsed = 0;
+        if (!addBlock(ctx, ctx->block.data())) {
+            return false;
+        }
+    }
+
+    if (!flushRun(ctx)) {
+        return false;
+    }
+
+    // Add CRC32 chunk so that readers can verify the image
+    if (!writeChunkHeader(ctx, CHUNK_TYPE_CRC32, 0, sizeof(uint32_t))
+            || !writeFully(ctx, &ctx->crc32, sizeof(uint32_t))) {
+        return false;
+    }
+
+    if (!writeSparseHeader(ctx)) {
+        ERROR("Failed to rewrite sparse header");
+        return false;
+    }
+
+    return true;
+}
+
+extern "C" {
+
+SparseWriterCtx * sparseWriterCtxNew()
+{
+    return new(std::nothrow) SparseWriterCtx();
+}
+
+bool sparseWriterCtxFree(SparseWriterCtx *ctx)
+{
+    bool ret = true;
+    if (ctx->isOpen) {
+        ret = sparseWriterClose(ctx);
+    }
+    delete ctx;
+    return ret;
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * The output, which may not necessarily be a file, is written by calling
+ * functions provided by the caller. Raw data written with sparseWriterWrite()
+ * is split into blocks of \a blockSize bytes. All-zero blocks are stored as
+ * "don't care" chunks, blocks consisting of a single repeating 32-bit value
+ * are stored as fill chunks, and all other blocks are stored as raw chunks.
+ * Adjacent blocks of the same kind are merged into a single chunk.
+ *
+ * The write and seek callbacks are required. The sparse header contains the
+ * number of blocks and chunks, which are not known until the sparse file is
+ * closed, so the library seeks back to the beginning of the output to rewrite
+ * the header in sparseWriterClose(). All other writes are sequential.
+ *
+ * The open and close callbacks behave the same way as with sparseOpen().
+ *
+ * \note Since all-zero blocks are stored as "don't care" chunks, tools that do
+ *       not write anything for those chunks (eg. fastboot) must be used with
+ *       an output that is already zeroed.
+ *
+ * \param ctx Sparse writer context
+ * \param blockSize Block size (must be a non-zero multiple of 4)
+ * \param openCb Open callback
+ * \param closeCb Close callback
+ * \param writeCb Write callback
+ * \param seekCb Seek callback
+ * \param userData Caller-supplied pointer to pass to callback functions
+ * \return Whether the sparse file is opened and the initial header is written
+ */
+bool sparseWriterOpen(SparseWriterCtx *ctx, uint32_t blockSize,
+                      SparseOpenCb openCb, SparseCloseCb closeCb,
+                      SparseWriteCb writeCb, SparseSeekCb seekCb,
+                      void *userData)
+{
+    if (ctx->isOpen) {
+        return false;
+    }
+
+    if (blockSize == 0 || blockSize % sizeof(uint32_t) != 0) {
+        ERROR("Invalid block size: %" PRIu32, blockSize);
+        return false;
+    }
+
+    if (!writeCb || !seekCb) {
+        ERROR("Write and seek callbacks are required");
+        return false;
+    }
+
+    ctx->setCallbacks(openCb, closeCb, writeCb, seekCb, userData);
+
+    if (ctx->cbOpen && !ctx->cbOpen(ctx->cbUserData)) {
+        ctx->clearCallbacks();
+        return false;
+    }
+
+    memset(&ctx->shdr, 0, sizeof(ctx->shdr));
+    ctx->shdr.magic = SPARSE_HEADER_MAGIC;
+    ctx->shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    ctx->shdr.minor_version = 0;
+    ctx->shdr.file_hdr_sz = sizeof(SparseHeader);
+    ctx->shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    ctx->shdr.blk_sz = blockSize;
+
+    ctx->block.resize(blockSize);
+    ctx->blockUsed = 0;
+    ctx->runBlocks = 0;
+    ctx->rawData.clear();
+    ctx->rawData.reserve(RAW_CHUNK_MAX_SIZE);
+    ctx->crc32 = 0;
+    ctx->failed = false;
+
+    // Write placeholder header, which will be rewritten when the file is closed
+    if (!writeSparseHeader(ctx)) {
+        if (ctx->cbClose) {
+            ctx->cbClose(ctx->cbUserData);
+        }
+        ctx->clearCallbacks();
+        return false;
+    }
+
+    ctx->isOpen = true;
+
+    return true;
+}
+
+/*!
+ * \brief Finish writing and close sparse file
+ *
+ * If the amount of data written is not a multiple of the block size, then the
+ * last block is padded with zeros. A CRC32 chunk covering the entire output is
+ * appended and the sparse header is rewritten.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Whether all data was written out and the close callback (if one was
+ *         provided) succeeded
+ */
+bool sparseWriterClose(SparseWriterCtx *ctx)
+{
+    if (!ctx->isOpen) {
+        return false;
+    }
+
+    bool ret = !ctx->failed && finishSparseFile(ctx);
+
+    ctx->isOpen = false;
+    ctx->block.clear();
+    ctx->blockUsed = 0;
+    ctx->runBlocks = 0;
+    ctx->rawData.clear();
+    ctx->rawData.shrink_to_fit();
+
+    if (ctx->cbClose && !ctx->cbClose(ctx->cbUserData)) {
+        ret = false;
+    }
+
+    ctx->clearCallbacks();
+    return ret;
+}
+
+/*!
+ * \brief Write raw data to sparse file
+ *
+ * Complete blocks are scanned directly from \a buf. Only a partial block at
+ * the end of \a buf is copied and kept until the next write.
+ *
+ * \param[in] ctx Sparse writer context
+ * \param[in] buf Input buffer
+ * \param[in] size Number of bytes to write
+ * \param[out] bytesWritten Number of bytes that were consumed
+ * \return Whether the data was successfully written. If false is returned, the
+ *         sparse file is incomplete and further writes will fail.
+ */
+bool sparseWriterWrite(SparseWriterCtx *ctx, const void *buf, uint64_t size,
+                       uint64_t *bytesWritten)
+{
+    if (!ctx->isOpen || ctx->failed) {
+        return false;
+    }
+
+    auto const *ptr = static_cast<const unsigned char *>(buf);
+    const size_t blockSize = ctx->block.size();
+    uint64_t remain = size;
+
+    // Complete partial block from the previous write
+    if (ctx->blockUsed > 0) {
+        size_t toCopy = std::min<uint64_t>(blockSize - ctx->blockUsed, remain);
+        memcpy(ctx->block.data() + ctx->blockUsed, ptr, toCopy);
+        ctx->blockUsed += toCopy;
+        ptr += toCopy;
+        remain -= toCopy;
+
+        if (ctx->blockUsed == blockSize) {
+            ctx->blockUsed = 0;
+            if (!addBlock(ctx, ctx->block.data())) {
+                ctx->failed = true;
+                return false;
+            }
+        }
+    }
+
+    for (; remain >= blockSize; remain -= blockSize, ptr += blockSize) {
+        if (!addBlock(ctx, ptr)) {
+            ctx->failed = true;
+            return false;
+        }
+    }
+
+    if (remain > 0) {
+        memcpy(ctx->block.data(), ptr, remain);
+        ctx->blockUsed = remain;
+    }
+
+    *bytesWritten = size;
+    return true;
+}
+
+}
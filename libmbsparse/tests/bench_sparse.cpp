@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+#include "mbsparse/sparse.h"
+
+#define BLOCK_SIZE          512
+#define NUM_CHUNKS          30000
+#define NUM_RANDOM_READS    5000
+#define RANDOM_READ_SIZE    256
+#define FILL_CHUNK_BLOCKS   65536
+#define FILL_BUFFER_SIZE    (1024 * 1024)
+#define WRITE_IMAGE_BLOCKS  65536
+#define WRITE_BLOCK_SIZE    4096
+#define EXPAND_CHUNKS       3000
+#define EXPAND_CHUNK_BLOCKS 64
+
+// Chunk headers are logged at the debug level, which would dominate the timings
+class NullLogger : public mb::log::BaseLogger
+{
+public:
+    virtual void log(mb::log::LogLevel prio, const char *fmt,
+                     va_list ap) override
+    {
+        (void) prio;
+        (void) fmt;
+        (void) ap;
+    }
+};
+
+struct MemorySource
+{
+    std::vector<unsigned char> data;
+    size_t pos = 0;
+};
+
+static bool cbRead(void *buf, uint64_t size, uint64_t *bytesRead,
+                   void *userData)
+{
+    MemorySource *src = static_cast<MemorySource *>(userData);
+    uint64_t canRead = 0;
+    if (src->pos < src->data.size()) {
+        canRead = std::min<uint64_t>(size, src->data.size() - src->pos);
+    }
+    memcpy(buf, src->data.data() + src->pos, canRead);
+    src->pos += canRead;
+    *bytesRead = canRead;
+    return true;
+}
+
+static bool cbSeek(int64_t offset, int whence, void *userData)
+{
+    MemorySource *src = static_cast<MemorySource *>(userData);
+    switch (whence) {
+    case SEEK_SET:
+        src->pos = offset;
+        return true;
+    case SEEK_CUR:
+        src->pos += offset;
+        return true;
+    default:
+        return false;
+    }
+}
+
+template<typename T>
+static void append(std::vector<unsigned char> &data, const T &item)
+{
+    auto const *ptr = reinterpret_cast<const unsigned char *>(&item);
+    data.insert(data.end(), ptr, ptr + sizeof(T));
+}
+
+/*!
+ * \brief Build sparse image with alternating raw, fill, and skip chunks
+ */
+static void buildImage(std::vector<unsigned char> &data, uint32_t numChunks,
+                       uint32_t blocksPerChunk)
+{
+    SparseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SPARSE_HEADER_MAGIC;
+    hdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    hdr.file_hdr_sz = sizeof(SparseHeader);
+    hdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    hdr.blk_sz = BLOCK_SIZE;
+    hdr.total_blks = numChunks * blocksPerChunk;
+    hdr.total_chunks = numChunks;
+
+    data.clear();
+    append(data, hdr);
+
+    for (uint32_t i = 0; i < numChunks; ++i) {
+        ChunkHeader chdr;
+        memset(&chdr, 0, sizeof(chdr));
+        chdr.chunk_sz = blocksPerChunk;
+
+        switch (i % 3) {
+        case 0:
+            chdr.chunk_type = CHUNK_TYPE_RAW;
+            chdr.total_sz = hdr.chunk_hdr_sz + blocksPerChunk * hdr.blk_sz;
+            append(data, chdr);
+            data.resize(data.size() + blocksPerChunk * hdr.blk_sz,
+                        static_cast<unsigned char>(i));
+            break;
+        case 1:
+            chdr.chunk_type = CHUNK_TYPE_FILL;
+            chdr.total_sz = hdr.chunk_hdr_sz + sizeof(uint32_t);
+            append(data, chdr);
+            append(data, static_cast<uint32_t>(0xdeadbeef ^ i));
+            break;
+        case 2:
+            chdr.chunk_type = CHUNK_TYPE_DONT_CARE;
+            chdr.total_sz = hdr.chunk_hdr_sz;
+            append(data, chdr);
+            break;
+        }
+    }
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    auto diff = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(diff).count();
+}
+
+/*!
+ * \brief Time random reads, optionally with the chunk index built up front
+ */
+static bool benchRandomReads(MemorySource *src, bool indexed,
+                             const std::vector<uint64_t> &offsets,
+                             double *setupMs, double *readMs)
+{
+    SparseCtx *ctx = sparseCtxNew();
+    if (!ctx) {
+        return false;
+    }
+
+    src->pos = 0;
+    bool ret = sparseOpen(ctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
+                          src);
+    if (!ret) {
+        sparseCtxFree(ctx);
+        return false;
+    }
+
+    char buf[RANDOM_READ_SIZE];
+    uint64_t n;
+
+    auto start = std::chrono::steady_clock::now();
+    if (indexed) {
+        ret = sparseBuildIndex(ctx);
+    } else {
+        // Load all chunk headers through the on-demand path so that both
+        // modes only measure the chunk lookup
+        ret = sparseSeek(ctx, -1, SEEK_END) && sparseRead(ctx, buf, 1, &n);
+    }
+    *setupMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto it = offsets.begin(); ret && it != offsets.end(); ++it) {
+        ret = sparseSeek(ctx, *it, SEEK_SET)
+                && sparseRead(ctx, buf, sizeof(buf), &n);
+    }
+    *readMs = elapsedMs(start);
+
+    sparseCtxFree(ctx);
+    return ret;
+}
+
+/*!
+ * \brief Build sparse image with one fill chunk spanning the whole file
+ */
+static void buildFillImage(std::vector<unsigned char> &data, uint32_t blocks)
+{
+    SparseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SPARSE_HEADER_MAGIC;
+    hdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    hdr.file_hdr_sz = sizeof(SparseHeader);
+    hdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    hdr.blk_sz = BLOCK_SIZE;
+    hdr.total_blks = blocks;
+    hdr.total_chunks = 1;
+
+    ChunkHeader chdr;
+    memset(&chdr, 0, sizeof(chdr));
+    chdr.chunk_type = CHUNK_TYPE_FILL;
+    chdr.chunk_sz = blocks;
+    chdr.total_sz = hdr.chunk_hdr_sz + sizeof(uint32_t);
+
+    data.clear();
+    append(data, hdr);
+    append(data, chdr);
+    append(data, static_cast<uint32_t>(0x12345678));
+}
+
+/*!
+ * \brief Expand a fill value 4 bytes at a time (the original implementation)
+ */
+static void fillBytewise(char *buf, uint32_t pattern, size_t size)
+{
+    while (size > 0) {
+        size_t toWrite = std::min<size_t>(sizeof(pattern), size);
+        memcpy(buf, &pattern, toWrite);
+        size -= toWrite;
+        buf += toWrite;
+    }
+}
+
+static void printThroughput(const char *name, uint64_t bytes, double ms)
+{
+    printf("  %-12s %9.3f ms (%9.1f MiB/s)\n", name, ms,
+           bytes / 1024.0 / 1024.0 / (ms / 1000.0));
+}
+
+/*!
+ * \brief Compare fill chunk expansion against memset() and the old loop
+ */
+static bool benchFillThroughput()
+{
+    MemorySource src;
+    buildFillImage(src.data, FILL_CHUNK_BLOCKS);
+
+    uint64_t fileSize = static_cast<uint64_t>(FILL_CHUNK_BLOCKS) * BLOCK_SIZE;
+    std::vector<char> buf(FILL_BUFFER_SIZE);
+
+    printf("Fill chunk expansion: %" PRIu64 " bytes, %d byte reads\n",
+           fileSize, FILL_BUFFER_SIZE);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t remain = fileSize; remain > 0;) {
+        size_t n = std::min<uint64_t>(remain, buf.size());
+        memset(buf.data(), 0x12, n);
+        remain -= n;
+    }
+    printThroughput("memset", fileSize, elapsedMs(start));
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t remain = fileSize; remain > 0;) {
+        size_t n = std::min<uint64_t>(remain, buf.size());
+        fillBytewise(buf.data(), 0x12345678, n);
+        remain -= n;
+    }
+    printThroughput("bytewise", fileSize, elapsedMs(start));
+
+    SparseCtx *ctx = sparseCtxNew();
+    if (!ctx) {
+        return false;
+    }
+
+    bool ret = sparseOpen(ctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
+                          &src);
+    uint64_t total = 0;
+    uint64_t n;
+
+    start = std::chrono::steady_clock::now();
+    while (ret && (ret = sparseRead(ctx, buf.data(), buf.size(), &n)) && n > 0) {
+        total += n;
+    }
+    printThroughput("sparseRead", total, elapsedMs(start));
+
+    sparseCtxFree(ctx);
+    return ret && total == fileSize;
+}
+
+static bool cbPread(void *buf, uint64_t size, uint64_t offset,
+                    uint64_t *bytesRead, void *userData)
+{
+    MemorySource *src = static_cast<MemorySource *>(userData);
+    uint64_t canRead = 0;
+    if (offset < src->data.size()) {
+        canRead = std::min<uint64_t>(size, src->data.size() - offset);
+    }
+    memcpy(buf, src->data.data() + offset, canRead);
+    *bytesRead = canRead;
+    return true;
+}
+
+static bool cbFdPwrite(const void *buf, uint64_t size, uint64_t offset,
+                       void *userData)
+{
+    int fd = *static_cast<int *>(userData);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n <= 0) {
+            return false;
+        }
+        buf = static_cast<const char *>(buf) + n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// The output file is truncated to the full size first, so holes already read
+// back as zeros
+static bool cbSkipHole(uint64_t offset, uint64_t size, void *userData)
+{
+    (void) offset;
+    (void) size;
+    (void) userData;
+    return true;
+}
+
+/*!
+ * \brief Time parallel expansion of a sparse image to a file
+ */
+static bool benchParallelExpand()
+{
+    MemorySource src;
+    buildImage(src.data, EXPAND_CHUNKS, EXPAND_CHUNK_BLOCKS);
+
+    uint64_t fileSize = static_cast<uint64_t>(EXPAND_CHUNKS)
+            * EXPAND_CHUNK_BLOCKS * BLOCK_SIZE;
+
+    char path[] = "/tmp/bench_sparse.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    unlink(path);
+
+    printf("Parallel expansion: %" PRIu64 " bytes to %s\n", fileSize, path);
+
+    SparseCtx *ctx = sparseCtxNew();
+    bool ret = ctx && sparseSetPreadCallback(ctx, &cbPread)
+            && sparseOpen(ctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
+                          &src)
+            && sparseBuildIndex(ctx);
+
+    for (unsigned int threads : { 1, 2, 4, 8 }) {
+        if (!ret) {
+            break;
+        }
+
+        ret = ftruncate(fd, 0) == 0
+                && ftruncate(fd, static_cast<off_t>(fileSize)) == 0;
+
+        auto start = std::chrono::steady_clock::now();
+        ret = ret && sparseExpand(ctx, threads, &cbFdPwrite, &cbSkipHole, &fd);
+        double ms = elapsedMs(start);
+
+        char name[20];
+        snprintf(name, sizeof(name), "%u thread%s", threads,
+                 threads == 1 ? "" : "s");
+        printThroughput(name, fileSize, ms);
+    }
+
+    if (ctx) {
+        sparseCtxFree(ctx);
+    }
+    close(fd);
+    return ret;
+}
+
+static bool cbNullWrite(const void *buf, uint64_t size,
+                        uint64_t *bytesWritten, void *userData)
+{
+    (void) buf;
+    *static_cast<uint64_t *>(userData) += size;
+    *bytesWritten = size;
+    return true;
+}
+
+static bool cbNullSeek(int64_t offset, int whence, void *userData)
+{
+    (void) offset;
+    (void) whence;
+    (void) userData;
+    return true;
+}
+
+/*!
+ * \brief Time conversion of a mostly empty raw image to a sparse image
+ *
+ * Every fifth block contains data, similar to a freshly created ext4 image.
+ */
+static bool benchWriteThroughput()
+{
+    std::vector<unsigned char> block(WRITE_BLOCK_SIZE);
+    std::vector<unsigned char> image;
+    image.reserve(static_cast<size_t>(WRITE_IMAGE_BLOCKS) * WRITE_BLOCK_SIZE);
+    for (uint32_t i = 0; i < WRITE_IMAGE_BLOCKS; ++i) {
+        for (size_t j = 0; j < block.size(); ++j) {
+            block[j] = i % 5 == 0 ? static_cast<unsigned char>(i + j * 7) : 0;
+        }
+        image.insert(image.end(), block.begin(), block.end());
+    }
+
+    SparseWriterCtx *ctx = sparseWriterCtxNew();
+    if (!ctx) {
+        return false;
+    }
+
+    uint64_t outSize = 0;
+    bool ret = sparseWriterOpen(ctx, WRITE_BLOCK_SIZE, nullptr, nullptr,
+                                &cbNullWrite, &cbNullSeek, &outSize);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; ret && i < image.size(); i += FILL_BUFFER_SIZE) {
+        uint64_t n;
+        ret = sparseWriterWrite(ctx, image.data() + i,
+                                std::min<size_t>(FILL_BUFFER_SIZE,
+                                                 image.size() - i), &n);
+    }
+    ret = sparseWriterClose(ctx) && ret;
+    double ms = elapsedMs(start);
+
+    printf("Sparse writer: %zu byte image, 80%% empty blocks\n", image.size());
+    printThroughput("sparseWrite", image.size(), ms);
+    printf("  %-12s %" PRIu64 " bytes\n", "output size", outSize);
+
+    sparseWriterCtxFree(ctx);
+    return ret;
+}
+
+int main()
+{
+    mb::log::log_set_logger(std::make_shared<NullLogger>());
+
+    MemorySource src;
+    buildImage(src.data, NUM_CHUNKS, 1);
+
+    uint64_t fileSize = static_cast<uint64_t>(NUM_CHUNKS) * BLOCK_SIZE;
+
+    std::mt19937_64 rng(12345);
+    std::uniform_int_distribution<uint64_t> dist(
+            0, fileSize - RANDOM_READ_SIZE);
+    std::vector<uint64_t> offsets(NUM_RANDOM_READS);
+    for (auto &offset : offsets) {
+        offset = dist(rng);
+    }
+
+    printf("Random reads: %d chunks, %d reads of %d bytes\n",
+           NUM_CHUNKS, NUM_RANDOM_READS, RANDOM_READ_SIZE);
+
+    for (bool indexed : { false, true }) {
+        double setupMs;
+        double readMs;
+
+        if (!benchRandomReads(&src, indexed, offsets, &setupMs, &readMs)) {
+            fprintf(stderr, "Failed to read sparse image\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("  %-12s setup: %9.3f ms, reads: %9.3f ms (%.3f us/read)\n",
+               indexed ? "indexed" : "linear walk", setupMs, readMs,
+               readMs * 1000 / NUM_RANDOM_READS);
+    }
+
+    if (!benchFillThroughput()) {
+        fprintf(stderr, "Failed to read sparse image\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!benchWriteThroughput()) {
+        fprintf(stderr, "Failed to write sparse image\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!benchParallelExpand()) {
+        fprintf(stderr, "Failed to expand sparse image\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -19,6 +19,16 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include <cstdio>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
 #include "mbsparse/sparse.h"
 
 struct SparseTest : testing::Test
@@ -83,6 +93,19 @@ struct SparseTest : testing::Test
         return true;
     }
 
+    static bool cbPread(void *buf, uint64_t size, uint64_t offset,
+                        uint64_t *bytesRead, void *userData)
+    {
+        SparseTest *test = static_cast<SparseTest *>(userData);
+        uint64_t canRead = 0;
+        if (offset < test->_data.size()) {
+            canRead = std::min<uint64_t>(size, test->_data.size() - offset);
+        }
+        memcpy(buf, test->_data.data() + offset, canRead);
+        *bytesRead = canRead;
+        return true;
+    }
+
     bool sparseOpen()
     {
         return ::sparseOpen(_ctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
@@ -100,6 +123,11 @@ struct SparseTest : testing::Test
         return ::sparseClose(_ctx);
     }
 
+    bool sparseBuildIndex()
+    {
+        return ::sparseBuildIndex(_ctx);
+    }
+
     bool sparseRead(void *buf, uint64_t size, uint64_t *bytesRead)
     {
         return ::sparseRead(_ctx, buf, size, bytesRead);
@@ -115,6 +143,79 @@ struct SparseTest : testing::Test
         return ::sparseTell(_ctx, offset);
     }
 
+    bool sparseGetExtent(SparseExtent *extent)
+    {
+        return ::sparseGetExtent(_ctx, extent);
+    }
+
+    bool sparseSkipExtent()
+    {
+        return ::sparseSkipExtent(_ctx);
+    }
+
+    bool sparseSetVerifyCrc32(bool enabled)
+    {
+        return ::sparseSetVerifyCrc32(_ctx, enabled);
+    }
+
+    bool sparseSetPreadCallback()
+    {
+        return ::sparseSetPreadCallback(_ctx, &cbPread);
+    }
+
+    bool sparseGetExtentAt(uint64_t offset, SparseExtent *extent)
+    {
+        return ::sparseGetExtentAt(_ctx, offset, extent);
+    }
+
+    static bool cbPwrite(const void *buf, uint64_t size, uint64_t offset,
+                         void *userData)
+    {
+        auto *out = static_cast<std::vector<unsigned char> *>(userData);
+        if (offset + size > out->size()) {
+            return false;
+        }
+        memcpy(out->data() + offset, buf, size);
+        return true;
+    }
+
+    static bool cbDiscard(uint64_t offset, uint64_t size, void *userData)
+    {
+        auto *out = static_cast<std::vector<unsigned char> *>(userData);
+        if (offset + size > out->size()) {
+            return false;
+        }
+        memset(out->data() + offset, 0xdd, size);
+        return true;
+    }
+
+    bool sparsePread(void *buf, uint64_t size, uint64_t offset,
+                     uint64_t *bytesRead)
+    {
+        return ::sparsePread(_ctx, buf, size, offset, bytesRead);
+    }
+
+    // Bitwise CRC32 for checking the table-driven implementation
+    static uint32_t referenceCrc32(const void *buf, size_t size)
+    {
+        auto const *ptr = static_cast<const unsigned char *>(buf);
+        uint32_t crc = 0xffffffff;
+        for (size_t i = 0; i < size; ++i) {
+            crc ^= ptr[i];
+            for (int k = 0; k < 8; ++k) {
+                crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+        }
+        return ~crc;
+    }
+
+    // Replace the checksum in the CRC32 chunk from buildDataCompleteValid()
+    void setCompleteValidCrc32(uint32_t crc32)
+    {
+        memcpy(_data.data() + _data.size() - sizeof(uint32_t), &crc32,
+               sizeof(uint32_t));
+    }
+
     void buildDataHeaderProperSized()
     {
         SparseHeader hdr;
@@ -230,6 +331,64 @@ struct SparseTest : testing::Test
         auto const *crc32Ptr = reinterpret_cast<const unsigned char *>(&crc32);
         _data.insert(_data.end(), crc32Ptr, crc32Ptr + sizeof(uint32_t));
     }
+
+    // Same image as buildDataCompleteValid(), but with an additional CRC32
+    // chunk between the raw chunk and the fill chunk
+    void buildDataMidCrc32(uint32_t midCrc32, uint32_t endCrc32)
+    {
+        buildDataCompleteValid();
+        setCompleteValidCrc32(endCrc32);
+
+        auto *hdr = reinterpret_cast<SparseHeader *>(_data.data());
+        ++hdr->total_chunks;
+
+        ChunkHeader chdr;
+        auto const *chdrPtr = reinterpret_cast<const unsigned char *>(&chdr);
+        auto const *crc32Ptr =
+                reinterpret_cast<const unsigned char *>(&midCrc32);
+
+        memset(&chdr, 0, sizeof(ChunkHeader));
+        chdr.chunk_type = CHUNK_TYPE_CRC32;
+        chdr.chunk_sz = 0;
+        chdr.total_sz = sizeof(ChunkHeader) + sizeof(uint32_t);
+
+        std::vector<unsigned char> chunk(chdrPtr, chdrPtr + sizeof(chdr));
+        chunk.insert(chunk.end(), crc32Ptr, crc32Ptr + sizeof(uint32_t));
+
+        // Insert after the raw chunk header and its 16 bytes of data
+        _data.insert(_data.begin() + sizeof(SparseHeader)
+                + sizeof(ChunkHeader) + 16, chunk.begin(), chunk.end());
+    }
+
+    void buildDataFillOnly(uint32_t fillVal, uint32_t blocks)
+    {
+        SparseHeader hdr;
+        auto const *hdrPtr = reinterpret_cast<const unsigned char *>(&hdr);
+
+        memset(&hdr, 0, sizeof(SparseHeader));
+        hdr.magic = SPARSE_HEADER_MAGIC;
+        hdr.major_version = SPARSE_HEADER_MAJOR_VER;
+        hdr.minor_version = 0;
+        hdr.file_hdr_sz = sizeof(SparseHeader);
+        hdr.chunk_hdr_sz = sizeof(ChunkHeader);
+        hdr.blk_sz = 64;
+        hdr.total_blks = blocks;
+        hdr.total_chunks = 1;
+        hdr.image_checksum = 0;
+        _data.insert(_data.end(), hdrPtr, hdrPtr + sizeof(SparseHeader));
+
+        ChunkHeader chdr;
+        auto const *chdrPtr = reinterpret_cast<const unsigned char *>(&chdr);
+
+        memset(&chdr, 0, sizeof(ChunkHeader));
+        chdr.chunk_type = CHUNK_TYPE_FILL;
+        chdr.chunk_sz = blocks;
+        chdr.total_sz = hdr.chunk_hdr_sz + sizeof(uint32_t);
+        _data.insert(_data.end(), chdrPtr, chdrPtr + sizeof(ChunkHeader));
+        auto const *fillValPtr =
+                reinterpret_cast<const unsigned char *>(&fillVal);
+        _data.insert(_data.end(), fillValPtr, fillValPtr + sizeof(uint32_t));
+    }
 };
 
 TEST_F(SparseTest, ReadPerfectlySizedHeader)
@@ -377,6 +536,604 @@ TEST_F(SparseTest, ReadValidSparseFileNoSeek)
     ASSERT_TRUE(sparseClose());
 }
 
+TEST_F(SparseTest, ReadValidSparseFileIndexed)
+{
+    char expected[48] = {
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+        'a', 'b', 'c', 'd', 'e', 'f',
+        0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+        0x78, 0x56, 0x34, 0x12,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    char buf[1024];
+    uint64_t bytesRead;
+    uint64_t pos;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpen());
+
+    // Check that building the index does not change the file position
+    ASSERT_TRUE(sparseSeek(5, SEEK_SET));
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 5);
+
+    // Building the index again is a no-op
+    ASSERT_TRUE(sparseBuildIndex());
+
+    // Check that reads work in reverse chunk order
+    ASSERT_TRUE(sparseSeek(40, SEEK_SET));
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 8);
+    ASSERT_EQ(memcmp(buf, expected + 40, 8), 0);
+
+    ASSERT_TRUE(sparseSeek(18, SEEK_SET));
+    ASSERT_TRUE(sparseRead(buf, 4, &bytesRead));
+    ASSERT_EQ(bytesRead, 4);
+    ASSERT_EQ(memcmp(buf, expected + 18, 4), 0);
+
+    ASSERT_TRUE(sparseSeek(3, SEEK_SET));
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 45);
+    ASSERT_EQ(memcmp(buf, expected + 3, 45), 0);
+
+    // Check that seeking past EOF is allowed and doing so returns no data
+    ASSERT_TRUE(sparseSeek(1000, SEEK_SET));
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 0);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, BuildIndexNoSeek)
+{
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpenNoSeek());
+    ASSERT_FALSE(sparseBuildIndex());
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, ReadFillChunkAllAlignments)
+{
+    const uint32_t fillVal = 0x12345678;
+    const uint32_t blocks = 8;
+    const size_t size = blocks * 64;
+
+    // Expected output from the simple byte-by-byte expansion
+    std::vector<unsigned char> expected(size);
+    for (size_t i = 0; i < size; ++i) {
+        expected[i] = reinterpret_cast<const unsigned char *>(&fillVal)[i % 4];
+    }
+
+    std::vector<unsigned char> buf(size + 1);
+    uint64_t bytesRead;
+    buildDataFillOnly(fillVal, blocks);
+
+    ASSERT_TRUE(sparseOpen());
+
+    // Cover every rotation of the pattern and every tail length that the
+    // vector loops can leave behind
+    for (size_t offset = 0; offset < 72; ++offset) {
+        for (size_t length : { 0, 1, 2, 3, 4, 5, 7, 15, 16, 17, 31, 32, 33,
+                               63, 64, 65, 127, 128, 129, 200, 300 }) {
+            size_t expectedLength = std::min(length, size - offset);
+
+            // Guard byte to detect writes past the requested size
+            std::fill(buf.begin(), buf.end(), 0xaa);
+
+            ASSERT_TRUE(sparseSeek(offset, SEEK_SET));
+            ASSERT_TRUE(sparseRead(buf.data(), length, &bytesRead));
+            ASSERT_EQ(bytesRead, expectedLength);
+            ASSERT_EQ(memcmp(buf.data(), expected.data() + offset,
+                             expectedLength), 0)
+                    << "offset=" << offset << ", length=" << length;
+            ASSERT_EQ(buf[expectedLength], 0xaa)
+                    << "offset=" << offset << ", length=" << length;
+        }
+    }
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, IterateExtents)
+{
+    SparseExtent extent;
+    uint64_t pos;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpen());
+
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_RAW);
+    ASSERT_EQ(extent.begin, 0);
+    ASSERT_EQ(extent.end, 16);
+    ASSERT_EQ(extent.srcOffset, sizeof(SparseHeader) + sizeof(ChunkHeader));
+
+    // Getting the extent does not move the file position
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 0);
+
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_EQ(extent.begin, 16);
+    ASSERT_EQ(extent.end, 32);
+    ASSERT_EQ(extent.fillVal, 0x12345678);
+
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_HOLE);
+    ASSERT_EQ(extent.begin, 32);
+    ASSERT_EQ(extent.end, 48);
+
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_EOF);
+    ASSERT_EQ(extent.begin, 48);
+    ASSERT_EQ(extent.end, 48);
+
+    // Skipping at EOF does nothing
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 48);
+
+    // Extents start at the file position
+    ASSERT_TRUE(sparseSeek(21, SEEK_SET));
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_EQ(extent.begin, 21);
+    ASSERT_EQ(extent.end, 32);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, IterateExtentsNoSeek)
+{
+    char buf[1024];
+    SparseExtent extent;
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpenNoSeek());
+
+    // Partially read the raw extent and skip the rest
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_RAW);
+    ASSERT_TRUE(sparseRead(buf, 4, &bytesRead));
+    ASSERT_EQ(bytesRead, 4);
+    ASSERT_EQ(memcmp(buf, "0123", 4), 0);
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_RAW);
+    ASSERT_EQ(extent.begin, 4);
+    ASSERT_TRUE(sparseSkipExtent());
+
+    // The fill extent must still be readable after skipping raw data
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_TRUE(sparseRead(buf, extent.end - extent.begin, &bytesRead));
+    ASSERT_EQ(bytesRead, 16);
+    ASSERT_EQ(memcmp(buf, "\x78\x56\x34\x12", 4), 0);
+
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_HOLE);
+    ASSERT_TRUE(sparseSkipExtent());
+
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_EOF);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+static const char completeValidData[48] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+    'a', 'b', 'c', 'd', 'e', 'f',
+    0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+    0x78, 0x56, 0x34, 0x12,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+TEST_F(SparseTest, VerifyCrc32Valid)
+{
+    char buf[1024];
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48));
+
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpen());
+
+    // Cannot be changed while open
+    ASSERT_FALSE(sparseSetVerifyCrc32(false));
+
+    // Read in uneven pieces to check that partial chunks are hashed correctly
+    for (uint64_t size : { 3, 14, 5, 9, 17 }) {
+        ASSERT_TRUE(sparseRead(buf, size, &bytesRead));
+        ASSERT_EQ(bytesRead, size);
+    }
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 0);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, VerifyCrc32Mismatch)
+{
+    char buf[1024];
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48) ^ 1);
+
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseRead(buf, 48, &bytesRead));
+    ASSERT_EQ(bytesRead, 48);
+    ASSERT_FALSE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_TRUE(sparseClose());
+
+    // Not checked if verification is disabled
+    ASSERT_TRUE(sparseSetVerifyCrc32(false));
+    _pos = 0;
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 48);
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, VerifyCrc32Indexed)
+{
+    char buf[1024];
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48) ^ 1);
+
+    // The CRC32 chunk is loaded before the data preceding it is read
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_FALSE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_TRUE(sparseClose());
+
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48));
+    _pos = 0;
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 48);
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, VerifyCrc32MiddleChunk)
+{
+    char buf[1024];
+    uint64_t bytesRead;
+    SparseExtent extent;
+    uint32_t midCrc32 = referenceCrc32(completeValidData, 16);
+    uint32_t endCrc32 = referenceCrc32(completeValidData, 48);
+
+    // Chunks following a CRC32 chunk must still be parsed correctly
+    buildDataMidCrc32(midCrc32, endCrc32);
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 48);
+    ASSERT_EQ(memcmp(buf, completeValidData, 48), 0);
+    ASSERT_TRUE(sparseClose());
+
+    _pos = 0;
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_TRUE(sparseGetExtentAt(16, &extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 48);
+    ASSERT_EQ(memcmp(buf, completeValidData, 48), 0);
+    ASSERT_TRUE(sparseClose());
+
+    // Mismatch in the middle chunk is detected before the end
+    _data.clear();
+    buildDataMidCrc32(midCrc32 ^ 1, endCrc32);
+    _pos = 0;
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseRead(buf, 16, &bytesRead));
+    ASSERT_EQ(bytesRead, 16);
+    ASSERT_FALSE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, VerifyCrc32SkipExtents)
+{
+    char buf[1024];
+    SparseExtent extent;
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48) ^ 1);
+
+    // Fill and skip chunks are hashed without being read
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpenNoSeek());
+    ASSERT_TRUE(sparseRead(buf, 16, &bytesRead));
+    ASSERT_EQ(bytesRead, 16);
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_FALSE(sparseGetExtent(&extent));
+    ASSERT_TRUE(sparseClose());
+
+    setCompleteValidCrc32(referenceCrc32(completeValidData, 48));
+    _pos = 0;
+    ASSERT_TRUE(sparseOpenNoSeek());
+    ASSERT_TRUE(sparseRead(buf, 16, &bytesRead));
+    ASSERT_EQ(bytesRead, 16);
+    ASSERT_TRUE(sparseRead(buf, 3, &bytesRead));
+    ASSERT_EQ(bytesRead, 3);
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseSkipExtent());
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_EOF);
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, PreadValidSparseFile)
+{
+    char buf[64];
+    uint64_t bytesRead;
+    uint64_t pos;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseSetPreadCallback());
+    ASSERT_TRUE(sparseOpen());
+
+    // The chunk index is required
+    ASSERT_FALSE(sparsePread(buf, 1, 0, &bytesRead));
+
+    ASSERT_TRUE(sparseSeek(7, SEEK_SET));
+    ASSERT_TRUE(sparseBuildIndex());
+
+    for (uint64_t offset = 0; offset <= 50; ++offset) {
+        for (uint64_t size = 0; size <= 50; ++size) {
+            uint64_t expectedSize = offset < 48
+                    ? std::min<uint64_t>(size, 48 - offset) : 0;
+            ASSERT_TRUE(sparsePread(buf, size, offset, &bytesRead));
+            ASSERT_EQ(bytesRead, expectedSize);
+            ASSERT_EQ(memcmp(buf, completeValidData + offset, expectedSize), 0)
+                    << "offset=" << offset << ", size=" << size;
+        }
+    }
+
+    // The file position is not used or changed
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 7);
+    ASSERT_TRUE(sparseRead(buf, 4, &bytesRead));
+    ASSERT_EQ(bytesRead, 4);
+    ASSERT_EQ(memcmp(buf, completeValidData + 7, 4), 0);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, PreadNoCallback)
+{
+    char buf[16];
+    uint64_t bytesRead;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_FALSE(sparseSetPreadCallback());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_FALSE(sparsePread(buf, sizeof(buf), 0, &bytesRead));
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, PreadConcurrent)
+{
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseSetPreadCallback());
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4);
+
+    for (size_t i = 0; i < failures.size(); ++i) {
+        threads.emplace_back([this, i, &failures] {
+            char buf[48];
+            uint64_t bytesRead;
+            for (int iter = 0; iter < 10000; ++iter) {
+                uint64_t offset = (iter * 7 + i * 13) % 48;
+                if (!sparsePread(buf, sizeof(buf), offset, &bytesRead)
+                        || bytesRead != 48 - offset
+                        || memcmp(buf, completeValidData + offset,
+                                  bytesRead) != 0) {
+                    ++failures[i];
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int count : failures) {
+        ASSERT_EQ(count, 0);
+    }
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, GetExtentAt)
+{
+    SparseExtent extent;
+    uint64_t pos;
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseOpen());
+
+    // The chunk index is required
+    ASSERT_FALSE(sparseGetExtentAt(0, &extent));
+
+    ASSERT_TRUE(sparseBuildIndex());
+
+    ASSERT_TRUE(sparseGetExtentAt(5, &extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_RAW);
+    ASSERT_EQ(extent.begin, 5);
+    ASSERT_EQ(extent.end, 16);
+    ASSERT_EQ(extent.srcOffset,
+              sizeof(SparseHeader) + sizeof(ChunkHeader) + 5);
+
+    ASSERT_TRUE(sparseGetExtentAt(16, &extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_EQ(extent.begin, 16);
+    ASSERT_EQ(extent.end, 32);
+    ASSERT_EQ(extent.fillVal, 0x12345678);
+
+    ASSERT_TRUE(sparseGetExtentAt(47, &extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_HOLE);
+    ASSERT_EQ(extent.begin, 47);
+    ASSERT_EQ(extent.end, 48);
+
+    ASSERT_TRUE(sparseGetExtentAt(48, &extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_EOF);
+    ASSERT_EQ(extent.begin, 48);
+    ASSERT_EQ(extent.end, 48);
+
+    // The file position is not changed
+    ASSERT_TRUE(sparseTell(&pos));
+    ASSERT_EQ(pos, 0);
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, ExpandValidSparseFile)
+{
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseSetPreadCallback());
+    ASSERT_TRUE(sparseOpen());
+
+    for (unsigned int threads : { 1, 4 }) {
+        std::vector<unsigned char> out(48, 0xaa);
+        ASSERT_TRUE(sparseExpand(_ctx, threads, &cbPwrite, nullptr, &out));
+        ASSERT_EQ(memcmp(out.data(), completeValidData, 48), 0);
+    }
+
+    // Holes are passed to the discard callback instead of being written
+    std::vector<unsigned char> out(48, 0xaa);
+    ASSERT_TRUE(sparseExpand(_ctx, 2, &cbPwrite, &cbDiscard, &out));
+    ASSERT_EQ(memcmp(out.data(), completeValidData, 32), 0);
+    ASSERT_TRUE(std::all_of(out.begin() + 32, out.end(),
+                            [](unsigned char c) { return c == 0xdd; }));
+
+    // Write failures are reported
+    std::vector<unsigned char> tooSmall(47);
+    ASSERT_FALSE(sparseExpand(_ctx, 2, &cbPwrite, nullptr, &tooSmall));
+
+    ASSERT_TRUE(sparseClose());
+}
+
+TEST_F(SparseTest, ExpandNoSeek)
+{
+    std::vector<unsigned char> out(48);
+    buildDataCompleteValid();
+
+    ASSERT_TRUE(sparseSetPreadCallback());
+    ASSERT_TRUE(sparseOpenNoSeek());
+    ASSERT_FALSE(sparseExpand(_ctx, 1, &cbPwrite, nullptr, &out));
+    ASSERT_TRUE(sparseClose());
+}
+
+#ifndef _WIN32
+TEST_F(SparseTest, CopyRawExtent)
+{
+    static const char prefix[] = "zip local header";
+    std::unique_ptr<FILE, decltype(fclose) *> src(tmpfile(), &fclose);
+    std::unique_ptr<FILE, decltype(fclose) *> dest(tmpfile(), &fclose);
+    ASSERT_TRUE(src && dest);
+    int srcFd = fileno(src.get());
+    int destFd = fileno(dest.get());
+
+    // The sparse file is embedded at an offset in the source fd
+    buildDataCompleteValid();
+    ASSERT_EQ(pwrite(srcFd, prefix, sizeof(prefix), 0),
+              (ssize_t) sizeof(prefix));
+    ASSERT_EQ(pwrite(srcFd, _data.data(), _data.size(), sizeof(prefix)),
+              (ssize_t) _data.size());
+    ASSERT_EQ(ftruncate(destFd, 48), 0);
+
+    ASSERT_TRUE(sparseOpenNoSeek());
+
+    SparseExtent extent;
+    uint64_t bytesCopied;
+    char buf[48];
+    uint64_t bytesRead;
+
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_RAW);
+    ASSERT_TRUE(sparseCopyRawExtent(_ctx, srcFd, sizeof(prefix), destFd,
+                                    &bytesCopied));
+    ASSERT_EQ(bytesCopied, 16u);
+
+    // Only raw extents can be copied
+    ASSERT_TRUE(sparseGetExtent(&extent));
+    ASSERT_EQ(extent.type, SPARSE_EXTENT_FILL);
+    ASSERT_EQ(extent.begin, 16u);
+    ASSERT_FALSE(sparseCopyRawExtent(_ctx, srcFd, sizeof(prefix), destFd,
+                                     nullptr));
+
+    // The sequential reader continues after the copied extent
+    ASSERT_TRUE(sparseRead(buf + 16, 32, &bytesRead));
+    ASSERT_EQ(bytesRead, 32u);
+    ASSERT_EQ(memcmp(buf + 16, completeValidData + 16, 32), 0);
+    ASSERT_TRUE(sparseClose());
+
+    ASSERT_EQ(pread(destFd, buf, 16, 0), 16);
+    ASSERT_EQ(memcmp(buf, completeValidData, 16), 0);
+}
+
+TEST_F(SparseTest, CopyRawExtentVerifyCrc32)
+{
+    std::unique_ptr<FILE, decltype(fclose) *> src(tmpfile(), &fclose);
+    std::unique_ptr<FILE, decltype(fclose) *> dest(tmpfile(), &fclose);
+    ASSERT_TRUE(src && dest);
+    int srcFd = fileno(src.get());
+    int destFd = fileno(dest.get());
+    uint32_t midCrc32 = referenceCrc32(completeValidData, 16);
+    uint32_t endCrc32 = referenceCrc32(completeValidData, 48);
+    static const char zeros[16] = {};
+    char buf[48];
+    uint64_t bytesRead;
+
+    // Copied data is hashed and the following CRC32 chunks are checked
+    buildDataMidCrc32(midCrc32, endCrc32);
+    ASSERT_EQ(pwrite(srcFd, _data.data(), _data.size(), 0),
+              (ssize_t) _data.size());
+    ASSERT_TRUE(sparseSetVerifyCrc32(true));
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_TRUE(sparseCopyRawExtent(_ctx, srcFd, 0, destFd, nullptr));
+    ASSERT_TRUE(sparseRead(buf, sizeof(buf), &bytesRead));
+    ASSERT_EQ(bytesRead, 32u);
+    ASSERT_TRUE(sparseClose());
+
+    // With the index built, a mismatch is detected before anything is written
+    _data.clear();
+    buildDataMidCrc32(midCrc32 ^ 1, endCrc32);
+    _pos = 0;
+    ASSERT_EQ(pwrite(srcFd, _data.data(), _data.size(), 0),
+              (ssize_t) _data.size());
+    ASSERT_EQ(ftruncate(destFd, 0), 0);
+    ASSERT_EQ(ftruncate(destFd, 16), 0);
+    ASSERT_TRUE(sparseOpen());
+    ASSERT_TRUE(sparseBuildIndex());
+    ASSERT_FALSE(sparseCopyRawExtent(_ctx, srcFd, 0, destFd, nullptr));
+    ASSERT_TRUE(sparseClose());
+
+    ASSERT_EQ(pread(destFd, buf, 16, 0), 16);
+    ASSERT_EQ(memcmp(buf, zeros, 16), 0);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     testing::InitGoogleTest(&argc, argv);
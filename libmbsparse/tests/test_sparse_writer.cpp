@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mbsparse/sparse.h"
+
+struct SparseWriterTest : testing::Test
+{
+    SparseWriterCtx *_wctx;
+    SparseCtx *_rctx;
+    std::vector<unsigned char> _data;
+    size_t _pos = 0;
+
+    SparseWriterTest()
+    {
+        _wctx = sparseWriterCtxNew();
+        _rctx = sparseCtxNew();
+    }
+
+    virtual ~SparseWriterTest()
+    {
+        sparseWriterCtxFree(_wctx);
+        sparseCtxFree(_rctx);
+    }
+
+    static bool cbWrite(const void *buf, uint64_t size, uint64_t *bytesWritten,
+                        void *userData)
+    {
+        SparseWriterTest *test = static_cast<SparseWriterTest *>(userData);
+        auto const *ptr = static_cast<const unsigned char *>(buf);
+        if (test->_pos + size > test->_data.size()) {
+            test->_data.resize(test->_pos + size);
+        }
+        std::copy(ptr, ptr + size, test->_data.begin() + test->_pos);
+        test->_pos += size;
+        *bytesWritten = size;
+        return true;
+    }
+
+    static bool cbRead(void *buf, uint64_t size, uint64_t *bytesRead,
+                       void *userData)
+    {
+        SparseWriterTest *test = static_cast<SparseWriterTest *>(userData);
+        uint64_t canRead = 0;
+        if (test->_pos < test->_data.size()) {
+            canRead = std::min<uint64_t>(size, test->_data.size() - test->_pos);
+        }
+        memcpy(buf, test->_data.data() + test->_pos, canRead);
+        test->_pos += canRead;
+        *bytesRead = canRead;
+        return true;
+    }
+
+    static bool cbSeek(int64_t offset, int whence, void *userData)
+    {
+        SparseWriterTest *test = static_cast<SparseWriterTest *>(userData);
+        switch (whence) {
+        case SEEK_SET:
+            test->_pos = offset;
+            return true;
+        case SEEK_CUR:
+            test->_pos += offset;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool sparseWriterOpen(uint32_t blockSize)
+    {
+        return ::sparseWriterOpen(_wctx, blockSize, nullptr, nullptr, &cbWrite,
+                                  &cbSeek, this);
+    }
+
+    // Write data in pieces of the specified size
+    bool sparseWriterWriteAll(const std::vector<unsigned char> &data,
+                              size_t pieceSize)
+    {
+        for (size_t i = 0; i < data.size(); i += pieceSize) {
+            size_t n = std::min(pieceSize, data.size() - i);
+            uint64_t bytesWritten;
+            if (!sparseWriterWrite(_wctx, data.data() + i, n, &bytesWritten)
+                    || bytesWritten != n) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Read entire sparse file back with the reader and CRC32 verification
+    bool readBack(std::vector<unsigned char> *out)
+    {
+        _pos = 0;
+        if (!sparseSetVerifyCrc32(_rctx, true)
+                || !sparseOpen(_rctx, nullptr, nullptr, &cbRead, &cbSeek,
+                               nullptr, this)) {
+            return false;
+        }
+
+        out->clear();
+        unsigned char buf[1000];
+        uint64_t n;
+        bool ret;
+        while ((ret = sparseRead(_rctx, buf, sizeof(buf), &n)) && n > 0) {
+            out->insert(out->end(), buf, buf + n);
+        }
+
+        return sparseClose(_rctx) && ret;
+    }
+
+    static bool cbPread(void *buf, uint64_t size, uint64_t offset,
+                        uint64_t *bytesRead, void *userData)
+    {
+        SparseWriterTest *test = static_cast<SparseWriterTest *>(userData);
+        uint64_t canRead = 0;
+        if (offset < test->_data.size()) {
+            canRead = std::min<uint64_t>(size, test->_data.size() - offset);
+        }
+        memcpy(buf, test->_data.data() + offset, canRead);
+        *bytesRead = canRead;
+        return true;
+    }
+
+    static bool cbPwrite(const void *buf, uint64_t size, uint64_t offset,
+                         void *userData)
+    {
+        auto *out = static_cast<std::vector<unsigned char> *>(userData);
+        if (offset + size > out->size()) {
+            return false;
+        }
+        memcpy(out->data() + offset, buf, size);
+        return true;
+    }
+
+    // Collect the types of the chunks in the sparse file
+    std::vector<uint16_t> chunkTypes()
+    {
+        std::vector<uint16_t> types;
+        SparseHeader hdr;
+        memcpy(&hdr, _data.data(), sizeof(hdr));
+
+        size_t offset = hdr.file_hdr_sz;
+        for (uint32_t i = 0; i < hdr.total_chunks; ++i) {
+            ChunkHeader chdr;
+            memcpy(&chdr, _data.data() + offset, sizeof(chdr));
+            types.push_back(chdr.chunk_type);
+            offset += chdr.total_sz;
+        }
+        EXPECT_EQ(offset, _data.size());
+
+        return types;
+    }
+
+    static void appendFill(std::vector<unsigned char> &data, uint32_t fillVal,
+                           size_t size)
+    {
+        auto const *ptr = reinterpret_cast<const unsigned char *>(&fillVal);
+        for (size_t i = 0; i < size; ++i) {
+            data.push_back(ptr[i % sizeof(fillVal)]);
+        }
+    }
+
+    static void appendRaw(std::vector<unsigned char> &data, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            data.push_back(static_cast<unsigned char>(i * 7 + 1));
+        }
+    }
+};
+
+TEST_F(SparseWriterTest, InvalidBlockSize)
+{
+    ASSERT_FALSE(sparseWriterOpen(0));
+    ASSERT_FALSE(sparseWriterOpen(6));
+    ASSERT_TRUE(_data.empty());
+}
+
+TEST_F(SparseWriterTest, RoundTripMixedBlocks)
+{
+    const uint32_t blockSize = 256;
+    std::vector<unsigned char> input;
+    appendRaw(input, 3 * blockSize);
+    appendFill(input, 0, 5 * blockSize);
+    appendFill(input, 0xdeadbeef, 2 * blockSize);
+    appendFill(input, 0x01020304, blockSize);
+    appendRaw(input, blockSize);
+    appendFill(input, 0, blockSize);
+
+    // Write in pieces that do not line up with the blocks
+    ASSERT_TRUE(sparseWriterOpen(blockSize));
+    ASSERT_TRUE(sparseWriterWriteAll(input, 100));
+    ASSERT_TRUE(sparseWriterClose(_wctx));
+
+    // Adjacent blocks of the same kind are merged
+    std::vector<uint16_t> expectedTypes{
+        CHUNK_TYPE_RAW, CHUNK_TYPE_DONT_CARE, CHUNK_TYPE_FILL, CHUNK_TYPE_FILL,
+        CHUNK_TYPE_RAW, CHUNK_TYPE_DONT_CARE, CHUNK_TYPE_CRC32
+    };
+    ASSERT_EQ(chunkTypes(), expectedTypes);
+
+    SparseHeader hdr;
+    memcpy(&hdr, _data.data(), sizeof(hdr));
+    ASSERT_EQ(hdr.total_blks, 13u);
+    ASSERT_EQ(hdr.total_chunks, expectedTypes.size());
+
+    // Only the raw blocks are stored
+    ASSERT_LT(_data.size(), 5 * blockSize + 512);
+
+    std::vector<unsigned char> output;
+    ASSERT_TRUE(readBack(&output));
+    ASSERT_EQ(output, input);
+}
+
+TEST_F(SparseWriterTest, RoundTripPartialBlock)
+{
+    const uint32_t blockSize = 64;
+    std::vector<unsigned char> input;
+    appendRaw(input, 2 * blockSize + 10);
+
+    ASSERT_TRUE(sparseWriterOpen(blockSize));
+    ASSERT_TRUE(sparseWriterWriteAll(input, 7));
+    ASSERT_TRUE(sparseWriterClose(_wctx));
+
+    // The last block is padded with zeros
+    std::vector<unsigned char> output;
+    ASSERT_TRUE(readBack(&output));
+    ASSERT_EQ(output.size(), 3 * blockSize);
+    ASSERT_TRUE(std::equal(input.begin(), input.end(), output.begin()));
+    ASSERT_TRUE(std::all_of(output.begin() + input.size(), output.end(),
+                            [](unsigned char c) { return c == 0; }));
+}
+
+TEST_F(SparseWriterTest, RoundTripEmpty)
+{
+    ASSERT_TRUE(sparseWriterOpen(4096));
+    ASSERT_TRUE(sparseWriterClose(_wctx));
+
+    std::vector<uint16_t> expectedTypes{CHUNK_TYPE_CRC32};
+    ASSERT_EQ(chunkTypes(), expectedTypes);
+
+    std::vector<unsigned char> output;
+    ASSERT_TRUE(readBack(&output));
+    ASSERT_TRUE(output.empty());
+}
+
+TEST_F(SparseWriterTest, DetectMismatchAtAnyOffset)
+{
+    const uint32_t blockSize = 512;
+
+    // A single differing byte anywhere in the block (including the parts
+    // handled by the vector loops and the scalar tail) makes it raw
+    for (uint32_t offset = 0; offset < blockSize; offset += 13) {
+        std::vector<unsigned char> input;
+        appendFill(input, 0x55aa55aa, blockSize);
+        input[offset] ^= 0x80;
+
+        _data.clear();
+        _pos = 0;
+        ASSERT_TRUE(sparseWriterOpen(blockSize));
+        ASSERT_TRUE(sparseWriterWriteAll(input, input.size()));
+        ASSERT_TRUE(sparseWriterClose(_wctx));
+
+        std::vector<uint16_t> expectedTypes{CHUNK_TYPE_RAW, CHUNK_TYPE_CRC32};
+        ASSERT_EQ(chunkTypes(), expectedTypes) << "offset=" << offset;
+
+        std::vector<unsigned char> output;
+        ASSERT_TRUE(readBack(&output));
+        ASSERT_EQ(output, input);
+    }
+}
+
+TEST_F(SparseWriterTest, SplitLargeRawRuns)
+{
+    const uint32_t blockSize = 4096;
+    std::vector<unsigned char> input;
+    // Raw data that does not repeat with a period of 4 bytes
+    for (size_t i = 0; i < 2048 * blockSize; ++i) {
+        input.push_back(static_cast<unsigned char>((i * 2654435761u) >> 13));
+    }
+
+    ASSERT_TRUE(sparseWriterOpen(blockSize));
+    ASSERT_TRUE(sparseWriterWriteAll(input, 1024 * 1024));
+    ASSERT_TRUE(sparseWriterClose(_wctx));
+
+    std::vector<uint16_t> types = chunkTypes();
+    ASSERT_GT(types.size(), 2u);
+    ASSERT_TRUE(std::all_of(types.begin(), types.end() - 1,
+                            [](uint16_t t) { return t == CHUNK_TYPE_RAW; }));
+
+    std::vector<unsigned char> output;
+    ASSERT_TRUE(readBack(&output));
+    ASSERT_EQ(output, input);
+}
+
+TEST_F(SparseWriterTest, RoundTripParallelExpand)
+{
+    const uint32_t blockSize = 4096;
+    std::vector<unsigned char> input;
+    // Spans several work units with chunks that cross the unit boundaries
+    for (int i = 0; i < 40; ++i) {
+        appendRaw(input, (i % 7 + 1) * 25 * blockSize);
+        appendFill(input, i % 3 == 0 ? 0 : 0xc0ffee00 + i, 77 * blockSize);
+    }
+
+    ASSERT_TRUE(sparseWriterOpen(blockSize));
+    ASSERT_TRUE(sparseWriterWriteAll(input, 1024 * 1024));
+    ASSERT_TRUE(sparseWriterClose(_wctx));
+
+    ASSERT_TRUE(sparseSetPreadCallback(_rctx, &cbPread));
+    ASSERT_TRUE(sparseOpen(_rctx, nullptr, nullptr, &cbRead, &cbSeek, nullptr,
+                           this));
+
+    for (unsigned int threads : { 1, 3, 8 }) {
+        std::vector<unsigned char> output(input.size(), 0xaa);
+        ASSERT_TRUE(sparseExpand(_rctx, threads, &cbPwrite, nullptr, &output));
+        ASSERT_EQ(output, input) << "threads=" << threads;
+    }
+
+    ASSERT_TRUE(sparseClose(_rctx));
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <cstddef>
+#include <cstdint>
+
+struct MbFile;
+
+namespace mb
+{
+namespace util
+{
+
+/*!
+ * \brief Multi-threaded compressor for gzip, LZ4, and xz streams
+ *
+ * The input is split into blocks that are compressed concurrently and written
+ * to the output file in order, so the output is a single ordinary stream that
+ * any decompressor for the format accepts:
+ *
+ * - gzip: one member made of pigz-style raw deflate blocks. Each block is
+ *   primed with the previous 32 KiB of input and ends on a byte boundary.
+ * - LZ4: one frame per 4 MiB block, compressed with liblz4's frame API and the
+ *   same frame parameters that libarchive uses. Concatenated frames form a
+ *   valid LZ4 stream.
+ * - xz: liblzma's multithreaded encoder with 1 MiB blocks.
+ *
+ * Filters are identified by libarchive's ARCHIVE_FILTER_* codes.
+ */
+class ParallelCompressor
+{
+public:
+    ParallelCompressor();
+    ~ParallelCompressor();
+
+    ParallelCompressor(const ParallelCompressor &) = delete;
+    ParallelCompressor & operator=(const ParallelCompressor &) = delete;
+
+    static bool is_supported(int filter);
+
+    bool open(MbFile *file, int filter, unsigned int threads);
+    bool write(const void *data, size_t size);
+    bool close();
+
+    uint64_t bytes_written() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+}
+}
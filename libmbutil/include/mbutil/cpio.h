@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+struct MbFile;
+
+namespace mb
+{
+namespace util
+{
+
+struct CpioEntry
+{
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t nlink;
+    uint32_t mtime;
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint32_t rdev_major;
+    uint32_t rdev_minor;
+
+    // Location of the NULL-terminated path in the name arena
+    size_t name_offset;
+    // Location of the file contents (or symlink target) in the data arena
+    size_t data_offset;
+    size_t data_size;
+};
+
+/*!
+ * \brief Growable buffer that moves to a temporary file when it gets too large
+ *
+ * The buffer is kept on the heap until it would grow beyond the spill
+ * threshold. It is then moved to an unlinked temporary file that is mapped into
+ * memory, so its pages can be written back and reclaimed by the kernel instead
+ * of staying resident.
+ */
+class CpioArena
+{
+public:
+    CpioArena();
+    ~CpioArena();
+
+    CpioArena(const CpioArena &) = delete;
+    CpioArena & operator=(const CpioArena &) = delete;
+
+    void set_spill(uint64_t threshold, const std::string &path);
+    uint64_t spill_threshold() const;
+    const std::string & spill_path() const;
+    bool spilled() const;
+
+    char * data();
+    const char * data() const;
+    size_t size() const;
+
+    bool resize(size_t size);
+    bool append(const void *data, size_t size);
+    void clear();
+    void swap(CpioArena &other);
+
+private:
+    std::string _heap;
+    uint64_t _threshold;
+    std::string _path;
+    int _fd;
+    char *_map;
+    size_t _size;
+    size_t _capacity;
+
+    bool spill(size_t size);
+    bool grow_file(size_t size);
+};
+
+/*!
+ * \brief Editable in-memory newc cpio archive
+ *
+ * Entry paths and contents are stored in two contiguous arenas instead of
+ * per-entry allocations. Replaced or removed data is reclaimed lazily when the
+ * arena contains more garbage than live data. Pointers returned by name() and
+ * data() are invalidated by any modification. If a spill threshold is set with
+ * set_spill(), the data arena moves to a temporary file once it exceeds it.
+ *
+ * Compression is handled by libarchive's filters, except that gzip, LZ4, and xz
+ * output is compressed in parallel by ParallelCompressor. The filters detected
+ * by load() are reused by save() unless changed with set_filters().
+ */
+class CpioArchive
+{
+public:
+    CpioArchive();
+
+    void set_spill(uint64_t threshold, const std::string &path);
+
+    bool load(MbFile *file);
+    bool save(MbFile *file, unsigned int threads = 0) const;
+
+    const std::vector<int> & filters() const;
+    void set_filters(std::vector<int> filters);
+
+    const std::vector<CpioEntry> & entries() const;
+    const CpioEntry * find(const std::string &path) const;
+    const char * name(const CpioEntry &entry) const;
+    const char * data(const CpioEntry &entry) const;
+
+    bool read_file(const std::string &path, std::string *data_out) const;
+    bool read_symlink(const std::string &path, std::string *target_out) const;
+
+    bool set_file(const std::string &path, const void *data, size_t size,
+                  mode_t perm);
+    bool set_file(const std::string &path, MbFile *file, mode_t perm);
+    bool set_symlink(const std::string &path, const std::string &target);
+    bool set_directory(const std::string &path, mode_t perm);
+    bool remove(const std::string &path);
+    bool rename(const std::string &path, const std::string &new_path);
+
+    bool extract(const CpioEntry &entry, const std::string &root,
+                 const std::string &path) const;
+
+private:
+    std::vector<CpioEntry> _entries;
+    std::string _names;
+    CpioArena _data;
+    size_t _garbage;
+    std::vector<int> _filters;
+
+    CpioEntry * find_mutable(const std::string &path);
+    bool erase(const std::string &path);
+    bool check_parent(const std::string &path) const;
+    CpioEntry * new_entry(const std::string &path, mode_t mode);
+    CpioEntry * file_entry(const std::string &path, mode_t perm);
+    void set_name(CpioEntry &entry, const std::string &path);
+    bool set_data(CpioEntry &entry, const void *data, size_t size);
+    void release(const CpioEntry &entry);
+    void compact();
+};
+
+}
+}
@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/compress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+#include <ctime>
+
+#include <archive.h>
+#include <lz4frame.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+#include "mblog/logging.h"
+
+// pigz's default block size. Each block is compressed with the previous
+// GZIP_DICT_SIZE bytes of input as the dictionary, so the ratio is close to
+// that of a single-threaded deflate stream.
+#define GZIP_BLOCK_SIZE         (128 * 1024)
+#define GZIP_DICT_SIZE          (32 * 1024)
+#define GZIP_LEVEL              Z_DEFAULT_COMPRESSION
+
+// Each block becomes one frame with a single LZ4F_max4MB block
+#define LZ4_BLOCK_SIZE          (4 * 1024 * 1024)
+
+// Blocks are independent, so a dictionary larger than the block size would
+// only waste memory
+#define XZ_BLOCK_SIZE           (1024 * 1024)
+#define XZ_PRESET               6
+
+namespace mb
+{
+namespace util
+{
+
+static inline void write_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+struct CompressBlock
+{
+    const char *data;
+    size_t size;
+    const char *dict;
+    size_t dict_size;
+    bool last;
+
+    std::string out;
+    uint32_t crc;
+    bool ok;
+};
+
+/*!
+ * \brief Compress a block into a sequence of raw deflate blocks
+ *
+ * Unless this is the last block, the output ends with a sync flush so that it
+ * is byte aligned and can be directly followed by the next block's output.
+ */
+static bool deflate_block(CompressBlock &b)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    bool ret = false;
+
+    if (b.dict_size > 0 && deflateSetDictionary(
+            &zs, reinterpret_cast<const Bytef *>(b.dict),
+            static_cast<uInt>(b.dict_size)) != Z_OK) {
+        goto done;
+    }
+
+    // Room for the sync flush marker in addition to the worst case expansion
+    b.out.resize(deflateBound(&zs, b.size) + 16);
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(b.data));
+    zs.avail_in = static_cast<uInt>(b.size);
+
+    while (true) {
+        size_t pos = zs.total_out;
+        if (pos == b.out.size()) {
+            b.out.resize(b.out.size() * 2);
+        }
+
+        zs.next_out = reinterpret_cast<Bytef *>(&b.out[pos]);
+        zs.avail_out = static_cast<uInt>(b.out.size() - pos);
+
+        int z_ret = deflate(&zs, b.last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (z_ret == Z_STREAM_END) {
+            break;
+        } else if (z_ret != Z_OK && z_ret != Z_BUF_ERROR) {
+            goto done;
+        } else if (!b.last && zs.avail_in == 0 && zs.avail_out > 0) {
+            // Flush completed
+            break;
+        }
+    }
+
+    b.out.resize(zs.total_out);
+    b.crc = crc32(0, reinterpret_cast<const Bytef *>(b.data),
+                  static_cast<uInt>(b.size));
+    ret = true;
+
+done:
+    deflateEnd(&zs);
+    return ret;
+}
+
+/*!
+ * \brief Compress a block into a complete LZ4 frame
+ *
+ * The frame parameters match libarchive's lz4 filter. liblz4 computes the
+ * content checksum.
+ */
+static bool lz4_frame(CompressBlock &b)
+{
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+    b.out.resize(LZ4F_compressFrameBound(b.size, &prefs));
+
+    size_t n = LZ4F_compressFrame(&b.out[0], b.out.size(), b.data, b.size,
+                                  &prefs);
+    if (LZ4F_isError(n)) {
+        LOGE("Failed to compress LZ4 frame: %s", LZ4F_getErrorName(n));
+        return false;
+    }
+
+    b.out.resize(n);
+    return true;
+}
+
+class ParallelCompressor::Impl
+{
+public:
+    MbFile *file = nullptr;
+    int filter = ARCHIVE_FILTER_NONE;
+    unsigned int threads = 1;
+    size_t block_size = 0;
+
+    // Input that has not been compressed yet
+    std::string pending;
+    // Tail of the input that was already compressed (gzip dictionary)
+    std::string dict;
+    uint64_t in_size = 0;
+    uint64_t out_size = 0;
+
+    uint32_t crc = 0;
+    lzma_stream lzma = LZMA_STREAM_INIT;
+    bool lzma_init = false;
+
+    ~Impl()
+    {
+        if (lzma_init) {
+            lzma_end(&lzma);
+        }
+    }
+
+    bool write_out(const void *data, size_t size)
+    {
+        size_t n;
+
+        if (mb_file_write_fully(file, data, size, &n) != MB_FILE_OK
+                || n != size) {
+            LOGE("Failed to write compressed data: %s",
+                 mb_file_error_string(file));
+            return false;
+        }
+
+        out_size += size;
+        return true;
+    }
+
+    bool compress_pending(size_t size, bool last);
+    bool lzma_run(lzma_action action);
+};
+
+/*!
+ * \brief Compress the first \p size bytes of pending input in parallel
+ */
+bool ParallelCompressor::Impl::compress_pending(size_t size, bool last)
+{
+    size_t count = std::max<size_t>((size + block_size - 1) / block_size, 1);
+    std::vector<CompressBlock> blocks(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        CompressBlock &b = blocks[i];
+        size_t offset = i * block_size;
+
+        b.data = pending.data() + offset;
+        b.size = std::min(block_size, size - std::min(offset, size));
+        b.last = last && i == count - 1;
+        b.ok = false;
+
+        if (i == 0) {
+            b.dict = dict.data();
+            b.dict_size = dict.size();
+        } else {
+            b.dict_size = std::min<size_t>(offset, GZIP_DICT_SIZE);
+            b.dict = pending.data() + offset - b.dict_size;
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]{
+        size_t i;
+        while ((i = next++) < count) {
+            CompressBlock &b = blocks[i];
+            b.ok = filter == ARCHIVE_FILTER_GZIP
+                    ? deflate_block(b) : lz4_frame(b);
+        }
+    };
+
+    // The calling thread is one of the workers
+    unsigned int n_threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, count));
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+    for (unsigned int i = 1; i < n_threads; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    for (auto &b : blocks) {
+        if (!b.ok) {
+            LOGE("Failed to compress block");
+            return false;
+        }
+
+        if (filter == ARCHIVE_FILTER_GZIP) {
+            crc = crc32_combine(crc, b.crc, static_cast<z_off_t>(b.size));
+        }
+
+        if (!write_out(b.out.data(), b.out.size())) {
+            return false;
+        }
+    }
+
+    if (filter == ARCHIVE_FILTER_GZIP) {
+        dict.append(pending, 0, size);
+        if (dict.size() > GZIP_DICT_SIZE) {
+            dict.erase(0, dict.size() - GZIP_DICT_SIZE);
+        }
+    }
+
+    in_size += size;
+    pending.erase(0, size);
+
+    return true;
+}
+
+bool ParallelCompressor::Impl::lzma_run(lzma_action action)
+{
+    uint8_t buf[65536];
+
+    while (true) {
+        lzma.next_out = buf;
+        lzma.avail_out = sizeof(buf);
+
+        lzma_ret ret = lzma_code(&lzma, action);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+            LOGE("Failed to compress data: liblzma error %d", ret);
+            return false;
+        }
+
+        size_t n = sizeof(buf) - lzma.avail_out;
+        if (n > 0 && !write_out(buf, n)) {
+            return false;
+        }
+
+        if (ret == LZMA_STREAM_END
+                || (action == LZMA_RUN && lzma.avail_in == 0
+                        && lzma.avail_out > 0)) {
+            return true;
+        }
+    }
+}
+
+ParallelCompressor::ParallelCompressor() : _impl(new Impl())
+{
+}
+
+ParallelCompressor::~ParallelCompressor() = default;
+
+bool ParallelCompressor::is_supported(int filter)
+{
+    switch (filter) {
+    case ARCHIVE_FILTER_GZIP:
+    case ARCHIVE_FILTER_LZ4:
+    case ARCHIVE_FILTER_XZ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Start a new compressed stream
+ *
+ * Nothing is written to \p file if this function fails, so the caller may fall
+ * back to another compressor.
+ *
+ * \param file Output file
+ * \param filter ARCHIVE_FILTER_GZIP, ARCHIVE_FILTER_LZ4, or ARCHIVE_FILTER_XZ
+ * \param threads Number of threads or 0 to use the number of CPUs
+ *
+ * \return Whether the stream was successfully started
+ */
+bool ParallelCompressor::open(MbFile *file, int filter, unsigned int threads)
+{
+    _impl.reset(new Impl());
+
+    if (!is_supported(filter)) {
+        LOGE("Unsupported filter for parallel compression: %d", filter);
+        return false;
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    _impl->file = file;
+    _impl->filter = filter;
+    _impl->threads = threads;
+
+    switch (filter) {
+    case ARCHIVE_FILTER_GZIP: {
+        // Same header as libarchive's gzip filter
+        unsigned char header[10] = { 0x1f, 0x8b, 0x08, 0x00,
+                                     0x00, 0x00, 0x00, 0x00, 0x00, 0x03 };
+        write_le32(header + 4, static_cast<uint32_t>(time(nullptr)));
+
+        _impl->block_size = GZIP_BLOCK_SIZE;
+        _impl->crc = crc32(0, nullptr, 0);
+
+        return _impl->write_out(header, sizeof(header));
+    }
+
+    case ARCHIVE_FILTER_LZ4:
+        // Frames are written as blocks are compressed
+        _impl->block_size = LZ4_BLOCK_SIZE;
+        return true;
+
+    case ARCHIVE_FILTER_XZ: {
+        lzma_options_lzma opt_lzma;
+        if (lzma_lzma_preset(&opt_lzma, XZ_PRESET)) {
+            LOGE("Failed to load xz preset %d", XZ_PRESET);
+            return false;
+        }
+        opt_lzma.dict_size = std::min<uint32_t>(opt_lzma.dict_size,
+                                                XZ_BLOCK_SIZE);
+
+        lzma_filter filters[] = {
+            { LZMA_FILTER_LZMA2, &opt_lzma },
+            { LZMA_VLI_UNKNOWN, nullptr },
+        };
+
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = threads;
+        mt.block_size = XZ_BLOCK_SIZE;
+        mt.filters = filters;
+        // Same integrity check as libarchive's xz filter
+        mt.check = LZMA_CHECK_CRC64;
+
+        lzma_ret ret = lzma_stream_encoder_mt(&_impl->lzma, &mt);
+        if (ret != LZMA_OK) {
+            LOGE("Failed to initialize multithreaded xz encoder: "
+                 "liblzma error %d", ret);
+            return false;
+        }
+
+        _impl->lzma_init = true;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+bool ParallelCompressor::write(const void *data, size_t size)
+{
+    if (_impl->filter == ARCHIVE_FILTER_XZ) {
+        _impl->lzma.next_in = static_cast<const uint8_t *>(data);
+        _impl->lzma.avail_in = size;
+        _impl->in_size += size;
+        return _impl->lzma_run(LZMA_RUN);
+    }
+
+    _impl->pending.append(static_cast<const char *>(data), size);
+
+    // Keep at least one byte pending so that close() can mark the final block
+    size_t batch_size = _impl->block_size * _impl->threads;
+    while (_impl->pending.size() > batch_size) {
+        if (!_impl->compress_pending(batch_size, false)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress remaining input and write the stream trailer
+ *
+ * The output file is not closed.
+ */
+bool ParallelCompressor::close()
+{
+    switch (_impl->filter) {
+    case ARCHIVE_FILTER_GZIP: {
+        if (!_impl->compress_pending(_impl->pending.size(), true)) {
+            return false;
+        }
+
+        unsigned char trailer[8];
+        write_le32(trailer, _impl->crc);
+        write_le32(trailer + 4, static_cast<uint32_t>(_impl->in_size));
+
+        return _impl->write_out(trailer, sizeof(trailer));
+    }
+
+    case ARCHIVE_FILTER_LZ4:
+        // Empty input still needs one (empty) frame
+        if (!_impl->pending.empty() || _impl->in_size == 0) {
+            return _impl->compress_pending(_impl->pending.size(), true);
+        }
+        return true;
+
+    case ARCHIVE_FILTER_XZ:
+        _impl->lzma.next_in = nullptr;
+        _impl->lzma.avail_in = 0;
+        return _impl->lzma_run(LZMA_FINISH);
+
+    default:
+        return false;
+    }
+}
+
+uint64_t ParallelCompressor::bytes_written() const
+{
+    return _impl->out_size;
+}
+
+}
+}
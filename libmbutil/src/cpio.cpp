@@ -0,0 +1,1511 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/cpio.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/autoclose/archive.h"
+#include "mbutil/compress.h"
+#include "mbutil/directory.h"
+#include "mbutil/finally.h"
+
+#define CPIO_NEWC_MAGIC         "070701"
+#define CPIO_NEWC_CRC_MAGIC     "070702"
+#define CPIO_MAGIC_SIZE         6
+#define CPIO_FIELD_SIZE         8
+#define CPIO_FIELD_COUNT        13
+#define CPIO_HEADER_SIZE        (CPIO_MAGIC_SIZE \
+                                + CPIO_FIELD_SIZE * CPIO_FIELD_COUNT)
+#define CPIO_TRAILER            "TRAILER!!!"
+
+// Entry data is read in chunks of this size so that the arena only grows as
+// much as the archive actually contains
+#define CPIO_READ_CHUNK_SIZE    (1024 * 1024)
+
+namespace mb
+{
+namespace util
+{
+
+typedef std::function<bool(const void *, size_t)> WriteFn;
+
+struct LaReadCtx
+{
+    MbFile *file;
+    char buf[10240];
+};
+
+static la_ssize_t la_read_cb(archive *a, void *userdata, const void **buffer)
+{
+    LaReadCtx *ctx = static_cast<LaReadCtx *>(userdata);
+    size_t n;
+
+    if (mb_file_read(ctx->file, ctx->buf, sizeof(ctx->buf), &n)
+            != MB_FILE_OK) {
+        archive_set_error(a, EIO, "%s", mb_file_error_string(ctx->file));
+        return -1;
+    }
+
+    *buffer = ctx->buf;
+    return static_cast<la_ssize_t>(n);
+}
+
+static la_ssize_t la_write_cb(archive *a, void *userdata,
+                              const void *buffer, size_t length)
+{
+    MbFile *file = static_cast<MbFile *>(userdata);
+    size_t n;
+
+    if (mb_file_write_fully(file, buffer, length, &n) != MB_FILE_OK
+            || n != length) {
+        archive_set_error(a, EIO, "%s", mb_file_error_string(file));
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(n);
+}
+
+static inline size_t padding(uint64_t offset)
+{
+    return (4 - offset % 4) % 4;
+}
+
+static bool read_exact(archive *a, void *buf, size_t size, uint64_t *offset)
+{
+    char *ptr = static_cast<char *>(buf);
+
+    while (size > 0) {
+        la_ssize_t n = archive_read_data(a, ptr, size);
+        if (n < 0) {
+            LOGE("Failed to read cpio archive: %s", archive_error_string(a));
+            return false;
+        } else if (n == 0) {
+            LOGE("Cpio archive is truncated at offset %" PRIu64, *offset);
+            return false;
+        }
+
+        ptr += n;
+        size -= n;
+        *offset += n;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Append data from the archive to an arena
+ *
+ * \p size comes from an untrusted header, so the arena is grown in bounded
+ * chunks as the data is read instead of all at once.
+ */
+static bool read_to_arena(archive *a, CpioArena *arena, size_t size,
+                          uint64_t *offset)
+{
+    while (size > 0) {
+        size_t n = std::min<size_t>(size, CPIO_READ_CHUNK_SIZE);
+        size_t arena_offset = arena->size();
+
+        if (!arena->resize(arena_offset + n)
+                || !read_exact(a, arena->data() + arena_offset, n, offset)) {
+            return false;
+        }
+
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool write_exact(const WriteFn &write, const void *buf, size_t size,
+                        uint64_t *offset)
+{
+    if (size > 0 && !write(buf, size)) {
+        return false;
+    }
+
+    *offset += size;
+    return true;
+}
+
+static bool parse_hex(const char *str, uint32_t *value_out)
+{
+    uint32_t value = 0;
+
+    for (size_t i = 0; i < CPIO_FIELD_SIZE; ++i) {
+        char c = str[i];
+
+        value <<= 4;
+
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+
+    *value_out = value;
+    return true;
+}
+
+static void format_hex(char *str, uint32_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = CPIO_FIELD_SIZE; i > 0; --i) {
+        str[i - 1] = digits[value & 0xf];
+        value >>= 4;
+    }
+}
+
+/*!
+ * \brief Convert path to the form used in the archive
+ *
+ * Leading "./" and "/" components and trailing slashes are removed so that
+ * "init", "./init", and "/init" all refer to the same entry.
+ */
+static std::string normalize_path(const char *path)
+{
+    while (true) {
+        if (*path == '/') {
+            ++path;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            break;
+        }
+    }
+
+    std::string result(path);
+
+    while (!result.empty() && result.back() == '/') {
+        result.pop_back();
+    }
+
+    if (result == ".") {
+        result.clear();
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Split a relative path for extraction
+ *
+ * Empty and "." components are skipped. Absolute paths and paths containing
+ * ".." components are rejected so that the result cannot refer to anything
+ * outside of the directory it is relative to.
+ */
+static bool split_extract_path(const std::string &path,
+                               std::vector<std::string> *components_out)
+{
+    std::vector<std::string> components;
+    size_t begin = 0;
+
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+
+    while (begin <= path.size()) {
+        size_t end = path.find('/', begin);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        std::string component = path.substr(begin, end - begin);
+        if (component == "..") {
+            return false;
+        } else if (!component.empty() && component != ".") {
+            components.push_back(std::move(component));
+        }
+
+        begin = end + 1;
+    }
+
+    if (components.empty()) {
+        return false;
+    }
+
+    components_out->swap(components);
+    return true;
+}
+
+/*!
+ * \brief Open (and create if needed) a subdirectory without following symlinks
+ *
+ * \return Directory file descriptor or -1 if \p name is not a directory
+ */
+static int open_subdirectory(int dfd, const std::string &name,
+                             const std::string &path)
+{
+    struct stat sb;
+
+    if (mkdirat(dfd, name.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    if (fstatat(dfd, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        LOGE("%s: Failed to stat parent directory: %s",
+             path.c_str(), strerror(errno));
+        return -1;
+    } else if (!S_ISDIR(sb.st_mode)) {
+        LOGE("%s: Refusing to extract through non-directory parent: %s",
+             path.c_str(), name.c_str());
+        return -1;
+    }
+
+    int fd = openat(dfd, name.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open parent directory: %s",
+             path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool write_fd_fully(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool is_child_of(const char *path, const std::string &parent)
+{
+    return strncmp(path, parent.c_str(), parent.size()) == 0
+            && path[parent.size()] == '/';
+}
+
+static bool write_entry(const WriteFn &write, const CpioEntry &entry,
+                        const char *name, const char *data, uint64_t *offset)
+{
+    static const char zeros[4] = {};
+    char header[CPIO_HEADER_SIZE];
+    size_t name_size = strlen(name) + 1;
+
+    const uint32_t fields[CPIO_FIELD_COUNT] = {
+        entry.ino,
+        entry.mode,
+        entry.uid,
+        entry.gid,
+        entry.nlink,
+        entry.mtime,
+        static_cast<uint32_t>(entry.data_size),
+        entry.dev_major,
+        entry.dev_minor,
+        entry.rdev_major,
+        entry.rdev_minor,
+        static_cast<uint32_t>(name_size),
+        0, // No checksum
+    };
+
+    memcpy(header, CPIO_NEWC_MAGIC, CPIO_MAGIC_SIZE);
+    for (size_t i = 0; i < CPIO_FIELD_COUNT; ++i) {
+        format_hex(header + CPIO_MAGIC_SIZE + i * CPIO_FIELD_SIZE, fields[i]);
+    }
+
+    return write_exact(write, header, sizeof(header), offset)
+            && write_exact(write, name, name_size, offset)
+            && write_exact(write, zeros, padding(*offset), offset)
+            && write_exact(write, data, entry.data_size, offset)
+            && write_exact(write, zeros, padding(*offset), offset);
+}
+
+static bool write_archive(const CpioArchive &cpio, const WriteFn &write)
+{
+    uint64_t offset = 0;
+
+    for (auto const &e : cpio.entries()) {
+        if (!write_entry(write, e, cpio.name(e), cpio.data(e), &offset)) {
+            return false;
+        }
+    }
+
+    CpioEntry trailer{};
+    trailer.nlink = 1;
+
+    return write_entry(write, trailer, CPIO_TRAILER, nullptr, &offset);
+}
+
+/*!
+ * \brief Write the archive with one of the multithreaded compressors
+ *
+ * The output is padded to a multiple of 512 bytes, like libarchive's output
+ * with a block size of 512.
+ *
+ * \return 1 on success, 0 on failure, or -1 if nothing was written because the
+ *         compressor could not be initialized
+ */
+static int save_parallel(const CpioArchive &cpio, MbFile *file, int filter,
+                         unsigned int threads)
+{
+    static const char zeros[512] = {};
+    ParallelCompressor pc;
+
+    if (!pc.open(file, filter, threads)) {
+        return pc.bytes_written() == 0 ? -1 : 0;
+    }
+
+    if (!write_archive(cpio, [&](const void *buf, size_t size) {
+        return pc.write(buf, size);
+    }) || !pc.close()) {
+        return 0;
+    }
+
+    size_t n;
+    size_t pad = (512 - pc.bytes_written() % 512) % 512;
+
+    if (pad > 0 && (mb_file_write_fully(file, zeros, pad, &n) != MB_FILE_OK
+            || n != pad)) {
+        LOGE("Failed to write cpio archive: %s", mb_file_error_string(file));
+        return 0;
+    }
+
+    return 1;
+}
+
+CpioArena::CpioArena()
+    : _threshold(UINT64_MAX)
+    , _fd(-1)
+    , _map(nullptr)
+    , _size(0)
+    , _capacity(0)
+{
+}
+
+CpioArena::~CpioArena()
+{
+    clear();
+}
+
+/*!
+ * \brief Set the size above which the buffer is moved to a temporary file
+ *
+ * \param threshold Maximum size of the heap buffer
+ * \param path Temporary files are created next to this path
+ */
+void CpioArena::set_spill(uint64_t threshold, const std::string &path)
+{
+    _threshold = threshold;
+    _path = path;
+}
+
+uint64_t CpioArena::spill_threshold() const
+{
+    return _threshold;
+}
+
+const std::string & CpioArena::spill_path() const
+{
+    return _path;
+}
+
+bool CpioArena::spilled() const
+{
+    return _fd >= 0;
+}
+
+char * CpioArena::data()
+{
+    return spilled() ? _map : &_heap[0];
+}
+
+const char * CpioArena::data() const
+{
+    return spilled() ? _map : _heap.data();
+}
+
+size_t CpioArena::size() const
+{
+    return spilled() ? _size : _heap.size();
+}
+
+/*!
+ * \brief Resize the buffer
+ *
+ * New space is not initialized. Pointers into the buffer are invalidated.
+ *
+ * \return Whether the buffer was resized. The buffer is unchanged on failure.
+ */
+bool CpioArena::resize(size_t size)
+{
+    if (!spilled()) {
+        if (size <= _threshold) {
+            _heap.resize(size);
+            return true;
+        } else if (!spill(size)) {
+            return false;
+        }
+    } else if (size > _capacity && !grow_file(size)) {
+        return false;
+    }
+
+    _size = size;
+    return true;
+}
+
+/*!
+ * \brief Append data to the buffer
+ *
+ * \p data may point into the buffer itself.
+ */
+bool CpioArena::append(const void *data, size_t size)
+{
+    const char *ptr = static_cast<const char *>(data);
+    size_t old_size = this->size();
+    bool inside = size > 0 && ptr >= this->data()
+            && ptr < this->data() + old_size;
+    size_t offset = inside ? ptr - this->data() : 0;
+
+    if (!resize(old_size + size)) {
+        return false;
+    }
+
+    if (inside) {
+        // The buffer may have moved
+        ptr = this->data() + offset;
+    }
+
+    if (size > 0) {
+        memcpy(this->data() + old_size, ptr, size);
+    }
+
+    return true;
+}
+
+void CpioArena::clear()
+{
+    if (_map) {
+        munmap(_map, _capacity);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+
+    std::string().swap(_heap);
+    _fd = -1;
+    _map = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+void CpioArena::swap(CpioArena &other)
+{
+    std::swap(_heap, other._heap);
+    std::swap(_threshold, other._threshold);
+    std::swap(_path, other._path);
+    std::swap(_fd, other._fd);
+    std::swap(_map, other._map);
+    std::swap(_size, other._size);
+    std::swap(_capacity, other._capacity);
+}
+
+/*!
+ * \brief Move the heap buffer to a new unlinked temporary file
+ */
+bool CpioArena::spill(size_t size)
+{
+    char *tmp_path = mb_format("%s.XXXXXX", _path.c_str());
+    if (!tmp_path) {
+        LOGE("Out of memory");
+        return false;
+    }
+
+    auto free_tmp_path = finally([&]{
+        free(tmp_path);
+    });
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOGE("%s: Failed to create temporary file: %s",
+             _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    unlink(tmp_path);
+
+    LOGV("%s: Spilling cpio data to temporary file", _path.c_str());
+
+    _fd = fd;
+
+    if (!grow_file(size)) {
+        close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    memcpy(_map, _heap.data(), _heap.size());
+    std::string().swap(_heap);
+
+    return true;
+}
+
+/*!
+ * \brief Enlarge the temporary file and map it again
+ */
+bool CpioArena::grow_file(size_t size)
+{
+    size_t capacity = std::max<size_t>(size, CPIO_READ_CHUNK_SIZE);
+    if (capacity - _capacity < _capacity) {
+        capacity = std::max(capacity, 2 * _capacity);
+    }
+
+    // Allocate the blocks now. Running out of space while writing through the
+    // mapping would raise SIGBUS instead of returning an error.
+    int ret = posix_fallocate(_fd, 0, capacity);
+    if (ret == EOPNOTSUPP || ret == EINVAL) {
+        ret = ftruncate(_fd, capacity) < 0 ? errno : 0;
+    }
+    if (ret != 0) {
+        LOGE("%s: Failed to enlarge temporary file: %s",
+             _path.c_str(), strerror(ret));
+        return false;
+    }
+
+    void *map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     _fd, 0);
+    if (map == MAP_FAILED) {
+        LOGE("%s: Failed to map temporary file: %s",
+             _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (_map) {
+        munmap(_map, _capacity);
+    }
+
+    _map = static_cast<char *>(map);
+    _capacity = capacity;
+
+    return true;
+}
+
+CpioArchive::CpioArchive() : _garbage(0)
+{
+}
+
+/*!
+ * \brief Move file data to a temporary file once it exceeds \p threshold bytes
+ *
+ * This applies to the current and all future contents of the archive.
+ *
+ * \param threshold Maximum amount of file data to keep on the heap
+ * \param path Temporary files are created next to this path
+ */
+void CpioArchive::set_spill(uint64_t threshold, const std::string &path)
+{
+    _data.set_spill(threshold, path);
+}
+
+/*!
+ * \brief Load a (possibly compressed) newc cpio archive
+ *
+ * Any previously loaded entries are discarded. Hard links are resolved so that
+ * every entry has its own copy of the data.
+ *
+ * \param file MbFile handle positioned at the start of the archive
+ *
+ * \return Whether the archive was successfully loaded
+ */
+bool CpioArchive::load(MbFile *file)
+{
+    autoclose::archive a(archive_read_new(), archive_read_free);
+    archive_entry *entry;
+    LaReadCtx ctx;
+    uint64_t offset = 0;
+
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    // libarchive is only used for decompression. The raw format exposes the
+    // decompressed stream as a single entry.
+    archive_read_support_filter_gzip(a.get());
+    archive_read_support_filter_lzop(a.get());
+    archive_read_support_filter_lz4(a.get());
+    archive_read_support_filter_lzma(a.get());
+    archive_read_support_filter_xz(a.get());
+    archive_read_support_format_raw(a.get());
+
+    ctx.file = file;
+
+    if (archive_read_open(a.get(), &ctx, nullptr, &la_read_cb, nullptr)
+            != ARCHIVE_OK
+            || archive_read_next_header(a.get(), &entry) != ARCHIVE_OK) {
+        LOGE("Failed to open cpio archive: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    _entries.clear();
+    _names.clear();
+    _data.clear();
+    _garbage = 0;
+
+    while (true) {
+        char header[CPIO_HEADER_SIZE];
+        uint32_t fields[CPIO_FIELD_COUNT];
+        uint64_t header_offset = offset;
+
+        if (!read_exact(a.get(), header, sizeof(header), &offset)) {
+            return false;
+        }
+
+        if (memcmp(header, CPIO_NEWC_MAGIC, CPIO_MAGIC_SIZE) != 0
+                && memcmp(header, CPIO_NEWC_CRC_MAGIC, CPIO_MAGIC_SIZE) != 0) {
+            LOGE("Invalid newc cpio header at offset %" PRIu64,
+                 header_offset);
+            return false;
+        }
+
+        for (size_t i = 0; i < CPIO_FIELD_COUNT; ++i) {
+            if (!parse_hex(header + CPIO_MAGIC_SIZE + i * CPIO_FIELD_SIZE,
+                           &fields[i])) {
+                LOGE("Invalid field in cpio header at offset %" PRIu64,
+                     header_offset);
+                return false;
+            }
+        }
+
+        uint32_t data_size = fields[6];
+        uint32_t name_size = fields[11];
+
+        if (name_size == 0 || name_size > PATH_MAX) {
+            LOGE("Invalid path size in cpio header at offset %" PRIu64,
+                 header_offset);
+            return false;
+        }
+
+        std::string raw_name(name_size, '\0');
+
+        if (!read_exact(a.get(), &raw_name[0], name_size, &offset)
+                || !read_exact(a.get(), header, padding(offset), &offset)) {
+            LOGE("Invalid path in cpio header at offset %" PRIu64,
+                 header_offset);
+            return false;
+        }
+
+        if (strcmp(raw_name.c_str(), CPIO_TRAILER) == 0) {
+            break;
+        }
+
+        CpioEntry e{};
+        e.ino = fields[0];
+        e.mode = fields[1];
+        e.uid = fields[2];
+        e.gid = fields[3];
+        e.nlink = fields[4];
+        e.mtime = fields[5];
+        e.dev_major = fields[7];
+        e.dev_minor = fields[8];
+        e.rdev_major = fields[9];
+        e.rdev_minor = fields[10];
+        e.data_offset = _data.size();
+        e.data_size = data_size;
+
+        if (!read_to_arena(a.get(), &_data, data_size, &offset)
+                || !read_exact(a.get(), header, padding(offset), &offset)) {
+            return false;
+        }
+
+        std::string path = normalize_path(raw_name.c_str());
+        if (path.empty()) {
+            // Root of the archive
+            _data.resize(e.data_offset);
+            continue;
+        }
+
+        set_name(e, path);
+        _entries.push_back(e);
+    }
+
+    _filters.clear();
+    for (int i = 0; i < archive_filter_count(a.get()); ++i) {
+        int code = archive_filter_code(a.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            _filters.push_back(code);
+        }
+    }
+
+    // newc stores the data of hard linked files only once, with the last link.
+    // Give the other links their own copy. Entries never share data, which
+    // keeps the garbage accounting in release() exact.
+    for (auto &e : _entries) {
+        if (S_ISDIR(e.mode) || e.nlink < 2) {
+            continue;
+        }
+
+        if (e.data_size == 0) {
+            for (auto const &other : _entries) {
+                if (other.ino == e.ino && other.data_size > 0
+                        && other.dev_major == e.dev_major
+                        && other.dev_minor == e.dev_minor) {
+                    if (!set_data(e, data(other), other.data_size)) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+        }
+
+        e.nlink = 1;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the archive in newc format
+ *
+ * The archive is serialized in a single pass directly into the compressor.
+ * The output is padded to a multiple of 512 bytes.
+ *
+ * If the archive has a single gzip, LZ4, or xz filter and more than one thread
+ * is requested, the blocks of the compressed stream are compressed in
+ * parallel with ParallelCompressor. Otherwise, libarchive's filters are used.
+ *
+ * \param file MbFile handle to write the archive to
+ * \param threads Number of compression threads or 0 to use the number of CPUs
+ *
+ * \return Whether the archive was successfully written
+ */
+bool CpioArchive::save(MbFile *file, unsigned int threads) const
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    if (threads > 1 && _filters.size() == 1
+            && ParallelCompressor::is_supported(_filters[0])) {
+        int ret = save_parallel(*this, file, _filters[0], threads);
+        if (ret >= 0) {
+            return ret > 0;
+        }
+
+        LOGW("Falling back to single-threaded compression");
+    }
+
+    autoclose::archive a(archive_write_new(), archive_write_free);
+    autoclose::archive_entry entry(archive_entry_new(), archive_entry_free);
+
+    if (!a || !entry) {
+        LOGE("Failed to allocate archive writer or entry instance");
+        return false;
+    }
+
+    archive_write_set_format_raw(a.get());
+
+    for (const int &filter : _filters) {
+        if (archive_write_add_filter(a.get(), filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+    }
+
+    archive_write_set_bytes_per_block(a.get(), 512);
+
+    if (archive_write_open(a.get(), file, nullptr, &la_write_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open cpio archive for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    // The raw format requires a single regular file entry
+    archive_entry_set_filetype(entry.get(), AE_IFREG);
+
+    if (archive_write_header(a.get(), entry.get()) != ARCHIVE_OK) {
+        LOGE("Failed to write cpio archive: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    if (!write_archive(*this, [&](const void *buf, size_t size) {
+        if (archive_write_data(a.get(), buf, size)
+                != static_cast<la_ssize_t>(size)) {
+            LOGE("Failed to write cpio archive: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+        return true;
+    })) {
+        return false;
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close cpio archive: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+const std::vector<int> & CpioArchive::filters() const
+{
+    return _filters;
+}
+
+void CpioArchive::set_filters(std::vector<int> filters)
+{
+    _filters = std::move(filters);
+}
+
+const std::vector<CpioEntry> & CpioArchive::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find entry by path
+ *
+ * \return Entry or nullptr if the path does not exist in the archive. The
+ *         entry remains valid until the archive is modified.
+ */
+const CpioEntry * CpioArchive::find(const std::string &path) const
+{
+    std::string normalized = normalize_path(path.c_str());
+
+    for (auto const &e : _entries) {
+        if (normalized == name(e)) {
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
+
+const char * CpioArchive::name(const CpioEntry &entry) const
+{
+    return _names.data() + entry.name_offset;
+}
+
+const char * CpioArchive::data(const CpioEntry &entry) const
+{
+    return _data.data() + entry.data_offset;
+}
+
+bool CpioArchive::read_file(const std::string &path,
+                            std::string *data_out) const
+{
+    const CpioEntry *e = find(path);
+    if (!e) {
+        LOGE("%s: File does not exist in archive", path.c_str());
+        return false;
+    } else if (!S_ISREG(e->mode)) {
+        LOGE("%s: Not a regular file", path.c_str());
+        return false;
+    }
+
+    data_out->assign(data(*e), e->data_size);
+    return true;
+}
+
+bool CpioArchive::read_symlink(const std::string &path,
+                               std::string *target_out) const
+{
+    const CpioEntry *e = find(path);
+    if (!e) {
+        LOGE("%s: File does not exist in archive", path.c_str());
+        return false;
+    } else if (!S_ISLNK(e->mode)) {
+        LOGE("%s: Not a symlink", path.c_str());
+        return false;
+    }
+
+    target_out->assign(data(*e), e->data_size);
+    return true;
+}
+
+/*!
+ * \brief Add or replace a regular file
+ *
+ * If \p path already refers to a regular file, its contents and permissions
+ * are replaced and the remaining metadata is kept. Any other non-directory
+ * entry at \p path is replaced by a new file owned by root.
+ */
+bool CpioArchive::set_file(const std::string &path, const void *data,
+                           size_t size, mode_t perm)
+{
+    std::string normalized = normalize_path(path.c_str());
+
+    if (static_cast<uint64_t>(size) > UINT32_MAX) {
+        LOGE("%s: File is too large for cpio archive", normalized.c_str());
+        return false;
+    }
+
+    CpioEntry *e = file_entry(normalized, perm);
+    if (!e || !set_data(*e, data, size)) {
+        return false;
+    }
+
+    compact();
+    return true;
+}
+
+/*!
+ * \brief Add or replace a regular file with the remaining contents of a file
+ *
+ * The contents are read in chunks directly into the data arena, so they are
+ * subject to the spill threshold. Otherwise, this behaves like the other
+ * set_file() overload.
+ */
+bool CpioArchive::set_file(const std::string &path, MbFile *file, mode_t perm)
+{
+    std::string normalized = normalize_path(path.c_str());
+    size_t offset = _data.size();
+    size_t size = 0;
+
+    // Nothing is modified until the whole file has been read
+    while (true) {
+        size_t n;
+
+        if (size > UINT32_MAX) {
+            LOGE("%s: File is too large for cpio archive", normalized.c_str());
+            _data.resize(offset);
+            return false;
+        } else if (!_data.resize(offset + size + CPIO_READ_CHUNK_SIZE)) {
+            _data.resize(offset);
+            return false;
+        } else if (mb_file_read_fully(file, _data.data() + offset + size,
+                                      CPIO_READ_CHUNK_SIZE, &n)
+                != MB_FILE_OK) {
+            LOGE("%s: Failed to read data: %s",
+                 normalized.c_str(), mb_file_error_string(file));
+            _data.resize(offset);
+            return false;
+        }
+
+        size += n;
+
+        if (n < CPIO_READ_CHUNK_SIZE) {
+            break;
+        }
+    }
+
+    _data.resize(offset + size);
+
+    CpioEntry *e = file_entry(normalized, perm);
+    if (!e) {
+        _data.resize(offset);
+        return false;
+    }
+
+    _garbage += e->data_size;
+    e->data_offset = offset;
+    e->data_size = size;
+
+    compact();
+    return true;
+}
+
+/*!
+ * \brief Add or replace a symlink
+ *
+ * Any existing non-directory entry at \p path is replaced.
+ */
+bool CpioArchive::set_symlink(const std::string &path,
+                              const std::string &target)
+{
+    std::string normalized = normalize_path(path.c_str());
+
+    const CpioEntry *e = find(normalized);
+    if (e) {
+        if (S_ISDIR(e->mode)) {
+            LOGE("%s: Cannot replace directory with symlink",
+                 normalized.c_str());
+            return false;
+        } else if (!erase(normalized)) {
+            return false;
+        }
+    }
+
+    CpioEntry *new_e = new_entry(normalized, S_IFLNK | 0777);
+    if (!new_e) {
+        return false;
+    }
+
+    if (!set_data(*new_e, target.data(), target.size())) {
+        return false;
+    }
+
+    compact();
+    return true;
+}
+
+/*!
+ * \brief Add a directory or change the permissions of an existing one
+ */
+bool CpioArchive::set_directory(const std::string &path, mode_t perm)
+{
+    std::string normalized = normalize_path(path.c_str());
+
+    CpioEntry *e = find_mutable(normalized);
+    if (e) {
+        if (!S_ISDIR(e->mode)) {
+            LOGE("%s: Exists and is not a directory", normalized.c_str());
+            return false;
+        }
+
+        e->mode = S_IFDIR | (perm & 07777);
+        return true;
+    }
+
+    return new_entry(normalized, S_IFDIR | (perm & 07777)) != nullptr;
+}
+
+/*!
+ * \brief Remove an entry
+ *
+ * If the entry is a directory, its children are removed as well.
+ */
+bool CpioArchive::remove(const std::string &path)
+{
+    if (!erase(normalize_path(path.c_str()))) {
+        return false;
+    }
+
+    compact();
+    return true;
+}
+
+/*!
+ * \brief Rename an entry
+ *
+ * If the entry is a directory, its children are moved as well. Fails if
+ * \p new_path already exists.
+ */
+bool CpioArchive::rename(const std::string &path, const std::string &new_path)
+{
+    std::string normalized = normalize_path(path.c_str());
+    std::string new_normalized = normalize_path(new_path.c_str());
+
+    if (!find(normalized)) {
+        LOGE("%s: File does not exist in archive", normalized.c_str());
+        return false;
+    } else if (find(new_normalized)) {
+        LOGE("%s: File already exists in archive", new_normalized.c_str());
+        return false;
+    } else if (!check_parent(new_normalized)) {
+        return false;
+    }
+
+    for (auto &e : _entries) {
+        std::string p = name(e);
+
+        if (p == normalized || is_child_of(p.c_str(), normalized)) {
+            _garbage += p.size() + 1;
+            set_name(e, new_normalized + p.substr(normalized.size()));
+        }
+    }
+
+    compact();
+    return true;
+}
+
+/*!
+ * \brief Extract an entry to the filesystem
+ *
+ * The entry is written to \p path relative to \p root. Parent directories are
+ * created as needed and any existing non-directory file at the destination is
+ * replaced. The owner, permissions, and modification time are restored.
+ *
+ * Archives are untrusted input, so \p path must not be absolute or contain
+ * ".." components. Symlinks are never followed below \p root, including ones
+ * created by previously extracted entries. Only \p root itself may be (or be
+ * located under) a symlink.
+ *
+ * \param entry Entry to extract
+ * \param root Directory to extract into
+ * \param path Destination path relative to \p root
+ *
+ * \return Whether the entry was extracted
+ */
+bool CpioArchive::extract(const CpioEntry &entry, const std::string &root,
+                          const std::string &path) const
+{
+    std::vector<std::string> components;
+    mode_t perm = entry.mode & 07777;
+
+    if (!split_extract_path(path, &components)) {
+        LOGE("%s: Refusing to extract unsafe path", path.c_str());
+        return false;
+    }
+
+    if (!mkdir_recursive(root, 0755)) {
+        LOGE("%s: Failed to create directory: %s",
+             root.c_str(), strerror(errno));
+        return false;
+    }
+
+    int dfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        LOGE("%s: Failed to open directory: %s",
+             root.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_dfd = finally([&]{
+        close(dfd);
+    });
+
+    for (size_t i = 0; i + 1 < components.size(); ++i) {
+        int fd = open_subdirectory(dfd, components[i], path);
+        if (fd < 0) {
+            return false;
+        }
+
+        close(dfd);
+        dfd = fd;
+    }
+
+    const char *name = components.back().c_str();
+    int fd = -1;
+
+    auto close_fd = finally([&]{
+        if (fd >= 0) {
+            close(fd);
+        }
+    });
+
+    if (S_ISDIR(entry.mode)) {
+        struct stat sb;
+
+        // Replace anything that isn't a real directory, including symlinks
+        if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+                && !S_ISDIR(sb.st_mode) && unlinkat(dfd, name, 0) < 0) {
+            LOGE("%s: Failed to remove existing file: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+    } else if (unlinkat(dfd, name, 0) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to remove existing file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    switch (entry.mode & S_IFMT) {
+    case S_IFDIR:
+        if (mkdirat(dfd, name, perm) < 0 && errno != EEXIST) {
+            LOGE("%s: Failed to create directory: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            LOGE("%s: Failed to open directory: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+        break;
+
+    case S_IFREG:
+        // O_EXCL ensures that a file (or symlink) created in the meantime is
+        // never written through
+        fd = openat(dfd, name,
+                    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, perm);
+        if (fd < 0) {
+            LOGE("%s: Failed to open for writing: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (!write_fd_fully(fd, data(entry), entry.data_size)) {
+            LOGE("%s: Failed to write file: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+        break;
+
+    case S_IFLNK: {
+        std::string link_target(data(entry), entry.data_size);
+
+        if (symlinkat(link_target.c_str(), dfd, name) < 0) {
+            LOGE("%s: Failed to create symlink: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+        break;
+    }
+
+    default:
+        if (mknodat(dfd, name, entry.mode,
+                    makedev(entry.rdev_major, entry.rdev_minor)) < 0) {
+            LOGE("%s: Failed to create special file: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+        break;
+    }
+
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = entry.mtime;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+
+    if (fd >= 0) {
+        if (fchown(fd, entry.uid, entry.gid) < 0) {
+            LOGE("%s: Failed to change owner: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        } else if (fchmod(fd, perm) < 0) {
+            LOGE("%s: Failed to change mode: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        } else if (futimens(fd, times) < 0) {
+            LOGE("%s: Failed to set modification time: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        int ret = close(fd);
+        fd = -1;
+
+        if (ret < 0) {
+            LOGE("%s: Failed to close file: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    if (fchownat(dfd, name, entry.uid, entry.gid, AT_SYMLINK_NOFOLLOW) < 0) {
+        LOGE("%s: Failed to change owner: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Special files were just created by mknodat() in a directory that was
+    // opened without following symlinks, so the path still refers to them
+    if (!S_ISLNK(entry.mode) && fchmodat(dfd, name, perm, 0) < 0) {
+        LOGE("%s: Failed to change mode: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (utimensat(dfd, name, times, AT_SYMLINK_NOFOLLOW) < 0) {
+        LOGE("%s: Failed to set modification time: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+CpioEntry * CpioArchive::find_mutable(const std::string &path)
+{
+    return const_cast<CpioEntry *>(find(path));
+}
+
+bool CpioArchive::erase(const std::string &path)
+{
+    if (!find(path)) {
+        LOGE("%s: File does not exist in archive", path.c_str());
+        return false;
+    }
+
+    auto it = std::remove_if(_entries.begin(), _entries.end(),
+                             [&](const CpioEntry &e) {
+        const char *p = name(e);
+        if (path == p || is_child_of(p, path)) {
+            release(e);
+            return true;
+        }
+        return false;
+    });
+    _entries.erase(it, _entries.end());
+
+    return true;
+}
+
+bool CpioArchive::check_parent(const std::string &path) const
+{
+    auto pos = path.rfind('/');
+    if (pos == std::string::npos) {
+        return true;
+    }
+
+    const CpioEntry *e = find(path.substr(0, pos));
+    if (!e || !S_ISDIR(e->mode)) {
+        LOGE("%s: Parent directory does not exist in archive", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+CpioEntry * CpioArchive::new_entry(const std::string &path, mode_t mode)
+{
+    if (path.empty()) {
+        LOGE("Cannot add entry with empty path");
+        return nullptr;
+    } else if (!check_parent(path)) {
+        return nullptr;
+    }
+
+    // Use an inode number that no other entry has
+    uint32_t ino = 0;
+    for (auto const &e : _entries) {
+        ino = std::max(ino, e.ino);
+    }
+
+    CpioEntry e{};
+    e.ino = ino + 1;
+    e.mode = mode;
+    e.nlink = 1;
+    e.data_offset = _data.size();
+
+    set_name(e, path);
+    _entries.push_back(e);
+
+    return &_entries.back();
+}
+
+/*!
+ * \brief Get the regular file entry at \p path, creating it if needed
+ *
+ * An existing regular file gets the new permissions. Any other non-directory
+ * entry is replaced.
+ */
+CpioEntry * CpioArchive::file_entry(const std::string &path, mode_t perm)
+{
+    CpioEntry *e = find_mutable(path);
+    if (e) {
+        if (S_ISREG(e->mode)) {
+            e->mode = S_IFREG | (perm & 07777);
+            return e;
+        } else if (S_ISDIR(e->mode)) {
+            LOGE("%s: Cannot replace directory with file", path.c_str());
+            return nullptr;
+        } else if (!erase(path)) {
+            return nullptr;
+        }
+    }
+
+    return new_entry(path, S_IFREG | (perm & 07777));
+}
+
+void CpioArchive::set_name(CpioEntry &entry, const std::string &path)
+{
+    entry.name_offset = _names.size();
+    _names.append(path.c_str(), path.size() + 1);
+}
+
+bool CpioArchive::set_data(CpioEntry &entry, const void *data, size_t size)
+{
+    size_t offset = _data.size();
+
+    // The source may be in the arena, which CpioArena::append() handles
+    if (!_data.append(data, size)) {
+        return false;
+    }
+
+    _garbage += entry.data_size;
+    entry.data_offset = offset;
+    entry.data_size = size;
+
+    return true;
+}
+
+void CpioArchive::release(const CpioEntry &entry)
+{
+    _garbage += strlen(name(entry)) + 1 + entry.data_size;
+}
+
+/*!
+ * \brief Rebuild the arenas if more than half of their contents are unused
+ */
+void CpioArchive::compact()
+{
+    if (_garbage * 2 <= _names.size() + _data.size()) {
+        return;
+    }
+
+    std::string names;
+    CpioArena data;
+    std::vector<size_t> data_offsets;
+
+    names.reserve(_names.size() - std::min(_garbage, _names.size()));
+    data.set_spill(_data.spill_threshold(), _data.spill_path());
+    data_offsets.reserve(_entries.size());
+
+    for (auto const &e : _entries) {
+        data_offsets.push_back(data.size());
+
+        if (!data.append(_data.data() + e.data_offset, e.data_size)) {
+            // Keep the old arenas. Nothing has been modified yet.
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        CpioEntry &e = _entries[i];
+        size_t name_offset = names.size();
+
+        names.append(name(e));
+        names.push_back('\0');
+
+        e.name_offset = name_offset;
+        e.data_offset = data_offsets[i];
+    }
+
+    _names.swap(names);
+    _data.swap(data);
+    _garbage = 0;
+}
+
+}
+}
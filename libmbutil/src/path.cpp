@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <libgen.h>
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <cstdlib>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbutil/compress.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+typedef std::unique_ptr<archive, decltype(archive_read_free) *> ScopedArchive;
+
+using namespace mb::util;
+
+static std::string make_input(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    // Compressible text with some incompressible runs in between
+    uint32_t state = 12345;
+    while (data.size() < size) {
+        if (data.size() % (700 * 1024) < 100 * 1024) {
+            state = state * 1103515245 + 12345;
+            data.push_back(static_cast<char>(state >> 16));
+        } else {
+            data.append("ro.build.property=");
+            data.append(std::to_string(data.size() % 9973));
+            data.push_back('\n');
+        }
+    }
+
+    data.resize(size);
+    return data;
+}
+
+static bool compress(const std::string &data, int filter,
+                     unsigned int threads, std::string *out)
+{
+    ScopedFile file(mb_file_new(), mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    if (!file || mb_file_open_memory_dynamic(file.get(), &buf, &size)
+            != MB_FILE_OK) {
+        return false;
+    }
+
+    ParallelCompressor pc;
+    bool ret = pc.open(file.get(), filter, threads);
+
+    // Odd write sizes so that blocks span several writes
+    for (size_t offset = 0; ret && offset < data.size(); offset += 77777) {
+        size_t n = std::min<size_t>(77777, data.size() - offset);
+        ret = pc.write(data.data() + offset, n);
+    }
+
+    ret = ret && pc.close() && pc.bytes_written() == size
+            && mb_file_close(file.get()) == MB_FILE_OK;
+    if (ret) {
+        out->assign(static_cast<char *>(buf), size);
+    }
+
+    free(buf);
+    return ret;
+}
+
+static bool decompress(const std::string &data, int filter, std::string *out)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    archive_entry *entry;
+    char buf[65536];
+    la_ssize_t n;
+
+    if (!a) {
+        return false;
+    }
+
+    archive_read_support_filter_all(a.get());
+    archive_read_support_format_raw(a.get());
+
+    if (archive_read_open_memory(a.get(), data.data(), data.size())
+            != ARCHIVE_OK
+            || archive_read_next_header(a.get(), &entry) != ARCHIVE_OK
+            || archive_filter_count(a.get()) != 2
+            || archive_filter_code(a.get(), 0) != filter) {
+        return false;
+    }
+
+    out->clear();
+
+    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+        out->append(buf, n);
+    }
+
+    return n == 0;
+}
+
+/*!
+ * \brief Clear the modification time in a gzip header
+ */
+static void strip_mtime(std::string *data, int filter)
+{
+    if (filter == ARCHIVE_FILTER_GZIP && data->size() >= 8) {
+        std::fill(data->begin() + 4, data->begin() + 8, '\0');
+    }
+}
+
+static void check_round_trip(int filter)
+{
+    // Larger than one batch of LZ4 blocks at 4 threads
+    std::string input = make_input(17 * 1024 * 1024 + 123);
+
+    for (unsigned int threads : { 1u, 4u }) {
+        std::string compressed;
+        std::string output;
+
+        ASSERT_TRUE(compress(input, filter, threads, &compressed)) << threads;
+        ASSERT_LT(compressed.size(), input.size()) << threads;
+        ASSERT_TRUE(decompress(compressed, filter, &output)) << threads;
+        ASSERT_TRUE(output == input) << threads;
+    }
+
+    // Input smaller than a block
+    for (unsigned int threads : { 1u, 4u }) {
+        std::string compressed;
+        std::string output;
+
+        ASSERT_TRUE(compress("x", filter, threads, &compressed)) << threads;
+        ASSERT_TRUE(decompress(compressed, filter, &output)) << threads;
+        ASSERT_EQ(output, "x") << threads;
+    }
+}
+
+static void check_thread_independence(int filter)
+{
+    std::string input = make_input(3 * 1024 * 1024 + 4567);
+    std::string expected;
+
+    ASSERT_TRUE(compress(input, filter, 1, &expected));
+    strip_mtime(&expected, filter);
+
+    for (unsigned int threads : { 2u, 3u, 8u }) {
+        std::string compressed;
+
+        ASSERT_TRUE(compress(input, filter, threads, &compressed)) << threads;
+        strip_mtime(&compressed, filter);
+        ASSERT_TRUE(compressed == expected) << threads;
+    }
+}
+
+TEST(ParallelCompressorTest, GzipShouldRoundTrip)
+{
+    check_round_trip(ARCHIVE_FILTER_GZIP);
+}
+
+TEST(ParallelCompressorTest, Lz4ShouldRoundTrip)
+{
+    check_round_trip(ARCHIVE_FILTER_LZ4);
+}
+
+TEST(ParallelCompressorTest, XzShouldRoundTrip)
+{
+    check_round_trip(ARCHIVE_FILTER_XZ);
+}
+
+TEST(ParallelCompressorTest, GzipOutputShouldNotDependOnThreadCount)
+{
+    check_thread_independence(ARCHIVE_FILTER_GZIP);
+}
+
+TEST(ParallelCompressorTest, Lz4OutputShouldNotDependOnThreadCount)
+{
+    check_thread_independence(ARCHIVE_FILTER_LZ4);
+}
+
+TEST(ParallelCompressorTest, XzOutputShouldNotDependOnThreadCount)
+{
+    check_thread_independence(ARCHIVE_FILTER_XZ);
+}
+
+TEST(ParallelCompressorTest, UnsupportedFilterShouldFail)
+{
+    ScopedFile file(mb_file_new(), mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    ASSERT_EQ(mb_file_open_memory_dynamic(file.get(), &buf, &size),
+              MB_FILE_OK);
+
+    ParallelCompressor pc;
+    ASSERT_FALSE(ParallelCompressor::is_supported(ARCHIVE_FILTER_BZIP2));
+    ASSERT_FALSE(pc.open(file.get(), ARCHIVE_FILTER_BZIP2, 1));
+    ASSERT_EQ(pc.bytes_written(), 0u);
+
+    file.reset();
+    free(buf);
+}
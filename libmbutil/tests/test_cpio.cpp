@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbutil/cpio.h"
+#include "mbutil/delete.h"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+
+using namespace mb::util;
+
+struct RawEntry
+{
+    const char *name;
+    uint32_t mode;
+    std::string data;
+    uint32_t ino;
+    uint32_t nlink;
+};
+
+static void append_raw_entry(std::string *out, const RawEntry &entry,
+                             uint32_t data_size)
+{
+    char header[111];
+    size_t name_size = strlen(entry.name) + 1;
+
+    snprintf(header, sizeof(header),
+             "070701%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x",
+             entry.ino, entry.mode, static_cast<unsigned>(getuid()),
+             static_cast<unsigned>(getgid()), entry.nlink, 0u, data_size,
+             0u, 0u, 0u, 0u, static_cast<unsigned>(name_size), 0u);
+
+    out->append(header, 110);
+    out->append(entry.name, name_size);
+    out->append((4 - out->size() % 4) % 4, '\0');
+    out->append(entry.data);
+    out->append((4 - out->size() % 4) % 4, '\0');
+}
+
+static std::string make_raw_archive(const std::vector<RawEntry> &entries)
+{
+    std::string out;
+
+    for (auto const &entry : entries) {
+        append_raw_entry(&out, entry, entry.data.size());
+    }
+    append_raw_entry(&out, { "TRAILER!!!", 0, {}, 0, 1 }, 0);
+
+    return out;
+}
+
+static bool load_string(CpioArchive *cpio, const std::string &data)
+{
+    ScopedFile file(mb_file_new(), mb_file_free);
+
+    return file && mb_file_open_memory_static(file.get(), data.data(),
+                                              data.size()) == MB_FILE_OK
+            && cpio->load(file.get());
+}
+
+static bool save_string(const CpioArchive &cpio, std::string *data_out)
+{
+    ScopedFile file(mb_file_new(), mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    bool ret = file && mb_file_open_memory_dynamic(file.get(), &buf, &size)
+            == MB_FILE_OK
+            && cpio.save(file.get(), 1)
+            && mb_file_close(file.get()) == MB_FILE_OK;
+    if (ret) {
+        data_out->assign(static_cast<char *>(buf), size);
+    }
+
+    free(buf);
+    return ret;
+}
+
+static std::string read_contents(const CpioArchive &cpio, const char *path)
+{
+    std::string data;
+    EXPECT_TRUE(cpio.read_file(path, &data)) << path;
+    return data;
+}
+
+TEST(CpioTest, SaveThenLoadShouldPreserveEntries)
+{
+    CpioArchive cpio;
+    ASSERT_TRUE(cpio.set_directory("sbin", 0750));
+    ASSERT_TRUE(cpio.set_file("sbin/busybox", "binary", 6, 0755));
+    ASSERT_TRUE(cpio.set_file("/default.prop", "a=b\n", 4, 0644));
+    ASSERT_TRUE(cpio.set_symlink("./init", "sbin/busybox"));
+
+    std::string data;
+    ASSERT_TRUE(save_string(cpio, &data));
+    ASSERT_EQ(data.size() % 512, 0u);
+
+    CpioArchive loaded;
+    ASSERT_TRUE(load_string(&loaded, data));
+    ASSERT_EQ(loaded.entries().size(), 4u);
+    ASSERT_TRUE(loaded.filters().empty());
+
+    const CpioEntry *dir = loaded.find("sbin/");
+    ASSERT_NE(dir, nullptr);
+    ASSERT_EQ(dir->mode, static_cast<uint32_t>(S_IFDIR | 0750));
+
+    const CpioEntry *file = loaded.find("sbin/busybox");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(file->mode, static_cast<uint32_t>(S_IFREG | 0755));
+    ASSERT_EQ(read_contents(loaded, "sbin/busybox"), "binary");
+    ASSERT_EQ(read_contents(loaded, "default.prop"), "a=b\n");
+
+    std::string target;
+    ASSERT_TRUE(loaded.read_symlink("init", &target));
+    ASSERT_EQ(target, "sbin/busybox");
+
+    // Saving an unmodified archive should produce identical output
+    std::string resaved;
+    ASSERT_TRUE(save_string(loaded, &resaved));
+    ASSERT_EQ(resaved, data);
+}
+
+TEST(CpioTest, CompressedArchiveShouldKeepFilter)
+{
+    CpioArchive cpio;
+    std::string contents(100000, 'x');
+    ASSERT_TRUE(cpio.set_file("file", contents.data(), contents.size(), 0644));
+    cpio.set_filters({ ARCHIVE_FILTER_GZIP });
+
+    std::string data;
+    ASSERT_TRUE(save_string(cpio, &data));
+    ASSERT_GE(data.size(), 2u);
+    ASSERT_EQ(static_cast<unsigned char>(data[0]), 0x1f);
+    ASSERT_EQ(static_cast<unsigned char>(data[1]), 0x8b);
+    ASSERT_LT(data.size(), contents.size());
+
+    CpioArchive loaded;
+    ASSERT_TRUE(load_string(&loaded, data));
+    ASSERT_EQ(loaded.filters(), std::vector<int>{ ARCHIVE_FILTER_GZIP });
+    ASSERT_EQ(read_contents(loaded, "file"), contents);
+}
+
+TEST(CpioTest, EditsShouldApplyToChildren)
+{
+    CpioArchive cpio;
+    ASSERT_TRUE(cpio.set_directory("a", 0755));
+    ASSERT_TRUE(cpio.set_directory("a/b", 0755));
+    ASSERT_TRUE(cpio.set_file("a/b/c", "c", 1, 0644));
+    ASSERT_TRUE(cpio.set_file("ab", "ab", 2, 0644));
+
+    // Adding to a nonexistent directory should fail
+    ASSERT_FALSE(cpio.set_file("x/y", "y", 1, 0644));
+
+    // Renaming a directory moves its children, but not siblings that share
+    // the same prefix
+    ASSERT_TRUE(cpio.rename("a", "z"));
+    ASSERT_EQ(cpio.find("a/b/c"), nullptr);
+    ASSERT_EQ(read_contents(cpio, "z/b/c"), "c");
+    ASSERT_EQ(read_contents(cpio, "ab"), "ab");
+
+    // Renaming onto an existing entry should fail
+    ASSERT_FALSE(cpio.rename("ab", "z"));
+
+    ASSERT_TRUE(cpio.remove("z"));
+    ASSERT_EQ(cpio.find("z/b"), nullptr);
+    ASSERT_EQ(cpio.entries().size(), 1u);
+    ASSERT_FALSE(cpio.remove("z"));
+
+    // Directories are not replaced by files
+    ASSERT_TRUE(cpio.set_directory("d", 0755));
+    ASSERT_FALSE(cpio.set_file("d", "d", 1, 0644));
+    ASSERT_FALSE(cpio.set_symlink("d", "target"));
+
+    // Files are replaced by symlinks and vice versa
+    ASSERT_TRUE(cpio.set_symlink("ab", "target"));
+    ASSERT_TRUE(cpio.set_file("ab", "file", 4, 0600));
+    ASSERT_EQ(read_contents(cpio, "ab"), "file");
+}
+
+TEST(CpioTest, ReplacingDataShouldReclaimSpace)
+{
+    CpioArchive cpio;
+    ASSERT_TRUE(cpio.set_file("keep", "keep", 4, 0644));
+
+    // Enough replacements to trigger several compactions
+    for (int i = 0; i < 100; ++i) {
+        std::string data(1000 + i, static_cast<char>('a' + i % 26));
+        ASSERT_TRUE(cpio.set_file("file", data.data(), data.size(), 0644));
+        ASSERT_EQ(read_contents(cpio, "file"), data);
+        ASSERT_EQ(read_contents(cpio, "keep"), "keep");
+    }
+
+    // Replacing a file with its own data must not read freed memory
+    const CpioEntry *e = cpio.find("file");
+    ASSERT_NE(e, nullptr);
+    std::string expected(cpio.data(*e), 10);
+    ASSERT_TRUE(cpio.set_file("file", cpio.data(*e), 10, 0644));
+    ASSERT_EQ(read_contents(cpio, "file"), expected);
+}
+
+TEST(CpioTest, HardLinksShouldNotShareData)
+{
+    // newc only stores the data with the last link
+    std::string raw = make_raw_archive({
+        { "a", S_IFREG | 0644, "", 10, 2 },
+        { "b", S_IFREG | 0644, "shared", 10, 2 },
+        { "c", S_IFREG | 0644, "other", 11, 1 },
+    });
+
+    CpioArchive cpio;
+    ASSERT_TRUE(load_string(&cpio, raw));
+    ASSERT_EQ(read_contents(cpio, "a"), "shared");
+    ASSERT_EQ(read_contents(cpio, "b"), "shared");
+
+    for (auto const &e : cpio.entries()) {
+        ASSERT_EQ(e.nlink, 1u);
+    }
+
+    // Removing one link and compacting must not affect the other
+    ASSERT_TRUE(cpio.remove("b"));
+    for (int i = 0; i < 10; ++i) {
+        std::string data(100, static_cast<char>('0' + i));
+        ASSERT_TRUE(cpio.set_file("c", data.data(), data.size(), 0644));
+    }
+    ASSERT_EQ(read_contents(cpio, "a"), "shared");
+
+    ASSERT_TRUE(cpio.set_file("a", "changed", 7, 0644));
+    ASSERT_EQ(read_contents(cpio, "a"), "changed");
+}
+
+TEST(CpioTest, LoadShouldRejectBadMagic)
+{
+    std::string raw = make_raw_archive({ { "a", S_IFREG | 0644, "a", 1, 1 } });
+    raw[5] = '9';
+
+    CpioArchive cpio;
+    ASSERT_FALSE(load_string(&cpio, raw));
+}
+
+TEST(CpioTest, LoadShouldRejectInvalidField)
+{
+    std::string raw = make_raw_archive({ { "a", S_IFREG | 0644, "a", 1, 1 } });
+    raw[6 + 8 * 6] = 'g';
+
+    CpioArchive cpio;
+    ASSERT_FALSE(load_string(&cpio, raw));
+}
+
+TEST(CpioTest, LoadShouldRejectTruncatedArchive)
+{
+    std::string raw = make_raw_archive({
+        { "a", S_IFREG | 0644, std::string(100, 'a'), 1, 1 },
+    });
+
+    CpioArchive cpio;
+
+    // In the header, path, data, and trailer
+    for (size_t size : { size_t(50), size_t(112), size_t(150),
+                         raw.size() - 10 }) {
+        ASSERT_FALSE(load_string(&cpio, raw.substr(0, size))) << size;
+    }
+
+    // Without the trailer
+    std::string no_trailer;
+    append_raw_entry(&no_trailer, { "a", S_IFREG | 0644, "a", 1, 1 }, 1);
+    ASSERT_FALSE(load_string(&cpio, no_trailer));
+}
+
+TEST(CpioTest, LoadShouldRejectOversizedFields)
+{
+    CpioArchive cpio;
+
+    // A huge data size must fail as truncated instead of being allocated
+    std::string raw;
+    append_raw_entry(&raw, { "a", S_IFREG | 0644, "short", 1, 1 },
+                     0xffffffffu);
+    ASSERT_FALSE(load_string(&cpio, raw));
+
+    // Same for the path size
+    raw = make_raw_archive({ { "a", S_IFREG | 0644, "a", 1, 1 } });
+    raw.replace(6 + 8 * 11, 8, "ffffffff");
+    ASSERT_FALSE(load_string(&cpio, raw));
+
+    raw.replace(6 + 8 * 11, 8, "00000000");
+    ASSERT_FALSE(load_string(&cpio, raw));
+}
+
+struct CpioExtractTest : testing::Test
+{
+    std::string _dir;
+    std::string _root;
+    std::string _outside;
+
+    virtual void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        _dir = tmpdir ? tmpdir : "/tmp";
+        _dir += "/mbutil_test_cpio.XXXXXX";
+
+        ASSERT_NE(mkdtemp(&_dir[0]), nullptr);
+
+        _root = _dir + "/root";
+        _outside = _dir + "/outside";
+        ASSERT_EQ(mkdir(_outside.c_str(), 0755), 0);
+    }
+
+    virtual void TearDown() override
+    {
+        mb::util::delete_recursive(_dir);
+    }
+
+    bool exists(const std::string &path)
+    {
+        struct stat sb;
+        return lstat(path.c_str(), &sb) == 0;
+    }
+};
+
+TEST_F(CpioExtractTest, ExtractShouldRestoreEntries)
+{
+    std::string raw = make_raw_archive({
+        { "sbin", S_IFDIR | 0750, "", 1, 2 },
+        { "sbin/file", S_IFREG | 0640, "contents", 2, 1 },
+        { "sbin/link", S_IFLNK | 0777, "file", 3, 1 },
+    });
+
+    CpioArchive cpio;
+    ASSERT_TRUE(load_string(&cpio, raw));
+
+    for (auto const &e : cpio.entries()) {
+        ASSERT_TRUE(cpio.extract(e, _root, cpio.name(e))) << cpio.name(e);
+    }
+
+    struct stat sb;
+    ASSERT_EQ(lstat((_root + "/sbin").c_str(), &sb), 0);
+    ASSERT_TRUE(S_ISDIR(sb.st_mode));
+    ASSERT_EQ(sb.st_mode & 07777, 0750u);
+
+    ASSERT_EQ(lstat((_root + "/sbin/file").c_str(), &sb), 0);
+    ASSERT_TRUE(S_ISREG(sb.st_mode));
+    ASSERT_EQ(sb.st_mode & 07777, 0640u);
+    ASSERT_EQ(sb.st_size, 8);
+
+    char buf[PATH_MAX];
+    ssize_t n = readlink((_root + "/sbin/link").c_str(), buf, sizeof(buf));
+    ASSERT_EQ(std::string(buf, std::max<ssize_t>(n, 0)), "file");
+
+    // Extracting again should replace the existing files
+    for (auto const &e : cpio.entries()) {
+        ASSERT_TRUE(cpio.extract(e, _root, cpio.name(e))) << cpio.name(e);
+    }
+}
+
+TEST_F(CpioExtractTest, ExtractShouldRejectDotDot)
+{
+    std::string raw = make_raw_archive({
+        { "sbin/../../outside/file", S_IFREG | 0644, "evil", 1, 1 },
+    });
+
+    CpioArchive cpio;
+    ASSERT_TRUE(load_string(&cpio, raw));
+    ASSERT_EQ(cpio.entries().size(), 1u);
+
+    const CpioEntry &e = cpio.entries()[0];
+    ASSERT_FALSE(cpio.extract(e, _root, cpio.name(e)));
+    ASSERT_FALSE(cpio.extract(e, _root, "../outside/file"));
+    ASSERT_FALSE(cpio.extract(e, _root, "/outside/file"));
+    ASSERT_FALSE(cpio.extract(e, _root, "."));
+    ASSERT_FALSE(exists(_outside + "/file"));
+
+    // Names that merely contain dots are fine
+    ASSERT_TRUE(cpio.extract(e, _root, "sbin/..file"));
+    ASSERT_TRUE(exists(_root + "/sbin/..file"));
+}
+
+TEST_F(CpioExtractTest, ExtractShouldNotFollowSymlinkedParents)
+{
+    // The first entry redirects sbin/ outside of the root
+    std::string raw = make_raw_archive({
+        { "sbin", S_IFLNK | 0777, _outside, 1, 1 },
+        { "sbin/file", S_IFREG | 0644, "evil", 2, 1 },
+    });
+
+    CpioArchive cpio;
+    ASSERT_TRUE(load_string(&cpio, raw));
+    ASSERT_EQ(cpio.entries().size(), 2u);
+
+    const CpioEntry &link = cpio.entries()[0];
+    const CpioEntry &file = cpio.entries()[1];
+    ASSERT_TRUE(cpio.extract(link, _root, cpio.name(link)));
+    ASSERT_FALSE(cpio.extract(file, _root, cpio.name(file)));
+    ASSERT_FALSE(exists(_outside + "/file"));
+}
+
+TEST_F(CpioExtractTest, ExtractShouldReplaceSymlinkInsteadOfFollowing)
+{
+    std::string raw = make_raw_archive({
+        { "file", S_IFREG | 0644, "contents", 1, 1 },
+        { "dir", S_IFDIR | 0755, "", 2, 2 },
+    });
+
+    CpioArchive cpio;
+    ASSERT_TRUE(load_string(&cpio, raw));
+
+    ASSERT_EQ(mkdir(_root.c_str(), 0755), 0);
+    ASSERT_EQ(symlink((_outside + "/file").c_str(),
+                      (_root + "/file").c_str()), 0);
+    ASSERT_EQ(symlink(_outside.c_str(), (_root + "/dir").c_str()), 0);
+
+    for (auto const &e : cpio.entries()) {
+        ASSERT_TRUE(cpio.extract(e, _root, cpio.name(e))) << cpio.name(e);
+    }
+
+    struct stat sb;
+    ASSERT_EQ(lstat((_root + "/file").c_str(), &sb), 0);
+    ASSERT_TRUE(S_ISREG(sb.st_mode));
+    ASSERT_EQ(lstat((_root + "/dir").c_str(), &sb), 0);
+    ASSERT_TRUE(S_ISDIR(sb.st_mode));
+    ASSERT_FALSE(exists(_outside + "/file"));
+}
+
+struct CpioSpillTest : CpioExtractTest
+{
+    size_t count_files()
+    {
+        DIR *dp = opendir(_dir.c_str());
+        size_t count = 0;
+
+        if (dp) {
+            while (dirent *ent = readdir(dp)) {
+                if (strcmp(ent->d_name, ".") != 0
+                        && strcmp(ent->d_name, "..") != 0) {
+                    ++count;
+                }
+            }
+            closedir(dp);
+        }
+
+        return count;
+    }
+};
+
+TEST_F(CpioSpillTest, SpilledArchiveShouldMatchInMemoryArchive)
+{
+    static const char *names[] = { "a", "b", "c", "d", "e" };
+    std::vector<RawEntry> entries;
+
+    for (uint32_t i = 0; i < 5; ++i) {
+        entries.push_back({ names[i], S_IFREG | 0644,
+                            std::string(100000, 'a' + i), i + 1, 1 });
+    }
+
+    std::string raw = make_raw_archive(entries);
+
+    CpioArchive memory;
+    CpioArchive spilled;
+    spilled.set_spill(64 * 1024, _dir + "/spill");
+    ASSERT_TRUE(load_string(&memory, raw));
+    ASSERT_TRUE(load_string(&spilled, raw));
+
+    for (CpioArchive *cpio : { &memory, &spilled }) {
+        // Source data is in the arena
+        const CpioEntry *e = cpio->find("b");
+        ASSERT_NE(e, nullptr);
+        ASSERT_TRUE(cpio->set_file("c", cpio->data(*e), e->data_size, 0600));
+        ASSERT_TRUE(cpio->remove("d"));
+
+        // Enough replacements to trigger compactions
+        for (int i = 0; i < 20; ++i) {
+            std::string data(50000 + i, static_cast<char>('0' + i % 10));
+            ASSERT_TRUE(cpio->set_file("e", data.data(), data.size(), 0644));
+        }
+    }
+
+    ASSERT_EQ(read_contents(spilled, "c"), std::string(100000, 'b'));
+
+    std::string expected;
+    std::string actual;
+    ASSERT_TRUE(save_string(memory, &expected));
+    ASSERT_TRUE(save_string(spilled, &actual));
+    ASSERT_EQ(actual, expected);
+
+    // Only the directory created by the fixture should exist. The temporary
+    // file is unlinked as soon as it is created.
+    ASSERT_EQ(count_files(), 1u);
+}
+
+TEST_F(CpioSpillTest, SetFileFromFileShouldReadRemainingContents)
+{
+    std::string contents(3 * 1024 * 1024 + 123, '\0');
+    for (size_t i = 0; i < contents.size(); ++i) {
+        contents[i] = static_cast<char>(i * 31 % 251);
+    }
+
+    CpioArchive cpio;
+    cpio.set_spill(1024 * 1024, _dir + "/spill");
+    ASSERT_TRUE(cpio.set_file("small", "x", 1, 0644));
+
+    ScopedFile file(mb_file_new(), mb_file_free);
+    ASSERT_TRUE(!!file);
+    ASSERT_EQ(mb_file_open_memory_static(file.get(), contents.data(),
+                                         contents.size()), MB_FILE_OK);
+    ASSERT_EQ(mb_file_seek(file.get(), 10, SEEK_SET, nullptr), MB_FILE_OK);
+    ASSERT_TRUE(cpio.set_file("big", file.get(), 0640));
+
+    const CpioEntry *e = cpio.find("big");
+    ASSERT_NE(e, nullptr);
+    ASSERT_EQ(e->mode, static_cast<uint32_t>(S_IFREG | 0640));
+    ASSERT_EQ(read_contents(cpio, "big"), contents.substr(10));
+    ASSERT_EQ(read_contents(cpio, "small"), "x");
+}
@@ -33,6 +33,8 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/file.h"
+#include "mbcommon/file/filename.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/autoclose/archive.h"
@@ -49,6 +51,7 @@
 #include "mbutil/string.h"
 #include "mbutil/time.h"
 
+#include "bootimg_delta.h"
 #include "installer_util.h"
 #include "image.h"
 #include "multiboot.h"
@@ -57,6 +60,8 @@
 
 #define BACKUP_MNT_DIR          "/mb_mnt"
 
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
+
 namespace mb
 {
 
@@ -322,6 +327,25 @@ static Result backup_boot_image(const std::shared_ptr<Rom> &rom,
         if (!util::copy_file(boot_image_path, boot_image_backup, 0)) {
             return Result::FAILED;
         }
+    } else if (bootimg_store_exists(rom->id)) {
+        LOGI("=== Backing up %s%s ===",
+             boot_image_path.c_str(), BOOTIMG_DELTA_SUFFIX);
+
+        ScopedMbFile file(mb_file_new(), &mb_file_free);
+        if (!file || mb_file_open_filename(file.get(),
+                                           boot_image_backup.c_str(),
+                                           MB_FILE_OPEN_WRITE_ONLY)
+                != MB_FILE_OK) {
+            LOGE("%s: Failed to open: %s", boot_image_backup.c_str(),
+                 file ? mb_file_error_string(file.get()) : "Out of memory");
+            return Result::FAILED;
+        }
+
+        if (!bootimg_store_extract(rom->id, file.get(), nullptr)
+                || mb_file_close(file.get()) != MB_FILE_OK) {
+            LOGE("%s: Failed to write boot image", boot_image_backup.c_str());
+            return Result::FAILED;
+        }
     } else {
         LOGW("=== %s does not exist ===", boot_image_path.c_str());
         return Result::FILES_MISSING;
@@ -365,6 +389,8 @@ static Result restore_boot_image(const std::shared_ptr<Rom> &rom,
         return Result::FAILED;
     }
 
+    bootimg_store_remove_delta(rom->id);
+
     // We explicitly don't update the checksums here. The user needs to know the
     // risk of restoring a backup that can be modified by any app.
 
@@ -0,0 +1,893 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bootimg_delta.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/file/filename.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/string.h"
+
+#include "mblog/logging.h"
+
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/finally.h"
+#include "mbutil/string.h"
+#include "mbutil/time.h"
+
+#include "multiboot.h"
+#include "roms.h"
+
+// Delta file format (all integers are little endian):
+//
+//   DeltaHeader
+//   DeltaOp[op_count]
+//   Literal data for each DELTA_OP_DATA op, in order
+//
+// The target image is rebuilt by concatenating the output of every op. A
+// DELTA_OP_COPY op copies a range of the base image and a DELTA_OP_DATA op
+// copies the next bytes of literal data from the delta file. Ops are generated
+// at boot image entry granularity: an entry that is identical to any entry in
+// the base image becomes a single copy, regardless of where it is located in
+// either image. Everything else (headers, padding, and changed entries) is
+// matched against the same offset in the base image in DELTA_CHUNK_SIZE
+// pieces.
+
+#define DELTA_MAGIC             "MBBIDLT1"
+#define DELTA_MAGIC_SIZE        8
+#define DELTA_MAX_OPS           (1024 * 1024)
+
+#define DELTA_OP_COPY           1
+#define DELTA_OP_DATA           2
+
+#define DELTA_CHUNK_SIZE        4096
+#define DELTA_BUF_SIZE          (1024 * 1024)
+
+#define BOOT_IMAGE_NAME         "boot.img"
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
+typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
+
+namespace mb
+{
+
+struct DeltaHeader
+{
+    char magic[DELTA_MAGIC_SIZE];
+    uint32_t op_count;
+    uint32_t reserved;
+    uint64_t base_size;
+    uint64_t target_size;
+    unsigned char base_digest[SHA512_DIGEST_LENGTH];
+    unsigned char target_digest[SHA512_DIGEST_LENGTH];
+};
+
+struct DeltaOp
+{
+    uint32_t type;
+    uint32_t reserved;
+    // Offset in the base image for DELTA_OP_COPY and offset in the target
+    // image for DELTA_OP_DATA
+    uint64_t offset;
+    uint64_t size;
+};
+
+static_assert(sizeof(DeltaHeader) == 160, "DeltaHeader has padding");
+static_assert(sizeof(DeltaOp) == 24, "DeltaOp has padding");
+
+static void delta_header_fix_byte_order(DeltaHeader &header)
+{
+    header.op_count = mb_le32toh(header.op_count);
+    header.reserved = mb_le32toh(header.reserved);
+    header.base_size = mb_le64toh(header.base_size);
+    header.target_size = mb_le64toh(header.target_size);
+}
+
+static void delta_op_fix_byte_order(DeltaOp &op)
+{
+    op.type = mb_le32toh(op.type);
+    op.reserved = mb_le32toh(op.reserved);
+    op.offset = mb_le64toh(op.offset);
+    op.size = mb_le64toh(op.size);
+}
+
+static bool read_all(MbFile *file, std::vector<unsigned char> *data_out)
+{
+    uint64_t size;
+    size_t n;
+
+    if (mb_file_seek(file, 0, SEEK_END, &size) != MB_FILE_OK
+            || mb_file_seek(file, 0, SEEK_SET, nullptr) != MB_FILE_OK) {
+        LOGE("Failed to seek file: %s", mb_file_error_string(file));
+        return false;
+    }
+
+    data_out->resize(size);
+
+    if (mb_file_read_fully(file, data_out->data(), data_out->size(), &n)
+            != MB_FILE_OK || n != size) {
+        LOGE("Failed to read file: %s", mb_file_error_string(file));
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_all(MbFile *file, const void *buf, size_t size)
+{
+    size_t n;
+
+    if (mb_file_write_fully(file, buf, size, &n) != MB_FILE_OK
+            || n != size) {
+        LOGE("Failed to write file: %s", mb_file_error_string(file));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the location of the entries in a boot image
+ *
+ * An empty list is returned if the data is not a boot image or if the format
+ * does not provide an entry table. The delta will still be valid, but it can
+ * only share data located at the same offset in both images.
+ */
+static std::vector<MbBiEntryInfo>
+get_entries(const std::vector<unsigned char> &data)
+{
+    ScopedMbFile file(mb_file_new(), &mb_file_free);
+    ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
+    MbBiHeader *header;
+    const MbBiEntryInfo *table;
+    size_t count;
+
+    if (!file || !bir
+            || mb_file_open_memory_static(file.get(), data.data(),
+                                          data.size()) != MB_FILE_OK
+            || mb_bi_reader_enable_format_all(bir.get()) != MB_BI_OK
+            || mb_bi_reader_open(bir.get(), file.get(), false) != MB_BI_OK
+            || mb_bi_reader_read_header(bir.get(), &header) != MB_BI_OK
+            || mb_bi_reader_get_entry_table(bir.get(), &table, &count)
+                    != MB_BI_OK) {
+        LOGW("Cannot determine boot image entries: %s",
+             bir ? mb_bi_reader_error_string(bir.get()) : "Out of memory");
+        return {};
+    }
+
+    std::vector<MbBiEntryInfo> entries;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (table[i].offset >= data.size() || table[i].size == 0) {
+            continue;
+        }
+
+        entries.push_back(table[i]);
+        entries.back().size = std::min<uint64_t>(
+                table[i].size, data.size() - table[i].offset);
+    }
+
+    return entries;
+}
+
+class DeltaBuilder
+{
+public:
+    DeltaBuilder(const std::vector<unsigned char> &base,
+                 const std::vector<unsigned char> &target)
+        : _base(base), _target(target)
+    {
+    }
+
+    void build()
+    {
+        std::vector<MbBiEntryInfo> base_entries = get_entries(_base);
+        std::vector<MbBiEntryInfo> target_entries = get_entries(_target);
+        uint64_t cursor = 0;
+
+        _base_entries = &base_entries;
+
+        for (auto const &e : target_entries) {
+            if (e.offset < cursor) {
+                // Overlapping entries are already covered
+                continue;
+            }
+
+            add_range(cursor, e.offset);
+            add_entry(e.offset, e.size);
+            cursor = e.offset + e.size;
+        }
+
+        add_range(cursor, _target.size());
+
+        _base_entries = nullptr;
+    }
+
+    const std::vector<DeltaOp> & ops() const
+    {
+        return _ops;
+    }
+
+private:
+    const std::vector<unsigned char> &_base;
+    const std::vector<unsigned char> &_target;
+    const std::vector<MbBiEntryInfo> *_base_entries = nullptr;
+    std::vector<DeltaOp> _ops;
+
+    void add_op(uint32_t type, uint64_t offset, uint64_t size)
+    {
+        if (size == 0) {
+            return;
+        }
+
+        if (!_ops.empty() && _ops.back().type == type
+                && _ops.back().offset + _ops.back().size == offset) {
+            _ops.back().size += size;
+        } else {
+            _ops.push_back({ type, 0, offset, size });
+        }
+    }
+
+    void add_entry(uint64_t offset, uint64_t size)
+    {
+        for (auto const &b : *_base_entries) {
+            if (b.size == size && memcmp(_base.data() + b.offset,
+                                         _target.data() + offset, size) == 0) {
+                add_op(DELTA_OP_COPY, b.offset, size);
+                return;
+            }
+        }
+
+        add_range(offset, offset + size);
+    }
+
+    void add_range(uint64_t begin, uint64_t end)
+    {
+        for (uint64_t pos = begin; pos < end; pos += DELTA_CHUNK_SIZE) {
+            uint64_t size = std::min<uint64_t>(DELTA_CHUNK_SIZE, end - pos);
+
+            if (pos + size <= _base.size() && memcmp(
+                    _base.data() + pos, _target.data() + pos, size) == 0) {
+                add_op(DELTA_OP_COPY, pos, size);
+            } else {
+                add_op(DELTA_OP_DATA, pos, size);
+            }
+        }
+    }
+};
+
+/*!
+ * \brief Create a delta that transforms one boot image into another
+ *
+ * \param base Base image
+ * \param target Target image
+ * \param delta Output file for the delta
+ *
+ * \return Whether the delta was successfully created
+ */
+bool bootimg_delta_create(MbFile *base, MbFile *target, MbFile *delta)
+{
+    std::vector<unsigned char> base_data;
+    std::vector<unsigned char> target_data;
+
+    if (!read_all(base, &base_data) || !read_all(target, &target_data)) {
+        return false;
+    }
+
+    DeltaBuilder builder(base_data, target_data);
+    builder.build();
+
+    auto const &ops = builder.ops();
+    if (ops.size() > DELTA_MAX_OPS) {
+        LOGE("Delta has too many operations: %zu", ops.size());
+        return false;
+    }
+
+    DeltaHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DELTA_MAGIC, DELTA_MAGIC_SIZE);
+    header.op_count = static_cast<uint32_t>(ops.size());
+    header.base_size = base_data.size();
+    header.target_size = target_data.size();
+    SHA512(base_data.data(), base_data.size(), header.base_digest);
+    SHA512(target_data.data(), target_data.size(), header.target_digest);
+    delta_header_fix_byte_order(header);
+
+    if (!write_all(delta, &header, sizeof(header))) {
+        return false;
+    }
+
+    for (DeltaOp op : ops) {
+        delta_op_fix_byte_order(op);
+        if (!write_all(delta, &op, sizeof(op))) {
+            return false;
+        }
+    }
+
+    for (auto const &op : ops) {
+        if (op.type == DELTA_OP_DATA && !write_all(
+                delta, target_data.data() + op.offset, op.size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_delta_header(MbFile *delta, DeltaHeader *header)
+{
+    size_t n;
+
+    int ret = mb_file_read_fully(delta, header, sizeof(*header), &n);
+    if (ret != MB_FILE_OK || n != sizeof(*header)) {
+        LOGE("Failed to read delta header: %s",
+             ret == MB_FILE_OK ? "Unexpected EOF"
+                     : mb_file_error_string(delta));
+        return false;
+    }
+
+    delta_header_fix_byte_order(*header);
+
+    if (memcmp(header->magic, DELTA_MAGIC, DELTA_MAGIC_SIZE) != 0) {
+        LOGE("Invalid delta magic");
+        return false;
+    } else if (header->op_count > DELTA_MAX_OPS) {
+        LOGE("Delta has too many operations: %" PRIu32, header->op_count);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the SHA512 hex digest of the base image of a delta
+ *
+ * \param delta Delta file positioned at the beginning
+ * \param sha512_out Output hex digest
+ *
+ * \return Whether the delta header was successfully read
+ */
+bool bootimg_delta_base_hash(MbFile *delta, std::string *sha512_out)
+{
+    DeltaHeader header;
+
+    if (!read_delta_header(delta, &header)) {
+        return false;
+    }
+
+    *sha512_out = util::hex_string(header.base_digest, SHA512_DIGEST_LENGTH);
+    return true;
+}
+
+/*!
+ * \brief Reconstruct a boot image from a base image and a delta
+ *
+ * The output is written sequentially in a single pass, so \p output can be a
+ * block device. The base image is only accessed at the offsets referenced by
+ * the delta. The SHA512 digest of the output is verified against the digest
+ * recorded in the delta.
+ *
+ * \param base Base image
+ * \param delta Delta file positioned at the beginning
+ * \param output Output file
+ * \param sha512_out Output hex digest of the reconstructed image (optional)
+ *
+ * \return Whether the image was successfully reconstructed and verified
+ */
+bool bootimg_delta_apply(MbFile *base, MbFile *delta, MbFile *output,
+                         std::string *sha512_out)
+{
+    uint64_t start_time = util::current_time_ms();
+    DeltaHeader header;
+    std::vector<DeltaOp> ops;
+    std::vector<unsigned char> buf(DELTA_BUF_SIZE);
+    uint64_t base_size;
+    uint64_t total = 0;
+    size_t n;
+    int ret;
+
+    if (!read_delta_header(delta, &header)) {
+        return false;
+    }
+
+    if (mb_file_seek(base, 0, SEEK_END, &base_size) != MB_FILE_OK) {
+        LOGE("Failed to seek base image: %s", mb_file_error_string(base));
+        return false;
+    } else if (base_size != header.base_size) {
+        LOGE("Base image size (%" PRIu64 ") does not match expected size"
+             " (%" PRIu64 ")", base_size, header.base_size);
+        return false;
+    }
+
+    ops.resize(header.op_count);
+
+    ret = mb_file_read_fully(delta, ops.data(), ops.size() * sizeof(DeltaOp),
+                             &n);
+    if (ret != MB_FILE_OK || n != ops.size() * sizeof(DeltaOp)) {
+        LOGE("Failed to read delta operations: %s",
+             ret == MB_FILE_OK ? "Unexpected EOF"
+                     : mb_file_error_string(delta));
+        return false;
+    }
+
+    for (DeltaOp &op : ops) {
+        delta_op_fix_byte_order(op);
+
+        if ((op.type != DELTA_OP_COPY && op.type != DELTA_OP_DATA)
+                || op.size > header.target_size - total
+                || (op.type == DELTA_OP_COPY
+                        && (op.offset > base_size
+                                || op.size > base_size - op.offset))) {
+            LOGE("Invalid delta operation: type=%" PRIu32 ", offset=%" PRIu64
+                 ", size=%" PRIu64, op.type, op.offset, op.size);
+            return false;
+        }
+
+        total += op.size;
+    }
+
+    if (total != header.target_size) {
+        LOGE("Delta operations produce %" PRIu64 " bytes instead of %" PRIu64,
+             total, header.target_size);
+        return false;
+    }
+
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+
+    for (auto const &op : ops) {
+        for (uint64_t pos = 0; pos < op.size; pos += n) {
+            size_t to_read = std::min<uint64_t>(buf.size(), op.size - pos);
+
+            if (op.type == DELTA_OP_COPY) {
+                ret = mb_file_pread_fully(base, buf.data(), to_read,
+                                          op.offset + pos, &n);
+            } else {
+                ret = mb_file_read_fully(delta, buf.data(), to_read, &n);
+            }
+
+            if (ret != MB_FILE_OK || n != to_read) {
+                MbFile *file = op.type == DELTA_OP_COPY ? base : delta;
+                LOGE("Failed to read %s: %s",
+                     op.type == DELTA_OP_COPY ? "base image" : "delta",
+                     ret == MB_FILE_OK ? "Unexpected EOF"
+                             : mb_file_error_string(file));
+                return false;
+            }
+
+            SHA512_Update(&ctx, buf.data(), n);
+
+            if (!write_all(output, buf.data(), n)) {
+                return false;
+            }
+        }
+    }
+
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    SHA512_Final(digest, &ctx);
+
+    if (memcmp(digest, header.target_digest, sizeof(digest)) != 0) {
+        LOGE("Reconstructed image does not match the expected digest");
+        return false;
+    }
+
+    if (sha512_out) {
+        *sha512_out = util::hex_string(digest, SHA512_DIGEST_LENGTH);
+    }
+
+    uint64_t elapsed = util::current_time_ms() - start_time;
+    LOGD("Reconstructed %" PRIu64 " byte image from %" PRIu32 " operations"
+         " in %" PRIu64 "ms", total, header.op_count, elapsed);
+
+    return true;
+}
+
+static std::string rom_image_path(const std::string &rom_id)
+{
+    std::string path(get_raw_path(MULTIBOOT_DIR));
+    path += "/";
+    path += rom_id;
+    path += "/" BOOT_IMAGE_NAME;
+    return path;
+}
+
+static std::string base_image_path(const std::string &sha512)
+{
+    std::string path(get_raw_path(MULTIBOOT_BOOT_BASES_DIR));
+    path += "/";
+    path += sha512;
+    path += ".img";
+    return path;
+}
+
+static bool open_file(MbFile *file, const std::string &path)
+{
+    if (mb_file_open_filename(file, path.c_str(), MB_FILE_OPEN_READ_ONLY)
+            != MB_FILE_OK) {
+        LOGE("%s: Failed to open: %s",
+             path.c_str(), mb_file_error_string(file));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check if a ROM has a full or delta-compressed boot image
+ */
+bool bootimg_store_exists(const std::string &rom_id)
+{
+    std::string path = rom_image_path(rom_id);
+    struct stat sb;
+
+    return stat(path.c_str(), &sb) == 0
+            || stat((path + BOOTIMG_DELTA_SUFFIX).c_str(), &sb) == 0;
+}
+
+/*!
+ * \brief Write the boot image of a ROM to a file
+ *
+ * If the ROM's boot image is stored as a delta, it is reconstructed on the fly
+ * from the shared base image.
+ *
+ * \param rom_id ROM ID
+ * \param output Output file
+ * \param sha512_out Output hex digest of the image (optional)
+ *
+ * \return Whether the boot image was successfully written
+ */
+bool bootimg_store_extract(const std::string &rom_id, MbFile *output,
+                           std::string *sha512_out)
+{
+    std::string path = rom_image_path(rom_id);
+    std::string delta_path = path + BOOTIMG_DELTA_SUFFIX;
+    ScopedMbFile input(mb_file_new(), &mb_file_free);
+    ScopedMbFile delta(mb_file_new(), &mb_file_free);
+    ScopedMbFile base(mb_file_new(), &mb_file_free);
+    std::string base_hash;
+
+    if (!input || !delta || !base) {
+        LOGE("Failed to allocate MbFile instances");
+        return false;
+    }
+
+    if (access(path.c_str(), F_OK) == 0) {
+        if (!open_file(input.get(), path)) {
+            return false;
+        }
+
+        std::vector<unsigned char> buf(DELTA_BUF_SIZE);
+        SHA512_CTX ctx;
+        size_t n;
+
+        SHA512_Init(&ctx);
+
+        do {
+            if (mb_file_read_fully(input.get(), buf.data(), buf.size(), &n)
+                    != MB_FILE_OK) {
+                LOGE("%s: Failed to read: %s",
+                     path.c_str(), mb_file_error_string(input.get()));
+                return false;
+            }
+
+            SHA512_Update(&ctx, buf.data(), n);
+
+            if (!write_all(output, buf.data(), n)) {
+                return false;
+            }
+        } while (n == buf.size());
+
+        if (sha512_out) {
+            unsigned char digest[SHA512_DIGEST_LENGTH];
+            SHA512_Final(digest, &ctx);
+            *sha512_out = util::hex_string(digest, SHA512_DIGEST_LENGTH);
+        }
+
+        return true;
+    }
+
+    if (!open_file(delta.get(), delta_path)
+            || !bootimg_delta_base_hash(delta.get(), &base_hash)
+            || mb_file_seek(delta.get(), 0, SEEK_SET, nullptr) != MB_FILE_OK
+            || !open_file(base.get(), base_image_path(base_hash))) {
+        return false;
+    }
+
+    return bootimg_delta_apply(base.get(), delta.get(), output, sha512_out);
+}
+
+static bool create_delta(const std::string &base_path,
+                         const std::vector<unsigned char> &target,
+                         std::vector<unsigned char> *delta_out)
+{
+    ScopedMbFile base(mb_file_new(), &mb_file_free);
+    ScopedMbFile target_file(mb_file_new(), &mb_file_free);
+    ScopedMbFile delta(mb_file_new(), &mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    auto free_buf = util::finally([&]{
+        free(buf);
+    });
+
+    if (!base || !target_file || !delta
+            || !open_file(base.get(), base_path)
+            || mb_file_open_memory_static(target_file.get(), target.data(),
+                                          target.size()) != MB_FILE_OK
+            || mb_file_open_memory_dynamic(delta.get(), &buf, &size)
+                    != MB_FILE_OK
+            || !bootimg_delta_create(base.get(), target_file.get(),
+                                     delta.get())
+            || mb_file_close(delta.get()) != MB_FILE_OK) {
+        return false;
+    }
+
+    delta_out->assign(static_cast<unsigned char *>(buf),
+                      static_cast<unsigned char *>(buf) + size);
+    return true;
+}
+
+/*!
+ * \brief Delete base images that are no longer referenced by any delta
+ */
+static void remove_unused_bases()
+{
+    std::string multiboot_dir(get_raw_path(MULTIBOOT_DIR));
+    std::string bases_dir(get_raw_path(MULTIBOOT_BOOT_BASES_DIR));
+    std::unordered_set<std::string> used;
+    DIR *dir;
+    dirent *ent;
+
+    dir = opendir(multiboot_dir.c_str());
+    if (!dir) {
+        return;
+    }
+
+    while ((ent = readdir(dir))) {
+        std::string path(multiboot_dir);
+        path += "/";
+        path += ent->d_name;
+        path += "/" BOOT_IMAGE_NAME BOOTIMG_DELTA_SUFFIX;
+
+        ScopedMbFile delta(mb_file_new(), &mb_file_free);
+        std::string hash;
+
+        if (access(path.c_str(), F_OK) != 0) {
+            continue;
+        }
+
+        if (!delta || !open_file(delta.get(), path)
+                || !bootimg_delta_base_hash(delta.get(), &hash)) {
+            // Keep everything if a delta can't be read
+            closedir(dir);
+            return;
+        }
+
+        used.insert(hash + ".img");
+    }
+
+    closedir(dir);
+
+    dir = opendir(bases_dir.c_str());
+    if (!dir) {
+        return;
+    }
+
+    auto close_directory = util::finally([&]{
+        closedir(dir);
+    });
+
+    while ((ent = readdir(dir))) {
+        if (!mb_ends_with(ent->d_name, ".img")
+                || used.find(ent->d_name) != used.end()) {
+            continue;
+        }
+
+        std::string path(bases_dir);
+        path += "/";
+        path += ent->d_name;
+
+        LOGD("Removing unused base image: %s", path.c_str());
+        if (unlink(path.c_str()) < 0) {
+            LOGW("%s: Failed to remove: %s", path.c_str(), strerror(errno));
+        }
+    }
+}
+
+/*!
+ * \brief Replace the boot image of a ROM with a delta against a shared base
+ *
+ * Every existing base image is tried and the one producing the smallest delta
+ * is used. If no base shares the kernel with the boot image (ie. the delta is
+ * larger than half of the image), the boot image becomes a new base image.
+ *
+ * \note The checksum in \a checksums.prop still refers to the full image and
+ *       is not modified.
+ *
+ * \param rom_id ROM ID
+ *
+ * \return Whether the boot image was successfully compacted or was already
+ *         stored as a delta
+ */
+bool bootimg_store_compact(const std::string &rom_id)
+{
+    std::string path = rom_image_path(rom_id);
+    std::string delta_path = path + BOOTIMG_DELTA_SUFFIX;
+    std::string bases_dir(get_raw_path(MULTIBOOT_BOOT_BASES_DIR));
+    std::vector<unsigned char> target;
+    std::vector<unsigned char> best_delta;
+    std::string best_base;
+
+    if (access(path.c_str(), F_OK) != 0) {
+        if (access(delta_path.c_str(), F_OK) == 0) {
+            LOGV("%s: Boot image is already compacted", rom_id.c_str());
+            return true;
+        }
+
+        LOGE("%s: Boot image does not exist", path.c_str());
+        return false;
+    }
+
+    if (!util::file_read_all(path, &target)) {
+        LOGE("%s: Failed to read: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (!util::mkdir_recursive(bases_dir, 0775)) {
+        LOGE("%s: Failed to create directory: %s",
+             bases_dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    DIR *dir = opendir(bases_dir.c_str());
+    if (dir) {
+        auto close_directory = util::finally([&]{
+            closedir(dir);
+        });
+
+        dirent *ent;
+        while ((ent = readdir(dir))) {
+            if (!mb_ends_with(ent->d_name, ".img")) {
+                continue;
+            }
+
+            std::string base_path(bases_dir);
+            base_path += "/";
+            base_path += ent->d_name;
+
+            std::vector<unsigned char> delta;
+            if (create_delta(base_path, target, &delta)
+                    && (best_base.empty()
+                            || delta.size() < best_delta.size())) {
+                best_delta.swap(delta);
+                best_base = base_path;
+            }
+        }
+    }
+
+    if (best_base.empty() || best_delta.size() > target.size() / 2) {
+        unsigned char digest[SHA512_DIGEST_LENGTH];
+        SHA512(target.data(), target.size(), digest);
+
+        best_base = base_image_path(
+                util::hex_string(digest, SHA512_DIGEST_LENGTH));
+        std::string temp_path(best_base);
+        temp_path += ".tmp";
+
+        LOGD("%s: Adding new base image", best_base.c_str());
+
+        if (!util::file_write_data(
+                temp_path, reinterpret_cast<const char *>(target.data()),
+                target.size())
+                || rename(temp_path.c_str(), best_base.c_str()) < 0) {
+            LOGE("%s: Failed to write: %s",
+                 best_base.c_str(), strerror(errno));
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        if (!create_delta(best_base, target, &best_delta)) {
+            return false;
+        }
+    }
+
+    LOGD("%s: Storing %zu byte boot image as %zu byte delta against %s",
+         rom_id.c_str(), target.size(), best_delta.size(), best_base.c_str());
+
+    // Make sure the delta reproduces the original image before deleting it
+    {
+        ScopedMbFile base(mb_file_new(), &mb_file_free);
+        ScopedMbFile delta(mb_file_new(), &mb_file_free);
+        ScopedMbFile output(mb_file_new(), &mb_file_free);
+        void *buf = nullptr;
+        size_t size = 0;
+
+        auto free_buf = util::finally([&]{
+            free(buf);
+        });
+
+        if (!base || !delta || !output
+                || !open_file(base.get(), best_base)
+                || mb_file_open_memory_static(delta.get(), best_delta.data(),
+                                              best_delta.size()) != MB_FILE_OK
+                || mb_file_open_memory_dynamic(output.get(), &buf, &size)
+                        != MB_FILE_OK
+                || !bootimg_delta_apply(base.get(), delta.get(), output.get(),
+                                        nullptr)) {
+            LOGE("%s: Failed to verify boot image delta", rom_id.c_str());
+            return false;
+        }
+    }
+
+    std::string temp_path(delta_path);
+    temp_path += ".tmp";
+
+    if (!util::file_write_data(
+            temp_path, reinterpret_cast<const char *>(best_delta.data()),
+            best_delta.size())
+            || rename(temp_path.c_str(), delta_path.c_str()) < 0) {
+        LOGE("%s: Failed to write: %s", delta_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (unlink(path.c_str()) < 0) {
+        LOGE("%s: Failed to remove: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    remove_unused_bases();
+
+    return true;
+}
+
+/*!
+ * \brief Remove a ROM's boot image delta after a full boot image was written
+ */
+void bootimg_store_remove_delta(const std::string &rom_id)
+{
+    std::string delta_path = rom_image_path(rom_id) + BOOTIMG_DELTA_SUFFIX;
+
+    if (unlink(delta_path.c_str()) < 0 && errno != ENOENT) {
+        LOGW("%s: Failed to remove: %s", delta_path.c_str(), strerror(errno));
+    }
+}
+
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+#define BOOTIMG_DELTA_SUFFIX            ".delta"
+
+namespace mb
+{
+
+bool bootimg_delta_create(MbFile *base, MbFile *target, MbFile *delta);
+bool bootimg_delta_apply(MbFile *base, MbFile *delta, MbFile *output,
+                         std::string *sha512_out);
+bool bootimg_delta_base_hash(MbFile *delta, std::string *sha512_out);
+
+bool bootimg_store_exists(const std::string &rom_id);
+bool bootimg_store_extract(const std::string &rom_id, MbFile *output,
+                           std::string *sha512_out);
+bool bootimg_store_compact(const std::string &rom_id);
+void bootimg_store_remove_delta(const std::string &rom_id);
+
+}
@@ -23,49 +23,15 @@
 #include <cstdio>
 #include <cstring>
 
-#include <unistd.h>
+#include "mbcommon/file/callbacks.h"
 
 #include "mblog/logging.h"
 
-#define BUF_SIZE    10240
-
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
 namespace mb
 {
 
-bool bi_copy_data_to_fd(MbBiReader *bir, int fd)
-{
-    int ret;
-    char buf[BUF_SIZE];
-    size_t n_read;
-    ssize_t n_written;
-    size_t remain;
-
-    while ((ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n_read))
-            == MB_BI_OK) {
-        remain = n_read;
-
-        while (remain > 0) {
-            n_written = write(fd, buf + (n_read - remain), remain);
-            if (n_written <= 0) {
-                LOGE("Failed to write data: %s", strerror(errno));
-                return false;
-            }
-
-            remain -= n_written;
-        }
-    }
-
-    if (ret != MB_BI_EOF) {
-        LOGE("Failed to read boot image entry data: %s",
-             mb_bi_reader_error_string(bir));
-        return false;
-    }
-
-    return true;
-}
-
 bool bi_copy_file_to_data(const std::string &path, MbBiWriter *biw)
 {
     ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
@@ -103,63 +69,87 @@ bool bi_copy_file_to_data(const std::string &path, MbBiWriter *biw)
     return true;
 }
 
-bool bi_copy_data_to_file(MbBiReader *bir, const std::string &path)
+bool bi_copy_data_to_data(MbBiReader *bir, MbBiWriter *biw)
 {
-    ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
+    uint64_t n_copied;
+
+    // Copies directly between the files when possible
+    if (mb_bi_writer_copy_data(biw, bir, &n_copied) != MB_BI_OK) {
+        LOGE("Failed to copy entry data: %s",
+             mb_bi_writer_error_string(biw));
         return false;
     }
 
-    int ret;
-    char buf[10240];
-    size_t n;
+    return true;
+}
 
-    while ((ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n))
-            == MB_BI_OK) {
-        if (fwrite(buf, 1, n, fp.get()) != n) {
-            LOGE("%s: Failed to write data: %s",
-                 path.c_str(), strerror(errno));
-            return false;
-        }
+static int reader_data_read_cb(MbFile *file, void *userdata,
+                               void *buf, size_t size, size_t *bytes_read)
+{
+    MbBiReader *bir = static_cast<MbBiReader *>(userdata);
+
+    int ret = mb_bi_reader_read_data(bir, buf, size, bytes_read);
+    if (ret == MB_BI_EOF) {
+        *bytes_read = 0;
+        return MB_FILE_OK;
+    } else if (ret != MB_BI_OK) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to read entry data: %s",
+                          mb_bi_reader_error_string(bir));
+        return MB_FILE_FAILED;
     }
 
-    if (ret != MB_BI_EOF) {
-        LOGE("Failed to read entry data: %s",
-             mb_bi_reader_error_string(bir));
-        return false;
+    return MB_FILE_OK;
+}
+
+static int writer_data_write_cb(MbFile *file, void *userdata,
+                                const void *buf, size_t size,
+                                size_t *bytes_written)
+{
+    MbBiWriter *biw = static_cast<MbBiWriter *>(userdata);
+
+    if (mb_bi_writer_write_data(biw, buf, size, bytes_written) != MB_BI_OK) {
+        mb_file_set_error(file, MB_FILE_ERROR_INTERNAL_ERROR,
+                          "Failed to write entry data: %s",
+                          mb_bi_writer_error_string(biw));
+        return MB_FILE_FAILED;
     }
 
-    if (fclose(fp.release()) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
+    return MB_FILE_OK;
+}
+
+/*!
+ * \brief Open a read-only, non-seekable MbFile over the current reader entry
+ *
+ * Reading from \p file reads the data of the current entry of \p bir. The
+ * reader must not be used directly until \p file is closed.
+ */
+bool bi_open_reader_data_file(MbFile *file, MbBiReader *bir)
+{
+    if (mb_file_open_callbacks(file, nullptr, nullptr, &reader_data_read_cb,
+                               nullptr, nullptr, nullptr, bir)
+            != MB_FILE_OK) {
+        LOGE("Failed to open entry data for reading: %s",
+             mb_file_error_string(file));
         return false;
     }
 
     return true;
 }
 
-bool bi_copy_data_to_data(MbBiReader *bir, MbBiWriter *biw)
+/*!
+ * \brief Open a write-only, non-seekable MbFile over the current writer entry
+ *
+ * Writing to \p file writes the data of the current entry of \p biw. The
+ * writer must not be used directly until \p file is closed.
+ */
+bool bi_open_writer_data_file(MbFile *file, MbBiWriter *biw)
 {
-    int ret;
-    char buf[10240];
-    size_t n_read;
-    size_t n_written;
-
-    while ((ret = mb_bi_reader_read_data(bir, buf, sizeof(buf), &n_read))
-            == MB_BI_OK) {
-        ret = mb_bi_writer_write_data(biw, buf, n_read, &n_written);
-        if (ret != MB_BI_OK || n_read != n_written) {
-            LOGE("Failed to write entry data: %s",
-                 mb_bi_writer_error_string(biw));
-            return false;
-        }
-    }
-
-    if (ret != MB_BI_EOF) {
-        LOGE("Failed to read boot image entry data: %s",
-             mb_bi_reader_error_string(bir));
+    if (mb_file_open_callbacks(file, nullptr, nullptr, nullptr,
+                               &writer_data_write_cb, nullptr, nullptr, biw)
+            != MB_FILE_OK) {
+        LOGE("Failed to open entry data for writing: %s",
+             mb_file_error_string(file));
         return false;
     }
 
@@ -24,12 +24,15 @@
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
+#include "mbcommon/file.h"
+
 namespace mb
 {
 
-bool bi_copy_data_to_fd(MbBiReader *bir, int fd);
 bool bi_copy_file_to_data(const std::string &path, MbBiWriter *biw);
-bool bi_copy_data_to_file(MbBiReader *bir, const std::string &path);
 bool bi_copy_data_to_data(MbBiReader *bir, MbBiWriter *biw);
 
+bool bi_open_reader_data_file(MbFile *file, MbBiReader *bir);
+bool bi_open_writer_data_file(MbFile *file, MbBiWriter *biw);
+
 }
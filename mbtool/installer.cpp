@@ -72,6 +72,7 @@
 #include "mbutil/time.h"
 
 // Local
+#include "bootimg_delta.h"
 #include "image.h"
 #include "installer_util.h"
 #include "multiboot.h"
@@ -1586,9 +1587,9 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
         return ProceedState::Fail;
     }
 
-    // Switch to target ROM if possible
-    std::string boot_image_path(_rom->boot_image_path());
-    if (access(boot_image_path.c_str(), R_OK) == 0) {
+    // Switch to target ROM if possible. The ROM's boot image may be stored as
+    // a delta after "utilities compact-boot".
+    if (bootimg_store_exists(_rom->id)) {
         // Use an empty base dirs list since we don't want to flash any non-boot
         // partitions
         const char * const *base_dirs = { nullptr };
@@ -1933,6 +1934,8 @@ Installer::ProceedState Installer::install_stage_finish()
             return ProceedState::Fail;
         }
 
+        bootimg_store_remove_delta(_rom->id);
+
         // Update checksums
         unsigned char digest[SHA512_DIGEST_LENGTH];
 
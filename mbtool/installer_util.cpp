@@ -26,10 +26,7 @@
 #include <cstdlib>
 #include <cstring>
 
-#include <sys/stat.h>
-
-#include <archive.h>
-#include <archive_entry.h>
+#include <unistd.h>
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
@@ -38,21 +35,18 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
-#include "mbcommon/file/filename.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/string.h"
 
 #include "mblog/logging.h"
 
-#include "mbutil/delete.h"
 #include "mbutil/finally.h"
-#include "mbutil/path.h"
+#include "mbutil/time.h"
 
 #include "bootimg_util.h"
 #include "multiboot.h"
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
-typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
 typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
 typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
@@ -60,261 +54,17 @@ typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
-{
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-    archive_entry *entry;
-    std::string target_path;
-    int ret;
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
-        return false;
-    }
-
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lzop(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
-            return false;
-        }
-
-        // Build path
-        target_path = output_dir;
-        if (!target_path.empty() && target_path.back() != '/' && *path != '/') {
-            target_path += '/';
-        }
-        target_path += path;
-
-        archive_entry_set_pathname(entry, target_path.c_str());
-
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-    }
-
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
-        }
-    }
-
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    return true;
-}
-
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
-{
-    (void) data;
-    (void) entry;
-
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
-    }
-    return 1;
-}
-
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
-{
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
-    }
-
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
-
-    archive_write_set_bytes_per_block(aout.get(), 512);
-
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
-
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
-
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            std::string relpath;
-            if (!util::relative_path(curpath, input_dir, &relpath)) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(), strerror(errno));
-                return false;
-            }
-            if (relpath.empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.c_str());
-        }
-
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
-        }
-
-        char buf[10240];
-        la_ssize_t n;
-
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, n) != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
-
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
-        }
-    }
-
-    archive_read_close(ain.get());
-
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    return true;
-}
-
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
-                                     std::vector<std::function<RamdiskPatcherFn>> &rps)
+                                     std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                     uint64_t spill_threshold)
 {
-    char *tmpdir = mb_format("%s.XXXXXX", output_file.c_str());
-    if (!tmpdir) {
-        LOGE("Out of memory");
-        return false;
-    }
-
-    auto free_temp_dir = util::finally([&]{
-        free(tmpdir);
-    });
-
-    if (!mkdtemp(tmpdir)) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = util::finally([&]{
-        util::delete_recursive(tmpdir);
-    });
-
     ScopedReader bir(mb_bi_reader_new(), &mb_bi_reader_free);
     ScopedWriter biw(mb_bi_writer_new(), &mb_bi_writer_free);
     MbBiHeader *header;
     MbBiEntry *in_entry;
     MbBiEntry *out_entry;
+    uint64_t start_time = util::current_time_ms();
     int ret;
 
     if (!bir || !biw) {
@@ -401,47 +151,78 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
             }
 
             if (type == MB_BI_ENTRY_RAMDISK) {
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
-
-                auto delete_temp_files = util::finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
+                ScopedMbFile fin(mb_file_new(), &mb_file_free);
+                ScopedMbFile fout(mb_file_new(), &mb_file_free);
+
+                if (!fin || !fout) {
+                    LOGE("Failed to allocate input or output MbFile handle");
+                    return false;
+                }
 
-                if (!bi_copy_data_to_file(bir.get(), ramdisk_in)) {
+                // The ramdisk is decompressed straight from the input entry
+                // and recompressed straight into the output entry. Only the
+                // cpio model is buffered and it spills past the threshold.
+                if (!bi_open_reader_data_file(fin.get(), bir.get())
+                        || !bi_open_writer_data_file(fout.get(), biw.get())) {
                     return false;
                 }
 
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
+                if (!patch_ramdisk(fin.get(), fout.get(), 0, rps,
+                                   output_file, spill_threshold)) {
                     return false;
                 }
 
-                if (!bi_copy_file_to_data(ramdisk_out, biw.get())) {
+                if (mb_file_close(fout.get()) != MB_FILE_OK) {
+                    LOGE("%s: Failed to close ramdisk: %s",
+                         output_file.c_str(), mb_file_error_string(fout.get()));
                     return false;
                 }
             } else if (type == MB_BI_ENTRY_KERNEL) {
-                std::string kernel_in(tmpdir);
-                kernel_in += "/kernel.in";
-                std::string kernel_out(tmpdir);
-                kernel_out += "/kernel.out";
-
-                auto delete_temp_files = util::finally([&]{
-                    unlink(kernel_in.c_str());
-                    unlink(kernel_out.c_str());
+                ScopedMbFile fin(mb_file_new(), &mb_file_free);
+                ScopedMbFile fstage(mb_file_new(), &mb_file_free);
+                ScopedMbFile fout(mb_file_new(), &mb_file_free);
+                void *stage_buf = nullptr;
+                size_t stage_size = 0;
+
+                auto free_stage_buf = util::finally([&]{
+                    fstage.reset();
+                    free(stage_buf);
                 });
 
-                if (!bi_copy_data_to_file(bir.get(), kernel_in)) {
+                if (!fin || !fstage || !fout) {
+                    LOGE("Failed to allocate input or output MbFile handle");
                     return false;
                 }
 
-                if (!patch_kernel_rkp(kernel_in, kernel_out)) {
+                // The kernel has to be searched before it can be written, so
+                // it is buffered in memory unless it is unusually large
+                bool spill = mb_bi_entry_size(in_entry) > spill_threshold;
+
+                if (!open_staging_file(fstage.get(), output_file, spill,
+                                       &stage_buf, &stage_size)
+                        || !bi_open_reader_data_file(fin.get(), bir.get())
+                        || !copy_file_to_file_eof(fin.get(), fstage.get())) {
+                    return false;
+                }
+
+                ret = mb_file_seek(fstage.get(), 0, SEEK_SET, nullptr);
+                if (ret != MB_FILE_OK) {
+                    LOGE("Failed to seek to beginning of kernel: %s",
+                         mb_file_error_string(fstage.get()));
+                    return false;
+                }
+
+                if (!bi_open_writer_data_file(fout.get(), biw.get())) {
+                    return false;
+                }
+
+                if (!patch_kernel_rkp(fstage.get(), fout.get())) {
                     return false;
                 }
 
-                if (!bi_copy_file_to_data(kernel_out, biw.get())) {
+                if (mb_file_close(fout.get()) != MB_FILE_OK) {
+                    LOGE("%s: Failed to close kernel: %s",
+                         output_file.c_str(), mb_file_error_string(fout.get()));
                     return false;
                 }
             } else {
@@ -459,80 +240,103 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
         return false;
     }
 
+    LOGD("Patched boot image in %" PRIu64 "ms",
+         util::current_time_ms() - start_time);
+
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
+bool InstallerUtil::patch_ramdisk(MbFile *fin, MbFile *fout,
+                                  unsigned int depth,
+                                  std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                  const std::string &spill_path,
+                                  uint64_t spill_threshold)
+{
+    util::CpioArchive cpio;
+
+    cpio.set_spill(spill_threshold, spill_path);
+
+    if (!cpio.load(fin)) {
+        return false;
+    }
+
+    if (!patch_ramdisk(cpio, depth, rps, spill_path, spill_threshold)) {
+        return false;
+    }
+
+    return cpio.save(fout);
+}
+
+bool InstallerUtil::patch_ramdisk(util::CpioArchive &cpio,
                                   unsigned int depth,
-                                  std::vector<std::function<RamdiskPatcherFn>> &rps)
+                                  std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                  const std::string &spill_path,
+                                  uint64_t spill_threshold)
 {
     if (depth > 1) {
         LOGV("Ignoring doubly-nested ramdisk");
         return true;
     }
 
-    char *tmpdir = mb_format("%s.XXXXXX", output_file.c_str());
-    if (!tmpdir) {
-        LOGE("Out of memory");
-        return false;
-    }
+    static const char *nested_path = "sbin/ramdisk.cpio";
+    const util::CpioEntry *nested = cpio.find(nested_path);
 
-    auto free_temp_dir = util::finally([&]{
-        free(tmpdir);
-    });
+    if (!nested) {
+        for (auto const &rp : rps) {
+            if (!rp(cpio)) {
+                return false;
+            }
+        }
 
-    if (!mkdtemp(tmpdir)) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
+        return true;
     }
 
-    auto delete_temp_dir = util::finally([&]{
-        util::delete_recursive(tmpdir);
-    });
+    // Patch nested ramdisk in memory, staging the output like the kernel
+    ScopedMbFile fin(mb_file_new(), &mb_file_free);
+    ScopedMbFile fout(mb_file_new(), &mb_file_free);
+    void *out_buf = nullptr;
+    size_t out_size = 0;
+    mode_t perm = nested->mode & 07777;
+    bool spill = nested->data_size > spill_threshold;
+    int ret;
 
-    int format;
-    std::vector<int> filters;
+    auto free_out_buf = util::finally([&]{
+        fout.reset();
+        free(out_buf);
+    });
 
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
+    if (!fin || !fout) {
+        LOGE("Failed to allocate input or output MbFile handle");
         return false;
     }
 
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
-
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
+    if (mb_file_open_memory_static(fin.get(), cpio.data(*nested),
+                                   nested->data_size) != MB_FILE_OK) {
+        LOGE("%s: Failed to open nested ramdisk", nested_path);
+        return false;
     }
 
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
+    if (!open_staging_file(fout.get(), spill_path, spill,
+                           &out_buf, &out_size)) {
         return false;
     }
 
-    return ret;
-}
+    if (!patch_ramdisk(fin.get(), fout.get(), depth + 1, rps,
+                       spill_path, spill_threshold)) {
+        return false;
+    }
 
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
-{
-    for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
-            return false;
-        }
+    ret = mb_file_seek(fout.get(), 0, SEEK_SET, nullptr);
+    if (ret != MB_FILE_OK) {
+        LOGE("%s: Failed to seek to beginning of nested ramdisk: %s",
+             nested_path, mb_file_error_string(fout.get()));
+        return false;
     }
 
-    return true;
+    return cpio.set_file(nested_path, fout.get(), perm);
 }
 
-bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
-                                     const std::string &output_file)
+bool InstallerUtil::patch_kernel_rkp(MbFile *fin, MbFile *fout)
 {
     // We'll use SuperSU's patch for negating the effects of
     // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
@@ -558,33 +362,10 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
     };
 
-    ScopedMbFile fin(mb_file_new(), &mb_file_free);
-    ScopedMbFile fout(mb_file_new(), &mb_file_free);
     // TODO: Replace with std::optional after switching to C++17
     std::pair<bool, uint64_t> offset;
     int ret;
 
-    if (!fin || !fout) {
-        LOGE("Failed to allocate input or output MbFile handle");
-        return false;
-    }
-
-    // Open input file
-    if (mb_file_open_filename(fin.get(), input_file.c_str(),
-                              MB_FILE_OPEN_READ_ONLY) != MB_FILE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
-        return false;
-    }
-
-    // Open output file
-    if (mb_file_open_filename(fout.get(), output_file.c_str(),
-                              MB_FILE_OPEN_WRITE_ONLY) != MB_FILE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), mb_file_error_string(fout.get()));
-        return false;
-    }
-
     // Replace pattern
     auto result_cb = [](MbFile *file, void *userdata, uint64_t offset) -> int {
         (void) file;
@@ -595,92 +376,95 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         return MB_FILE_OK;
     };
 
-    ret = mb_file_search(fin.get(), -1, -1, 0, source_pattern,
+    ret = mb_file_search(fin, -1, -1, 0, source_pattern,
                          sizeof(source_pattern), 1, result_cb, &offset);
     if (ret < 0) {
-        LOGE("%s: Error when searching for pattern: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
+        LOGE("Error when searching for pattern: %s", mb_file_error_string(fin));
         return false;
     }
 
     // Copy data
-    ret = mb_file_seek(fin.get(), 0, SEEK_SET, nullptr);
+    ret = mb_file_seek(fin, 0, SEEK_SET, nullptr);
     if (ret != MB_FILE_OK) {
-        LOGE("%s: Failed to seek to beginning: %s",
-             input_file.c_str(), mb_file_error_string(fin.get()));
+        LOGE("Failed to seek to beginning: %s", mb_file_error_string(fin));
         return false;
     }
 
     if (offset.first) {
         LOGD("RKP pattern found at offset: 0x%" PRIx64, offset.second);
 
-        if (!copy_file_to_file(fin.get(), fout.get(), offset.second)) {
+        if (!copy_file_to_file(fin, fout, offset.second)) {
             return false;
         }
 
-        ret = mb_file_seek(fin.get(), sizeof(source_pattern), SEEK_CUR,
-                           nullptr);
+        ret = mb_file_seek(fin, sizeof(source_pattern), SEEK_CUR, nullptr);
         if (ret != MB_FILE_OK) {
-            LOGE("%s: Failed to skip pattern: %s",
-                 input_file.c_str(), mb_file_error_string(fin.get()));
+            LOGE("Failed to skip pattern: %s", mb_file_error_string(fin));
             return false;
         }
 
         size_t n;
-        ret = mb_file_write_fully(fout.get(), target_pattern,
+        ret = mb_file_write_fully(fout, target_pattern,
                                   sizeof(target_pattern), &n);
         if (ret != MB_FILE_OK || n != sizeof(target_pattern)) {
-            LOGE("%s: Failed to write target pattern: %s",
-                 output_file.c_str(), mb_file_error_string(fout.get()));
+            LOGE("Failed to write target pattern: %s",
+                 mb_file_error_string(fout));
             return false;
         }
     }
 
-    if (!copy_file_to_file_eof(fin.get(), fout.get())) {
-        return false;
-    }
-
-    ret = mb_file_close(fout.get());
-    if (ret != MB_FILE_OK) {
-        LOGE("%s: Failed to close file: %s",
-             output_file.c_str(), mb_file_error_string(fout.get()));
+    if (!copy_file_to_file_eof(fin, fout)) {
         return false;
     }
 
     return true;
 }
 
-bool InstallerUtil::replace_file(const std::string &replace,
-                                 const std::string &with)
+/*!
+ * \brief Open a seekable file for buffering entry data
+ *
+ * If \p spill is false, \p file is backed by memory that must be freed with
+ * `free(*buf)` after \p file is closed. Otherwise, the data is kept in an
+ * unlinked temporary file next to \p path.
+ */
+bool InstallerUtil::open_staging_file(MbFile *file, const std::string &path,
+                                      bool spill, void **buf, size_t *size)
 {
-    struct stat sb;
-    int sb_ret;
+    if (!spill) {
+        if (mb_file_open_memory_dynamic(file, buf, size) != MB_FILE_OK) {
+            LOGE("Failed to open memory file: %s", mb_file_error_string(file));
+            return false;
+        }
 
-    sb_ret = stat(replace.c_str(), &sb);
-    if (sb_ret < 0 && errno != ENOENT) {
-        LOGE("%s: Failed to stat file: %s",
-             replace.c_str(), strerror(errno));
+        return true;
+    }
+
+    char *tmp_path = mb_format("%s.XXXXXX", path.c_str());
+    if (!tmp_path) {
+        LOGE("Out of memory");
         return false;
     }
 
-    if (rename(with.c_str(), replace.c_str()) < 0) {
-        LOGE("%s: Failed to rename from %s: %s",
-             replace.c_str(), with.c_str(), strerror(errno));
+    auto free_tmp_path = util::finally([&]{
+        free(tmp_path);
+    });
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOGE("%s: Failed to create temporary file: %s",
+             path.c_str(), strerror(errno));
         return false;
     }
 
-    if (sb_ret == 0) {
-        if (chown(replace.c_str(), sb.st_uid, sb.st_gid) < 0) {
-            LOGE("%s: Failed to chown file: %s",
-                 replace.c_str(), strerror(errno));
-            return false;
-        }
+    unlink(tmp_path);
 
-        if (chmod(replace.c_str(), sb.st_mode & 0777) < 0) {
-            LOGE("%s: Failed to chmod file: %s",
-                 replace.c_str(), strerror(errno));
-            return false;
-        }
+    LOGV("%s: Spilling entry data to temporary file", path.c_str());
+
+    if (mb_file_open_fd(file, fd, true) != MB_FILE_OK) {
+        LOGE("%s: Failed to open temporary file: %s",
+             tmp_path, mb_file_error_string(file));
+        close(fd);
+        return false;
     }
 
     return true;
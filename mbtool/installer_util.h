@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
 #include "ramdisk_patcher.h"
 
 struct MbBiReader;
@@ -34,31 +36,28 @@ namespace mb
 class InstallerUtil
 {
 public:
-    static bool unpack_ramdisk(const std::string &input_file,
-                               const std::string &output_dir,
-                               int &format_out,
-                               std::vector<int> &filters_out);
-    static bool pack_ramdisk(const std::string &input_dir,
-                             const std::string &output_file,
-                             int format,
-                             const std::vector<int> &filters);
+    // Entries that need to be buffered are kept in memory up to this size
+    static constexpr uint64_t DEFAULT_SPILL_THRESHOLD = 64 * 1024 * 1024;
 
     static bool patch_boot_image(const std::string &input_file,
                                  const std::string &output_file,
-                                 std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk(const std::string &input_file,
-                              const std::string &output_file,
+                                 std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                 uint64_t spill_threshold = DEFAULT_SPILL_THRESHOLD);
+    static bool patch_ramdisk(MbFile *fin, MbFile *fout,
                               unsigned int depth,
-                              std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                  std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_kernel_rkp(const std::string &input_file,
-                                 const std::string &output_file);
-
-    static bool replace_file(const std::string &replace,
-                             const std::string &with);
+                              std::vector<std::function<RamdiskPatcherFn>> &rps,
+                              const std::string &spill_path,
+                              uint64_t spill_threshold);
+    static bool patch_ramdisk(util::CpioArchive &cpio,
+                              unsigned int depth,
+                              std::vector<std::function<RamdiskPatcherFn>> &rps,
+                              const std::string &spill_path,
+                              uint64_t spill_threshold);
+    static bool patch_kernel_rkp(MbFile *fin, MbFile *fout);
 
 private:
+    static bool open_staging_file(MbFile *file, const std::string &path,
+                                  bool spill, void **buf, size_t *size);
     static bool copy_file_to_file(MbFile *fin, MbFile *fout, uint64_t to_copy);
     static bool copy_file_to_file_eof(MbFile *fin, MbFile *fout);
 };
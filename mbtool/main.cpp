@@ -43,6 +43,7 @@
 #include "uevent_dump.h"
 #endif
 
+#include "mbcommon/file.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
 #include "mbutil/process.h"
@@ -89,6 +90,26 @@ struct tool tools[] = {
 };
 
 
+// Called for MbFile handles closed while MB_FILE_STATS is set
+static void log_file_stats(MbFile *file, const MbFileStats *stats,
+                           void *userdata)
+{
+    (void) userdata;
+
+    char *str = mb_file_stats_to_string(stats);
+    if (!str) {
+        return;
+    }
+
+    char *save_ptr;
+    for (char *line = strtok_r(str, "\n", &save_ptr); line;
+            line = strtok_r(nullptr, "\n", &save_ptr)) {
+        LOGD("MbFile %p: %s", static_cast<void *>(file), line);
+    }
+
+    free(str);
+}
+
 static void mbtool_usage(int error)
 {
     FILE *stream = error ? stderr : stdout;
@@ -189,6 +210,8 @@ int main(int argc, char *argv[])
 
     umask(0);
 
+    mb_file_set_stats_report_callback(&log_file_stats, nullptr);
+
     if (!setlocale(LC_ALL, "C")) {
         fprintf(stderr, "Failed to set default locale\n");
     }
@@ -24,6 +24,7 @@
 #define INTERNAL_STORAGE                "/data/media/0"
 #define MULTIBOOT_DIR                   INTERNAL_STORAGE "/MultiBoot"
 #define MULTIBOOT_BACKUP_DIR            MULTIBOOT_DIR "/backups"
+#define MULTIBOOT_BOOT_BASES_DIR        MULTIBOOT_DIR "/boot-bases"
 #define MULTIBOOT_LOG_INSTALLER         INTERNAL_STORAGE "/MultiBoot.log"
 #define MULTIBOOT_LOG_APPSYNC           MULTIBOOT_DIR "/appsync.log"
 #define MULTIBOOT_LOG_DAEMON            MULTIBOOT_DIR "/daemon.log"
@@ -22,56 +22,36 @@
 #include <algorithm>
 
 #include <cerrno>
-#include <cstdio>
-#include <cstdlib>
 #include <cstring>
 
 #include <sys/stat.h>
-#include <unistd.h>
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/copy.h"
+#include "mbutil/file.h"
 #include "mbutil/path.h"
 
-#include "installer_util.h"
-
 namespace mb
 {
 
-static bool _rp_write_rom_id(const std::string &dir, const std::string &rom_id)
+static bool add_file_from_disk(util::CpioArchive &cpio,
+                               const std::string &source,
+                               const std::string &target, mode_t perm)
 {
-    std::string path(dir);
-    path += "/romid";
-
-    FILE *fp = fopen(path.c_str(), "wb");
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fputs(rom_id.c_str(), fp) == EOF) {
-        LOGE("%s: Failed to write ROM ID: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
+    std::vector<unsigned char> data;
 
-    if (fchmod(fileno(fp), 0664) < 0) {
-        LOGE("%s: Failed to chmod: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
+    if (!util::file_read_all(source, &data)) {
+        LOGE("%s: Failed to read file: %s", source.c_str(), strerror(errno));
         return false;
     }
 
-    if (fclose(fp) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
+    return cpio.set_file(target, data.data(), data.size(), perm);
+}
 
-    return true;
+static bool _rp_write_rom_id(util::CpioArchive &cpio,
+                             const std::string &rom_id)
+{
+    return cpio.set_file("romid", rom_id.data(), rom_id.size(), 0664);
 }
 
 std::function<RamdiskPatcherFn>
@@ -82,105 +62,43 @@ rp_write_rom_id(const std::string &rom_id)
     return std::bind(_rp_write_rom_id, _1, rom_id);
 }
 
-static bool _rp_patch_default_prop(const std::string &dir,
+static bool _rp_patch_default_prop(util::CpioArchive &cpio,
                                    const std::string &device_id,
                                    bool use_fuse_exfat)
 {
-    char *tmp_path = nullptr;
-    int tmp_fd = -1;
-    FILE *fp_in = nullptr;
-    FILE *fp_out = nullptr;
-    char *buf = nullptr;
-    size_t buf_size = 0;
-    ssize_t n;
-    bool ret = false;
-
-    std::string path(dir);
-    path += "/default.prop";
-
-    tmp_path = mb_format("%s.XXXXXX", path.c_str());
-    if (!tmp_path) {
-        LOGE("Out of memory");
-        goto done;
-    }
-
-    tmp_fd = mkstemp(tmp_path);
-    if (tmp_fd < 0) {
-        LOGE("%s: Failed to create temporary file: %s",
-             path.c_str(), strerror(errno));
-        goto done;
-    }
+    const char *path = "default.prop";
+    std::string data;
+    std::string new_data;
 
-    fp_in = fopen(path.c_str(), "rb");
-    if (!fp_in) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
-        goto done;
+    const util::CpioEntry *entry = cpio.find(path);
+    if (!entry || !cpio.read_file(path, &data)) {
+        LOGE("%s: Failed to read properties", path);
+        return false;
     }
 
-    fp_out = fdopen(tmp_fd, "wb");
-    if (!fp_out) {
-        LOGE("%s: Failed to open for writing: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
+    new_data.reserve(data.size() + 100);
 
-    tmp_fd = -1;
+    for (size_t begin = 0; begin < data.size();) {
+        size_t end = data.find('\n', begin);
+        end = end == std::string::npos ? data.size() : end + 1;
 
-    while ((n = getline(&buf, &buf_size, fp_in)) >= 0) {
         // Remove old multiboot properties
-        if (mb_starts_with(buf, "ro.patcher.")) {
-            continue;
+        if (!mb_starts_with(data.c_str() + begin, "ro.patcher.")) {
+            new_data.append(data, begin, end - begin);
         }
 
-        if (fwrite(buf, 1, n, fp_out) != static_cast<size_t>(n)) {
-            LOGE("%s: Failed to write file: %s",
-                 tmp_path, strerror(errno));
-            goto done;
-        }
+        begin = end;
     }
 
     // Write new properties
-    if (fputc('\n', fp_out) == EOF
-            || fprintf(fp_out, "ro.patcher.device=%s\n", device_id.c_str()) < 0
-            || fprintf(fp_out, "ro.patcher.use_fuse_exfat=%s\n",
-                       use_fuse_exfat ? "true" : "false") < 0) {
-        LOGE("%s: Failed to write properties: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
-
-    if (fclose(fp_out) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             tmp_path, strerror(errno));
-        goto done;
-    }
-
-    fp_out = nullptr;
-
-    if (!InstallerUtil::replace_file(path.c_str(), tmp_path)) {
-        goto done;
-    }
-
-    ret = true;
-
-done:
-    if (tmp_fd >= 0) {
-        close(tmp_fd);
-    }
-    if (fp_in) {
-        fclose(fp_in);
-    }
-    if (fp_out) {
-        fclose(fp_out);
-    }
-
-    unlink(tmp_path);
-
-    free(tmp_path);
-    free(buf);
-
-    return ret;
+    new_data += "\nro.patcher.device=";
+    new_data += device_id;
+    new_data += "\nro.patcher.use_fuse_exfat=";
+    new_data += use_fuse_exfat ? "true" : "false";
+    new_data += '\n';
+
+    return cpio.set_file(path, new_data.data(), new_data.size(),
+                         entry->mode & 07777);
 }
 
 std::function<RamdiskPatcherFn>
@@ -191,7 +109,7 @@ rp_patch_default_prop(const std::string &device_id, bool use_fuse_exfat)
     return std::bind(_rp_patch_default_prop, _1, device_id, use_fuse_exfat);
 }
 
-static bool _rp_add_binaries(const std::string &dir,
+static bool _rp_add_binaries(util::CpioArchive &cpio,
                              const std::string &binaries_dir)
 {
     struct CopySpec
@@ -216,15 +134,8 @@ static bool _rp_add_binaries(const std::string &dir,
         std::string source(binaries_dir);
         source += "/";
         source += item.from;
-        std::string target(dir);
-        target += "/";
-        target += item.to;
 
-        if (!util::copy_file(source, target, 0)) {
-            return false;
-        }
-        if (chmod(target.c_str(), item.perm) < 0) {
-            LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        if (!add_file_from_disk(cpio, source, item.to, item.perm)) {
             return false;
         }
     }
@@ -240,18 +151,11 @@ rp_add_binaries(const std::string &binaries_dir)
     return std::bind(_rp_add_binaries, _1, binaries_dir);
 }
 
-static bool _rp_symlink_fuse_exfat(const std::string &dir)
+static bool _rp_symlink_fuse_exfat(util::CpioArchive &cpio)
 {
-    std::string fsck_exfat(dir);
-    fsck_exfat += "/sbin/fsck.exfat";
-    std::string fsck_exfat_sig(fsck_exfat);
-    fsck_exfat_sig += ".sig";
-
-    if ((unlink(fsck_exfat.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat", fsck_exfat.c_str()) < 0
-            || (unlink(fsck_exfat_sig.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat.sig", fsck_exfat_sig.c_str()) < 0) {
-        LOGE("Failed to symlink exfat fsck binaries: %s", strerror(errno));
+    if (!cpio.set_symlink("sbin/fsck.exfat", "mount.exfat")
+            || !cpio.set_symlink("sbin/fsck.exfat.sig", "mount.exfat.sig")) {
+        LOGE("Failed to symlink exfat fsck binaries");
         return false;
     }
 
@@ -264,14 +168,10 @@ rp_symlink_fuse_exfat()
     return _rp_symlink_fuse_exfat;
 }
 
-static bool _rp_symlink_init(const std::string &dir)
+static bool _rp_symlink_init(util::CpioArchive &cpio)
 {
-    std::string target{dir};
-    target += "/init";
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    struct stat sb;
+    std::string target{"init"};
+    std::string real_init{"init.orig"};
 
     // If this is a Sony device that doesn't use sbin/ramdisk.cpio for the
     // combined ramdisk, we'll have to explicitly allow their init executable to
@@ -282,17 +182,16 @@ static bool _rp_symlink_init(const std::string &dir)
     // * https://github.com/chenxiaolong/DualBootPatcher/issues/533
     // * https://github.com/sonyxperiadev/device-sony-common-init
     {
-        std::string sony_init_wrapper(dir);
-        sony_init_wrapper += "/sbin/init_sony";
-        std::string sony_real_init(dir);
-        sony_real_init += "/init.real";
+        std::string sony_real_init{"init.real"};
+        const util::CpioEntry *entry = cpio.find(target);
         std::string sony_symlink_target;
 
         // Check that /init is a symlink and that /init.real exists
-        if (lstat(target.c_str(), &sb) == 0 && S_ISLNK(sb.st_mode)
-                && util::read_link(target, &sony_symlink_target)
-                && lstat(sony_real_init.c_str(), &sb) == 0) {
-            std::vector<std::string> haystack{util::path_split(sony_symlink_target)};
+        if (entry && S_ISLNK(entry->mode)
+                && cpio.read_symlink(target, &sony_symlink_target)
+                && cpio.find(sony_real_init)) {
+            std::vector<std::string> haystack{
+                    util::path_split(sony_symlink_target)};
             std::vector<std::string> needle{util::path_split("sbin/init_sony")};
 
             util::normalize_path(&haystack);
@@ -309,22 +208,14 @@ static bool _rp_symlink_init(const std::string &dir)
     LOGD("[init] Target init path: %s", target.c_str());
     LOGD("[init] Real init path: %s", real_init.c_str());
 
-    if (lstat(real_init.c_str(), &sb) < 0) {
-        if (errno != ENOENT) {
-            LOGE("%s: Failed to access file: %s",
-                 real_init.c_str(), strerror(errno));
+    if (!cpio.find(real_init)) {
+        if (!cpio.rename(target, real_init)) {
+            LOGE("%s: Failed to rename file", target.c_str());
             return false;
         }
 
-        if (rename(target.c_str(), real_init.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 target.c_str(), strerror(errno));
-            return false;
-        }
-
-        if (symlink("/mbtool", target.c_str()) < 0) {
-            LOGE("%s: Failed to symlink mbtool: %s",
-                 target.c_str(), strerror(errno));
+        if (!cpio.set_symlink(target, "/mbtool")) {
+            LOGE("%s: Failed to symlink mbtool", target.c_str());
             return false;
         }
     }
@@ -338,23 +229,10 @@ rp_symlink_init()
     return _rp_symlink_init;
 }
 
-static bool _rp_add_device_json(const std::string &dir,
+static bool _rp_add_device_json(util::CpioArchive &cpio,
                                 const std::string &device_json_file)
 {
-    std::string device_json(dir);
-    device_json += "/device.json";
-
-    if (!util::copy_file(device_json_file, device_json, 0)) {
-        return false;
-    }
-
-    if (chmod(device_json.c_str(), 0644) < 0) {
-        LOGE("%s: Failed to chmod file: %s",
-             device_json.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
+    return add_file_from_disk(cpio, device_json_file, "device.json", 0644);
 }
 
 std::function<RamdiskPatcherFn>
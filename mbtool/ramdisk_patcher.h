@@ -23,10 +23,12 @@
 #include <string>
 //#include <vector>
 
+#include "mbutil/cpio.h"
+
 namespace mb
 {
 
-typedef bool (RamdiskPatcherFn)(const std::string &dir);
+typedef bool (RamdiskPatcherFn)(util::CpioArchive &cpio);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
@@ -19,6 +19,9 @@
 
 #include "rom_installer.h"
 
+#include <cerrno>
+#include <cstring>
+
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
@@ -29,22 +32,21 @@
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/reader.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
-#include "mbutil/autoclose/archive.h"
 #include "mbutil/autoclose/file.h"
-#include "mbutil/archive.h"
 #include "mbutil/chown.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
+#include "mbutil/cpio.h"
 #include "mbutil/file.h"
-#include "mbutil/finally.h"
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
-#include "archive_util.h"
 #include "bootimg_util.h"
 #include "installer.h"
 #include "multiboot.h"
@@ -54,6 +56,7 @@
 #define DEBUG_ENABLE_PASSTHROUGH 0
 
 
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
 typedef std::unique_ptr<MbBiReader, decltype(mb_bi_reader_free) *> ScopedReader;
 
 namespace mb
@@ -86,8 +89,8 @@ private:
 
     static bool extract_ramdisk(const std::string &boot_image_file,
                                 const std::string &output_dir, bool nested);
-    static bool extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                   bool nested);
+    static bool extract_ramdisk_files(const util::CpioArchive &cpio,
+                                      const std::string &output_dir);
 };
 
 
@@ -165,7 +168,7 @@ Installer::ProceedState RomInstaller::on_checked_device()
     // /sbin is not going to be populated with anything useful in a normal boot
     // image. We can almost guarantee that a recovery image is going to be
     // installed though, so we'll open the recovery partition with libmbp and
-    // extract its /sbin with libarchive into the chroot's /sbin.
+    // extract its /sbin into the chroot's /sbin.
 
     std::string block_dev(_recovery_block_dev);
     bool using_boot = false;
@@ -325,149 +328,68 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
         return false;
     }
 
-    {
-        char *tmpfile = mb_format("%s.XXXXXX", output_dir.c_str());
-        if (!tmpfile) {
-            LOGE("Out of memory");
-            return false;
-        }
-
-        auto free_temp_file = util::finally([&]{
-            free(tmpfile);
-        });
-
-        int tmpfd = mkstemp(tmpfile);
-        if (tmpfd < 0) {
-            LOGE("Failed to create temporary file: %s", strerror(errno));
-            return false;
-        }
-
-        // We don't need the path
-        unlink(tmpfile);
+    util::CpioArchive cpio;
+    ScopedMbFile fin(mb_file_new(), &mb_file_free);
 
-        auto close_fd = util::finally([&]{
-            close(tmpfd);
-        });
+    if (!fin) {
+        LOGE("Failed to allocate MbFile handle");
+        return false;
+    }
 
-        return bi_copy_data_to_fd(bir.get(), tmpfd)
-                && extract_ramdisk_fd(tmpfd, output_dir, nested);
+    if (!bi_open_reader_data_file(fin.get(), bir.get())
+            || !cpio.load(fin.get())) {
+        LOGE("%s: Failed to load ramdisk", boot_image_file.c_str());
+        return false;
     }
-}
 
-bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                      bool nested)
-{
-    autoclose::archive in(archive_read_new(), archive_read_free);
-    autoclose::archive out(archive_write_disk_new(), archive_write_free);
-    archive_entry *entry;
-    int ret;
+    if (!nested) {
+        return extract_ramdisk_files(cpio, output_dir);
+    }
 
-    if (!in || !out) {
-        LOGE("Failed to allocate input or output archive");
+    const util::CpioEntry *nested_entry = cpio.find("sbin/ramdisk.cpio");
+    if (!nested_entry) {
+        LOGE("Nested ramdisk not found");
         return false;
     }
 
-    // Seek to beginning
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        LOGE("Failed to seek to beginning: %s", strerror(errno));
+    util::CpioArchive nested_cpio;
+    ScopedMbFile fnested(mb_file_new(), &mb_file_free);
+
+    if (!fnested) {
+        LOGE("Failed to allocate MbFile handle");
         return false;
     }
 
-    archive_read_support_filter_gzip(in.get());
-    archive_read_support_filter_lzop(in.get());
-    archive_read_support_filter_lz4(in.get());
-    archive_read_support_filter_lzma(in.get());
-    archive_read_support_filter_xz(in.get());
-    archive_read_support_format_cpio(in.get());
-
-    if (archive_read_open_fd(in.get(), fd, 10240) != ARCHIVE_OK) {
-        LOGE("Failed to open archive: %s", archive_error_string(in.get()));
+    if (mb_file_open_memory_static(fnested.get(), cpio.data(*nested_entry),
+                                   nested_entry->data_size) != MB_FILE_OK
+            || !nested_cpio.load(fnested.get())) {
+        LOGE("%s: Failed to load nested ramdisk", boot_image_file.c_str());
         return false;
     }
 
-    // Set up output
-    archive_write_disk_set_options(out.get(),
-                                   ARCHIVE_EXTRACT_ACL |
-                                   ARCHIVE_EXTRACT_FFLAGS |
-                                   ARCHIVE_EXTRACT_PERM |
-                                   ARCHIVE_EXTRACT_SECURE_NODOTDOT |
-                                   ARCHIVE_EXTRACT_SECURE_SYMLINKS |
-                                   ARCHIVE_EXTRACT_TIME |
-                                   ARCHIVE_EXTRACT_UNLINK |
-                                   ARCHIVE_EXTRACT_XATTR);
+    return extract_ramdisk_files(nested_cpio, output_dir);
+}
 
+bool RomInstaller::extract_ramdisk_files(const util::CpioArchive &cpio,
+                                         const std::string &output_dir)
+{
+    for (auto const &entry : cpio.entries()) {
+        const char *path = cpio.name(entry);
 
-    while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        const char *path = archive_entry_pathname(entry);
-        if (!path) {
-            LOGE("Archive entry has no path");
-            return false;
+        if (strcmp(path, "default.prop") == 0) {
+            path = "default.recovery.prop";
+        } else if (!mb_starts_with(path, "sbin/")) {
+            continue;
         }
 
-        if (nested) {
-            if (strcmp(path, "sbin/ramdisk.cpio") == 0) {
-                char *tmpfile = mb_format("%s.XXXXXX", output_dir.c_str());
-                if (!tmpfile) {
-                    LOGE("Out of memory");
-                    return false;
-                }
-
-                auto free_temp_file = util::finally([&]{
-                    free(tmpfile);
-                });
-
-                int tmpfd = mkstemp(tmpfile);
-                if (tmpfd < 0) {
-                    LOGE("Failed to create temporary file: %s",
-                         strerror(errno));
-                    return false;
-                }
-
-                // We don't need the path
-                unlink(tmpfile);
-
-                auto close_fd = util::finally([&]{
-                    close(tmpfd);
-                });
-
-                return la_copy_data_to_fd(in.get(), tmpfd)
-                        && extract_ramdisk_fd(tmpfd, output_dir, false);
-            }
-        } else {
-            if (strcmp(path, "default.prop") == 0) {
-                path = "default.recovery.prop";
-            } else if (!mb_starts_with(path, "sbin/")) {
-                continue;
-            }
-
-            LOGD("Extracting from recovery ramdisk: %s", path);
-
-            std::string output_path(output_dir);
-            output_path += '/';
-            output_path += path;
-
-            archive_entry_set_pathname(entry, output_path.c_str());
-
-            if (util::libarchive_copy_header_and_data(
-                    in.get(), out.get(), entry) != ARCHIVE_OK) {
-                return false;
-            }
-
-            archive_entry_set_pathname(entry, path);
-        }
-    }
+        LOGD("Extracting from recovery ramdisk: %s", path);
 
-    if (ret != ARCHIVE_EOF) {
-        LOGE("Failed to read entry: %s", archive_error_string(in.get()));
-        return false;
+        if (!cpio.extract(entry, output_dir, path)) {
+            return false;
+        }
     }
 
-    if (nested) {
-        LOGE("Nested ramdisk not found");
-        return false;
-    } else {
-        return true;
-    }
+    return true;
 }
 
 static void rom_installer_usage(bool error)
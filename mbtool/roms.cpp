@@ -35,6 +35,7 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "bootimg_delta.h"
 #include "multiboot.h"
 
 #define BUILD_PROP "build.prop"
@@ -300,7 +301,9 @@ void Roms::add_extsd_roms()
             image += "/system.img";
         }
 
-        if (stat(image.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+        if ((stat(image.c_str(), &sb) == 0 && S_ISREG(sb.st_mode))
+                || (is_boot && stat((image + BOOTIMG_DELTA_SUFFIX).c_str(),
+                                    &sb) == 0 && S_ISREG(sb.st_mode))) {
             temp_roms.push_back(create_rom_extsd_slot(ent->d_name + 11));
         }
     }
@@ -322,7 +325,8 @@ void Roms::add_installed()
         std::string boot_path = get_raw_path(rom->boot_image_path());
         std::string system_path = rom->full_system_path();
 
-        if (stat(boot_path.c_str(), &sb) == 0) {
+        if (stat(boot_path.c_str(), &sb) == 0
+                || stat((boot_path + BOOTIMG_DELTA_SUFFIX).c_str(), &sb) == 0) {
             // If boot image exists, assume that the ROM is installed
             roms.push_back(rom);
         } else if (rom->system_is_image) {
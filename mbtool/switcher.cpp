@@ -19,15 +19,21 @@
 
 #include "switcher.h"
 
+#include <memory>
+
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <openssl/sha.h>
 
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/chmod.h"
@@ -40,11 +46,14 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "bootimg_delta.h"
 #include "multiboot.h"
 #include "roms.h"
 
 #define CHECKSUMS_PATH "/data/multiboot/checksums.prop"
 
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedMbFile;
+
 namespace mb
 {
 
@@ -280,6 +289,43 @@ static bool add_extra_images(const char *multiboot_dir,
     return true;
 }
 
+/*!
+ * \brief Read a ROM's boot image into memory
+ *
+ * If the boot image is stored as a delta, it is reconstructed from the shared
+ * base image.
+ */
+static bool read_boot_image(const char *id, Flashable *f)
+{
+    if (access(f->image.c_str(), F_OK) == 0) {
+        return util::file_read_all(f->image, &f->data, &f->size);
+    }
+
+    ScopedMbFile file(mb_file_new(), &mb_file_free);
+    void *data = nullptr;
+    size_t size = 0;
+
+    if (!file || mb_file_open_memory_dynamic(file.get(), &data, &size)
+            != MB_FILE_OK) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    bool ret = bootimg_store_extract(id, file.get(), nullptr)
+            && mb_file_close(file.get()) == MB_FILE_OK;
+    file.reset();
+
+    if (!ret) {
+        free(data);
+        errno = EINVAL;
+        return false;
+    }
+
+    f->data = static_cast<unsigned char *>(data);
+    f->size = size;
+    return true;
+}
+
 /*!
  * \brief Switch to another ROM
  *
@@ -356,7 +402,9 @@ SwitchRomResult switch_rom(const char *id, const char *boot_blockdev,
         // If memory becomes an issue, an alternative method is to create a
         // temporary directory in /data/multiboot/ that's only writable by root
         // and copy the images there.
-        if (!util::file_read_all(f.image, &f.data, &f.size)) {
+        if (!(&f == &flashables.front()
+                ? read_boot_image(id, &f)
+                : util::file_read_all(f.image, &f.data, &f.size))) {
             LOGE("%s: Failed to read image: %s",
                  f.image.c_str(), strerror(errno));
             return SwitchRomResult::FAILED;
@@ -492,6 +540,8 @@ bool set_kernel(const char *id, const char *boot_blockdev)
         return false;
     }
 
+    bootimg_store_remove_delta(id);
+
     LOGD("Updating checksums file");
     checksums_write(props);
 
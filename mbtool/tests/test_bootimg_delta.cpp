@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of MultiBootPatcher
+ *
+ * MultiBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MultiBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <openssl/sha.h>
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbutil/string.h"
+
+#include "bootimg_delta.h"
+
+// Delta layout, as documented in bootimg_delta.cpp
+#define HEADER_OP_COUNT_OFFSET      8
+#define HEADER_BASE_SIZE_OFFSET     16
+#define HEADER_TARGET_SIZE_OFFSET   24
+#define HEADER_SIZE                 160
+#define OP_SIZE                     24
+#define OP_TYPE_OFFSET              0
+#define OP_OFFSET_OFFSET            8
+#define OP_SIZE_OFFSET              16
+#define OP_COPY                     1
+#define OP_DATA                     2
+
+typedef std::unique_ptr<MbFile, decltype(mb_file_free) *> ScopedFile;
+typedef std::unique_ptr<MbBiWriter, decltype(mb_bi_writer_free) *> ScopedWriter;
+
+using namespace mb;
+
+static std::string random_data(size_t size, unsigned int seed)
+{
+    std::string data(size, '\0');
+
+    for (auto &c : data) {
+        seed = seed * 1103515245 + 12345;
+        c = static_cast<char>(seed >> 16);
+    }
+
+    return data;
+}
+
+static std::string make_boot_image(const std::string &kernel,
+                                   const std::string &ramdisk,
+                                   const char *cmdline)
+{
+    ScopedWriter biw(mb_bi_writer_new(), mb_bi_writer_free);
+    ScopedFile file(mb_file_new(), mb_file_free);
+    MbBiHeader *header;
+    MbBiEntry *entry;
+    void *buf = nullptr;
+    size_t size = 0;
+    size_t n;
+    int ret;
+
+    EXPECT_TRUE(biw && file);
+    EXPECT_EQ(mb_file_open_memory_dynamic(file.get(), &buf, &size),
+              MB_FILE_OK);
+    EXPECT_EQ(mb_bi_writer_set_format_android(biw.get()), MB_BI_OK);
+    EXPECT_EQ(mb_bi_writer_open(biw.get(), file.get(), false), MB_BI_OK);
+    EXPECT_EQ(mb_bi_writer_get_header(biw.get(), &header), MB_BI_OK);
+    EXPECT_EQ(mb_bi_header_set_page_size(header, 2048), MB_BI_OK);
+    EXPECT_EQ(mb_bi_header_set_kernel_cmdline(header, cmdline), MB_BI_OK);
+    EXPECT_EQ(mb_bi_writer_write_header(biw.get(), header), MB_BI_OK);
+
+    while ((ret = mb_bi_writer_get_entry(biw.get(), &entry)) == MB_BI_OK) {
+        const std::string *data = nullptr;
+
+        switch (mb_bi_entry_type(entry)) {
+        case MB_BI_ENTRY_KERNEL:
+            data = &kernel;
+            break;
+        case MB_BI_ENTRY_RAMDISK:
+            data = &ramdisk;
+            break;
+        }
+
+        EXPECT_EQ(mb_bi_writer_write_entry(biw.get(), entry), MB_BI_OK);
+        if (data) {
+            EXPECT_EQ(mb_bi_writer_write_data(biw.get(), data->data(),
+                                              data->size(), &n), MB_BI_OK);
+        }
+    }
+    EXPECT_EQ(ret, MB_BI_EOF);
+    EXPECT_EQ(mb_bi_writer_close(biw.get()), MB_BI_OK);
+    EXPECT_EQ(mb_file_close(file.get()), MB_FILE_OK);
+
+    std::string result(static_cast<char *>(buf), size);
+    free(buf);
+    return result;
+}
+
+static bool create_delta(const std::string &base, const std::string &target,
+                         std::string *delta_out)
+{
+    ScopedFile fbase(mb_file_new(), mb_file_free);
+    ScopedFile ftarget(mb_file_new(), mb_file_free);
+    ScopedFile fdelta(mb_file_new(), mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    bool ret = mb_file_open_memory_static(fbase.get(), base.data(),
+                                          base.size()) == MB_FILE_OK
+            && mb_file_open_memory_static(ftarget.get(), target.data(),
+                                          target.size()) == MB_FILE_OK
+            && mb_file_open_memory_dynamic(fdelta.get(), &buf, &size)
+                    == MB_FILE_OK
+            && bootimg_delta_create(fbase.get(), ftarget.get(), fdelta.get())
+            && mb_file_close(fdelta.get()) == MB_FILE_OK;
+    if (ret) {
+        delta_out->assign(static_cast<char *>(buf), size);
+    }
+
+    free(buf);
+    return ret;
+}
+
+static bool apply_delta(const std::string &base, const std::string &delta,
+                        std::string *output_out, std::string *sha512_out)
+{
+    ScopedFile fbase(mb_file_new(), mb_file_free);
+    ScopedFile fdelta(mb_file_new(), mb_file_free);
+    ScopedFile foutput(mb_file_new(), mb_file_free);
+    void *buf = nullptr;
+    size_t size = 0;
+
+    bool ret = mb_file_open_memory_static(fbase.get(), base.data(),
+                                          base.size()) == MB_FILE_OK
+            && mb_file_open_memory_static(fdelta.get(), delta.data(),
+                                          delta.size()) == MB_FILE_OK
+            && mb_file_open_memory_dynamic(foutput.get(), &buf, &size)
+                    == MB_FILE_OK
+            && bootimg_delta_apply(fbase.get(), fdelta.get(), foutput.get(),
+                                   sha512_out)
+            && mb_file_close(foutput.get()) == MB_FILE_OK;
+    if (ret && output_out) {
+        output_out->assign(static_cast<char *>(buf), size);
+    }
+
+    free(buf);
+    return ret;
+}
+
+static std::string sha512_hex(const std::string &data)
+{
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    SHA512(reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+           digest);
+    return util::hex_string(digest, sizeof(digest));
+}
+
+template<typename T>
+static T get_le(const std::string &data, size_t offset)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<unsigned char>(
+                data[offset + i])) << (i * 8);
+    }
+    return value;
+}
+
+template<typename T>
+static void set_le(std::string *data, size_t offset, T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        (*data)[offset + i] = static_cast<char>(value >> (i * 8));
+    }
+}
+
+static size_t op_offset(size_t index)
+{
+    return HEADER_SIZE + index * OP_SIZE;
+}
+
+struct BootImgDeltaTest : testing::Test
+{
+    std::string _kernel = random_data(300000, 1);
+    std::string _base = make_boot_image(_kernel, random_data(50000, 2), "a=1");
+    std::string _target = make_boot_image(_kernel, random_data(40000, 3),
+                                          "a=1 romid=dual");
+    std::string _delta;
+
+    virtual void SetUp() override
+    {
+        ASSERT_TRUE(create_delta(_base, _target, &_delta));
+    }
+
+    uint32_t op_count()
+    {
+        return get_le<uint32_t>(_delta, HEADER_OP_COUNT_OFFSET);
+    }
+
+    // Find the first op of the given type
+    size_t find_op(uint32_t type)
+    {
+        for (uint32_t i = 0; i < op_count(); ++i) {
+            if (get_le<uint32_t>(_delta, op_offset(i) + OP_TYPE_OFFSET)
+                    == type) {
+                return i;
+            }
+        }
+        ADD_FAILURE() << "No op of type " << type;
+        return 0;
+    }
+};
+
+TEST_F(BootImgDeltaTest, ApplyShouldReconstructTarget)
+{
+    std::string output;
+    std::string sha512;
+
+    ASSERT_TRUE(apply_delta(_base, _delta, &output, &sha512));
+    ASSERT_EQ(output, _target);
+    ASSERT_EQ(sha512, sha512_hex(_target));
+
+    // The shared kernel should be copied instead of stored
+    ASSERT_LT(_delta.size(), _target.size() - _kernel.size() + 4096);
+
+    std::string base_hash;
+    ScopedFile fdelta(mb_file_new(), mb_file_free);
+    ASSERT_EQ(mb_file_open_memory_static(fdelta.get(), _delta.data(),
+                                         _delta.size()), MB_FILE_OK);
+    ASSERT_TRUE(bootimg_delta_base_hash(fdelta.get(), &base_hash));
+    ASSERT_EQ(base_hash, sha512_hex(_base));
+}
+
+TEST_F(BootImgDeltaTest, ApplyShouldHandleNonBootImages)
+{
+    std::string base = random_data(20000, 4);
+    std::string target = base.substr(0, 8192) + random_data(5000, 5)
+            + base.substr(13192);
+    std::string delta;
+    std::string output;
+
+    ASSERT_TRUE(create_delta(base, target, &delta));
+    ASSERT_TRUE(apply_delta(base, delta, &output, nullptr));
+    ASSERT_EQ(output, target);
+
+    // Identical and empty images
+    ASSERT_TRUE(create_delta(base, base, &delta));
+    ASSERT_TRUE(apply_delta(base, delta, &output, nullptr));
+    ASSERT_EQ(output, base);
+
+    ASSERT_TRUE(create_delta(base, "", &delta));
+    ASSERT_TRUE(apply_delta(base, delta, &output, nullptr));
+    ASSERT_EQ(output, "");
+}
+
+TEST_F(BootImgDeltaTest, ApplyShouldRejectInvalidHeader)
+{
+    // Bad magic
+    std::string delta = _delta;
+    delta[0] = 'X';
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Truncated header
+    ASSERT_FALSE(apply_delta(_base, _delta.substr(0, HEADER_SIZE - 1),
+                             nullptr, nullptr));
+
+    // Too many ops
+    delta = _delta;
+    set_le<uint32_t>(&delta, HEADER_OP_COUNT_OFFSET, 0xffffffffu);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Wrong base image size
+    ASSERT_FALSE(apply_delta(_base + "x", _delta, nullptr, nullptr));
+    ASSERT_FALSE(apply_delta(_base.substr(1), _delta, nullptr, nullptr));
+}
+
+TEST_F(BootImgDeltaTest, ApplyShouldRejectTruncatedOps)
+{
+    // Truncated in the middle of the op list
+    std::string delta = _delta.substr(0, op_offset(op_count()) - 1);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // More ops than the file contains
+    delta = _delta.substr(0, op_offset(op_count()));
+    set_le<uint32_t>(&delta, HEADER_OP_COUNT_OFFSET, op_count() + 1000);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Missing literal data
+    delta = _delta.substr(0, _delta.size() - 1);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+}
+
+TEST_F(BootImgDeltaTest, ApplyShouldRejectInvalidOps)
+{
+    size_t copy = op_offset(find_op(OP_COPY));
+    uint64_t base_size = _base.size();
+
+    // Unknown type
+    std::string delta = _delta;
+    set_le<uint32_t>(&delta, copy + OP_TYPE_OFFSET, 3);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Copy starting past the end of the base image
+    delta = _delta;
+    set_le<uint64_t>(&delta, copy + OP_OFFSET_OFFSET, base_size + 1);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Copy ending past the end of the base image
+    uint64_t size = get_le<uint64_t>(_delta, copy + OP_SIZE_OFFSET);
+    delta = _delta;
+    set_le<uint64_t>(&delta, copy + OP_OFFSET_OFFSET, base_size - size + 1);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Copy range that wraps around
+    delta = _delta;
+    set_le<uint64_t>(&delta, copy + OP_OFFSET_OFFSET, UINT64_MAX - size + 2);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Ops producing more data than the target size
+    delta = _delta;
+    set_le<uint64_t>(&delta, copy + OP_SIZE_OFFSET, UINT64_MAX);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Ops producing less data than the target size
+    delta = _delta;
+    set_le<uint64_t>(&delta, HEADER_TARGET_SIZE_OFFSET,
+                     get_le<uint64_t>(_delta, HEADER_TARGET_SIZE_OFFSET) + 1);
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+}
+
+TEST_F(BootImgDeltaTest, ApplyShouldRejectDigestMismatch)
+{
+    // Corrupted literal data
+    std::string delta = _delta;
+    delta.back() ^= 0xff;
+    ASSERT_FALSE(apply_delta(_base, delta, nullptr, nullptr));
+
+    // Base image with the right size, but different contents
+    std::string base = _base;
+    base[get_le<uint64_t>(_delta,
+            op_offset(find_op(OP_COPY)) + OP_OFFSET_OFFSET)] ^= 0xff;
+    ASSERT_FALSE(apply_delta(base, _delta, nullptr, nullptr));
+
+    // Sanity check that the unmodified inputs still work
+    ASSERT_TRUE(apply_delta(_base, _delta, nullptr, nullptr));
+    ASSERT_EQ(get_le<uint64_t>(_delta, HEADER_BASE_SIZE_OFFSET),
+              _base.size());
+}
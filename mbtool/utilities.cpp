@@ -46,6 +46,7 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "bootimg_delta.h"
 #include "multiboot.h"
 #include "romconfig.h"
 #include "roms.h"
@@ -167,6 +168,16 @@ static bool utilities_switch_rom(const char *rom_id, bool force)
     return ret == SwitchRomResult::SUCCEEDED;
 }
 
+static bool utilities_compact_boot(const char *rom_id)
+{
+    auto rom = Roms::create_rom(rom_id);
+    if (!rom) {
+        return false;
+    }
+
+    return bootimg_store_compact(rom->id);
+}
+
 static bool utilities_wipe_system(const char *rom_id)
 {
     auto rom = Roms::create_rom(rom_id);
@@ -478,6 +489,7 @@ static void utilities_usage(bool error)
     fprintf(stream,
             "Usage: utilities [opt...] generate [template dir] [output file]\n"
             "   OR: utilities [opt...] switch [ROM ID] [--force]\n"
+            "   OR: utilities [opt...] compact-boot [ROM ID]\n"
             "   OR: utilities [opt...] wipe-system [ROM ID]\n"
             "   OR: utilities [opt...] wipe-cache [ROM ID]\n"
             "   OR: utilities [opt...] wipe-data [ROM ID]\n"
@@ -554,6 +566,8 @@ int utilities_main(int argc, char *argv[])
         ret = gen.run();
     } else if (action == "switch") {
         ret = utilities_switch_rom(argv[optind + 1], force);
+    } else if (action == "compact-boot") {
+        ret = utilities_compact_boot(argv[optind + 1]);
     } else if (action == "wipe-system") {
         ret = utilities_wipe_system(argv[optind + 1]);
     } else if (action == "wipe-cache") {
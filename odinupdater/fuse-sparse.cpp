@@ -1,6 +1,8 @@
 #define FUSE_USE_VERSION 26
 
+#include <algorithm>
 #include <new>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -9,7 +11,6 @@
 #include <cstring>
 
 #include <fcntl.h>
-#include <pthread.h>
 #include <unistd.h>
 
 // fuse
@@ -28,6 +29,7 @@
 #define OFF_T off_t
 #endif
 
+static int source_fd = -1;
 static char source_fd_path[50];
 static uint64_t sparse_size;
 
@@ -35,7 +37,6 @@ struct context
 {
     SparseCtx *sctx;
     MbFile *file;
-    pthread_mutex_t mutex;
 };
 
 /*!
@@ -104,6 +105,39 @@ static bool cb_seek(int64_t offset, int whence, void *userData)
     return true;
 }
 
+/*!
+ * \brief Positional read callback for sparsePread()
+ *
+ * This reads directly from the source fd with pread64(), which does not use the
+ * fd's file position, so it is safe to call from multiple threads.
+ */
+static bool cb_pread(void *buf, uint64_t size, uint64_t offset,
+                     uint64_t *bytesRead, void *userData)
+{
+    (void) userData;
+
+    uint64_t total = 0;
+    while (size > 0) {
+        ssize_t n = pread64(source_fd, buf, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "%s: Failed to read: %s\n",
+                    source_fd_path, strerror(errno));
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+        size -= n;
+        offset += n;
+        total += n;
+        buf = static_cast<char *>(buf) + n;
+    }
+    *bytesRead = total;
+    return true;
+}
+
 /*!
  * \brief Open callback for fuse
  */
@@ -133,8 +167,18 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -ENOMEM;
     }
 
-    if (!sparseOpen(ctx->sctx, &cb_open, &cb_close, &cb_read, &cb_seek, nullptr,
-                    ctx)) {
+    if (!sparseSetPreadCallback(ctx->sctx, &cb_pread)
+            || !sparseOpen(ctx->sctx, &cb_open, &cb_close, &cb_read, &cb_seek,
+                           nullptr, ctx)) {
+        sparseCtxFree(ctx->sctx);
+        mb_file_free(ctx->file);
+        delete ctx;
+        return -EIO;
+    }
+
+    // Read all chunk headers now. After this, the chunk list is immutable and
+    // sparsePread() can be used from multiple threads at the same time
+    if (!sparseBuildIndex(ctx->sctx)) {
         sparseCtxFree(ctx->sctx);
         mb_file_free(ctx->file);
         delete ctx;
@@ -162,42 +206,119 @@ static int fuse_release(const char *path, fuse_file_info *fi)
 }
 
 /*!
- * \brief Read from sparse file
+ * \brief Read callback for fuse
  *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
+ * fuse calls this from multiple threads, possibly for the same file handle.
+ * sparsePread() does not modify the sparse context, so no locking is needed.
+ *
+ * \note fuse only uses this if fuse_read_buf() is not available.
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
+                     fuse_file_info *fi)
 {
-    // Seek to position
-    if (!sparseSeek(ctx->sctx, offset, SEEK_SET)) {
-        return -1;
-    }
+    (void) path;
+
+    context *ctx = reinterpret_cast<context *>(fi->fh);
 
     uint64_t bytes_read;
-    if (!sparseRead(ctx->sctx, buf, size, &bytes_read)) {
-        return -1;
+    if (!sparsePread(ctx->sctx, buf, size, offset, &bytes_read)) {
+        return -EIO;
     }
 
     return bytes_read;
 }
 
 /*!
- * \brief Read callback for fuse
+ * \brief Free memory buffers in a list of fuse buffers
  */
-static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
-                     fuse_file_info *fi)
+static void free_fuse_bufs(std::vector<fuse_buf> &bufs)
+{
+    for (fuse_buf &buf : bufs) {
+        free(buf.mem);
+    }
+    bufs.clear();
+}
+
+/*!
+ * \brief read_buf callback for fuse
+ *
+ * Raw chunk data is returned as a reference to the source fd instead of being
+ * read into memory. fuse can then splice it straight from the source file to
+ * the kernel without the data passing through user space. If splicing is not
+ * possible, fuse falls back to reading the range into its own buffer.
+ *
+ * Fill and hole ranges have no backing data, so they are expanded into
+ * memory buffers, which fuse frees after replying.
+ */
+static int fuse_read_buf(const char *path, fuse_bufvec **bufp, size_t size,
+                         OFF_T offset, fuse_file_info *fi)
 {
     (void) path;
 
     context *ctx = reinterpret_cast<context *>(fi->fh);
+    std::vector<fuse_buf> bufs;
+    uint64_t pos = offset;
+    uint64_t end = pos + size;
+
+    while (pos < end) {
+        SparseExtent extent;
+        if (!sparseGetExtentAt(ctx->sctx, pos, &extent)) {
+            free_fuse_bufs(bufs);
+            return -EIO;
+        } else if (extent.type == SPARSE_EXTENT_EOF) {
+            break;
+        }
 
-    pthread_mutex_lock(&ctx->mutex);
-    int ret = fuse_read_locked(ctx, buf, size, offset);
-    pthread_mutex_unlock(&ctx->mutex);
+        uint64_t n = std::min(extent.end, end) - pos;
+
+        fuse_buf buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.size = n;
+
+        if (extent.type == SPARSE_EXTENT_RAW) {
+            buf.flags = static_cast<fuse_buf_flags>(
+                    FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+            buf.fd = source_fd;
+            buf.pos = extent.srcOffset;
+        } else {
+            uint64_t bytes_read;
+            buf.mem = malloc(n);
+            if (!buf.mem) {
+                free_fuse_bufs(bufs);
+                return -ENOMEM;
+            } else if (!sparsePread(ctx->sctx, buf.mem, n, pos, &bytes_read)
+                    || bytes_read != n) {
+                free(buf.mem);
+                free_fuse_bufs(bufs);
+                return -EIO;
+            }
+        }
+
+        bufs.push_back(buf);
+        pos += n;
+    }
 
-    return ret;
+    // fuse_bufvec ends with a 1-element array, so it must be over-allocated to
+    // hold the rest of the buffers
+    size_t count = std::max<size_t>(bufs.size(), 1);
+    fuse_bufvec *bufv = static_cast<fuse_bufvec *>(malloc(
+            sizeof(fuse_bufvec) + (count - 1) * sizeof(fuse_buf)));
+    if (!bufv) {
+        free_fuse_bufs(bufs);
+        return -ENOMEM;
+    }
+
+    memset(bufv, 0, sizeof(fuse_bufvec));
+    bufv->count = count;
+    if (bufs.empty()) {
+        // EOF
+        memset(&bufv->buf[0], 0, sizeof(fuse_buf));
+    } else {
+        std::copy(bufs.begin(), bufs.end(), bufv->buf);
+    }
+
+    *bufp = bufv;
+    return 0;
 }
 
 /*!
@@ -342,6 +463,7 @@ int main(int argc, char *argv[])
         }
         snprintf(source_fd_path, sizeof(source_fd_path),
                  "/proc/self/fd/%d", fd);
+        source_fd = fd;
 
         if (get_sparse_file_size() < 0) {
             close(fd);
@@ -351,10 +473,11 @@ int main(int argc, char *argv[])
 
     fuse_operations fuse_oper;
     memset(&fuse_oper, 0, sizeof(fuse_oper));
-    fuse_oper.getattr = fuse_getattr;
-    fuse_oper.open    = fuse_open;
-    fuse_oper.read    = fuse_read;
-    fuse_oper.release = fuse_release;
+    fuse_oper.getattr  = fuse_getattr;
+    fuse_oper.open     = fuse_open;
+    fuse_oper.read     = fuse_read;
+    fuse_oper.read_buf = fuse_read_buf;
+    fuse_oper.release  = fuse_release;
 
     int fuse_ret = fuse_main(args.argc, args.argv, &fuse_oper, nullptr);
 
@@ -17,6 +17,7 @@
  * along with MultiBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -27,9 +28,12 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 // libmbsparse
 #include "mbsparse/sparse.h"
@@ -373,6 +377,139 @@ static bool cb_zip_read(void *buf, uint64_t size, uint64_t *bytes_read,
     return true;
 }
 
+static bool pread_fully(int fd, void *buf, size_t size, uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pread64(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        buf = static_cast<char *>(buf) + n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/*!
+ * \brief Find the data of an uncompressed zip entry
+ *
+ * libarchive has no API for getting an entry's compression method or data
+ * offset, but once it has read an entry's header, the position in the zip is
+ * at the beginning of the entry's data. If the entry is stored uncompressed,
+ * the data read through libarchive is therefore identical to the data in the
+ * zip at that position. Comparing the first part of both rejects compressed
+ * entries without having to parse the zip separately.
+ *
+ * \note This consumes data from the current entry in \p a.
+ *
+ * \return Whether the data of \p entry is stored uncompressed at
+ *         [\p offset_out, \p offset_out + \p size_out) in \p fd
+ */
+static bool find_stored_entry_data(archive *a, archive_entry *entry, int fd,
+                                   uint64_t *offset_out, uint64_t *size_out)
+{
+    char expected[4096];
+    char actual[sizeof(expected)];
+    uint64_t bytes_read;
+    struct stat sb;
+
+    if (!archive_entry_size_is_set(entry) || archive_entry_size(entry) < 0
+            || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        return false;
+    }
+
+    la_int64_t offset = archive_filter_bytes(a, -1);
+    uint64_t size = archive_entry_size(entry);
+
+    if (offset < 0 || offset > sb.st_size
+            || size > static_cast<uint64_t>(sb.st_size - offset)) {
+        return false;
+    }
+
+    size_t to_compare = std::min<uint64_t>(size, sizeof(expected));
+
+    if (!cb_zip_read(expected, to_compare, &bytes_read, a)
+            || bytes_read != to_compare
+            || !pread_fully(fd, actual, to_compare, offset)
+            || memcmp(expected, actual, to_compare) != 0) {
+        return false;
+    }
+
+    *offset_out = offset;
+    *size_out = size;
+    return true;
+}
+
+// Uncompressed zip entry accessed directly through the zip's file descriptor
+struct ZipEntryFd
+{
+    int fd;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t pos;
+};
+
+static bool cb_fd_read(void *buf, uint64_t size, uint64_t *bytes_read,
+                       void *user_data)
+{
+    ZipEntryFd *entry = static_cast<ZipEntryFd *>(user_data);
+    uint64_t to_read = std::min(size, entry->size - entry->pos);
+
+    if (!pread_fully(entry->fd, buf, to_read, entry->offset + entry->pos)) {
+        error("%s: Failed to read: %s", zip_file, strerror(errno));
+        return false;
+    }
+
+    entry->pos += to_read;
+    *bytes_read = to_read;
+    return true;
+}
+
+static bool cb_fd_seek(int64_t offset, int whence, void *user_data)
+{
+    ZipEntryFd *entry = static_cast<ZipEntryFd *>(user_data);
+    int64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = entry->pos;
+        break;
+    case SEEK_END:
+        base = entry->size;
+        break;
+    default:
+        return false;
+    }
+
+    if ((offset < 0 && -offset > base)
+            || (offset > 0 && static_cast<uint64_t>(base + offset)
+                    > entry->size)) {
+        error("%s: Invalid seek offset", zip_file);
+        return false;
+    }
+
+    entry->pos = base + offset;
+    return true;
+}
+
+/*!
+ * \brief Zero out a range of a block device without writing the zeros
+ *
+ * \return Whether BLKZEROOUT succeeded. If false, the caller must write the
+ *         zeros itself.
+ */
+static bool zero_out_range(int fd, uint64_t offset, uint64_t size)
+{
+    uint64_t range[2] = { offset, size };
+    return ioctl(fd, BLKZEROOUT, &range) == 0;
+}
+
 #if DEBUG_SKIP_FLASH_SYSTEM
 MB_UNUSED
 #endif
@@ -385,6 +522,9 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
     uint64_t n;
     bool sparse_ret;
     int fd;
+    struct stat sb;
+    bool is_blkdev;
+    SparseExtent extent;
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = 0;
     uint64_t old_bytes = 0;
@@ -406,10 +546,61 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return result;
     }
 
-    if (!sparseOpen(ctx.get(), nullptr, nullptr, &cb_zip_read, nullptr, nullptr,
-                    a.get())) {
-        error("Failed to open sparse file");
-        return ExtractResult::ERROR;
+    // If the image is stored without compression, raw chunks can be written
+    // straight from the zip to the output without passing through user space
+    ZipEntryFd zip_entry = {};
+    zip_entry.fd = open64(zip_file, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+
+    auto close_zip_fd = mb::util::finally([&zip_entry]{
+        if (zip_entry.fd >= 0) {
+            close(zip_entry.fd);
+        }
+    });
+
+    bool direct = zip_entry.fd >= 0
+            && find_stored_entry_data(a.get(), entry, zip_entry.fd,
+                                      &zip_entry.offset, &zip_entry.size);
+
+    // Every CRC32 chunk in the image is checked. When reading from the zip
+    // directly, the index is built first so that a mismatch is detected
+    // before the data it covers is written to the device. Otherwise, the data
+    // is read sequentially and a mismatch is only detected after the data has
+    // been written, but it still causes the installation to fail instead of
+    // leaving a corrupted partition unreported.
+    sparseSetVerifyCrc32(ctx.get(), true);
+
+    if (direct) {
+        info("%s is uncompressed; copying raw data directly", zip_filename);
+
+        if (!sparseOpen(ctx.get(), nullptr, nullptr, &cb_fd_read, &cb_fd_seek,
+                        nullptr, &zip_entry)
+                || !sparseBuildIndex(ctx.get())) {
+            error("Failed to open sparse file");
+            return ExtractResult::ERROR;
+        }
+    } else {
+        // The start of the entry was consumed while checking whether it is
+        // stored uncompressed, so start over
+        a.reset(archive_read_new());
+        if (!a) {
+            error("Out of memory");
+            return ExtractResult::ERROR;
+        }
+
+        if (!la_open_zip(a.get(), zip_file)) {
+            return ExtractResult::ERROR;
+        }
+
+        result = la_skip_to(a.get(), zip_filename, &entry);
+        if (result != ExtractResult::OK) {
+            return result;
+        }
+
+        if (!sparseOpen(ctx.get(), nullptr, nullptr, &cb_zip_read, nullptr,
+                        nullptr, a.get())) {
+            error("Failed to open sparse file");
+            return ExtractResult::ERROR;
+        }
     }
 
     fd = open64(out_filename,
@@ -423,11 +614,19 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         close(fd);
     });
 
+    if (fstat(fd, &sb) < 0) {
+        error("%s: Failed to stat: %s", out_filename, strerror(errno));
+        return ExtractResult::ERROR;
+    }
+
+    is_blkdev = S_ISBLK(sb.st_mode);
+
     sparseSize(ctx.get(), &max_bytes);
 
     set_progress(0);
 
-    while ((sparse_ret = sparseRead(ctx.get(), buf, sizeof(buf), &n)) && n > 0) {
+    while ((sparse_ret = sparseGetExtent(ctx.get(), &extent))
+            && extent.type != SPARSE_EXTENT_EOF) {
         // Rate limit: update progress only after difference exceeds 0.1%
         old_ratio = (double) old_bytes / max_bytes;
         new_ratio = (double) cur_bytes / max_bytes;
@@ -436,26 +635,104 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             old_bytes = cur_bytes;
         }
 
-        char *out_ptr = buf;
-        ssize_t nwritten;
+        uint64_t extent_size = extent.end - extent.begin;
 
-        do {
-            if ((nwritten = write(fd, out_ptr, n)) < 0) {
-                error("%s: Failed to write: %s",
+        // Don't write anything for holes. Zero fills don't need to be written
+        // either if the output is a truncated regular file (sparse regions
+        // read as zeros) or if the block device can zero the range itself.
+        if (extent.type == SPARSE_EXTENT_HOLE
+                || (extent.type == SPARSE_EXTENT_FILL && extent.fillVal == 0
+                        && (!is_blkdev || zero_out_range(
+                                fd, extent.begin, extent_size)))) {
+            if (!(sparse_ret = sparseSkipExtent(ctx.get()))) {
+                break;
+            }
+
+            if (lseek64(fd, extent.end, SEEK_SET) < 0) {
+                error("%s: Failed to seek: %s",
                       out_filename, strerror(errno));
                 return ExtractResult::ERROR;
             }
 
-            n -= nwritten;
-            out_ptr += nwritten;
-            cur_bytes += nwritten;
-        } while (n > 0);
+            cur_bytes += extent_size;
+            continue;
+        }
+
+        if (direct && extent.type == SPARSE_EXTENT_RAW) {
+            if (!(sparse_ret = sparseCopyRawExtent(
+                    ctx.get(), zip_entry.fd, zip_entry.offset, fd, &n))) {
+                break;
+            }
+
+            // The copy does not move the file position
+            if (lseek64(fd, extent.end, SEEK_SET) < 0) {
+                error("%s: Failed to seek: %s",
+                      out_filename, strerror(errno));
+                return ExtractResult::ERROR;
+            }
+
+            cur_bytes += n;
+            continue;
+        }
+
+        // Raw data and non-zero fills are expanded by sparseRead()
+        while (extent_size > 0) {
+            if (!(sparse_ret = sparseRead(
+                    ctx.get(), buf, std::min<uint64_t>(sizeof(buf), extent_size),
+                    &n))) {
+                break;
+            } else if (n == 0) {
+                error("Sparse file %s ended prematurely", zip_filename);
+                return ExtractResult::ERROR;
+            }
+
+            extent_size -= n;
+
+            char *out_ptr = buf;
+            ssize_t nwritten;
+
+            do {
+                if ((nwritten = write(fd, out_ptr, n)) < 0) {
+                    error("%s: Failed to write: %s",
+                          out_filename, strerror(errno));
+                    return ExtractResult::ERROR;
+                }
+
+                n -= nwritten;
+                out_ptr += nwritten;
+                cur_bytes += nwritten;
+            } while (n > 0);
+        }
+        if (!sparse_ret) {
+            break;
+        }
     }
     if (!sparse_ret) {
         error("Failed to read sparse file %s", zip_filename);
         return ExtractResult::ERROR;
     }
 
+    // libarchive verifies the zip entry's CRC32 once all of its data has been
+    // read. When reading from the zip directly, read the rest of the entry
+    // through libarchive as well so that corruption is still detected in
+    // images that have no CRC32 chunks of their own.
+    if (direct) {
+        do {
+            if (!cb_zip_read(buf, sizeof(buf), &n, a.get())) {
+                error("Failed to verify %s", zip_filename);
+                return ExtractResult::ERROR;
+            }
+        } while (n > 0);
+    }
+
+    // If the image ends with a hole, the regular file must still be extended
+    // to the full size
+    if (!is_blkdev && ftruncate64(fd, max_bytes) < 0) {
+        error("%s: Failed to set file size: %s",
+              out_filename, strerror(errno));
+        return ExtractResult::ERROR;
+    }
+
     return ExtractResult::OK;
 }
 